@@ -473,7 +473,7 @@ classdef IQBiasControl < handle
             end
         end
 
-        function self = getVoltageStepResponse(self,numSamples,jump_index,jump_amount)
+        function self = getVoltageStepResponse(self,numSamples,jump_index,jump_amount,numRepeats)
             %GETVOLTAGESTEPRESPONSE Fetches bias stabilisation data
             %after a voltage step is applied to the PWM outputs
             %
@@ -482,6 +482,10 @@ classdef IQBiasControl < handle
             %   bias voltage corresponding to JUMP_INDEX (X,Y,Z or 1,2,3)
             %   is changed by JUMP_AMOUNT in volts
             %
+            %   SELF = GETVOLTAGESTEPRESPONSE(...,NUMREPEATS) averages
+            %   NUMREPEATS alternating up and down steps on the device
+            %   and returns the average as a single upward step
+            %
             if ischar(jump_index) || isstring(jump_index)
                 if strcmpi(jump_index,'x')
                     jump_index = 1;
@@ -506,6 +510,9 @@ classdef IQBiasControl < handle
             write_arg = {'./analyze_jump_response','-n',sprintf('%d',numSamples),'-j',sprintf('%d',round(jump_amount)),...
                             '-i',sprintf('%d',round(jump_index)),'-x',sprintf('%d',round(Vx)),'-s',sprintf('%d',IQBiasControl.NUM_MEAS),...
                             '-y',sprintf('%d',round(Vy)),'-z',sprintf('%d',round(Vz))};
+            if nargin >= 5 && numRepeats > 1
+                write_arg = [write_arg,{'-r',sprintf('%d',round(numRepeats))}];
+            end
             if self.auto_retry
                 for jj = 1:10
                     try
@@ -533,6 +540,50 @@ classdef IQBiasControl < handle
             end
         end
 
+        function V = getSweepResponse(self,numSamples,channels,Vstart,Vend,updateSamples,shape)
+            %GETSWEEPRESPONSE Records the bias signals while ramping
+            %PWM outputs continuously
+            %
+            %   V = GETSWEEPRESPONSE(SELF,NUMSAMPLES,CHANNELS,VSTART,VEND)
+            %   Ramps the PWM outputs CHANNELS (1-4) from VSTART to VEND
+            %   in volts over NUMSAMPLES samples while recording the bias
+            %   signals into SELF.DATA.  V is the value of each swept
+            %   output, in volts, when each sample was read
+            %
+            %   V = GETSWEEPRESPONSE(__,UPDATESAMPLES) Updates the outputs
+            %   every UPDATESAMPLES samples (default 1000)
+            %
+            %   V = GETSWEEPRESPONSE(__,'triangle') Ramps from VSTART to
+            %   VEND and back
+            if nargin < 6 || isempty(updateSamples)
+                updateSamples = 1000;
+            end
+            if nargin < 7
+                shape = 'ramp';
+            end
+            numSamples = round(numSamples);
+            Vstart = Vstart.*ones(size(channels));
+            Vend = Vend.*ones(size(channels));
+            write_arg = {'./sweep_biases','-n',sprintf('%d',numSamples),'-u',sprintf('%d',round(updateSamples))};
+            [channels,idx] = sort(channels);
+            for nn = 1:numel(channels)
+                write_arg = [write_arg,{'-v',sprintf('%d:%d:%d',channels(nn) - 1,...
+                    round(Vstart(idx(nn))/self.CONV_PWM),round(Vend(idx(nn))/self.CONV_PWM))}]; %#ok<AGROW>
+            end
+            if strcmpi(shape,'triangle')
+                write_arg = [write_arg,{'-T'}];
+            end
+            self.conn.write(0,'mode','command','cmd',write_arg,'return_mode','file');
+            if self.conn.header.err
+                error('Connection returned error: %s',self.conn.header.errMsg);
+            end
+            raw = double(typecast(self.conn.recvMessage,'int32'));
+            raw = reshape(raw,self.NUM_MEAS + numel(channels),numSamples)';
+            self.data = raw(:,1:self.NUM_MEAS);
+            self.t = self.dt()*(0:(numSamples-1));
+            V = raw(:,(self.NUM_MEAS + 1):end)*self.CONV_PWM;
+        end
+
         function self = getPhaseData(self,numSamples,saveFactor,saveType)
             %GETPHASEDATA Fetches phase data from the device
             %
@@ -540,6 +591,10 @@ classdef IQBiasControl < handle
             %   
             %   SELF = GETPHASEDATA(__,SAVEFACTOR) Retrieves up to
             %   SAVEFACTOR (<= 5) different types of phase data
+            %
+            %   SELF = GETPHASEDATA(__,CHANNELS) with a vector CHANNELS
+            %   retrieves only those types of phase data (1 to 5), so
+            %   that the others are never read from the device
             numSamples = round(numSamples);
             if nargin < 3
                 saveFactor = 5;
@@ -552,6 +607,12 @@ classdef IQBiasControl < handle
                 c(3) = IQBiasControl.CONV_PWM;
             end
             write_arg = {'./savePhaseData','-n',sprintf('%d',numSamples),'-t',sprintf('%d',saveType),'-s',sprintf('%d',round(saveFactor))};
+            if ~isscalar(saveFactor)
+                channels = sort(unique(round(saveFactor(:)')));
+                write_arg(end-1:end) = {'-C',sprintf('%d',sum(2.^(channels - 1)))};
+                c = c(channels);
+                saveFactor = numel(channels);
+            end
             if self.auto_retry
                 for jj = 1:10
                     try
@@ -579,7 +640,7 @@ classdef IQBiasControl < handle
             end
         end
 
-        function self = getPhaseJumpResponse(self,numSamples,jump_amount,saveFactor)
+        function self = getPhaseJumpResponse(self,numSamples,jump_amount,saveFactor,numRepeats)
             %GETPHASEJUMPRESPONSE Fetches phase data from the device after
             %a phase jump
             %
@@ -587,8 +648,12 @@ classdef IQBiasControl < handle
             %   Acquires NUMSAMPLES of phase data with phase jump
             %   JUMP_AMOUNT
             %
+            %   SELF = GETPHASEJUMPRESPONSE(...,SAVEFACTOR,NUMREPEATS)
+            %   averages NUMREPEATS alternating up and down jumps on the
+            %   device
+            %
             numSamples = round(numSamples);
-            if nargin < 4
+            if nargin < 4 || isempty(saveFactor)
                 saveFactor = 5;
             end
 
@@ -598,6 +663,9 @@ classdef IQBiasControl < handle
             write_arg = {'./analyze_phase_jump','-n',sprintf('%d',numSamples),...
                 '-s',sprintf('%d',round(saveFactor)),'-j',sprintf('%d',jump_amount),'-v',sprintf('%d',V),...
                 '-t',sprintf('%d',round(self.phase_lock.output_switch.value))};
+            if nargin >= 5 && numRepeats > 1
+                write_arg = [write_arg,{'-r',sprintf('%d',round(numRepeats))}];
+            end
             c = [IQBiasControl.CONV_PHASE,IQBiasControl.CONV_PHASE,IQBiasControl.CONV_AUX_DAC,1,1];
             if self.phase_lock.output_switch.value
                 c(3) = IQBiasControl.CONV_PWM;
@@ -682,6 +750,230 @@ classdef IQBiasControl < handle
             end
         end
 
+        function T = getLockTrials(self,numTrials,numSamples,change_sample,tolerance,hold)
+            %GETLOCKTRIALS Measures how reliably and how quickly the
+            %phase lock acquires
+            %
+            %   T = GETLOCKTRIALS(NUMTRIALS,NUMSAMPLES) disengages and
+            %   engages the phase lock NUMTRIALS times, recording
+            %   NUMSAMPLES samples per trial with the lock engaged 1/4 of
+            %   the way through.  The trials are analysed on the device,
+            %   and only the results are transferred
+            %
+            %   T = GETLOCKTRIALS(__,CHANGE_SAMPLE,TOLERANCE,HOLD) engages
+            %   the lock at CHANGE_SAMPLE, and counts the lock as acquired
+            %   once the phase stays within TOLERANCE radians of zero for
+            %   HOLD samples
+            %
+            %   T is a structure with one element per trial in each of
+            %   the fields acquisitionTime, initialError, overshoot and
+            %   residual (the RMS error once locked), and the flags failed
+            %   and lost
+            if nargin < 4 || isempty(change_sample)
+                change_sample = floor(0.25*numSamples);
+            end
+            cmd = {'./analyze_phase_lock','-N',sprintf('%d',round(numTrials)),'-n',sprintf('%d',round(numSamples)),...
+                '-c',sprintf('%d',round(change_sample)),'-s','1'};
+            if nargin >= 5 && ~isempty(tolerance)
+                cmd = [cmd,{'-e',sprintf('%d',round(tolerance/self.CONV_PHASE))}];
+            end
+            if nargin >= 6 && ~isempty(hold)
+                cmd = [cmd,{'-h',sprintf('%d',round(hold))}];
+            end
+            self.conn.write(0,'mode','command','cmd',cmd,'return_mode','file');
+            raw = typecast(self.conn.recvMessage,'uint8');
+            if self.conn.header.err
+                error('Connection returned error: %s',self.conn.header.errMsg);
+            end
+            C = textscan(char(raw(:)'),'%f %f %f %f %f %f','CommentStyle','#');
+            T.acquisitionTime = C{3};
+            T.initialError = C{4}*self.CONV_PHASE;
+            T.overshoot = C{5}*self.CONV_PHASE;
+            T.residual = C{6}*self.CONV_PHASE;
+            T.failed = bitand(C{2},1) ~= 0;
+            T.lost = bitand(C{2},2) ~= 0;
+        end
+
+        function L = runMimoControl(self,G,duration,bandwidth,setpoint,maxStep)
+            %RUNMIMOCONTROL Runs the MIMO bias controller on the device
+            %
+            %   L = RUNMIMOCONTROL(G,DURATION) corrects the bias voltages
+            %   for DURATION seconds using the response matrix G from
+            %   get_linear_response, with a bandwidth of 1 Hz.  The loop
+            %   runs on the device, and only the log (one line per second)
+            %   is transferred at the end
+            %
+            %   L = RUNMIMOCONTROL(__,BANDWIDTH,SETPOINT,MAXSTEP) sets the
+            %   bandwidth of each decoupled loop in Hz, the setpoints of
+            %   the signals, and the largest change of a voltage per update
+            %   in V
+            %
+            %   L is a structure with the fields t, signals, error,
+            %   voltages and flags, one row per log line
+            cmd = {'./mimo_bias_control','-G',strjoin(arrayfun(@(x) sprintf('%.6g',x),reshape(G',1,[]),'UniformOutput',false),','),...
+                '-T',sprintf('%g',duration),'-o','SavedData.bin'};
+            if nargin >= 4 && ~isempty(bandwidth)
+                cmd = [cmd,{'-b',strjoin(arrayfun(@(x) sprintf('%g',x),bandwidth(:)','UniformOutput',false),',')}];
+            end
+            if nargin >= 5 && ~isempty(setpoint)
+                cmd = [cmd,{'-r',strjoin(arrayfun(@(x) sprintf('%g',x),setpoint(:)','UniformOutput',false),',')}];
+            end
+            if nargin >= 6 && ~isempty(maxStep)
+                cmd = [cmd,{'-m',sprintf('%g',maxStep/self.CONV_PWM)}];
+            end
+            self.conn.write(0,'mode','command','cmd',cmd,'return_mode','file');
+            raw = typecast(self.conn.recvMessage,'uint8');
+            if self.conn.header.err
+                error('Connection returned error: %s',self.conn.header.errMsg);
+            end
+            C = textscan(char(raw(:)'),repmat('%f ',1,12),'CommentStyle','#');
+            L.t = C{1};
+            L.signals = [C{3:5}];
+            L.error = [C{6:8}];
+            L.voltages = [C{9:11}]*self.CONV_PWM;
+            L.flags = C{12};
+        end
+
+        function T = autoTune(self,writeFlag,bandwidth,phaseFlag)
+            %AUTOTUNE Measures the system and computes the feedback gains
+            %on the device
+            %
+            %   T = AUTOTUNE() measures the response matrix and step
+            %   responses of the biases and computes the bias controller
+            %   gains and divisors without changing any settings
+            %
+            %   T = AUTOTUNE(WRITEFLAG) also writes the new voltages and
+            %   gains to the device and fetches them if WRITEFLAG is true
+            %
+            %   T = AUTOTUNE(__,BANDWIDTH,PHASEFLAG) sets the target
+            %   bandwidths in Hz instead of half the open-loop bandwidths,
+            %   and tunes the phase lock too if PHASEFLAG is true
+            %
+            %   T is a structure with the register addresses and values in
+            %   the fields registers and values, and the lines of the
+            %   report in the field report
+            cmd = {'./auto_tune','-o','SavedData.bin'};
+            if nargin >= 2 && writeFlag
+                cmd = [cmd,{'-w'}];
+            end
+            if nargin >= 3 && ~isempty(bandwidth)
+                cmd = [cmd,{'-b',strjoin(arrayfun(@(x) sprintf('%g',x),bandwidth(:)','UniformOutput',false),',')}];
+            end
+            if nargin >= 4 && phaseFlag
+                cmd = [cmd,{'-P'}];
+            end
+            self.conn.write(0,'mode','command','cmd',cmd,'return_mode','file');
+            raw = typecast(self.conn.recvMessage,'uint8');
+            if self.conn.header.err
+                error('Connection returned error: %s',self.conn.header.errMsg);
+            end
+            s = char(raw(:)');
+            lines = strsplit(strtrim(s),newline);
+            T.report = lines(startsWith(lines,'#'))';
+            C = textscan(s,'%s %s','CommentStyle','#');
+            T.registers = hex2dec(strrep(C{1},'0x',''));
+            T.values = hex2dec(strrep(C{2},'0x',''));
+            if nargin >= 2 && writeFlag
+                self.fetch;
+            end
+        end
+
+        function [C,H] = runSequence(self,plan)
+            %RUNSEQUENCE Runs an experiment sequence on the device
+            %
+            %   C = RUNSEQUENCE(PLAN) runs the steps in PLAN, a character
+            %   vector with the steps separated by ';' or a cell array with
+            %   one step per cell (see sequence.h or the readme), in one
+            %   command on the device.  C is a structure array with one
+            %   element per capture, in the order they were taken, with the
+            %   fields line, source ('bias' or 'phase'), mask, loop (the
+            %   iteration of each enclosing loop, from 1), t (start time in
+            %   s from the start of the sequence), dt (sample period in s)
+            %   and data (one column per FIFO, in counts)
+            %
+            %   [C,H] = RUNSEQUENCE(PLAN) also returns the header, with the
+            %   run time, the number of late ticks and the number of waits
+            %   that timed out
+            if iscell(plan)
+                plan = strjoin(plan,';');
+            end
+            cmd = {'./sequencer','-e',plan,'-o','SavedData.bin'};
+            self.conn.write(0,'mode','command','cmd',cmd,'return_mode','file');
+            raw = typecast(self.conn.recvMessage,'uint8');
+            if self.conn.header.err
+                error('Connection returned error: %s',self.conn.header.errMsg);
+            end
+            raw = raw(:)';
+            u32 = typecast(raw(1:16),'uint32');
+            if u32(1) ~= hex2dec('51535149')
+                error('Invalid sequence output');
+            end
+            u64 = double(typecast(raw(17:56),'uint64'));
+            d = typecast(raw(57:72),'double');
+            u32b = typecast(raw(73:80),'uint32');
+            H.flags = double(u32(4));
+            H.numCaptures = u64(1);
+            H.startTime = u64(4)*1e-9;
+            H.duration = u64(5)*1e-9;
+            H.dt = d(:)';
+            H.lateTicks = double(u32b(1));
+            H.timeouts = double(u32b(2));
+            data = typecast(raw((u64(2) + 1):end),'int32');
+            sources = {'bias','phase'};
+            C = struct('line',{},'source',{},'mask',{},'loop',{},'t',{},'dt',{},'data',{});
+            for nn = 1:H.numCaptures
+                e = raw(double(u32(3)) + (nn - 1)*56 + (1:56));
+                f = double(typecast(e(1:40),'uint32'));
+                g = double(typecast(e(41:56),'uint64'));
+                C(nn).line = f(1);
+                C(nn).source = sources{f(2) + 1};
+                C(nn).mask = f(3);
+                C(nn).loop = f(7:(6 + f(6))) + 1;
+                C(nn).t = g(1)*1e-9;
+                C(nn).dt = H.dt(f(2) + 1);
+                C(nn).data = double(reshape(data(g(2) + (1:f(4)*f(5))),f(4),f(5))');
+            end
+        end
+
+        function S = getLockStatus(self,waitTime)
+            %GETLOCKSTATUS Reads the status published by the lock
+            %watchdog service
+            %
+            %   S = GETLOCKSTATUS() returns the last status of the locks
+            %   without touching the device.  The lock_watchdog service
+            %   must be running on the device
+            %
+            %   S = GETLOCKSTATUS(WAITTIME) waits up to WAITTIME seconds
+            %   for the locks to be good
+            %
+            %   S is a structure with the field result ('LOCKED',
+            %   'NOT_LOCKED', 'NOT_RUNNING' or 'LOCKED_SATURATED'), a field
+            %   locked that is true for LOCKED and LOCKED_SATURATED, and
+            %   one field for every value printed by lock_status -v
+            cmd = {'./lock_status','-v','-z','-o','SavedData.bin'};
+            if nargin >= 2 && ~isempty(waitTime)
+                cmd = [cmd,{'-w',sprintf('%d',round(waitTime*1e3))}];
+            end
+            self.conn.write(0,'mode','command','cmd',cmd,'return_mode','file');
+            raw = typecast(self.conn.recvMessage,'uint8');
+            if self.conn.header.err
+                error('Connection returned error: %s',self.conn.header.errMsg);
+            end
+            lines = strsplit(strtrim(char(raw(:)')),newline);
+            S = struct;
+            for nn = 1:numel(lines)
+                parts = strsplit(strtrim(lines{nn}));
+                if strcmp(parts{1},'result')
+                    S.result = parts{2};
+                elseif startsWith(parts{2},'0x')
+                    S.(parts{1}) = hex2dec(parts{2}(3:end));
+                else
+                    S.(parts{1}) = str2double(parts(2:end));
+                end
+            end
+            S.locked = any(strcmp(S.result,{'LOCKED','LOCKED_SATURATED'}));
+        end
+
         function self = getRAM(self,numSamples)
             %GETRAM Fetches recorded in block memory from the device
             %
@@ -712,7 +1004,7 @@ classdef IQBiasControl < handle
             self.t = dt*(0:(size(self.data,1)-1));
         end
 
-        function D = getCharacterisationData(self,numVoltages,numAvgs,maxVoltage)
+        function [D,settle,S] = getCharacterisationData(self,numVoltages,numAvgs,maxVoltage,settleTolerance,stats)
             %GETCHARACTERISATIONDATA Acquires data characterising the
             %response of the system to bias voltages
             %
@@ -723,6 +1015,16 @@ classdef IQBiasControl < handle
             %
             %   SELF = GETCHARACTERISATIONDATA(__,NA) Averages NA samples per
             %   voltage
+            %
+            %   [D,SETTLE] = GETCHARACTERISATIONDATA(__,TOL) Starts averaging
+            %   at each voltage once the signals change by less than TOL
+            %   counts between windows, rather than after a fixed 10 ms.
+            %   SETTLE has the settle time in seconds and whether settling
+            %   timed out for each voltage
+            %
+            %   [D,SETTLE,S] = GETCHARACTERISATIONDATA(__,STATS) Also returns
+            %   the statistics in the cell array STATS ('var', 'min', 'max')
+            %   for each voltage as fields of S
             if nargin == 1
                 numVoltages = 10;
                 numAvgs = 100;
@@ -733,18 +1035,110 @@ classdef IQBiasControl < handle
             elseif nargin == 3
                 maxVoltage = 1;
             end
+            if nargin < 5
+                settleTolerance = [];
+            end
+            if nargin < 6
+                stats = {};
+            end
+            statNames = {'mean','var','min','max'};
+            stats = statNames(ismember(statNames,[{'mean'},stats]));
             
             maxVoltageInt = round(self.pwm(1).toIntegerFunction(maxVoltage),-1);
-            self.conn.write(0,'mode','command','cmd',...
-                {'./analyze_biases','-n',sprintf('%d',round(numVoltages)),'-a',sprintf('%d',numAvgs),'-m',sprintf('%d',maxVoltageInt)},...
-                'return_mode','file');
+            cmd = {'./analyze_biases','-n',sprintf('%d',round(numVoltages)),'-a',sprintf('%d',numAvgs),'-m',sprintf('%d',maxVoltageInt)};
+            if ~isempty(settleTolerance)
+                cmd = [cmd,{'-w',sprintf('%d',round(settleTolerance))}];
+            end
+            if numel(stats) > 1
+                cmd = [cmd,{'-e',strjoin(stats,',')}];
+            end
+            self.conn.write(0,'mode','command','cmd',cmd,'return_mode','file');
             raw = typecast(self.conn.recvMessage,'int32');
-            D = zeros([numVoltages*[1,1,1],4]);
-            for nn = 1:size(D,4)
-                tmp = raw((nn - 1)*numVoltages^3 + (1:(numVoltages^3)));
-                D(:,:,:,nn) = reshape(double(tmp),numVoltages*[1,1,1]);
+            N = numVoltages^3;
+            S = [];
+            for mm = 1:numel(stats)
+                tmp = zeros([numVoltages*[1,1,1],4]);
+                for nn = 1:size(tmp,4)
+                    block = raw((4*(mm - 1) + nn - 1)*N + (1:N));
+                    if strcmp(stats{mm},'var')
+                        %The variance is sent as float32
+                        block = typecast(block,'single');
+                    end
+                    tmp(:,:,:,nn) = reshape(double(block),numVoltages*[1,1,1]);
+                end
+                if mm == 1
+                    D = tmp;
+                else
+                    S.(stats{mm}) = tmp;
+                end
+            end
+            settle = [];
+            if ~isempty(settleTolerance)
+                offset = 4*numel(stats)*N;
+                tmp = raw(offset + (1:N));
+                settle.time = 1e-6*reshape(double(tmp),numVoltages*[1,1,1]);
+                tmp = raw(offset + N + (1:N));
+                settle.timedOut = reshape(tmp ~= 0,numVoltages*[1,1,1]);
             end
         end
+
+        function S = searchBiases(self,numVoltages,numAvgs,maxVoltage,numLevels,numMinima,settleTolerance)
+            %SEARCHBIASES Finds the bias voltages that minimise the
+            %demodulated signals using a coarse-to-fine search
+            %
+            %   S = SEARCHBIASES(SELF) Measures a coarse grid of 10
+            %   voltages per bias averaging 100 samples per point, then
+            %   refines the grid 4 times around the lowest minimum
+            %
+            %   S = SEARCHBIASES(__,NV,NA,VMAX) Uses NV coarse voltages
+            %   up to VMAX with NA averages per point
+            %
+            %   S = SEARCHBIASES(__,NL,NM) Refines NL times around the NM
+            %   lowest local minima of the coarse grid
+            %
+            %   S = SEARCHBIASES(__,TOL) Waits for the signals to settle
+            %   within TOL counts at each point instead of a fixed 10 ms
+            %
+            %   S is a structure with fields V (visited voltages, one row
+            %   per point), D (the 4 averaged signals), level (0 for the
+            %   coarse grid), settleTime, timedOut and Vmin (the best
+            %   voltages found)
+            if nargin < 2
+                numVoltages = 10;
+            end
+            if nargin < 3
+                numAvgs = 100;
+            end
+            if nargin < 4
+                maxVoltage = 1;
+            end
+            if nargin < 5
+                numLevels = 4;
+            end
+            if nargin < 6
+                numMinima = 1;
+            end
+            if nargin < 7
+                settleTolerance = [];
+            end
+
+            maxVoltageInt = round(self.pwm(1).toIntegerFunction(maxVoltage),-1);
+            cmd = {'./analyze_biases','-n',sprintf('%d',round(numVoltages)),'-a',sprintf('%d',numAvgs),...
+                '-m',sprintf('%d',maxVoltageInt),'-r',sprintf('%d',numLevels),'-k',sprintf('%d',numMinima)};
+            if ~isempty(settleTolerance)
+                cmd = [cmd,{'-w',sprintf('%d',round(settleTolerance))}];
+            end
+            self.conn.write(0,'mode','command','cmd',cmd,'return_mode','file');
+            raw = double(typecast(self.conn.recvMessage,'int32'));
+            raw = reshape(raw,[],10);
+            S.V = raw(:,1:3)*self.CONV_PWM;
+            S.D = raw(:,4:7);
+            S.level = raw(:,8);
+            S.settleTime = 1e-6*raw(:,9);
+            S.timedOut = raw(:,10) ~= 0;
+            [~,idx] = min(sum(S.D(:,1:3).^2,2));
+            S.Vmin = S.V(idx,:);
+        end
         
         function disp(self)
             %DISP Displays the current device settings
@@ -854,9 +1248,13 @@ classdef IQBiasControl < handle
         function d = convertData(raw)
             %CONVERTDATA Converts raw bias stabilisation data to proper
             %integer format
+            numStreams = IQBiasControl.NUM_MEAS;
+            if exist('iq_decode_mex','file') == 3
+                d = iq_decode_mex(uint8(raw(:)),0,numStreams,1);
+                return
+            end
             raw = raw(:);
             Nraw = numel(raw);
-            numStreams = IQBiasControl.NUM_MEAS;
             d = zeros(Nraw/(numStreams*4),numStreams,'int32');
             
             raw = reshape(raw,4*numStreams,Nraw/(4*numStreams));
@@ -869,6 +1267,10 @@ classdef IQBiasControl < handle
         function d = convertPhaseData(raw,numStreams,c)
             %CONVERTPHASEDATA converts raw data from the device into useful
             %phase data
+            if exist('iq_decode_mex','file') == 3
+                d = iq_decode_mex(uint8(raw(:)),0,numStreams,double(c(1:numStreams)));
+                return
+            end
             raw = raw(:);
             Nraw = numel(raw);
 
@@ -896,6 +1298,10 @@ classdef IQBiasControl < handle
             if nargin < 2
                 c = 1;
             end
+            if exist('iq_decode_mex','file') == 3
+                v = iq_decode_mex(uint8(raw(:)),1,2,double(c));
+                return
+            end
             
             Nraw = numel(raw);
             d = zeros(Nraw/4,2,'int16');
@@ -910,6 +1316,109 @@ classdef IQBiasControl < handle
             v = double(d)*c;
         end
         
+        function [d,hdr] = readCaptureFile(filename,sampleRange)
+            %READCAPTUREFILE Reads data from a self-describing capture
+            %file written using the -F option of the acquisition programs
+            %
+            %   [D,HDR] = READCAPTUREFILE(FILENAME) reads all samples in
+            %   FILENAME into the NxM array D, one column per stream, and
+            %   returns the file header as the structure HDR.  The time of
+            %   each sample is HDR.t
+            %
+            %   [D,HDR] = READCAPTUREFILE(FILENAME,SAMPLERANGE) reads only
+            %   samples SAMPLERANGE(1) to SAMPLERANGE(2) (1-based,
+            %   inclusive) using the chunk index, so that only the
+            %   necessary parts of the file are read
+            fid = fopen(filename,'r','ieee-le');
+            if fid < 0
+                error('Could not open file %s',filename);
+            end
+            cleanup = onCleanup(@() fclose(fid));
+            %
+            % Read the header
+            %
+            hdr.magic = fread(fid,1,'uint32');
+            if hdr.magic ~= hex2dec('43425149')
+                error('File %s is not a capture file',filename);
+            end
+            hdr.version = fread(fid,1,'uint32');
+            hdr.header_size = fread(fid,1,'uint32');
+            hdr.num_streams = fread(fid,1,'uint32');
+            hdr.sample_format = fread(fid,1,'uint32');
+            hdr.source = fread(fid,1,'uint32');
+            hdr.channel_mask = fread(fid,1,'uint32');
+            hdr.filter_reg = fread(fid,1,'uint32');
+            hdr.log2_rate = fread(fid,1,'uint32');
+            hdr.cic_shift = fread(fid,1,'int32');
+            hdr.decimation = fread(fid,1,'uint32');
+            hdr.chunk_samples = fread(fid,1,'uint32');
+            hdr.sample_period = fread(fid,1,'double');
+            hdr.start_time = datetime(double(fread(fid,1,'uint64=>uint64'))*1e-9,'ConvertFrom','posixtime');
+            fseek(fid,3*8,'cof');
+            names = fread(fid,[16,16],'char=>char')';
+            hdr.stream_names = cell(1,hdr.num_streams);
+            for nn = 1:hdr.num_streams
+                hdr.stream_names{nn} = deblank(strtok(names(nn,:),char(0)));
+            end
+            %
+            % Jumps and lock changes applied during the capture, from
+            % version 2 onwards.  SAMPLE is the number of samples read
+            % before the write, so row SAMPLE+1 of D is the first one read
+            % after it, and HW_SAMPLE is the number the FIFOs had produced
+            % when it was issued
+            %
+            hdr.events = struct('type',{},'repeat',{},'sample',{},'hw_sample',{},'time',{},'latency',{});
+            hdr.realtime = false;
+            if hdr.version >= 2
+                num_events = fread(fid,1,'uint32');
+                hdr.realtime = bitand(fread(fid,1,'uint32'),1) ~= 0;
+                for nn = 1:num_events
+                    hdr.events(nn).type = fread(fid,1,'uint32');
+                    hdr.events(nn).repeat = fread(fid,1,'uint32');
+                    hdr.events(nn).sample = fread(fid,1,'uint64');
+                    hdr.events(nn).hw_sample = fread(fid,1,'double');
+                    hdr.events(nn).time = fread(fid,1,'uint64')*1e-9;
+                    hdr.events(nn).latency = fread(fid,1,'uint32')*1e-9;
+                    fseek(fid,4,'cof');
+                end
+            end
+            %
+            % The footer always has the index location and sample count
+            %
+            fseek(fid,-32,'eof');
+            index_offset = fread(fid,1,'uint64');
+            num_chunks = fread(fid,1,'uint64');
+            hdr.num_samples = fread(fid,1,'uint64');
+            fseek(fid,index_offset,'bof');
+            index = reshape(fread(fid,3*num_chunks,'uint64'),3,num_chunks)';
+            %
+            % Read only the chunks that overlap the requested range
+            %
+            if nargin < 2 || isempty(sampleRange)
+                sampleRange = [1,hdr.num_samples];
+            end
+            sampleRange = [max(sampleRange(1),1),min(sampleRange(2),hdr.num_samples)];
+            N = max(sampleRange(2) - sampleRange(1) + 1,0);
+            if hdr.sample_format == 1
+                fmt = 'single';
+            else
+                fmt = 'int32';
+            end
+            d = zeros(N,hdr.num_streams);
+            for kk = 1:num_chunks
+                first = index(kk,1) + 1;
+                last = index(kk,1) + index(kk,3);
+                if last < sampleRange(1) || first > sampleRange(2)
+                    continue;
+                end
+                fseek(fid,index(kk,2),'bof');
+                chunk = reshape(fread(fid,index(kk,3)*hdr.num_streams,fmt),index(kk,3),hdr.num_streams);
+                idx = max(first,sampleRange(1)):min(last,sampleRange(2));
+                d(idx - sampleRange(1) + 1,:) = chunk(idx - first + 1,:);
+            end
+            hdr.t = hdr.sample_period*((sampleRange(1):sampleRange(2))' - 1);
+        end
+
         function D = load_bias_analysis_file(filename,numVoltages)
             if isempty(filename)
                 filename = 'SavedData.bin';
@@ -932,6 +1441,41 @@ classdef IQBiasControl < handle
             end
         end
         
+        function [D,hdr] = load_bias_record_file(filename)
+            %LOAD_BIAS_RECORD_FILE Loads a record file written by
+            %analyze_biases -i
+            %
+            %   [D,HDR] = LOAD_BIAS_RECORD_FILE(FILENAME) Returns the grid
+            %   D with size [N,N,N,C], where C is the number of output
+            %   columns, and the header HDR.  Points that have not been
+            %   measured are NaN
+            fid = fopen(filename,'r');
+            names = {'magic','version','header_size','record_words','numVoltages',...
+                'numAvgs','Vmax','stats','settle_window','settle_tolerance',...
+                'settle_max_dwell','order'};
+            for nn = 1:numel(names)
+                hdr.(names{nn}) = double(fread(fid,1,'uint32'));
+            end
+            hdr.box = double(fread(fid,6,'uint32'))';
+            fseek(fid,hdr.header_size,'bof');
+            x = fread(fid,[hdr.record_words,Inf],'*int32');
+            fclose(fid);
+
+            N = hdr.numVoltages;
+            C = hdr.record_words - 4;
+            y = double(x(5:end,:));
+            if bitand(hdr.stats,2)
+                %The variance columns, after the means if present, are float32
+                idx = 4*bitget(hdr.stats,1) + (1:4);
+                y(idx,:) = reshape(double(typecast(reshape(x(4 + idx,:),[],1),'single')),4,[]);
+            end
+            x = double(x);
+            D = nan(N^3,C);
+            D(x(1,:) + 1,:) = y';
+            D = reshape(D,[N,N,N,C]);
+            hdr.V = x(2:4,:)'*IQBiasControl.CONV_PWM;
+        end
+
         function app = get_running_app_instance
             h = findall(groot,'type','figure');
             for nn = 1:numel(h)
@@ -0,0 +1,62 @@
+/*
+ * MEX interface to the decoder in programs/iq_decode.c, used by
+ * IQBiasControl.convertData, convertPhaseData and convertADCData when it is on the path.
+ *
+ *    D = IQ_DECODE_MEX(RAW,LAYOUT,NUMSTREAMS,C)
+ *
+ * RAW is the uint8 data from the device, LAYOUT is 0 for int32 streams and 1 for ADC
+ * pairs, NUMSTREAMS is the number of int32 streams per sample, and C is a scalar or one
+ * factor per column.  D is a double matrix with one column per stream.  A trailing
+ * partial sample is ignored.  Build from this directory with a GCC-compatible compiler
+ * (MinGW-w64 on Windows):
+ *
+ *    mex -O iq_decode_mex.c programs/iq_decode.c                           (Linux, macOS)
+ *    mex -O -DIQ_DECODE_NO_THREADS iq_decode_mex.c programs/iq_decode.c    (Windows)
+ */
+#include <stdint.h>
+#include "mex.h"
+#include "programs/iq_decode.h"
+
+void mexFunction(int nlhs,mxArray *plhs[],int nrhs,const mxArray *prhs[]) {
+  iq_decode_t d;
+  double scale[IQ_DECODE_MAX_COLUMNS];
+  const double *c;
+  size_t numSamples, numScale, sampleBytes;
+  uint32_t cols, k;
+
+  if (nrhs != 4) {
+    mexErrMsgIdAndTxt("iq_decode_mex:args","Usage: D = iq_decode_mex(RAW,LAYOUT,NUMSTREAMS,C)");
+  }
+  if (!mxIsUint8(prhs[0]) && !mxIsInt8(prhs[0])) {
+    mexErrMsgIdAndTxt("iq_decode_mex:args","RAW must be uint8");
+  }
+  if (!mxIsDouble(prhs[3]) || mxIsComplex(prhs[3])) {
+    mexErrMsgIdAndTxt("iq_decode_mex:args","C must be real and double");
+  }
+  d.layout = (uint32_t) mxGetScalar(prhs[1]);
+  d.num_streams = (uint32_t) mxGetScalar(prhs[2]);
+  d.out_format = IQ_OUT_DOUBLE;
+  d.threads = 0;
+  sampleBytes = iq_decode_sample_bytes(&d);
+  if (sampleBytes == 0) {
+    mexErrMsgIdAndTxt("iq_decode_mex:args","Invalid LAYOUT or NUMSTREAMS");
+  }
+  cols = iq_decode_columns(&d);
+
+  //A scalar factor applies to every column
+  c = mxGetPr(prhs[3]);
+  numScale = mxGetNumberOfElements(prhs[3]);
+  if (numScale != 1 && numScale != cols) {
+    mexErrMsgIdAndTxt("iq_decode_mex:args","C must have 1 or %u elements",cols);
+  }
+  for (k = 0;k < cols;k++) {
+    scale[k] = c[numScale == 1 ? 0 : k];
+  }
+  d.scale = scale;
+
+  numSamples = mxGetNumberOfElements(prhs[0])/sampleBytes;
+  plhs[0] = mxCreateUninitNumericMatrix(numSamples,cols,mxDOUBLE_CLASS,mxREAL);
+  if (numSamples > 0) {
+    iq_decode(&d,mxGetData(prhs[0]),numSamples,mxGetData(plhs[0]),numSamples);
+  }
+}
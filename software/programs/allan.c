@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "allan.h"
+
+int allan_init(allan_t *a,uint32_t num_streams,double tau0) {
+  uint32_t k;
+  allan_level_t *l;
+
+  memset(a,0,sizeof(*a));
+  if (num_streams == 0) return -1;
+  a->num_streams = num_streams;
+  a->num_levels = ALLAN_MAX_LEVELS;
+  a->tau0 = tau0;
+  a->ref = (int32_t *) calloc(num_streams,sizeof(int32_t));
+  a->cascade = (int64_t *) calloc((size_t) ALLAN_MAX_LEVELS*num_streams,sizeof(int64_t));
+  a->cascade_count = (uint32_t *) calloc(ALLAN_MAX_LEVELS,sizeof(uint32_t));
+  a->block = (int64_t *) calloc((size_t) 2*num_streams,sizeof(int64_t));
+  if (!a->ref || !a->cascade || !a->cascade_count || !a->block) {
+    allan_free(a);
+    return -1;
+  }
+  for (k = 0;k < a->num_levels;k++) {
+    l = &a->level[k];
+    l->m = 1u << (k < ALLAN_OVERLAP_LOG2 ? k : ALLAN_OVERLAP_LOG2);
+    l->M = 1ULL << k;
+    l->ring = (int64_t *) calloc((size_t) 2*l->m*num_streams,sizeof(int64_t));
+    l->sum_new = (int64_t *) calloc(num_streams,sizeof(int64_t));
+    l->sum_old = (int64_t *) calloc(num_streams,sizeof(int64_t));
+    l->dring = (int64_t *) calloc((size_t) l->m*num_streams,sizeof(int64_t));
+    l->dsum = (int64_t *) calloc(num_streams,sizeof(int64_t));
+    l->avar = (double *) calloc(num_streams,sizeof(double));
+    l->mvar = (double *) calloc(num_streams,sizeof(double));
+    if (!l->ring || !l->sum_new || !l->sum_old || !l->dring || !l->dsum || !l->avar || !l->mvar) {
+      allan_free(a);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void allan_free(allan_t *a) {
+  uint32_t k;
+  allan_level_t *l;
+  for (k = 0;k < ALLAN_MAX_LEVELS;k++) {
+    l = &a->level[k];
+    free(l->ring);
+    free(l->sum_new);
+    free(l->sum_old);
+    free(l->dring);
+    free(l->dsum);
+    free(l->avar);
+    free(l->mvar);
+  }
+  free(a->ref);
+  free(a->cascade);
+  free(a->cascade_count);
+  free(a->block);
+  memset(a,0,sizeof(*a));
+}
+
+/*
+ * Adds one block sum per stream to a level.  The block ring holds the last 2m blocks, so
+ * the slot about to be overwritten is 2m blocks old and the one m slots on is m blocks old
+ */
+static void level_push(allan_level_t *l,uint32_t num_streams,const int64_t *b) {
+  const uint32_t m = l->m;
+  uint32_t st;
+  int64_t *r, *dr, oldm, old2m, d;
+
+  for (st = 0;st < num_streams;st++) {
+    r = l->ring + (size_t) st*2*m;
+    oldm = l->blocks >= m ? r[(l->pos + m) % (2*m)] : 0;
+    old2m = l->blocks >= 2*m ? r[l->pos] : 0;
+    l->sum_new[st] += b[st] - oldm;
+    l->sum_old[st] += oldm - old2m;
+    r[l->pos] = b[st];
+  }
+  l->pos = (l->pos + 1) % (2*m);
+  l->blocks++;
+  if (l->blocks < 2*m) return;
+
+  //M times the difference of the means of the two windows
+  for (st = 0;st < num_streams;st++) {
+    d = l->sum_new[st] - l->sum_old[st];
+    l->avar[st] += (double) d*(double) d;
+    dr = l->dring + (size_t) st*m;
+    l->dsum[st] += d - (l->diffs >= m ? dr[l->dpos] : 0);
+    dr[l->dpos] = d;
+    if (l->diffs + 1 >= m) {
+      l->mvar[st] += (double) l->dsum[st]*(double) l->dsum[st];
+    }
+  }
+  l->dpos = (l->dpos + 1) % m;
+  l->diffs++;
+  if (l->diffs >= m) l->mod_terms++;
+}
+
+void allan_push(allan_t *a,const uint32_t *data,uint32_t numSamples) {
+  const uint32_t S = a->num_streams;
+  uint32_t i, k, j, st;
+  int64_t *y = a->block, *b = a->block + S, *c;
+  const int32_t *x;
+
+  for (i = 0;i < numSamples;i++) {
+    x = (const int32_t *) data + (size_t) i*S;
+    if (a->samples == 0) {
+      for (st = 0;st < S;st++) a->ref[st] = x[st];
+    }
+    for (st = 0;st < S;st++) y[st] = (int64_t) x[st] - a->ref[st];
+    a->samples++;
+    for (k = 0;k <= ALLAN_OVERLAP_LOG2 && k < a->num_levels;k++) {
+      level_push(&a->level[k],S,y);
+    }
+    //Pairwise sums of 2^j samples feed level L + j
+    memcpy(b,y,S*sizeof(int64_t));
+    for (j = 1;ALLAN_OVERLAP_LOG2 + j < a->num_levels;j++) {
+      c = a->cascade + (size_t) j*S;
+      if (a->cascade_count[j] == 0) {
+        memcpy(c,b,S*sizeof(int64_t));
+        a->cascade_count[j] = 1;
+        break;
+      }
+      for (st = 0;st < S;st++) b[st] += c[st];
+      a->cascade_count[j] = 0;
+      level_push(&a->level[ALLAN_OVERLAP_LOG2 + j],S,b);
+    }
+  }
+}
+
+uint64_t allan_result(const allan_t *a,uint32_t k,uint32_t stream,double *adev,double *mdev) {
+  const allan_level_t *l = &a->level[k];
+  double M = (double) l->M, m = (double) l->m;
+  *adev = l->diffs > 0 ? sqrt(0.5*l->avar[stream]/((double) l->diffs*M*M)) : 0;
+  *mdev = l->mod_terms > 0 ? sqrt(0.5*l->mvar[stream]/((double) l->mod_terms*m*m*M*M)) : 0;
+  return l->diffs;
+}
+
+void allan_print(const allan_t *a,FILE *f) {
+  uint32_t k, st;
+  uint64_t n;
+  double adev, mdev;
+
+  fprintf(f,"# Overlapping Allan and modified Allan deviation [counts], tau0 = %.9g s, %llu samples\n",
+          a->tau0,(unsigned long long) a->samples);
+  fprintf(f,"# tau[s] terms");
+  for (st = 0;st < a->num_streams;st++) {
+    if (a->stream_names[st][0]) {
+      fprintf(f," %s_adev %s_mdev",a->stream_names[st],a->stream_names[st]);
+    } else {
+      fprintf(f," adev%u mdev%u",st + 1,st + 1);
+    }
+  }
+  fprintf(f,"\n");
+  for (k = 0;k < a->num_levels;k++) {
+    if (a->level[k].diffs == 0) break;
+    fprintf(f,"%.6e %llu",a->tau0*(double) a->level[k].M,(unsigned long long) a->level[k].diffs);
+    for (st = 0;st < a->num_streams;st++) {
+      n = allan_result(a,k,st,&adev,&mdev);
+      fprintf(f," %.6e %.6e",adev,n > 0 && a->level[k].mod_terms > 0 ? mdev : NAN);
+    }
+    fprintf(f,"\n");
+  }
+}
+
+int allan_write_snapshot(const allan_t *a,const char *path) {
+  char tmp[4096];
+  FILE *f;
+  snprintf(tmp,sizeof(tmp),"%s.tmp",path);
+  if (!(f = fopen(tmp,"w"))) {
+    perror(tmp);
+    return -1;
+  }
+  allan_print(a,f);
+  if (fclose(f) != 0 || rename(tmp,path) != 0) {
+    perror(path);
+    return -1;
+  }
+  return 0;
+}
+
+int allan_stream_tap(void *arg,const uint32_t *block,uint32_t num_words) {
+  allan_t *a = (allan_t *) arg;
+  struct timespec t;
+  uint64_t now;
+
+  allan_push(a,block,num_words/a->num_streams);
+  if (a->snapshot_path) {
+    clock_gettime(CLOCK_MONOTONIC,&t);
+    now = (uint64_t) t.tv_sec*1000000000ULL + (uint64_t) t.tv_nsec;
+    if (now - a->last_snapshot_ns >= (uint64_t)(ALLAN_SNAPSHOT_PERIOD*1e9)) {
+      allan_write_snapshot(a,a->snapshot_path);
+      a->last_snapshot_ns = now;
+    }
+  }
+  return 0;
+}
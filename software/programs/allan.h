@@ -0,0 +1,88 @@
+#ifndef ALLAN_H_
+#define ALLAN_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "capture_file.h"
+
+/*
+ * Online overlapping Allan and modified Allan deviation of interleaved int32 streams, at
+ * octave-spaced averaging times tau = 2^k*tau0.
+ *
+ * Level k compares the means of adjacent windows of M = 2^k samples.  Levels up to
+ * ALLAN_OVERLAP_LOG2 slide the windows by one sample, which is the fully overlapping
+ * estimator.  Above that the samples are first summed in blocks of s = 2^(k - L) by a
+ * cascade of pairwise sums, and the windows slide by one block, i.e. by tau/2^L.  Each
+ * level therefore keeps at most 2^(L+1) block sums per stream, so the memory grows with
+ * the number of octaves, log2(N), rather than with N.  The modified Allan variance
+ * averages the 2^min(k,L) window differences that are s apart instead of all M of them,
+ * which again is exact up to level L.
+ *
+ * All window sums are exact 64-bit integers taken relative to the first sample of each
+ * stream, so that hours of data do not lose precision.  Deviations are in counts
+ */
+#define ALLAN_OVERLAP_LOG2          4
+#define ALLAN_MAX_LEVELS            40
+#define ALLAN_SNAPSHOT_PERIOD       1.0     //Seconds between snapshot files
+
+typedef struct {
+  uint32_t m;                     //Window length in blocks
+  uint64_t M;                     //Window length in samples
+  uint32_t pos;                   //Oldest slot of the block ring
+  uint32_t dpos;                  //Oldest slot of the difference ring
+  uint64_t blocks;                //Blocks seen
+  uint64_t diffs;                 //Window differences seen, i.e. Allan terms
+  uint64_t mod_terms;             //Modified Allan terms
+  int64_t *ring;                  //Last 2m block sums of each stream
+  int64_t *sum_new, *sum_old;     //Sums of the latest and the previous m blocks
+  int64_t *dring;                 //Last m window differences of each stream
+  int64_t *dsum;                  //Sum of dring
+  double *avar, *mvar;            //Sums of the squared terms
+} allan_level_t;
+
+typedef struct {
+  uint32_t num_streams;
+  uint32_t num_levels;            //Levels in use
+  double tau0;                    //Sample period [s]
+  uint64_t samples;
+  int32_t *ref;                   //First sample of each stream
+  int64_t *cascade;               //Partial pair sums feeding the levels above L
+  uint32_t *cascade_count;
+  int64_t *block;                 //Scratch block sums
+  allan_level_t level[ALLAN_MAX_LEVELS];
+
+  //Snapshot file, rewritten every ALLAN_SNAPSHOT_PERIOD while streaming
+  const char *snapshot_path;
+  uint64_t last_snapshot_ns;
+  char stream_names[CAPTURE_MAX_STREAMS][CAPTURE_NAME_LENGTH];
+} allan_t;
+
+int allan_init(allan_t *a,uint32_t num_streams,double tau0);
+void allan_free(allan_t *a);
+/*
+ * Adds numSamples interleaved samples
+ */
+void allan_push(allan_t *a,const uint32_t *data,uint32_t numSamples);
+/*
+ * Returns the number of Allan terms at level k and sets the deviations of STREAM.  The
+ * deviations are 0 when there are no terms yet
+ */
+uint64_t allan_result(const allan_t *a,uint32_t k,uint32_t stream,double *adev,double *mdev);
+/*
+ * Prints a table with one row per averaging time: tau, the number of terms and the
+ * Allan and modified Allan deviation of each stream
+ */
+void allan_print(const allan_t *a,FILE *f);
+/*
+ * Writes the table to a temporary file and renames it to PATH, so that readers always
+ * see a complete table.  Returns 0 on success
+ */
+int allan_write_snapshot(const allan_t *a,const char *path);
+
+/*
+ * Tap for stream_to_output() which pushes each block into the estimator pointed to by ARG
+ * and rewrites its snapshot file every ALLAN_SNAPSHOT_PERIOD
+ */
+int allan_stream_tap(void *arg,const uint32_t *block,uint32_t num_words);
+#endif
@@ -4,12 +4,12 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <unistd.h>
-#include <sys/mman.h>
-#include <fcntl.h>
 #include <math.h>
 #include <time.h>
 
 #include "iq_bias_control.h"
+#include "capture_output.h"
+#include "bias_search.h"
  
 int main(int argc, char **argv)
 {
@@ -17,7 +17,6 @@ int main(int argc, char **argv)
   int numVoltages;	    //Number of voltages to scan over
   int numAvgs;          //Number of averages to use
   void *cfg;		    //A pointer to a memory location.  The * indicates that it is a pointer - it points to a location in memory
-  char *name = "/dev/mem";	//Name of the memory resource
   uint16_t Vmax = 160;
 
   uint32_t i, incr = 0;
@@ -28,6 +27,13 @@ int main(int argc, char **argv)
   int *data;
   uint8_t debugFlag = 0;
   FILE *ptr;
+  char *outputFile = NULL;    //Output destination, SavedData.bin by default
+  int memfd;                  //Memory file backing the data buffer, if any
+  int saveErr = 0;            //Writing the output failed
+  bias_search_params_t search;  //Coarse-to-fine search settings
+  uint32_t numPoints;
+  char *recordFile = NULL;    //Record file for long scans
+  uint8_t resumeFlag = 0;
 
   clock_t start, stop;
 
@@ -35,7 +41,8 @@ int main(int argc, char **argv)
    * Parse the input arguments
    */
   int c;
-  while ((c = getopt(argc,argv,"n:a:m:f")) != -1) {
+  bias_search_defaults(&search);
+  while ((c = getopt(argc,argv,"n:a:m:o:r:p:k:g:w:W:s:SPe:i:Rb:f")) != -1) {
     switch (c) {
       case 'n':
         numVoltages = atoi(optarg);
@@ -46,6 +53,55 @@ int main(int argc, char **argv)
       case 'm':
         Vmax = atoi(optarg);
         break;
+      case 'o':
+        outputFile = optarg;
+        break;
+      case 'r':
+        search.numLevels = atoi(optarg);
+        break;
+      case 'p':
+        search.refinePoints = atoi(optarg);
+        break;
+      case 'k':
+        search.numMinima = atoi(optarg);
+        break;
+      case 'g':
+        search.costMask = strtoul(optarg,NULL,0);
+        break;
+      case 'w':
+        search.settle.tolerance = atoi(optarg);
+        if (search.settle.window == 0) search.settle.window = DEFAULT_SETTLE_WINDOW;
+        break;
+      case 'W':
+        search.settle.maxDwell = atoi(optarg);
+        break;
+      case 's':
+        search.settle.window = atoi(optarg);
+        break;
+      case 'S':
+        search.order = BIAS_ORDER_SERPENTINE;
+        break;
+      case 'P':
+        search.reduceCPU = BIAS_REDUCE_CPU;
+        break;
+      case 'e':
+        if (parse_bias_stats(optarg,&search.stats) != 0) {
+          fprintf(stderr,"Unknown statistics `%s'.\n",optarg);
+          return 1;
+        }
+        break;
+      case 'i':
+        recordFile = optarg;
+        break;
+      case 'R':
+        resumeFlag = 1;
+        break;
+      case 'b':
+        if (parse_bias_box(optarg,search.box) != 0) {
+          fprintf(stderr,"Invalid box `%s'.\n",optarg);
+          return 1;
+        }
+        break;
       case 'f':
         debugFlag = 1;
         break;
@@ -73,78 +129,81 @@ int main(int argc, char **argv)
     return -1;
   }
 
-  uint32_t data_size = (uint32_t) saveFactor*pow((double) numVoltages,3);
-  data = (int *) malloc(data_size * sizeof(int));
-  if (!raw_data) {
+  if (search.refinePoints < 4) {
+    printf("Refinement grids need at least 4 points per axis\n");
+    return -1;
+  }
+  search.numVoltages = numVoltages;
+  search.numAvgs = numAvgs;
+  search.Vmax = Vmax;
+
+  if (recordFile) {
+    /*
+     * Long scans go straight to the record file, one point at a time
+     */
+    if (search.numLevels > 0) {
+      printf("Record files are only supported for grid scans\n");
+      return -1;
+    }
+    cfg = map_device(MEM_LOC,&fd);
+    if (!cfg) {
+      return 1;
+    }
+    if (scan_biases_to_file(cfg,&search,raw_data,recordFile,resumeFlag,&numPoints) != 0) {
+      printf("Error writing record file\n");
+      return -1;
+    }
+    if (debugFlag) {
+      printf("%u points in %s\n",numPoints,recordFile);
+    }
+    free(raw_data);
+    unmap_device(cfg,fd);
+    return 0;
+  }
+
+  uint32_t data_size;
+  if (search.numLevels > 0) {
+    data_size = bias_search_columns(&search)*bias_search_max_points(&search);
+  } else {
+    data_size = (uint32_t) scan_biases_columns(&search)*pow((double) numVoltages,3);
+  }
+  data = (int *) alloc_capture_buffer((size_t) data_size * sizeof(int),&memfd);
+  if (!data) {
     printf("Error allocating memory for saved data");
     return -1;
   }
 
-  //This returns a file identifier corresponding to the memory, and allows for reading and writing.  O_RDWR is just a constant
-  if((fd = open(name, O_RDWR)) < 0) {
-    perror("open");
+  cfg = map_device(MEM_LOC,&fd);
+  if (!cfg) {
     return 1;
   }
 
-  /*mmap maps the memory location 0x40000000 to the pointer cfg, which "points" to that location in memory.*/
-  cfg = mmap(0,MAP_SIZE,PROT_READ|PROT_WRITE,MAP_SHARED,fd,MEM_LOC);
-
   /*
-   * Start looping through voltage values
+   * Loop through voltage values
    */
-  int linear_index = 0;
-  int offset_index = (int) pow((double) numVoltages,3);
-  uint16_t Vx, Vy, Vz;
-  for (int xx = 0;xx < numVoltages; xx++) {
-    Vx = xx*(Vmax/numVoltages);
-    for (int yy = 0;yy < numVoltages; yy++) {
-      Vy = yy*(Vmax/numVoltages);
-      for (int zz = 0;zz < numVoltages; zz++) {
-        Vz = zz*(Vmax/numVoltages);
-        // Set PWM values
-        write_to_bias_pwm(cfg,Vx,Vy,Vz);
-/*        if ((xx == 0) || (yy == 0) || (zz == 0)) {
-          sleep(1);
-        } else {
-          usleep(100);
-        }
-*/
-        usleep(10000);
-        // Record raw data
-        start_fifo(cfg);
-        for (i = 0;i < raw_data_size;i += saveFactor) {
-          for (incr = 0;incr < saveFactor;incr++) {
-            *(raw_data + i + incr) = *((uint32_t *)(cfg + FIFO_BIAS_DATA_START_LOC + incr*4));
-          }
-        }
-        stop_fifo(cfg);
-        // Average raw data
-        linear_index = xx + yy*numVoltages + zz*numVoltages*numVoltages;
-        *(data + linear_index) = 0;
-        *(data + linear_index + offset_index) = 0;
-        *(data + linear_index + 2*offset_index) = 0;
-        *(data + linear_index + 3*offset_index) = 0;
-        for (i = 0;i < raw_data_size;i += saveFactor) {
-          *(data + linear_index) += (int) *(raw_data + i);
-          *(data + linear_index + offset_index) += (int) *(raw_data + i + 1);
-          *(data + linear_index + 2*offset_index) += (int) *(raw_data + i + 2);
-          *(data + linear_index + 3*offset_index) += (int) *(raw_data + i + 3);
-        }
-        *(data + linear_index) /= numAvgs;
-        *(data + linear_index + offset_index) /= numAvgs;
-        *(data + linear_index + 2*offset_index) /= numAvgs;
-        *(data + linear_index + 3*offset_index) /= numAvgs;
-      }
+  if (search.numLevels > 0) {
+    /*
+     * Coarse grid followed by refinement around the minima.  Only the visited points
+     * are saved, as a table with bias_search_columns() columns
+     */
+    if (bias_search(cfg,&search,raw_data,data,&numPoints) != 0) {
+      printf("Error allocating memory for search");
+      return -1;
+    }
+    if (debugFlag) {
+      printf("Visited %u points\n",numPoints);
     }
+    saveErr = write_capture(outputFile,data,(size_t) bias_search_columns(&search)*numPoints*4,memfd);
+  } else {
+    if (scan_biases(cfg,&search,raw_data,data) != 0) {
+      printf("Error allocating memory for scan");
+      return -1;
+    }
+    saveErr = write_capture(outputFile,data,(size_t) data_size * 4,memfd);
   }
-
-  ptr = fopen("SavedData.bin","wb");
-  fwrite(data,4,(size_t)(data_size),ptr);
-  fclose(ptr);
-  free(data);
+  free_capture_buffer(data,(size_t) data_size * 4,memfd);
   free(raw_data);
 
-  //Unmap cfg from pointing to the previous location in memory
-  munmap(cfg, MAP_SIZE);
-  return 0;	//C functions should have a return value - 0 is the usual "no error" return value
+  unmap_device(cfg,fd);
+  return saveErr ? 1 : 0;	//C functions should have a return value - 0 is the usual "no error" return value
 }
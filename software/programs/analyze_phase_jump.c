@@ -4,19 +4,19 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <unistd.h>
-#include <sys/mman.h>
-#include <fcntl.h>
 #include <math.h>
 #include <time.h>
 
 #include "iq_bias_control.h"
+#include "capture_output.h"
+#include "capture_file.h"
+#include "step_response.h"
  
 int main(int argc, char **argv)
 {
   int fd;		        //File identifier
   int num_samples;      //Number of samples to acquire
   void *cfg;		    //A pointer to a memory location.  The * indicates that it is a pointer - it points to a location in memory
-  char *name = "/dev/mem";	//Name of the memory resource
   uint16_t V = 320;
   uint16_t Vjump = 64;
   uint8_t jump_index = 0;
@@ -24,12 +24,24 @@ int main(int argc, char **argv)
   uint32_t i, incr = 0;
   uint8_t saveType = 2;
   uint32_t saveFactor = 5;
-  uint8_t allow_jump = 1;
+  uint32_t mask = 0;          //FIFOs to read, the first saveFactor by default
   uint8_t jump_type = 0;
   uint32_t tmp;
   uint32_t *data;
   uint8_t debugFlag = 0;
   FILE *ptr;
+  char *outputFile = NULL;    //Output destination, SavedData.bin by default
+  int memfd;                  //Memory file backing the data buffer, if any
+  int saveErr = 0;            //Writing the output failed
+  uint8_t containerFlag = 0;  //Write a self-describing capture file instead of raw words
+  capture_header_t hdr;
+  uint8_t rtFlag = 0;         //Real-time mode: locked memory, SCHED_FIFO and timed jumps
+  char *eventFile = NULL;     //Text log of the jump times, for raw output
+  uint32_t repeats = 1;       //Number of alternating jumps to average
+  char *metricsFile = NULL;   //Step response metrics, printed to stderr by default
+  double band = STEP_DEFAULT_BAND;
+  double *avg = NULL;         //Coherent average of the repeats
+  FILE *mptr;
 
   clock_t start, stop;
 
@@ -37,11 +49,14 @@ int main(int argc, char **argv)
    * Parse the input arguments
    */
   int c;
-  while ((c = getopt(argc,argv,"s:j:n:v:t:f")) != -1) {
+  while ((c = getopt(argc,argv,"s:C:j:n:v:t:r:m:b:o:E:LFf")) != -1) {
     switch (c) {
         case 's':
             saveFactor = atoi(optarg);
             break;
+        case 'C':
+            mask = strtoul(optarg,NULL,0);
+            break;
         case 'j':
             Vjump = atoi(optarg);
             break;
@@ -54,6 +69,27 @@ int main(int argc, char **argv)
         case 't':
             jump_type = atoi(optarg);
             break;
+        case 'r':
+            repeats = atoi(optarg);
+            break;
+        case 'm':
+            metricsFile = optarg;
+            break;
+        case 'b':
+            band = atof(optarg);
+            break;
+        case 'o':
+            outputFile = optarg;
+            break;
+        case 'F':
+            containerFlag = 1;
+            break;
+        case 'L':
+            rtFlag = 1;
+            break;
+        case 'E':
+            eventFile = optarg;
+            break;
         case 'f':
             debugFlag = 1;
             break;
@@ -74,58 +110,70 @@ int main(int argc, char **argv)
   }
 
 
+  mask = capture_mask(mask,saveFactor,NUM_PHASE_FIFOS);
+  if (mask == 0) {
+    fprintf(stderr,"Invalid channel mask or save factor\n");
+    return 1;
+  }
+  saveFactor = __builtin_popcount(mask);
   uint32_t data_size = saveFactor*num_samples;
-  data = (uint32_t *) malloc(data_size * sizeof(uint32_t));
+  data = (uint32_t *) alloc_capture_buffer((size_t) data_size * sizeof(uint32_t),&memfd);
   if (!data) {
     printf("Error allocating memory for data");
     return -1;
   }
+  if (repeats > 1 || metricsFile != NULL) {
+    avg = (double *) malloc((size_t) data_size * sizeof(double));
+    if (!avg) {
+      printf("Error allocating memory for data");
+      return -1;
+    }
+  }
 
-  //This returns a file identifier corresponding to the memory, and allows for reading and writing.  O_RDWR is just a constant
-  if((fd = open(name, O_RDWR)) < 0) {
-    perror("open");
+  cfg = map_device(MEM_LOC,&fd);
+  if (!cfg) {
     return 1;
   }
-
-  /*mmap maps the memory location 0x40000000 to the pointer cfg, which "points" to that location in memory.*/
-  cfg = mmap(0,MAP_SIZE,PROT_READ|PROT_WRITE,MAP_SHARED,fd,MEM_LOC);
- 
-  // Set voltages
-  if (jump_type == 1) {
-    write_to_phase_pwm(cfg,V);
-  } else {
-    write_to_aux_dac(cfg,V);
+  if (rtFlag) {
+    rt_enter(RT_DEFAULT_CPU,RT_DEFAULT_PRIORITY);
   }
-  
-  sleep(1);
-  // Record data
-  start_fifo(cfg);
-  for (i = 0;i < data_size;i += saveFactor) {
-    if ((i >= (data_size >> 2)) & (allow_jump == 1)) {
-        allow_jump = 0;
-        if (jump_type == 1) {
-          write_to_phase_pwm(cfg,V + Vjump);
-        } else {
-          write_to_aux_dac(cfg,V + Vjump);
-        }
+ 
+  capture_header_init(&hdr,cfg,CAPTURE_SOURCE_PHASE,mask);
+  if (avg) {
+    // Record and average alternating jumps, and save the average instead of a single
+    // trace: as float32 in a capture file, so the extra resolution is kept, and rounded
+    // to int32 otherwise
+    if (record_phase_steps(cfg,mask,num_samples,V,Vjump,jump_type,repeats,data,avg,&hdr.events) == -1) {
+      printf("Error allocating memory");
+      return -1;
     }
-    for (incr = 0;incr < saveFactor;incr++) {
-        *(data + i + incr) = *((uint32_t *)(cfg + FIFO_PHASE_DATA_START_LOC + (incr << 2)));
+    if (containerFlag) {
+      hdr.sample_format = CAPTURE_FORMAT_FLOAT32;
     }
-  }
-  stop_fifo(cfg);
-  if (jump_type == 1) {
-    write_to_phase_pwm(cfg,V);
+    step_average_to_words(avg,data_size,hdr.sample_format,data);
+    mptr = metricsFile ? fopen(metricsFile,"w") : stderr;
+    if (mptr) {
+      step_print_metrics(mptr,&hdr,avg,num_samples,step_jump_sample(mask,num_samples),repeats,band);
+      if (mptr != stderr) fclose(mptr);
+    } else {
+      perror(metricsFile);
+    }
+    free(avg);
   } else {
-    write_to_aux_dac(cfg,V);
+    // Record the response to the voltage jump
+    record_phase_jump(cfg,mask,num_samples,V,Vjump,jump_type,data,&hdr.events);
   }
 
-  ptr = fopen("SavedData.bin","wb");
-  fwrite(data,4,(size_t)(data_size),ptr);
-  fclose(ptr);
-  free(data);
+  if (eventFile) {
+    capture_write_events(eventFile,&hdr);
+  }
+  if (containerFlag) {
+    saveErr = save_capture_file(outputFile,&hdr,data,num_samples);
+  } else {
+    saveErr = write_capture(outputFile,data,(size_t) data_size * 4,memfd);
+  }
+  free_capture_buffer(data,(size_t) data_size * 4,memfd);
 
-  //Unmap cfg from pointing to the previous location in memory
-  munmap(cfg, MAP_SIZE);
-  return 0;	//C functions should have a return value - 0 is the usual "no error" return value
+  unmap_device(cfg,fd);
+  return saveErr ? 1 : 0;	//C functions should have a return value - 0 is the usual "no error" return value
 }
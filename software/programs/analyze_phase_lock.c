@@ -4,36 +4,46 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <unistd.h>
-#include <sys/mman.h>
-#include <fcntl.h>
 #include <math.h>
 #include <time.h>
 
 #include "iq_bias_control.h"
-#define PHASE_LOCK_REG 0x00000300
-
-int set_lock_status(void *cfg,uint32_t s) {
-  uint32_t old = *((uint32_t *)(cfg + PHASE_LOCK_REG));
-  old = (old & ~((uint32_t) 1 << 31)) | (s << 31);
-  *((uint32_t *)(cfg + 0x00000300)) = old;
-}
+#include "capture_output.h"
+#include "capture_file.h"
+#include "step_response.h"
+#include "lock_trials.h"
 
 int main(int argc, char **argv)
 {
   int fd;		        //File identifier
   int num_samples;      //Number of samples to acquire
   void *cfg;		    //A pointer to a memory location.  The * indicates that it is a pointer - it points to a location in memory
-  char *name = "/dev/mem";	//Name of the memory resource
 
   uint32_t i, incr = 0;
   uint8_t saveType = 2;
   uint32_t saveFactor = 5;
+  uint32_t mask = 0;          //FIFOs to read, the first saveFactor by default
   uint32_t change_sample = 0;
-  uint32_t change_lock_status = 1;
   uint32_t tmp;
   uint32_t *data;
   uint8_t debugFlag = 0;
   FILE *ptr;
+  char *outputFile = NULL;    //Output destination, SavedData.bin by default
+  int memfd;                  //Memory file backing the data buffer, if any
+  int saveErr = 0;            //Writing the output failed
+  uint8_t containerFlag = 0;  //Write a self-describing capture file instead of raw words
+  capture_header_t hdr;
+  uint8_t rtFlag = 0;         //Real-time mode: locked memory, SCHED_FIFO and timed jumps
+  char *eventFile = NULL;     //Text log of the jump times, for raw output
+  uint32_t numTrials = 0;     //Lock/unlock trials, 0 for a single capture
+  lock_detect_t det = {0,0,LOCK_DEFAULT_TOLERANCE,LOCK_DEFAULT_HOLD,LOCK_DEFAULT_OFF_US};
+  char *avgFile = NULL;       //Mean trace of the trials, if wanted
+  lock_trial_t *result = NULL;
+  double *avg = NULL;
+  char *table;
+  size_t table_len;
+  int outfd;
+  FILE *tptr;
 
   clock_t start, stop;
 
@@ -41,17 +51,53 @@ int main(int argc, char **argv)
    * Parse the input arguments
    */
   int c;
-  while ((c = getopt(argc,argv,"s:n:c:f")) != -1) {
+  while ((c = getopt(argc,argv,"s:C:n:c:N:u:k:x:e:h:a:o:E:LFf")) != -1) {
     switch (c) {
         case 's':
             saveFactor = atoi(optarg);
             break;
+        case 'C':
+            mask = strtoul(optarg,NULL,0);
+            break;
         case 'n':
             num_samples = atoi(optarg);
             break;
         case 'c':
             change_sample = atoi(optarg);
             break;
+        case 'N':
+            numTrials = atoi(optarg);
+            break;
+        case 'u':
+            det.off_us = atoi(optarg);
+            break;
+        case 'k':
+            det.stream = atoi(optarg);
+            break;
+        case 'x':
+            det.setpoint = atoi(optarg);
+            break;
+        case 'e':
+            det.tolerance = atoi(optarg);
+            break;
+        case 'h':
+            det.hold = atoi(optarg);
+            break;
+        case 'a':
+            avgFile = optarg;
+            break;
+        case 'o':
+            outputFile = optarg;
+            break;
+        case 'F':
+            containerFlag = 1;
+            break;
+        case 'L':
+            rtFlag = 1;
+            break;
+        case 'E':
+            eventFile = optarg;
+            break;
         case 'f':
             debugFlag = 1;
             break;
@@ -72,46 +118,91 @@ int main(int argc, char **argv)
   }
 
 
+  mask = capture_mask(mask,saveFactor,NUM_PHASE_FIFOS);
+  if (mask == 0) {
+    fprintf(stderr,"Invalid channel mask or save factor\n");
+    return 1;
+  }
+  saveFactor = __builtin_popcount(mask);
   uint32_t data_size = saveFactor*num_samples;
-  data = (uint32_t *) malloc(data_size * sizeof(uint32_t));
+  data = (uint32_t *) alloc_capture_buffer((size_t) data_size * sizeof(uint32_t),&memfd);
   if (!data) {
     printf("Error allocating memory for data");
     return -1;
   }
+  if (numTrials > 0) {
+    if (!(mask & (1u << det.stream))) {
+      fprintf(stderr,"The error stream %u is not in the channel mask\n",det.stream);
+      return 1;
+    }
+    result = (lock_trial_t *) malloc(numTrials*sizeof(lock_trial_t));
+    if (avgFile) {
+      avg = (double *) malloc((size_t) data_size * sizeof(double));
+    }
+    if (!result || (avgFile && !avg)) {
+      printf("Error allocating memory for data");
+      return -1;
+    }
+  }
 
-  //This returns a file identifier corresponding to the memory, and allows for reading and writing.  O_RDWR is just a constant
-  if((fd = open(name, O_RDWR)) < 0) {
-    perror("open");
+  cfg = map_device(MEM_LOC,&fd);
+  if (!cfg) {
     return 1;
   }
-
-  /*mmap maps the memory location 0x40000000 to the pointer cfg, which "points" to that location in memory.*/
-  cfg = mmap(0,MAP_SIZE,PROT_READ|PROT_WRITE,MAP_SHARED,fd,MEM_LOC);
- 
-  if (change_sample == 0) {
-    change_sample = (data_size >> 2);
+  if (rtFlag) {
+    rt_enter(RT_DEFAULT_CPU,RT_DEFAULT_PRIORITY);
   }
-  // Record data
-  set_lock_status(cfg,0);
-  usleep(1000);
-  start_fifo(cfg);
-  for (i = 0;i < data_size;i += saveFactor) {
-    if ((i >= saveFactor*change_sample) & (change_lock_status == 1)) {
-        change_lock_status = 0;
-        set_lock_status(cfg,1);
+ 
+  capture_header_init(&hdr,cfg,CAPTURE_SOURCE_PHASE,mask);
+  if (numTrials > 0) {
+    // Cycle the lock and analyse each trial here, so that only the table of results (and
+    // optionally the mean trace) has to be transferred.  The table goes to the output
+    if (change_sample == 0) change_sample = num_samples >> 2;
+    record_lock_trials(cfg,mask,num_samples,change_sample,numTrials,&det,data,avg,result,&hdr.events);
+    tptr = open_memstream(&table,&table_len);
+    if (!tptr) {
+      printf("Error allocating memory for data");
+      return -1;
+    }
+    lock_print_trials(tptr,result,numTrials,&det,hdr.sample_period);
+    fclose(tptr);
+    if ((outfd = open_output(outputFile)) >= 0) {
+      write_all(outfd,table,table_len);
+      close_output(outfd);
     }
-    for (incr = 0;incr < saveFactor;incr++) {
-        *(data + i + incr) = *((uint32_t *)(cfg + FIFO_PHASE_DATA_START_LOC + (incr << 2)));
+    free(table);
+    if (avg) {
+      if (containerFlag) {
+        hdr.sample_format = CAPTURE_FORMAT_FLOAT32;
+      }
+      step_average_to_words(avg,data_size,hdr.sample_format,data);
+      if (containerFlag) {
+        saveErr = save_capture_file(avgFile,&hdr,data,num_samples);
+      } else {
+        saveErr = write_capture(avgFile,data,(size_t) data_size * 4,memfd);
+      }
+      free(avg);
     }
+    if (eventFile) {
+      capture_write_events(eventFile,&hdr);
+    }
+    free(result);
+    free_capture_buffer(data,(size_t) data_size * 4,memfd);
+    unmap_device(cfg,fd);
+    return saveErr ? 1 : 0;
+  }
+  // Record data while engaging the lock
+  record_phase_lock(cfg,mask,num_samples,change_sample,data,&hdr.events);
+  if (eventFile) {
+    capture_write_events(eventFile,&hdr);
+  }
+  if (containerFlag) {
+    saveErr = save_capture_file(outputFile,&hdr,data,num_samples);
+  } else {
+    saveErr = write_capture(outputFile,data,(size_t) data_size * 4,memfd);
   }
-  stop_fifo(cfg);
-  set_lock_status(cfg,0);
-  ptr = fopen("SavedData.bin","wb");
-  fwrite(data,4,(size_t)(data_size),ptr);
-  fclose(ptr);
-  free(data);
+  free_capture_buffer(data,(size_t) data_size * 4,memfd);
 
-  //Unmap cfg from pointing to the previous location in memory
-  munmap(cfg, MAP_SIZE);
-  return 0;	//C functions should have a return value - 0 is the usual "no error" return value
+  unmap_device(cfg,fd);
+  return saveErr ? 1 : 0;	//C functions should have a return value - 0 is the usual "no error" return value
 }
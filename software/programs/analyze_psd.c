@@ -0,0 +1,273 @@
+//These are libraries which contain useful functions
+#include <ctype.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <math.h>
+#include <time.h>
+
+#include "iq_bias_control.h"
+#include "capture_output.h"
+#include "capture_file.h"
+#include "fifo_stream.h"
+#include "decimate.h"
+#include "psd.h"
+
+/*
+ * Streams the bias or phase FIFOs through a Welch PSD estimate on the device and writes
+ * only the averaged spectra (see psd.h for the file format).  The FFTs run in the
+ * streaming writer thread, so the reader keeps draining the FIFOs while they are
+ * computed.  With -c, one spectrum of numAvgs segments is written after another until
+ * the program is stopped with SIGINT/SIGTERM
+ */
+typedef struct {
+  psd_t psd;
+  decimator_t *dec;
+  uint32_t *dec_out;              //Decimated block
+  psd_header_t hdr;
+  double *spectra;
+  int fd;
+  uint32_t numAvgs;               //Segments per spectrum
+  int continuous;
+  uint64_t numSpectra;            //Spectra written so far
+} psd_consumer_t;
+
+static uint64_t now_ns(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_REALTIME,&t);
+  return (uint64_t) t.tv_sec*1000000000ULL + (uint64_t) t.tv_nsec;
+}
+
+static int write_spectrum(psd_consumer_t *c) {
+  c->hdr.num_averages = c->psd.segments;
+  psd_spectrum(&c->psd,c->spectra,1);
+  if (psd_write(c->fd,&c->hdr,c->spectra) != 0) {
+    return -1;
+  }
+  c->hdr.start_time_ns = now_ns();
+  c->numSpectra++;
+  return 0;
+}
+
+static int consume_block(void *arg,const uint32_t *block,uint32_t num_words) {
+  psd_consumer_t *c = (psd_consumer_t *) arg;
+  uint32_t n = num_words/c->psd.num_streams, chunk;
+
+  if (c->dec) {
+    n = decimate(c->dec,block,n,c->dec_out);
+    block = c->dec_out;
+  }
+  //Push at most one hop at a time so that each spectrum has exactly numAvgs segments
+  while (n > 0) {
+    chunk = n < c->psd.hop ? n : c->psd.hop;
+    psd_push(&c->psd,block,chunk);
+    block += (size_t) chunk*c->psd.num_streams;
+    n -= chunk;
+    if (c->psd.segments >= c->numAvgs) {
+      if (write_spectrum(c) != 0) return -1;
+      if (!c->continuous) return 1;
+    }
+  }
+  return 0;
+}
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void handle_stop(int sig) {
+  stop_requested = 1;
+}
+
+int main(int argc, char **argv)
+{
+  int fd;		        //File identifier
+  void *cfg;		    //A pointer to a memory location.  The * indicates that it is a pointer - it points to a location in memory
+
+  uint32_t saveFactor = 0;    //Number of FIFOs to read, all of the group by default
+  uint32_t mask = 0;          //FIFOs to read, the first saveFactor by default
+  uint8_t phaseFlag = 0;      //Analyse the phase FIFOs instead of the bias FIFOs
+  uint32_t numFifos;
+  uint32_t nfft = PSD_DEFAULT_NFFT;
+  uint32_t numAvgs = 100;     //Segments averaged in each spectrum
+  int overlapPercent = 50;
+  const char *windowName = "hann";
+  int window;
+  uint32_t decimation = 1;    //On-device decimation factor, 1 for none
+  const char *filterSpec = "cic";
+  decimator_t dec;
+  int readerCPU = 1;          //CPU for the streaming reader thread, -1 to not pin it
+  uint8_t continuousFlag = 0;
+  uint8_t rtFlag = 0;         //Real-time mode: locked memory and SCHED_FIFO
+  uint8_t debugFlag = 0;
+  char *outputFile = NULL;    //Output destination, SavedData.bin by default
+  capture_header_t capture;
+  psd_consumer_t consumer;
+  fifo_stream_t s;
+  struct sigaction sa;
+  int ticks = 0;
+
+  /*
+   * Parse the input arguments
+   */
+  int c;
+  while ((c = getopt(argc,argv,"s:C:PN:a:O:w:d:D:p:o:cLf")) != -1) {
+    switch (c) {
+      case 's':
+        saveFactor = atoi(optarg);
+        break;
+      case 'C':
+        mask = strtoul(optarg,NULL,0);
+        break;
+      case 'P':
+        phaseFlag = 1;
+        break;
+      case 'N':
+        nfft = atoi(optarg);
+        break;
+      case 'a':
+        numAvgs = atoi(optarg);
+        break;
+      case 'O':
+        overlapPercent = atoi(optarg);
+        break;
+      case 'w':
+        windowName = optarg;
+        break;
+      case 'd':
+        decimation = atoi(optarg);
+        break;
+      case 'D':
+        filterSpec = optarg;
+        break;
+      case 'p':
+        readerCPU = atoi(optarg);
+        break;
+      case 'o':
+        outputFile = optarg;
+        break;
+      case 'c':
+        continuousFlag = 1;
+        break;
+      case 'L':
+        rtFlag = 1;
+        break;
+      case 'f':
+        debugFlag = 1;
+        break;
+
+      case '?':
+        if (isprint (optopt))
+            fprintf (stderr, "Unknown option `-%c'.\n", optopt);
+        else
+            fprintf (stderr,
+                    "Unknown option character `\\x%x'.\n",
+                    optopt);
+        return 1;
+
+      default:
+        abort();
+        break;
+    }
+  }
+
+  numFifos = phaseFlag ? NUM_PHASE_FIFOS : NUM_BIAS_FIFOS;
+  mask = capture_mask(mask,saveFactor > 0 ? saveFactor : numFifos,numFifos);
+  if (mask == 0) {
+    fprintf(stderr,"Invalid channel mask or save factor\n");
+    return 1;
+  }
+  saveFactor = __builtin_popcount(mask);
+  if ((window = psd_parse_window(windowName)) < 0) {
+    fprintf(stderr,"Unknown window `%s', use rect, hann, hamming or blackmanharris\n",windowName);
+    return 1;
+  }
+  if (numAvgs == 0 || overlapPercent < 0 || overlapPercent >= 100) {
+    fprintf(stderr,"Invalid number of averages or overlap\n");
+    return 1;
+  }
+  if (decimation > 1 && decimator_init(&dec,filterSpec,decimation,saveFactor) != 0) {
+    fprintf(stderr,"Invalid decimation filter\n");
+    return 1;
+  }
+
+  cfg = map_device(MEM_LOC,&fd);
+  if (!cfg) {
+    return 1;
+  }
+  capture_header_init(&capture,cfg,phaseFlag ? CAPTURE_SOURCE_PHASE : CAPTURE_SOURCE_BIAS,mask);
+  capture.decimation = decimation;
+  capture.sample_period *= decimation;
+
+  memset(&consumer,0,sizeof(consumer));
+  if (psd_init(&consumer.psd,nfft,(uint32_t)((uint64_t) nfft*overlapPercent/100),window,saveFactor,1.0/capture.sample_period) != 0) {
+    fprintf(stderr,"Invalid FFT length, use a power of two from %u to %u\n",PSD_MIN_NFFT,PSD_MAX_NFFT);
+    unmap_device(cfg,fd);
+    return 1;
+  }
+  psd_header_init(&consumer.hdr,&capture,&consumer.psd);
+  consumer.numAvgs = numAvgs;
+  consumer.continuous = continuousFlag;
+  consumer.dec = decimation > 1 ? &dec : NULL;
+  consumer.spectra = (double *) malloc((size_t) consumer.psd.num_bins*saveFactor*sizeof(double));
+  consumer.dec_out = (uint32_t *) malloc((size_t) STREAM_DEFAULT_BLOCK_WORDS*sizeof(uint32_t));
+  if (!consumer.spectra || !consumer.dec_out ||
+      stream_init(&s,cfg,phaseFlag ? FIFO_PHASE_DATA_START_LOC : FIFO_BIAS_DATA_START_LOC,mask,0,
+                  STREAM_DEFAULT_BLOCK_WORDS,STREAM_DEFAULT_NUM_BLOCKS) != 0) {
+    printf("Error allocating memory");
+    return -1;
+  }
+  if (debugFlag) {
+    fprintf(stderr,"Sample rate: %.6g Hz, bin width: %.6g Hz, ENBW: %.6g Hz, %.3g s per spectrum\n",
+            consumer.hdr.sample_rate,consumer.hdr.bin_width,consumer.hdr.enbw,
+            ((double) nfft + (double)(numAvgs - 1)*consumer.psd.hop)/consumer.hdr.sample_rate);
+  }
+  if ((consumer.fd = open_output(outputFile)) < 0) {
+    return 1;
+  }
+  if (rtFlag) {
+    // Only the reader runs at real-time priority, on readerCPU
+    rt_enter(-1,0);
+  }
+
+  memset(&sa,0,sizeof(sa));
+  sa.sa_handler = handle_stop;
+  sigaction(SIGINT,&sa,NULL);
+  sigaction(SIGTERM,&sa,NULL);
+  signal(SIGPIPE,SIG_IGN);
+
+  consumer.hdr.start_time_ns = now_ns();
+  if (stream_start(&s,consume_block,&consumer,readerCPU) != 0) {
+    fprintf(stderr,"Could not start streaming threads\n");
+    return 1;
+  }
+  while (!stream_is_done(&s)) {
+    usleep(100000);
+    if (stop_requested) {
+      stream_stop(&s);
+    }
+    if (debugFlag && (++ticks % 10 == 0)) {
+      stream_print_stats(&s,stderr);
+    }
+  }
+  stream_join(&s);
+  if (debugFlag || atomic_load(&s.overruns) > 0) {
+    stream_print_stats(&s,stderr);
+  }
+  //A stopped measurement still returns what it has averaged so far
+  if (consumer.psd.segments > 0 && (consumer.numSpectra == 0 || consumer.continuous)) {
+    write_spectrum(&consumer);
+  }
+  close_output(consumer.fd);
+
+  stream_free(&s);
+  psd_free(&consumer.psd);
+  free(consumer.spectra);
+  free(consumer.dec_out);
+  if (decimation > 1) {
+    decimator_free(&dec);
+  }
+  unmap_device(cfg,fd);
+  return 0;	//C functions should have a return value - 0 is the usual "no error" return value
+}
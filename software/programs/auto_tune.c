@@ -0,0 +1,179 @@
+//These are libraries which contain useful functions
+#include <ctype.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "iq_bias_control.h"
+#include "capture_output.h"
+#include "mimo_control.h"
+#include "feedback_tuning.h"
+
+/*
+ * Automatic tuning of the bias controller, and optionally the phase lock, in one run on
+ * the device (see feedback_tuning.h).  The result is a text table: the measurements and
+ * gains as comments, then the address and value of every register to write.  With -w
+ * the registers are also written, otherwise the device is left as it was.  Gains from a
+ * fallback time constant or clipped to fit their registers are never written
+ */
+int main(int argc, char **argv)
+{
+  int fd;		        //File identifier
+  void *cfg;		    //A pointer to a memory location.  The * indicates that it is a pointer - it points to a location in memory
+
+  tune_params_t params;
+  tune_result_t result;
+  uint8_t phaseFlag = 0;      //Tune the phase lock as well
+  uint8_t writeFlag = 0;      //Write the registers
+  uint8_t refused = 0;        //Gains not written because they are fallbacks or clipped
+  uint8_t rtFlag = 0;         //Real-time mode: locked memory and SCHED_FIFO
+  uint8_t debugFlag = 0;
+  char *outputFile = "-";     //Output destination, standard output by default
+  char *table;
+  size_t table_len;
+  FILE *tptr;
+  int outfd, ret;
+
+  clock_t start, stop;
+
+  tune_defaults(&params);
+  /*
+   * Parse the input arguments
+   */
+  int c;
+  while ((c = getopt(argc,argv,"s:n:a:d:j:N:r:F:b:B:o:PwLf")) != -1) {
+    switch (c) {
+      case 's':
+        params.step = atoi(optarg);
+        break;
+      case 'n':
+        params.points = atoi(optarg);
+        break;
+      case 'a':
+        params.numAvgs = atoi(optarg);
+        break;
+      case 'd':
+        params.settle.maxDwell = atoi(optarg);
+        break;
+      case 'j':
+        params.jump = atoi(optarg);
+        break;
+      case 'N':
+        params.numSamples = atoi(optarg);
+        break;
+      case 'r':
+        params.repeats = atoi(optarg);
+        break;
+      case 'F':
+        params.factor = atof(optarg);
+        break;
+      case 'b':
+        if (mimo_parse_list(optarg,params.bandwidth,MIMO_NUM) != 0) {
+          fprintf(stderr,"Option -b needs 1 or %d values\n",MIMO_NUM);
+          return 1;
+        }
+        break;
+      case 'B':
+        params.phase_bandwidth = atof(optarg);
+        break;
+      case 'o':
+        outputFile = optarg;
+        break;
+      case 'P':
+        phaseFlag = 1;
+        break;
+      case 'w':
+        writeFlag = 1;
+        break;
+      case 'L':
+        rtFlag = 1;
+        break;
+      case 'f':
+        debugFlag = 1;
+        break;
+
+      case '?':
+        if (isprint (optopt))
+            fprintf (stderr, "Unknown option `-%c'.\n", optopt);
+        else
+            fprintf (stderr,
+                    "Unknown option character `\\x%x'.\n",
+                    optopt);
+        return 1;
+
+      default:
+        abort();
+        break;
+    }
+  }
+
+  if (params.step == 0 || params.points == 0 || params.numAvgs == 0 || params.numSamples < 4 || params.jump == 0) {
+    fprintf(stderr,"The scan, averages, step response and jump must not be empty\n");
+    return 1;
+  }
+
+  cfg = map_device(MEM_LOC,&fd);
+  if (!cfg) {
+    return 1;
+  }
+  if (rtFlag) {
+    rt_enter(RT_DEFAULT_CPU,RT_DEFAULT_PRIORITY);
+  }
+
+  memset(&result,0,sizeof(result));
+  start = clock();
+  ret = tune_measure_bias(cfg,&params,&result);
+  if (ret == -1) {
+    printf("Error allocating memory");
+    return -1;
+  } else if (ret == -2 || tune_bias_gains(&params,&result) != 0) {
+    fprintf(stderr,"The response matrix is singular: check the light and the demodulation phases\n");
+    unmap_device(cfg,fd);
+    return 1;
+  }
+  if (phaseFlag) {
+    ret = tune_phase(cfg,&params,&result);
+    if (ret == -1) {
+      printf("Error allocating memory");
+      return -1;
+    } else if (ret == -2) {
+      fprintf(stderr,"No response of the phase to its actuator, the phase lock is not tuned\n");
+    }
+  }
+  stop = clock();
+  if (result.flags & TUNE_NO_RESPONSE) {
+    fprintf(stderr,"A bias step response was lost in the noise, its time constant is one sample\n");
+  }
+  if ((result.flags | result.phase_flags) & TUNE_CLIPPED) {
+    fprintf(stderr,"Some gains do not fit their registers and were clipped\n");
+  }
+  //Fallback and clipped gains are only reported, never applied
+  refused = writeFlag && ((result.flags | result.phase_flags) & (TUNE_NO_RESPONSE | TUNE_CLIPPED));
+  if (refused) {
+    fprintf(stderr,"The gains are not written to the device\n");
+  } else if (writeFlag) {
+    tune_write(cfg,&result);
+  }
+  if (debugFlag) {
+    fprintf(stderr,"Tuning took %.3f s of CPU time\n",(double)(stop - start)/CLOCKS_PER_SEC);
+  }
+
+  tptr = open_memstream(&table,&table_len);
+  if (!tptr) {
+    printf("Error allocating memory");
+    return -1;
+  }
+  tune_print(tptr,&result);
+  fclose(tptr);
+  if ((outfd = open_output(outputFile)) >= 0) {
+    write_all(outfd,table,table_len);
+    close_output(outfd);
+  }
+  free(table);
+
+  unmap_device(cfg,fd);
+  return refused ? 1 : 0;	//C functions should have a return value - 0 is the usual "no error" return value
+}
@@ -0,0 +1,34 @@
+#!/bin/sh
+#
+# Runs the savers and analyzers built with `make mock' against the mock backend and then
+# the capture benchmarks.  Options are passed on to capture_bench, e.g. -t 5 to fail if
+# the raw FIFO reads drop below 5 Mwords/s.  IQ_MOCK_RATE, IQ_MOCK_DEPTH and
+# IQ_MOCK_READ_NS apply to the programs as described in mock_backend.h
+#
+cd "$(dirname "$0")" || exit 1
+N=${BENCH_SAMPLES:-100000}
+export IQ_MOCK_STATS=1
+export IQ_MOCK_RATE=${IQ_MOCK_RATE:-0}
+
+run() {
+  echo "== $*"
+  start=$(date +%s.%N)
+  "$@" > /dev/null || { echo "FAILED: $*"; exit 1; }
+  end=$(date +%s.%N)
+  echo "$start $end" | awk '{printf "   %.3f s\n", $2 - $1}'
+}
+
+run mock/saveData -n $N -t 1 -o /dev/null
+run mock/saveData -n $N -t 2 -o /dev/null
+run mock/saveData -n $N -t 3 -o /dev/null
+run mock/savePhaseData -n $N -t 1 -o /dev/null
+run mock/fetchRAM $N /dev/null
+run mock/analyze_biases -n 4 -a 100 -o /dev/null
+run mock/analyze_jump_response -n $N -o /dev/null
+run mock/analyze_phase_jump -n $N -o /dev/null
+run mock/analyze_phase_lock -n $N -o /dev/null
+run mock/sweep_biases -n $N -v 0:0:1023 -o /dev/null
+
+echo "== capture_bench"
+unset IQ_MOCK_STATS IQ_MOCK_RATE
+exec mock/capture_bench "$@"
@@ -0,0 +1,605 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "iq_bias_control.h"
+#include "bias_search.h"
+#include "capture_output.h"
+
+#define RECORD_BUFFER_WORDS         16384
+
+/*
+ * Averages points on another CPU.  Raw data alternates between two buffers, so that
+ * one can be averaged while the next point is acquired into the other
+ */
+typedef struct {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  uint32_t *raw[2];
+  bias_point_t *job[2];           //Point waiting to be averaged, NULL if the buffer is free
+  uint32_t next;                  //Buffer that the next point is acquired into
+  int stop;
+} reducer_t;
+
+typedef struct {
+  void *cfg;
+  const bias_search_params_t *p;
+  uint32_t *raw_data;
+  bias_point_t *points;
+  uint32_t num_points;
+  reducer_t *reducer;
+  const uint8_t *done;            //Bitmap of coarse points already recorded, NULL if none
+  int fd;                         //Record file, -1 if the points are kept in memory
+  bias_point_t ring[4];           //Points in flight when recording to a file
+  uint32_t ring_next;
+  uint32_t num_recorded;
+  int error;
+} search_state_t;
+
+void bias_search_defaults(bias_search_params_t *p) {
+  p->numVoltages = 10;
+  p->numAvgs = 100;
+  p->Vmax = 160;
+  p->numLevels = 0;
+  p->refinePoints = BIAS_SEARCH_DEFAULT_POINTS;
+  p->numMinima = 1;
+  p->costMask = BIAS_SEARCH_DEFAULT_MASK;
+  p->settle.window = 0;
+  p->settle.tolerance = 0;
+  p->settle.maxDwell = DEFAULT_BIAS_DWELL;
+  p->order = BIAS_ORDER_RASTER;
+  p->reduceCPU = -1;
+  p->stats = BIAS_STAT_MEAN;
+  for (int i = 0;i < 3;i++) {
+    p->box[2*i] = 0;
+    p->box[2*i + 1] = UINT32_MAX;
+  }
+}
+
+int parse_bias_box(const char *spec,uint32_t *box) {
+  if (sscanf(spec,"%u:%u,%u:%u,%u:%u",box,box + 1,box + 2,box + 3,box + 4,box + 5) != 6) return -1;
+  for (int i = 0;i < 3;i++) {
+    if (box[2*i] > box[2*i + 1]) return -1;
+  }
+  return 0;
+}
+
+int parse_bias_stats(const char *list,uint32_t *stats) {
+  const char *names[NUM_BIAS_STATS] = {"mean","var","min","max"};
+  const char *start = list;
+  size_t len;
+  int k;
+  *stats = 0;
+  while (*start) {
+    len = strcspn(start,",");
+    for (k = 0;k < NUM_BIAS_STATS;k++) {
+      if (strlen(names[k]) == len && strncmp(start,names[k],len) == 0) break;
+    }
+    if (k == NUM_BIAS_STATS) return -1;
+    *stats |= 1 << k;
+    start += len;
+    if (*start == ',') start++;
+  }
+  return *stats ? 0 : -1;
+}
+
+static uint32_t num_stats(const bias_search_params_t *p) {
+  return __builtin_popcount(p->stats & ((1 << NUM_BIAS_STATS) - 1));
+}
+
+uint32_t scan_biases_columns(const bias_search_params_t *p) {
+  return NUM_BIAS_FIFOS*num_stats(p) + (p->settle.window > 0 ? NUM_SETTLE_COLUMNS : 0);
+}
+
+uint32_t bias_search_columns(const bias_search_params_t *p) {
+  return 3 + NUM_BIAS_FIFOS*num_stats(p) + 3;
+}
+
+uint32_t bias_search_max_points(const bias_search_params_t *p) {
+  uint32_t n = p->numVoltages*p->numVoltages*p->numVoltages;
+  uint32_t r = p->refinePoints*p->refinePoints*p->refinePoints;
+  return n + p->numMinima*p->numLevels*r;
+}
+
+static double point_cost(const bias_search_params_t *p,const int *s) {
+  double cost = 0;
+  for (int i = 0;i < NUM_BIAS_FIFOS;i++) {
+    if (p->costMask & (1 << i)) cost += (double) s[i]*(double) s[i];
+  }
+  return cost;
+}
+
+static void reduce_point(const bias_search_params_t *p,const uint32_t *raw,bias_point_t *pt) {
+  bias_stats_t st;
+  bias_stats(raw,p->numAvgs,&st);
+  for (int k = 0;k < NUM_BIAS_STATS;k++) {
+    if (k == 0 || (p->stats & (1 << k))) bias_stats_value(&st,1 << k,pt->s[k]);
+  }
+  pt->cost = point_cost(p,pt->s[0]);
+}
+
+/*
+ * Appends one record to the record file
+ */
+static void record_point(search_state_t *st,const bias_point_t *pt) {
+  const bias_search_params_t *p = st->p;
+  int32_t rec[4 + NUM_BIAS_STATS*NUM_BIAS_FIFOS + NUM_SETTLE_COLUMNS];
+  uint32_t n = 0;
+  rec[n++] = (int32_t) pt->index;
+  rec[n++] = pt->V[0];
+  rec[n++] = pt->V[1];
+  rec[n++] = pt->V[2];
+  for (int k = 0;k < NUM_BIAS_STATS;k++) {
+    if (!(p->stats & (1 << k))) continue;
+    for (int j = 0;j < NUM_BIAS_FIFOS;j++) rec[n++] = pt->s[k][j];
+  }
+  if (p->settle.window > 0) {
+    rec[n++] = (int32_t) pt->settle_us;
+    rec[n++] = pt->timed_out;
+  }
+  if (write_all(st->fd,rec,n*sizeof(int32_t)) != 0) {
+    st->error = 1;
+  } else {
+    st->num_recorded++;
+  }
+}
+
+static void finish_point(search_state_t *st,const uint32_t *raw,bias_point_t *pt) {
+  reduce_point(st->p,raw,pt);
+  if (st->fd >= 0) record_point(st,pt);
+}
+
+/*
+ * Writes the selected statistics of a point into columns of length N starting at data,
+ * and returns the start of the next column
+ */
+static int *write_stats(const bias_search_params_t *p,const bias_point_t *pt,int *data,uint32_t N) {
+  for (int k = 0;k < NUM_BIAS_STATS;k++) {
+    if (!(p->stats & (1 << k))) continue;
+    for (int j = 0;j < NUM_BIAS_FIFOS;j++) {
+      *data = pt->s[k][j];
+      data += N;
+    }
+  }
+  return data;
+}
+
+static void *reducer_thread(void *arg) {
+  search_state_t *st = (search_state_t *) arg;
+  reducer_t *r = st->reducer;
+  uint32_t k = 0;
+  bias_point_t *pt;
+  while (1) {
+    pthread_mutex_lock(&r->lock);
+    while (!r->job[k] && !r->stop) pthread_cond_wait(&r->cond,&r->lock);
+    pt = r->job[k];
+    pthread_mutex_unlock(&r->lock);
+    if (!pt) break;
+    finish_point(st,r->raw[k],pt);
+    pthread_mutex_lock(&r->lock);
+    r->job[k] = NULL;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+    k ^= 1;
+  }
+  return NULL;
+}
+
+static int reducer_start(search_state_t *st,reducer_t *r) {
+  cpu_set_t cpus;
+  size_t raw_size = (size_t) NUM_BIAS_FIFOS*st->p->numAvgs*sizeof(uint32_t);
+  r->raw[0] = (uint32_t *) malloc(2*raw_size);
+  if (!r->raw[0]) return -1;
+  r->raw[1] = r->raw[0] + NUM_BIAS_FIFOS*st->p->numAvgs;
+  r->job[0] = r->job[1] = NULL;
+  r->next = 0;
+  r->stop = 0;
+  pthread_mutex_init(&r->lock,NULL);
+  pthread_cond_init(&r->cond,NULL);
+  st->reducer = r;
+  if (pthread_create(&r->thread,NULL,reducer_thread,st) != 0) {
+    free(r->raw[0]);
+    st->reducer = NULL;
+    return -1;
+  }
+  CPU_ZERO(&cpus);
+  CPU_SET(st->p->reduceCPU,&cpus);
+  pthread_setaffinity_np(r->thread,sizeof(cpus),&cpus);
+  return 0;
+}
+
+/*
+ * Waits until every point handed to the reducer has been averaged
+ */
+static void reducer_flush(reducer_t *r) {
+  pthread_mutex_lock(&r->lock);
+  while (r->job[0] || r->job[1]) pthread_cond_wait(&r->cond,&r->lock);
+  pthread_mutex_unlock(&r->lock);
+}
+
+static void reducer_stop(search_state_t *st) {
+  reducer_t *r = st->reducer;
+  if (!r) return;
+  reducer_flush(r);
+  pthread_mutex_lock(&r->lock);
+  r->stop = 1;
+  pthread_cond_broadcast(&r->cond);
+  pthread_mutex_unlock(&r->lock);
+  pthread_join(r->thread,NULL);
+  pthread_mutex_destroy(&r->lock);
+  pthread_cond_destroy(&r->cond);
+  free(r->raw[0]);
+  st->reducer = NULL;
+}
+
+/*
+ * Sets and acquires one point into pt.  With a reducer the averaging is queued and
+ * happens while the next point is acquired; call reducer_flush() before using the results
+ */
+static void measure(search_state_t *st,bias_point_t *pt,uint16_t Vx,uint16_t Vy,uint16_t Vz,uint16_t level) {
+  reducer_t *r = st->reducer;
+  uint32_t *raw = st->raw_data;
+  pt->V[0] = Vx;
+  pt->V[1] = Vy;
+  pt->V[2] = Vz;
+  pt->level = level;
+  if (r) {
+    pthread_mutex_lock(&r->lock);
+    while (r->job[r->next]) pthread_cond_wait(&r->cond,&r->lock);
+    pthread_mutex_unlock(&r->lock);
+    raw = r->raw[r->next];
+  }
+  pt->timed_out = acquire_bias_point(st->cfg,Vx,Vy,Vz,st->p->numAvgs,&st->p->settle,raw,&pt->settle_us);
+  if (r) {
+    pthread_mutex_lock(&r->lock);
+    r->job[r->next] = pt;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+    r->next ^= 1;
+  } else {
+    finish_point(st,raw,pt);
+  }
+}
+
+/*
+ * Fills v with the distinct grid values start + k*step, k = 0..n-1, clamped to the PWM
+ * range, and returns how many there are
+ */
+static uint32_t axis_values(int start,int step,uint32_t n,uint16_t *v) {
+  uint32_t m = 0;
+  int x;
+  for (uint32_t k = 0;k < n;k++) {
+    x = start + (int) k*step;
+    if (x < 0) x = 0;
+    if (x > BIAS_MAX_PWM) x = BIAS_MAX_PWM;
+    if (m == 0 || v[m - 1] != x) v[m++] = (uint16_t) x;
+  }
+  return m;
+}
+
+/*
+ * Index into a grid, which is stored with x varying fastest as in scan_biases()
+ */
+static inline uint32_t grid_index(uint32_t nx,uint32_t ny,int xx,int yy,int zz) {
+  return xx + yy*nx + zz*nx*ny;
+}
+
+/*
+ * Measures the points of the grid vx x vy x vz within the inclusive index ranges
+ * box = {x0,x1,y0,y1,z0,z1} (the whole grid if NULL) in the configured order.  Points
+ * are stored from points + base, indexed by grid_index(), or recorded to the file if
+ * there is one.  Points marked in the done bitmap are skipped
+ */
+static void measure_grid(search_state_t *st,uint32_t base,const uint16_t *vx,uint32_t nx,
+                         const uint16_t *vy,uint32_t ny,const uint16_t *vz,uint32_t nz,
+                         const uint32_t *box,uint16_t level) {
+  const int serpentine = st->p->order == BIAS_ORDER_SERPENTINE;
+  uint32_t lo[3] = {0,0,0}, len[3] = {nx,ny,nz};
+  uint32_t xx, yy, zz, i, j, k, row, idx;
+  bias_point_t *pt;
+  if (box) {
+    for (i = 0;i < 3;i++) {
+      lo[i] = box[2*i] < len[i] ? box[2*i] : len[i];
+      len[i] = (box[2*i + 1] < len[i] ? box[2*i + 1] + 1 : len[i]) - lo[i];
+    }
+  }
+  for (i = 0;i < len[0] && !st->error;i++) {
+    xx = lo[0] + i;
+    for (j = 0;j < len[1];j++) {
+      yy = lo[1] + ((serpentine && (i & 1)) ? len[1] - 1 - j : j);
+      row = i*len[1] + j;
+      for (k = 0;k < len[2];k++) {
+        zz = lo[2] + ((serpentine && (row & 1)) ? len[2] - 1 - k : k);
+        idx = grid_index(nx,ny,xx,yy,zz);
+        if (st->done && (st->done[idx >> 3] & (1 << (idx & 7)))) continue;
+        pt = st->fd >= 0 ? st->ring + (st->ring_next++ & 3) : st->points + base + idx;
+        pt->index = idx;
+        measure(st,pt,vx[xx],vy[yy],vz[zz],level);
+      }
+    }
+  }
+  if (st->reducer) reducer_flush(st->reducer);
+}
+
+static int is_local_minimum(const search_state_t *st,int xx,int yy,int zz) {
+  const int n = (int) st->p->numVoltages;
+  const int d[6][3] = {{-1,0,0},{1,0,0},{0,-1,0},{0,1,0},{0,0,-1},{0,0,1}};
+  double c = st->points[grid_index(n,n,xx,yy,zz)].cost;
+  int x, y, z;
+  for (int k = 0;k < 6;k++) {
+    x = xx + d[k][0];
+    y = yy + d[k][1];
+    z = zz + d[k][2];
+    if (x < 0 || y < 0 || z < 0 || x >= n || y >= n || z >= n) continue;
+    if (st->points[grid_index(n,n,x,y,z)].cost < c) return 0;
+  }
+  return 1;
+}
+
+static void refine(search_state_t *st,bias_point_t best,int step) {
+  const bias_search_params_t *p = st->p;
+  uint16_t vx[p->refinePoints], vy[p->refinePoints], vz[p->refinePoints];
+  uint32_t nx, ny, nz, base, i;
+  int new_step, start[3];
+
+  for (uint32_t level = 1;level <= p->numLevels && step > 1;level++) {
+    new_step = 2*step/(int) (p->refinePoints - 1);
+    if (new_step < 1) new_step = 1;
+    for (i = 0;i < 3;i++) {
+      start[i] = (int) best.V[i] - new_step*(int) ((p->refinePoints - 1)/2);
+    }
+    nx = axis_values(start[0],new_step,p->refinePoints,vx);
+    ny = axis_values(start[1],new_step,p->refinePoints,vy);
+    nz = axis_values(start[2],new_step,p->refinePoints,vz);
+    base = st->num_points;
+    measure_grid(st,base,vx,nx,vy,ny,vz,nz,NULL,level);
+    st->num_points += nx*ny*nz;
+    for (i = base;i < st->num_points;i++) {
+      if (st->points[i].cost < best.cost) best = st->points[i];
+    }
+    step = new_step;
+  }
+}
+
+static int search_init(search_state_t *st,reducer_t *r,void *cfg,const bias_search_params_t *p,uint32_t *raw_data,uint32_t max_points) {
+  st->cfg = cfg;
+  st->p = p;
+  st->raw_data = raw_data;
+  st->num_points = 0;
+  st->reducer = NULL;
+  st->done = NULL;
+  st->fd = -1;
+  st->ring_next = 0;
+  st->num_recorded = 0;
+  st->error = 0;
+  st->points = NULL;
+  if (max_points > 0) {
+    st->points = (bias_point_t *) calloc((size_t) max_points,sizeof(bias_point_t));
+    if (!st->points) return -1;
+  }
+  if (p->reduceCPU >= 0 && reducer_start(st,r) != 0) {
+    free(st->points);
+    return -1;
+  }
+  return 0;
+}
+
+static void search_free(search_state_t *st) {
+  reducer_stop(st);
+  free(st->points);
+}
+
+/*
+ * Coarse grid over [0,Vmax), stored from the first point
+ */
+static void measure_coarse_grid(search_state_t *st,const uint32_t *box) {
+  const uint32_t n = st->p->numVoltages;
+  uint16_t v[n];
+  for (uint32_t i = 0;i < n;i++) {
+    v[i] = i*(st->p->Vmax/n);
+  }
+  measure_grid(st,0,v,n,v,n,v,n,box,0);
+  st->num_points = n*n*n;
+}
+
+int scan_biases(void *cfg,const bias_search_params_t *p,uint32_t *raw_data,int *data) {
+  search_state_t st;
+  reducer_t r;
+  const uint32_t N = p->numVoltages*p->numVoltages*p->numVoltages;
+  uint32_t i;
+  int *col;
+
+  if (search_init(&st,&r,cfg,p,raw_data,N) != 0) return -1;
+  measure_coarse_grid(&st,p->box);
+  for (i = 0;i < N;i++) {
+    col = write_stats(p,st.points + i,data + i,N);
+    if (p->settle.window > 0) {
+      *col = (int) st.points[i].settle_us;
+      *(col + N) = st.points[i].timed_out;
+    }
+  }
+  search_free(&st);
+  return 0;
+}
+
+int bias_search(void *cfg,const bias_search_params_t *p,uint32_t *raw_data,int *table,uint32_t *numPoints) {
+  search_state_t st;
+  reducer_t r;
+  const uint32_t n = p->numVoltages;
+  const int step = p->Vmax/n;
+  uint32_t num_coarse = n*n*n;
+  uint32_t *minima, num_minima = 0, i, j, tmp;
+  int *col;
+
+  minima = (uint32_t *) malloc((size_t) num_coarse*sizeof(uint32_t));
+  if (!minima) return -1;
+  if (search_init(&st,&r,cfg,p,raw_data,bias_search_max_points(p)) != 0) {
+    free(minima);
+    return -1;
+  }
+
+  measure_coarse_grid(&st,NULL);
+
+  /*
+   * Local minima of the coarse grid, sorted by cost
+   */
+  if (p->numLevels > 0) {
+    for (uint32_t zz = 0;zz < n;zz++) {
+      for (uint32_t yy = 0;yy < n;yy++) {
+        for (uint32_t xx = 0;xx < n;xx++) {
+          if (is_local_minimum(&st,xx,yy,zz)) minima[num_minima++] = grid_index(n,n,xx,yy,zz);
+        }
+      }
+    }
+    for (i = 1;i < num_minima;i++) {
+      tmp = minima[i];
+      for (j = i;j > 0 && st.points[minima[j - 1]].cost > st.points[tmp].cost;j--) {
+        minima[j] = minima[j - 1];
+      }
+      minima[j] = tmp;
+    }
+    if (num_minima > p->numMinima) num_minima = p->numMinima;
+    for (i = 0;i < num_minima;i++) {
+      refine(&st,st.points[minima[i]],step);
+    }
+  }
+
+  /*
+   * Write the visited points as a column-major table
+   */
+  for (i = 0;i < st.num_points;i++) {
+    for (j = 0;j < 3;j++) {
+      table[i + j*st.num_points] = st.points[i].V[j];
+    }
+    col = write_stats(p,st.points + i,table + i + 3*st.num_points,st.num_points);
+    *col = st.points[i].level;
+    *(col + st.num_points) = (int) st.points[i].settle_us;
+    *(col + 2*st.num_points) = st.points[i].timed_out;
+  }
+  *numPoints = st.num_points;
+
+  search_free(&st);
+  free(minima);
+  return 0;
+}
+
+uint32_t bias_record_words(const bias_search_params_t *p) {
+  return 4 + scan_biases_columns(p);
+}
+
+static void record_header_init(bias_record_header_t *hdr,const bias_search_params_t *p) {
+  memset(hdr,0,sizeof(*hdr));
+  hdr->magic = BIAS_RECORD_MAGIC;
+  hdr->version = BIAS_RECORD_VERSION;
+  hdr->header_size = sizeof(*hdr);
+  hdr->record_words = bias_record_words(p);
+  hdr->numVoltages = p->numVoltages;
+  hdr->numAvgs = p->numAvgs;
+  hdr->Vmax = p->Vmax;
+  hdr->stats = p->stats;
+  hdr->settle_window = p->settle.window;
+  hdr->settle_tolerance = p->settle.tolerance;
+  hdr->settle_max_dwell = p->settle.maxDwell;
+  hdr->order = p->order;
+  memcpy(hdr->box,p->box,sizeof(hdr->box));
+}
+
+/*
+ * Reads the records in an existing file into the done bitmap and drops any partial
+ * record at the end.  Returns the number of complete records, or -1 if the file does
+ * not match the settings
+ */
+static long load_records(int fd,const bias_record_header_t *expected,uint8_t *done,uint32_t N) {
+  bias_record_header_t hdr;
+  struct stat sb;
+  int32_t rec[RECORD_BUFFER_WORDS];
+  uint64_t num_records, i, n, k;
+  uint32_t idx;
+
+  if (pread(fd,&hdr,sizeof(hdr),0) != sizeof(hdr) || hdr.magic != BIAS_RECORD_MAGIC) {
+    fprintf(stderr,"Not a bias record file\n");
+    return -1;
+  }
+  if (hdr.version != expected->version || hdr.record_words != expected->record_words ||
+      hdr.numVoltages != expected->numVoltages || hdr.numAvgs != expected->numAvgs ||
+      hdr.Vmax != expected->Vmax || hdr.stats != expected->stats ||
+      hdr.settle_window != expected->settle_window) {
+    fprintf(stderr,"Record file was made with different settings\n");
+    return -1;
+  }
+  if (fstat(fd,&sb) != 0) return -1;
+  num_records = (sb.st_size - hdr.header_size)/(hdr.record_words*4);
+  if (ftruncate(fd,hdr.header_size + num_records*hdr.record_words*4) != 0) return -1;
+  if (lseek(fd,hdr.header_size,SEEK_SET) < 0) return -1;
+  /*
+   * Read whole records in batches, and mark their indices
+   */
+  const uint64_t per_batch = RECORD_BUFFER_WORDS/hdr.record_words;
+  for (i = 0;i < num_records;i += n) {
+    n = num_records - i < per_batch ? num_records - i : per_batch;
+    if (read(fd,rec,n*hdr.record_words*4) != (ssize_t) (n*hdr.record_words*4)) return -1;
+    for (k = 0;k < n;k++) {
+      idx = (uint32_t) rec[k*hdr.record_words];
+      if (idx < N) done[idx >> 3] |= 1 << (idx & 7);
+    }
+  }
+  return (long) num_records;
+}
+
+int scan_biases_to_file(void *cfg,const bias_search_params_t *p,uint32_t *raw_data,const char *filename,int resume,uint32_t *numPoints) {
+  search_state_t st;
+  reducer_t r;
+  bias_record_header_t hdr;
+  const uint32_t N = p->numVoltages*p->numVoltages*p->numVoltages;
+  uint8_t *done;
+  long previous = 0;
+  int fd;
+
+  fd = open(filename,resume ? O_RDWR | O_CREAT : O_RDWR | O_CREAT | O_TRUNC,0644);
+  if (fd < 0) {
+    perror("open");
+    return -1;
+  }
+  done = (uint8_t *) calloc((N + 7)/8,1);
+  if (!done) {
+    close(fd);
+    return -1;
+  }
+  record_header_init(&hdr,p);
+  if (resume && lseek(fd,0,SEEK_END) > 0) {
+    previous = load_records(fd,&hdr,done,N);
+    if (previous < 0) {
+      free(done);
+      close(fd);
+      return -1;
+    }
+  } else if (write_all(fd,&hdr,sizeof(hdr)) != 0) {
+    free(done);
+    close(fd);
+    return -1;
+  }
+  lseek(fd,0,SEEK_END);
+
+  if (search_init(&st,&r,cfg,p,raw_data,0) != 0) {
+    free(done);
+    close(fd);
+    return -1;
+  }
+  st.fd = fd;
+  st.done = done;
+  measure_coarse_grid(&st,p->box);
+  search_free(&st);
+
+  *numPoints = (uint32_t) previous + st.num_recorded;
+  free(done);
+  close(fd);
+  return st.error ? -1 : 0;
+}
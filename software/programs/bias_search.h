@@ -0,0 +1,145 @@
+#ifndef BIAS_SEARCH_H_
+#define BIAS_SEARCH_H_
+
+#include <stdint.h>
+
+#include "iq_bias_control.h"
+
+#define BIAS_MAX_PWM                1023
+#define BIAS_SEARCH_DEFAULT_POINTS  5
+#define BIAS_SEARCH_DEFAULT_MASK    0x7
+#define BIAS_REDUCE_CPU             1
+
+/*
+ * Order in which the points of a grid are visited.  In raster order z varies fastest
+ * and snaps back to its first value at the end of every row.  In serpentine order the
+ * direction of z and y alternates between rows and planes, so that every step changes a
+ * single voltage by one grid step
+ */
+#define BIAS_ORDER_RASTER           0
+#define BIAS_ORDER_SERPENTINE       1
+
+/*
+ * Settings for grid scans and the coarse-to-fine search of the bias voltages.
+ *
+ * The search measures a coarse numVoltages^3 grid over [0,Vmax) exactly as
+ * scan_biases() does, and finds its numMinima lowest local minima, where the cost of a
+ * point is the sum of squares of the averaged signals selected by costMask.  Each
+ * minimum is then refined numLevels times: a refinePoints^3 grid spanning one previous
+ * grid step either side of the current best point is measured, and the grid step
+ * shrinks by a factor (refinePoints - 1)/2 each level until it reaches one PWM step.
+ *
+ * If reduceCPU is not negative, the averaging of each point is done by a thread pinned
+ * to that CPU while the next point is set and acquired
+ */
+typedef struct {
+  uint32_t numVoltages;           //Points per axis in the coarse grid
+  uint32_t numAvgs;               //Samples averaged per point
+  uint16_t Vmax;                  //Upper limit of the coarse grid
+  uint32_t numLevels;             //Number of refinement levels, 0 for a plain grid
+  uint32_t refinePoints;          //Points per axis in each refinement grid, at least 4
+  uint32_t numMinima;             //Number of coarse minima to refine
+  uint32_t costMask;              //Signals that make up the cost
+  bias_settle_t settle;           //Settling detection for each point
+  uint32_t order;                 //BIAS_ORDER_*
+  int reduceCPU;                  //CPU for pipelined averaging, -1 to average in line
+  uint32_t stats;                 //BIAS_STAT_* flags of the statistics to output
+  uint32_t box[6];                //Inclusive index ranges x0,x1,y0,y1,z0,z1 of a grid scan
+} bias_search_params_t;
+
+typedef struct {
+  uint32_t index;                 //Linear index in its grid
+  uint16_t V[3];
+  uint16_t level;
+  int s[NUM_BIAS_STATS][NUM_BIAS_FIFOS];   //Statistics in BIAS_STAT_* order, mean first
+  uint32_t settle_us;
+  int timed_out;
+  double cost;
+} bias_point_t;
+
+void bias_search_defaults(bias_search_params_t *p);
+/*
+ * Parses a comma-separated list of statistics (mean, var, min, max) into BIAS_STAT_*
+ * flags.  Returns -1 if a name is not recognised
+ */
+int parse_bias_stats(const char *list,uint32_t *stats);
+/*
+ * Parses a sub-box of the grid given as x0:x1,y0:y1,z0:z1, where the ranges are
+ * inclusive grid indices.  Returns -1 if it is not valid
+ */
+int parse_bias_box(const char *spec,uint32_t *box);
+/*
+ * Number of output columns of scan_biases(): NUM_BIAS_FIFOS for each selected
+ * statistic, plus NUM_SETTLE_COLUMNS if settling detection is enabled
+ */
+uint32_t scan_biases_columns(const bias_search_params_t *p);
+/*
+ * Scans all three bias voltages over a numVoltages^3 grid.  raw_data needs
+ * NUM_BIAS_FIFOS*numAvgs words and data needs scan_biases_columns()*numVoltages^3.  Each
+ * column is a block of numVoltages^3 values indexed by xx + yy*N + zz*N^2 whatever the
+ * order of the scan: NUM_BIAS_FIFOS columns for each selected statistic in the order
+ * mean, variance (float32 bit patterns), minimum, maximum, then the settle time [us]
+ * and timeout flag if settling detection is enabled.  Returns 0 on success and -1 if
+ * memory could not be allocated
+ */
+int scan_biases(void *cfg,const bias_search_params_t *p,uint32_t *raw_data,int *data);
+/*
+ * Number of columns in the table of visited points: Vx, Vy, Vz, NUM_BIAS_FIFOS columns
+ * for each selected statistic, the refinement level (0 for the coarse grid), the settle
+ * time [us] and whether settling timed out
+ */
+uint32_t bias_search_columns(const bias_search_params_t *p);
+/*
+ * Upper limit on the number of points that bias_search() visits
+ */
+uint32_t bias_search_max_points(const bias_search_params_t *p);
+/*
+ * Runs the search.  raw_data needs NUM_BIAS_FIFOS*numAvgs words and table needs
+ * bias_search_columns()*bias_search_max_points() words.  On return table holds numPoints
+ * rows in column-major order: the coarse grid followed by each refinement grid, each
+ * indexed with x varying fastest.  Returns 0 on success and -1 if memory could not be
+ * allocated
+ */
+int bias_search(void *cfg,const bias_search_params_t *p,uint32_t *raw_data,int *table,uint32_t *numPoints);
+
+/*
+ * Record files for long grid scans.  Each point of the grid is appended to the file as
+ * a fixed-size record as soon as it has been measured, so memory use does not depend on
+ * the size of the grid and an interrupted scan loses at most the point in progress:
+ *
+ *    bias_record_header_t
+ *    records         record_words int32 values each: the linear index
+ *                    xx + yy*N + zz*N^2, Vx, Vy, Vz, then the scan_biases() columns
+ *
+ * Records are in the order the points were measured.  A scan can be resumed, in which
+ * case any partial record at the end of the file is dropped and the points that are
+ * already in the file are skipped
+ */
+#define BIAS_RECORD_MAGIC           0x53425149    //"IQBS"
+#define BIAS_RECORD_VERSION         1
+
+typedef struct {
+  uint32_t magic;                 //BIAS_RECORD_MAGIC
+  uint32_t version;               //BIAS_RECORD_VERSION
+  uint32_t header_size;           //Bytes before the first record
+  uint32_t record_words;          //32-bit words per record
+  uint32_t numVoltages;
+  uint32_t numAvgs;
+  uint32_t Vmax;
+  uint32_t stats;
+  uint32_t settle_window;
+  int32_t settle_tolerance;
+  uint32_t settle_max_dwell;
+  uint32_t order;
+  uint32_t box[6];                //Sub-box of the scan that created the file
+} bias_record_header_t;
+
+uint32_t bias_record_words(const bias_search_params_t *p);
+/*
+ * Grid scan that appends each point to the record file FILENAME.  If RESUME is set and
+ * the file exists, it must have been made with the same settings, and only the points
+ * in the box that it does not already hold are measured.  numPoints is set to the
+ * number of records in the file.  Returns 0 on success and -1 on error
+ */
+int scan_biases_to_file(void *cfg,const bias_search_params_t *p,uint32_t *raw_data,const char *filename,int resume,uint32_t *numPoints);
+#endif
@@ -0,0 +1,288 @@
+//These are libraries which contain useful functions
+#include <ctype.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "iq_bias_control.h"
+#include "capture_output.h"
+#include "fifo_stream.h"
+#include "bias_search.h"
+#include "psd.h"
+#include "mock_backend.h"
+
+/*
+ * Benchmarks of the acquisition routines against the mock backend.  Each case resets
+ * the mock statistics, runs one routine and reports the FIFO words it read per second,
+ * the words dropped by full FIFOs and the per-read latency.  Cases marked as throughput
+ * cases run with unlimited FIFO rates and are checked against the threshold given
+ * with -t, so that CI can catch regressions in the capture loops
+ */
+typedef struct {
+  const char *name;
+  int throughput;                 //Checked against the threshold
+  double rate;                    //FIFO rate for the case, 0 for unlimited
+  uint32_t read_ns;               //Emulated bus time of each read
+} bench_case_t;
+
+static double elapsed(const struct timespec *t0) {
+  struct timespec t1;
+  clock_gettime(CLOCK_MONOTONIC,&t1);
+  return (double)(t1.tv_sec - t0->tv_sec) + 1e-9*(double)(t1.tv_nsec - t0->tv_nsec);
+}
+
+/*
+ * Prints the result of a case and returns its throughput in words/s
+ */
+static double report(const bench_case_t *c,double t,int histograms) {
+  mock_fifo_stats_t st, all;
+  uint32_t k, b;
+  memset(&all,0,sizeof(all));
+  for (k = 0;k < MOCK_NUM_FIFOS;k++) {
+    mock_get_stats(k,&st);
+    all.words_read += st.words_read;
+    all.words_dropped += st.words_dropped;
+    all.timeouts += st.timeouts;
+    if (st.max_level > all.max_level) all.max_level = st.max_level;
+    for (b = 0;b < MOCK_HIST_BINS;b++) all.hist[b] += st.hist[b];
+  }
+  printf("%-26s %10llu %9.1f %9.3f %10llu %9.0f %9.0f\n",c->name,(unsigned long long) all.words_read,1e3*t,
+         1e-6*(double) all.words_read/t,(unsigned long long) all.words_dropped,
+         mock_latency_percentile(&all,50),mock_latency_percentile(&all,99));
+  if (histograms) {
+    for (b = 0;b < MOCK_HIST_BINS;b++) {
+      if (all.hist[b] == 0) continue;
+      printf("    %10llu-%-10llu ns %10llu\n",1ULL << b,(1ULL << (b + 1)) - 1,(unsigned long long) all.hist[b]);
+    }
+  }
+  return (double) all.words_read/t;
+}
+
+int main(int argc, char **argv)
+{
+  int fd;
+  void *cfg, *ram;
+  uint32_t numSamples = 1000000;
+  uint32_t readNs = 200;
+  double threshold = 0;
+  int histograms = 0, failed = 0;
+  uint32_t *data, *raw_data;
+  int *scan;
+  uint32_t i, k;
+  double t, throughput;
+  struct timespec t0;
+  bench_case_t c;
+  bias_search_params_t search;
+  bias_sweep_t sweep;
+  uint32_t numDrop;
+  psd_t psd;
+
+  /*
+   * Parse the input arguments
+   */
+  int opt;
+  while ((opt = getopt(argc,argv,"n:r:t:v")) != -1) {
+    switch (opt) {
+      case 'n':
+        numSamples = atoi(optarg);
+        break;
+      case 'r':
+        readNs = atoi(optarg);
+        break;
+      case 't':
+        threshold = atof(optarg);
+        break;
+      case 'v':
+        histograms = 1;
+        break;
+
+      case '?':
+        if (isprint (optopt))
+            fprintf (stderr, "Unknown option `-%c'.\n", optopt);
+        else
+            fprintf (stderr,
+                    "Unknown option character `\\x%x'.\n",
+                    optopt);
+        return 1;
+
+      default:
+        abort();
+        break;
+    }
+  }
+
+  data = (uint32_t *) malloc((size_t) NUM_PHASE_FIFOS*numSamples*sizeof(uint32_t));
+  raw_data = (uint32_t *) malloc((size_t) NUM_BIAS_FIFOS*numSamples*sizeof(uint32_t));
+  if (!data || !raw_data) {
+    printf("Error allocating memory");
+    return -1;
+  }
+  cfg = map_device(MEM_LOC,&fd);
+  ram = map_device(RAM_DATA_LOC,&fd);
+  if (!cfg || !ram) {
+    return 1;
+  }
+
+  printf("%-26s %10s %9s %9s %10s %9s %9s\n","case","words","ms","Mwords/s","dropped","p50[ns]","p99[ns]");
+
+  /*
+   * Raw FIFO reads at unlimited rates for every layout the programs use
+   */
+  for (i = 1;i <= NUM_BIAS_FIFOS + 1;i++) {
+    char name[32];
+    uint32_t loc = i <= NUM_BIAS_FIFOS ? FIFO_BIAS_DATA_START_LOC : FIFO_PHASE_DATA_START_LOC;
+    uint32_t saveFactor = i <= NUM_BIAS_FIFOS ? i : NUM_PHASE_FIFOS;
+    snprintf(name,sizeof(name),"read_fifo_data %s x%u",i <= NUM_BIAS_FIFOS ? "bias" : "phase",saveFactor);
+    c = (bench_case_t) {name,1,0,0};
+    mock_set_rate(c.rate);
+    mock_set_read_ns(c.read_ns);
+    mock_reset_stats();
+    start_fifo(cfg);
+    clock_gettime(CLOCK_MONOTONIC,&t0);
+    read_fifo_data(cfg,loc,saveFactor,numSamples,data);
+    t = elapsed(&t0);
+    stop_fifo(cfg);
+    throughput = report(&c,t,histograms);
+    if (threshold > 0 && throughput < threshold*1e6) {
+      printf("  below threshold of %.3f Mwords/s\n",threshold);
+      failed = 1;
+    }
+  }
+
+  /*
+   * Two of the five phase streams, as used for monitoring
+   */
+  c = (bench_case_t) {"read_fifo_mask phase 0x3",1,0,0};
+  mock_reset_stats();
+  start_fifo(cfg);
+  clock_gettime(CLOCK_MONOTONIC,&t0);
+  read_fifo_mask(cfg,FIFO_PHASE_DATA_START_LOC,0x3,numSamples,data);
+  t = elapsed(&t0);
+  stop_fifo(cfg);
+  throughput = report(&c,t,histograms);
+  if (threshold > 0 && throughput < threshold*1e6) {
+    printf("  below threshold of %.3f Mwords/s\n",threshold);
+    failed = 1;
+  }
+
+  /*
+   * Overrun behaviour: with readNs per read the reader keeps up with the slower rates and
+   * drops samples once the FIFOs fill at the faster ones
+   */
+  numDrop = numSamples/10 > 0 ? numSamples/10 : 1;
+  for (i = 0;i < 4;i++) {
+    char name[32];
+    double rate = 1e4*(double)(1 << (3*i));
+    snprintf(name,sizeof(name),"overrun %.0f S/s",rate);
+    c = (bench_case_t) {name,0,rate,readNs};
+    mock_set_rate(c.rate);
+    mock_set_read_ns(c.read_ns);
+    mock_reset_stats();
+    start_fifo(cfg);
+    clock_gettime(CLOCK_MONOTONIC,&t0);
+    read_fifo_data(cfg,FIFO_BIAS_DATA_START_LOC,NUM_BIAS_FIFOS,rate < 1e5 ? numDrop/10 : numDrop,data);
+    t = elapsed(&t0);
+    stop_fifo(cfg);
+    report(&c,t,histograms);
+  }
+  mock_set_read_ns(0);
+
+  /*
+   * Streaming through the reader/writer ring to /dev/null
+   */
+  c = (bench_case_t) {"stream_to_output bias x4",1,0,0};
+  mock_set_rate(c.rate);
+  mock_reset_stats();
+  clock_gettime(CLOCK_MONOTONIC,&t0);
+  stream_to_output(cfg,FIFO_BIAS_DATA_START_LOC,IQ_BIAS_MASK,(uint64_t) numSamples,"/dev/null",NULL,NULL,NULL,NULL,
+                   STREAM_DEFAULT_BLOCK_WORDS,STREAM_DEFAULT_NUM_BLOCKS,-1,0);
+  report(&c,elapsed(&t0),histograms);
+
+  /*
+   * The recording routines of the analyzers.  The jump routines include their 1 s of
+   * settling, so they are run on fewer samples
+   */
+  c = (bench_case_t) {"record_bias_jump",0,0,0};
+  mock_reset_stats();
+  clock_gettime(CLOCK_MONOTONIC,&t0);
+  record_bias_jump(cfg,IQ_BIAS_MASK,numSamples,300,400,500,10,1,data,NULL);
+  report(&c,elapsed(&t0),histograms);
+
+  c = (bench_case_t) {"record_phase_jump",0,0,0};
+  mock_reset_stats();
+  clock_gettime(CLOCK_MONOTONIC,&t0);
+  record_phase_jump(cfg,IQ_PHASE_MASK,numSamples,300,10,1,data,NULL);
+  report(&c,elapsed(&t0),histograms);
+
+  c = (bench_case_t) {"record_phase_lock",0,0,0};
+  mock_reset_stats();
+  clock_gettime(CLOCK_MONOTONIC,&t0);
+  record_phase_lock(cfg,IQ_PHASE_MASK,numSamples,0,data,NULL);
+  report(&c,elapsed(&t0),histograms);
+
+  memset(&sweep,0,sizeof(sweep));
+  sweep.channel_mask = 0x7;
+  sweep.shape = SWEEP_TRIANGLE;
+  sweep.end[0] = sweep.end[1] = sweep.end[2] = 1023;
+  sweep.update_samples = 100;
+  c = (bench_case_t) {"record_bias_sweep",0,0,0};
+  mock_reset_stats();
+  clock_gettime(CLOCK_MONOTONIC,&t0);
+  record_bias_sweep(cfg,numSamples/2,&sweep,data);
+  report(&c,elapsed(&t0),histograms);
+
+  /*
+   * A small grid scan with settling detection, at the default hardware rate so that the
+   * time per point is realistic
+   */
+  bias_search_defaults(&search);
+  search.numVoltages = 4;
+  search.numAvgs = 100;
+  search.Vmax = 1000;
+  search.settle.window = DEFAULT_SETTLE_WINDOW;
+  search.settle.tolerance = 16;
+  search.order = BIAS_ORDER_SERPENTINE;
+  scan = (int *) malloc((size_t) scan_biases_columns(&search)*64*sizeof(int));
+  c = (bench_case_t) {"scan_biases 4^3",0,MOCK_RATE_FROM_REGS,0};
+  mock_set_rate(c.rate);
+  mock_reset_stats();
+  clock_gettime(CLOCK_MONOTONIC,&t0);
+  if (scan) scan_biases(cfg,&search,raw_data,scan);
+  report(&c,elapsed(&t0),histograms);
+  free(scan);
+
+  /*
+   * Fetching the RAM block does not go through the FIFOs, so only its time is reported
+   */
+  i = numSamples < MAP_SIZE/4 ? numSamples : MAP_SIZE/4;
+  clock_gettime(CLOCK_MONOTONIC,&t0);
+  for (k = 0;k < i;k++) {
+    data[k] = reg_read(ram,k << 2);
+  }
+  t = elapsed(&t0);
+  printf("%-26s %10u %9.1f %9.3f\n","fetch RAM",i,1e3*t,1e-6*(double) i/t);
+
+  /*
+   * Welch PSD of the four bias streams, which only costs CPU time
+   */
+  if (psd_init(&psd,PSD_DEFAULT_NFFT,PSD_DEFAULT_NFFT/2,PSD_WINDOW_HANN,NUM_BIAS_FIFOS,1) == 0) {
+    for (k = 0;k < (uint32_t) NUM_BIAS_FIFOS*numSamples;k++) {
+      raw_data[k] = k*2654435761u >> 20;
+    }
+    clock_gettime(CLOCK_MONOTONIC,&t0);
+    psd_push(&psd,raw_data,numSamples);
+    t = elapsed(&t0);
+    printf("%-26s %10u %9.1f %9.3f\n","psd bias x4 nfft 4096",NUM_BIAS_FIFOS*numSamples,1e3*t,
+           1e-6*(double) NUM_BIAS_FIFOS*numSamples/t);
+    psd_free(&psd);
+  }
+
+  free(data);
+  free(raw_data);
+  unmap_device(ram,fd);
+  unmap_device(cfg,fd);
+  return failed;
+}
@@ -0,0 +1,240 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "iq_bias_control.h"
+#include "capture_output.h"
+#include "capture_file.h"
+
+static const char *phase_stream_names[NUM_PHASE_FIFOS] = {"phase","phase_unwrap","actuator","I","Q"};
+static const uint8_t zeros[CAPTURE_ALIGNMENT] = {0};
+
+void capture_header_init(capture_header_t *hdr,void *cfg,uint32_t source,uint32_t channel_mask) {
+  struct timespec now;
+  uint32_t route, reg, i, n = 0;
+
+  memset(hdr,0,sizeof(*hdr));
+  hdr->magic = CAPTURE_FILE_MAGIC;
+  hdr->version = CAPTURE_FILE_VERSION;
+  hdr->header_size = CAPTURE_ALIGNMENT;
+  hdr->sample_format = CAPTURE_FORMAT_INT32;
+  hdr->source = source;
+  hdr->channel_mask = channel_mask;
+  hdr->decimation = 1;
+  hdr->chunk_samples = CAPTURE_DEFAULT_CHUNK;
+  clock_gettime(CLOCK_REALTIME,&now);
+  hdr->start_time_ns = (uint64_t) now.tv_sec*1000000000ULL + (uint64_t) now.tv_nsec;
+
+  /*
+   * The bias and phase FIFOs have separate CIC filters with the rate in bits 0-3 and
+   * the shift in bits 4-11 of their control registers
+   */
+  reg = source == CAPTURE_SOURCE_PHASE ? IQ_READ(cfg,phase_control) : IQ_READ(cfg,filter);
+  hdr->filter_reg = reg;
+  hdr->log2_rate = reg & 0xF;
+  hdr->cic_shift = (int8_t)((reg >> 4) & 0xFF);
+  hdr->sample_period = (double)(1 << hdr->log2_rate)/CLK_FREQ;
+
+  route = (IQ_READ(cfg,top) >> 16) & 0xF;
+  for (i = 0;i < 32 && n < CAPTURE_MAX_STREAMS;i++) {
+    if (!(channel_mask & (1u << i))) continue;
+    if (source == CAPTURE_SOURCE_PHASE) {
+      if (i < NUM_PHASE_FIFOS) {
+        strncpy(hdr->stream_names[n],phase_stream_names[i],CAPTURE_NAME_LENGTH - 1);
+      }
+    } else {
+      //Bias FIFOs record either the demodulated input or the PWM output
+      snprintf(hdr->stream_names[n],CAPTURE_NAME_LENGTH,"%s%u",(route >> i) & 1 ? "out" : "in",i + 1);
+    }
+    n++;
+  }
+  hdr->num_streams = n;
+}
+
+/*
+ * One line per event, then the mean and range of the lag between the planned and the
+ * actual sample of the writes
+ */
+void capture_print_events(FILE *f,const capture_events_t *ev,double sample_period) {
+  static const char *names[] = {"-","bias_jump","phase_jump","lock"};
+  const capture_event_t *e;
+  double lag, min_lag = 0, max_lag = 0, sum_lag = 0;
+  uint32_t i;
+
+  fprintf(f,"# %u events%s\n",ev->num_events,ev->flags & CAPTURE_EVENTS_REALTIME ? ", real-time mode" : "");
+  fprintf(f,"# type repeat sample hw_sample time[s] latency[s] lag[samples]\n");
+  for (i = 0;i < ev->num_events;i++) {
+    e = &ev->event[i];
+    lag = e->hw_sample - (double) e->sample;
+    fprintf(f,"%s %u %llu %.3f %.9f %.9f %.3f\n",names[e->type < 4 ? e->type : 0],e->repeat,
+            (unsigned long long) e->sample,e->hw_sample,1e-9*(double) e->time_ns,1e-9*(double) e->latency_ns,lag);
+    if (i == 0 || lag < min_lag) min_lag = lag;
+    if (i == 0 || lag > max_lag) max_lag = lag;
+    sum_lag += lag;
+  }
+  if (ev->num_events > 0) {
+    fprintf(f,"# lag mean %.3f, min %.3f, max %.3f samples (sample period %.6e s)\n",
+            sum_lag/ev->num_events,min_lag,max_lag,sample_period);
+  }
+}
+
+int capture_write_events(const char *path,const capture_header_t *hdr) {
+  FILE *f = fopen(path,"w");
+  if (!f) {
+    perror(path);
+    return -1;
+  }
+  capture_print_events(f,&hdr->events,(double)(1 << hdr->log2_rate)/CLK_FREQ);
+  fclose(f);
+  return 0;
+}
+
+/*
+ * Writes LEN bytes at the end of the file and pads it to the next aligned offset
+ */
+static int append_aligned(capture_file_t *f,const void *buf,size_t len) {
+  size_t pad;
+  if (write_all(f->fd,buf,len) != 0) return -1;
+  f->offset += len;
+  pad = (CAPTURE_ALIGNMENT - (f->offset % CAPTURE_ALIGNMENT)) % CAPTURE_ALIGNMENT;
+  if (pad > 0) {
+    if (write_all(f->fd,zeros,pad) != 0) return -1;
+    f->offset += pad;
+  }
+  return 0;
+}
+
+static int flush_chunk(capture_file_t *f) {
+  uint32_t n = f->pending_samples, ns = f->hdr.num_streams;
+  uint32_t i, s;
+  capture_index_t *entry;
+
+  if (n == 0) return 0;
+  if (f->hdr.num_chunks == f->index_size) {
+    f->index_size = f->index_size ? 2*f->index_size : 64;
+    entry = (capture_index_t *) realloc(f->index,f->index_size*sizeof(capture_index_t));
+    if (!entry) return -1;
+    f->index = entry;
+  }
+  //Transpose into columns
+  for (s = 0;s < ns;s++) {
+    for (i = 0;i < n;i++) {
+      f->column[(size_t) s*n + i] = f->pending[(size_t) i*ns + s];
+    }
+  }
+  entry = f->index + f->hdr.num_chunks;
+  entry->first_sample = f->hdr.num_samples;
+  entry->offset = f->offset;
+  entry->num_samples = n;
+  if (append_aligned(f,f->column,(size_t) n*ns*sizeof(uint32_t)) != 0) return -1;
+  f->hdr.num_chunks++;
+  f->hdr.num_samples += n;
+  f->pending_samples = 0;
+  return 0;
+}
+
+int capture_file_open(capture_file_t *f,const char *dest,const capture_header_t *hdr) {
+  memset(f,0,sizeof(*f));
+  f->fd = -1;
+  f->hdr = *hdr;
+  f->hdr.num_samples = 0;
+  f->hdr.num_chunks = 0;
+  f->hdr.index_offset = 0;
+  if (f->hdr.num_streams == 0 || f->hdr.num_streams > CAPTURE_MAX_STREAMS || f->hdr.chunk_samples == 0) {
+    fprintf(stderr,"Invalid capture file header\n");
+    return -1;
+  }
+  f->pending = (uint32_t *) malloc((size_t) f->hdr.chunk_samples*f->hdr.num_streams*sizeof(uint32_t));
+  f->column = (uint32_t *) malloc((size_t) f->hdr.chunk_samples*f->hdr.num_streams*sizeof(uint32_t));
+  if (!f->pending || !f->column) {
+    printf("Error allocating memory");
+    capture_file_close(f);
+    return -1;
+  }
+  if ((f->fd = open_output(dest)) < 0) {
+    capture_file_close(f);
+    return -1;
+  }
+  f->seekable = lseek(f->fd,0,SEEK_CUR) == 0;
+  if (append_aligned(f,&f->hdr,sizeof(f->hdr)) != 0) {
+    perror("write");
+    close_output(f->fd);
+    f->fd = -1;
+    capture_file_close(f);
+    return -1;
+  }
+  return 0;
+}
+
+int capture_file_write(capture_file_t *f,const uint32_t *data,uint32_t num_samples) {
+  uint32_t n, ns = f->hdr.num_streams;
+  while (num_samples > 0) {
+    n = f->hdr.chunk_samples - f->pending_samples;
+    if (n > num_samples) n = num_samples;
+    memcpy(f->pending + (size_t) f->pending_samples*ns,data,(size_t) n*ns*sizeof(uint32_t));
+    f->pending_samples += n;
+    data += (size_t) n*ns;
+    num_samples -= n;
+    if (f->pending_samples == f->hdr.chunk_samples) {
+      if (flush_chunk(f) != 0) return -1;
+    }
+  }
+  return 0;
+}
+
+int capture_file_close(capture_file_t *f) {
+  capture_footer_t footer;
+  int err = 0;
+
+  if (f->fd >= 0) {
+    err |= flush_chunk(f);
+    f->hdr.index_offset = f->offset;
+    if (f->hdr.num_chunks > 0) {
+      err |= write_all(f->fd,f->index,(size_t) f->hdr.num_chunks*sizeof(capture_index_t));
+    }
+    footer.index_offset = f->hdr.index_offset;
+    footer.num_chunks = f->hdr.num_chunks;
+    footer.num_samples = f->hdr.num_samples;
+    footer.magic = CAPTURE_FOOTER_MAGIC;
+    footer.version = CAPTURE_FILE_VERSION;
+    err |= write_all(f->fd,&footer,sizeof(footer));
+    //Complete the header if we can go back to it
+    if (f->seekable) {
+      if (pwrite(f->fd,&f->hdr,sizeof(f->hdr),0) != sizeof(f->hdr)) err = -1;
+    }
+    close_output(f->fd);
+    f->fd = -1;
+  }
+  free(f->pending);
+  free(f->column);
+  free(f->index);
+  f->pending = NULL;
+  f->column = NULL;
+  f->index = NULL;
+  return err;
+}
+
+int save_capture_file(const char *dest,const capture_header_t *hdr,const uint32_t *data,uint32_t num_samples) {
+  capture_file_t f;
+  if (capture_file_open(&f,dest,hdr) != 0) {
+    return -1;
+  }
+  if (capture_file_write(&f,data,num_samples) != 0) {
+    perror("write");
+    capture_file_close(&f);
+    return -1;
+  }
+  if (capture_file_close(&f) != 0) {
+    perror("write");
+    return -1;
+  }
+  return 0;
+}
+
+int stream_write_capture_file(void *arg,const uint32_t *block,uint32_t num_words) {
+  capture_file_t *f = (capture_file_t *) arg;
+  return capture_file_write(f,block,num_words/f->hdr.num_streams);
+}
@@ -0,0 +1,158 @@
+#ifndef CAPTURE_FILE_H_
+#define CAPTURE_FILE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * Self-describing capture container.  All values are little-endian.
+ *
+ *    offset 0       capture_header_t, padded with zeros to CAPTURE_ALIGNMENT bytes
+ *    chunks         each chunk starts on a CAPTURE_ALIGNMENT boundary and holds n samples
+ *                   of every stream in column-major order: n words of stream 0, then n
+ *                   words of stream 1, etc.  Every chunk except the last has
+ *                   chunk_samples samples
+ *    index          num_chunks capture_index_t entries, one per chunk
+ *    footer         capture_footer_t, the last bytes of the file
+ *
+ * The header is rewritten with the final sample count and index location when the file
+ * is closed.  If the output is not seekable (e.g. a pipe) those header fields stay zero
+ * and readers use the footer instead, which always has the same information.
+ */
+#define CAPTURE_FILE_MAGIC          0x43425149    //"IQBC"
+#define CAPTURE_FOOTER_MAGIC        0x58444e49    //"INDX"
+#define CAPTURE_FILE_VERSION        2
+#define CAPTURE_ALIGNMENT           4096
+#define CAPTURE_MAX_STREAMS         16
+#define CAPTURE_NAME_LENGTH         16
+#define CAPTURE_DEFAULT_CHUNK       65536
+
+#define CAPTURE_SOURCE_BIAS         0
+#define CAPTURE_SOURCE_PHASE        1
+
+#define CAPTURE_FORMAT_INT32        0
+#define CAPTURE_FORMAT_FLOAT32      1
+
+/*
+ * Events applied to the system during a capture, i.e. the bias and phase jumps and the
+ * engaging of the phase lock.  SAMPLE is the number of samples read before the write, so
+ * it is the first sample that can show the response if the reader keeps up with the
+ * FIFOs.  HW_SAMPLE is the number of samples the FIFOs had produced when the write was
+ * issued, from the monotonic clock and the time the FIFOs were enabled, so HW_SAMPLE -
+ * SAMPLE is how far the reader was behind.  Version 1 files have no events
+ */
+#define CAPTURE_MAX_EVENTS          64
+
+#define CAPTURE_EVENT_BIAS_JUMP     1
+#define CAPTURE_EVENT_PHASE_JUMP    2
+#define CAPTURE_EVENT_LOCK          3
+
+#define CAPTURE_EVENTS_REALTIME     0x1           //Recorded in real-time mode
+
+typedef struct {
+  uint32_t type;                  //CAPTURE_EVENT_*
+  uint32_t repeat;                //Repeat of an averaged step response, 0 otherwise
+  uint64_t sample;                //Samples per stream read before the write
+  double hw_sample;               //Samples per stream produced when the write was issued
+  uint64_t time_ns;               //Time of the write since the FIFOs were enabled [ns]
+  uint32_t latency_ns;            //Time taken by the register write(s) [ns]
+  uint32_t reserved;
+} capture_event_t;
+
+typedef struct {
+  uint32_t num_events;            //Events recorded, at most CAPTURE_MAX_EVENTS
+  uint32_t flags;                 //CAPTURE_EVENTS_*
+  capture_event_t event[CAPTURE_MAX_EVENTS];
+} capture_events_t;
+
+typedef struct {
+  uint32_t magic;                 //CAPTURE_FILE_MAGIC
+  uint32_t version;               //CAPTURE_FILE_VERSION
+  uint32_t header_size;           //Bytes before the first chunk
+  uint32_t num_streams;           //Number of streams (columns)
+  uint32_t sample_format;         //CAPTURE_FORMAT_*
+  uint32_t source;                //CAPTURE_SOURCE_*
+  uint32_t channel_mask;          //FIFOs of the source that the streams came from
+  uint32_t filter_reg;            //Raw filter/control register at the start of the capture
+  uint32_t log2_rate;             //Log2 of the CIC decimation rate
+  int32_t cic_shift;              //Log2 of the CIC output scaling
+  uint32_t decimation;            //Additional on-device decimation, 1 for none
+  uint32_t chunk_samples;         //Samples per stream in each full chunk
+  double sample_period;           //Time between samples in the file [s]
+  uint64_t start_time_ns;         //Start of the capture, ns since the UNIX epoch
+  uint64_t num_samples;           //Samples per stream, 0 if not known
+  uint64_t index_offset;          //File offset of the chunk index, 0 if not known
+  uint64_t num_chunks;            //Number of chunks, 0 if not known
+  char stream_names[CAPTURE_MAX_STREAMS][CAPTURE_NAME_LENGTH];
+  capture_events_t events;        //Version 2 onwards
+} capture_header_t;
+
+_Static_assert(sizeof(capture_header_t) <= CAPTURE_ALIGNMENT,"capture_header_t");
+
+typedef struct {
+  uint64_t first_sample;          //Index of the first sample in the chunk
+  uint64_t offset;                //File offset of the chunk
+  uint64_t num_samples;           //Samples per stream in the chunk
+} capture_index_t;
+
+typedef struct {
+  uint64_t index_offset;
+  uint64_t num_chunks;
+  uint64_t num_samples;
+  uint32_t magic;                 //CAPTURE_FOOTER_MAGIC
+  uint32_t version;
+} capture_footer_t;
+
+typedef struct {
+  int fd;
+  int seekable;
+  capture_header_t hdr;
+  uint64_t offset;                //Current end of the file
+  uint32_t *pending;              //Interleaved samples waiting for a full chunk
+  uint32_t pending_samples;
+  uint32_t *column;               //Chunk transposed into column-major order
+  capture_index_t *index;
+  uint64_t index_size;            //Allocated entries in index
+} capture_file_t;
+
+/*
+ * Fills in a header for streams from SOURCE using the current filter settings read from
+ * the register space CFG.  Each set bit in CHANNEL_MASK is a FIFO that was recorded, in
+ * order, which sets the number of streams and their names
+ */
+void capture_header_init(capture_header_t *hdr,void *cfg,uint32_t source,uint32_t channel_mask);
+
+/*
+ * Prints one line per event with the times in seconds, and how far the writes lagged
+ * behind the reads.  SAMPLE_PERIOD is the time between FIFO samples
+ */
+void capture_print_events(FILE *f,const capture_events_t *ev,double sample_period);
+/*
+ * Writes the events of HDR to the text file PATH, for captures saved as raw words.
+ * Returns 0 on success
+ */
+int capture_write_events(const char *path,const capture_header_t *hdr);
+
+/*
+ * Opens DEST (see open_output()) and writes the header.  Returns 0 on success
+ */
+int capture_file_open(capture_file_t *f,const char *dest,const capture_header_t *hdr);
+/*
+ * Appends NUM_SAMPLES interleaved samples (num_streams words each)
+ */
+int capture_file_write(capture_file_t *f,const uint32_t *data,uint32_t num_samples);
+/*
+ * Flushes the last chunk, writes the index and footer and closes the file
+ */
+int capture_file_close(capture_file_t *f);
+
+/*
+ * Convenience function for programs which capture everything into memory first.  The
+ * header should be initialised just before the capture starts
+ */
+int save_capture_file(const char *dest,const capture_header_t *hdr,const uint32_t *data,uint32_t num_samples);
+/*
+ * Consumer for fifo_stream_t which appends blocks to the capture file pointed to by ARG
+ */
+int stream_write_capture_file(void *arg,const uint32_t *block,uint32_t num_words);
+#endif
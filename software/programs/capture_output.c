@@ -0,0 +1,199 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+
+#include "capture_output.h"
+
+static int open_tcp(const char *spec) {
+  char host[256];
+  const char *port;
+  struct addrinfo hints, *res, *rp;
+  int fd = -1;
+
+  port = strrchr(spec,':');
+  if (!port || (size_t)(port - spec) >= sizeof(host)) {
+    fprintf(stderr,"Invalid TCP destination %s\n",spec);
+    return -1;
+  }
+  memcpy(host,spec,port - spec);
+  host[port - spec] = '\0';
+  port++;
+
+  memset(&hints,0,sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host,port,&hints,&res) != 0) {
+    fprintf(stderr,"Could not resolve %s\n",spec);
+    return -1;
+  }
+  for (rp = res;rp != NULL;rp = rp->ai_next) {
+    fd = socket(rp->ai_family,rp->ai_socktype,rp->ai_protocol);
+    if (fd < 0) continue;
+    if (connect(fd,rp->ai_addr,rp->ai_addrlen) == 0) break;
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(res);
+  if (fd < 0) {
+    perror("connect");
+  }
+  return fd;
+}
+
+int open_output(const char *dest) {
+  int fd;
+  if (dest == NULL) {
+    dest = DEFAULT_OUTPUT_FILE;
+  }
+  if (strcmp(dest,"-") == 0) {
+    return STDOUT_FILENO;
+  } else if (strncmp(dest,"tcp:",4) == 0) {
+    return open_tcp(dest + 4);
+  }
+  fd = open(dest,O_WRONLY | O_CREAT | O_TRUNC,0644);
+  if (fd < 0) {
+    perror("open");
+  }
+  return fd;
+}
+
+void close_output(int fd) {
+  if (fd >= 0 && fd != STDOUT_FILENO) {
+    close(fd);
+  }
+}
+
+int write_all(int fd,const void *buf,size_t len) {
+  const char *p = (const char *) buf;
+  ssize_t n;
+  while (len > 0) {
+    n = write(fd,p,len);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    p += n;
+    len -= (size_t) n;
+  }
+  return 0;
+}
+
+void *alloc_capture_buffer(size_t bytes,int *memfd) {
+  void *buf;
+  size_t len = bytes > 0 ? bytes : 1;
+
+  *memfd = memfd_create("iq_capture",MFD_CLOEXEC);
+  if (*memfd >= 0) {
+    if (ftruncate(*memfd,(off_t) len) == 0) {
+      buf = mmap(0,len,PROT_READ | PROT_WRITE,MAP_SHARED,*memfd,0);
+      if (buf != MAP_FAILED) {
+        memset(buf,0,len);
+        return buf;
+      }
+    }
+    close(*memfd);
+    *memfd = -1;
+  }
+  //Fall back to ordinary memory if memfd_create is not available
+  buf = malloc(len);
+  if (buf) {
+    memset(buf,0,len);
+  }
+  return buf;
+}
+
+void free_capture_buffer(void *buf,size_t bytes,int memfd) {
+  if (!buf) return;
+  if (memfd >= 0) {
+    munmap(buf,bytes > 0 ? bytes : 1);
+    close(memfd);
+  } else {
+    free(buf);
+  }
+}
+
+/*
+ * The zero-copy helpers return the number of bytes sent, which is less than BYTES if
+ * they fail, with errno set
+ */
+static size_t send_vmsplice(int fd,const void *buf,size_t bytes) {
+  struct iovec iov;
+  ssize_t n;
+  iov.iov_base = (void *) buf;
+  iov.iov_len = bytes;
+  while (iov.iov_len > 0) {
+    n = vmsplice(fd,&iov,1,0);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    iov.iov_base = (char *) iov.iov_base + n;
+    iov.iov_len -= (size_t) n;
+  }
+  return bytes - iov.iov_len;
+}
+
+static size_t send_memfd(int fd,int memfd,size_t bytes) {
+  off_t offset = 0;
+  ssize_t n;
+  while ((size_t) offset < bytes) {
+    n = sendfile(fd,memfd,&offset,bytes - (size_t) offset);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    if (n == 0) {
+      errno = EINVAL;
+      break;
+    }
+  }
+  return (size_t) offset;
+}
+
+int send_capture(int fd,const void *buf,size_t bytes,int memfd) {
+  struct stat st;
+  size_t sent = 0;
+  int tried = 0;
+  if (bytes == 0) {
+    return 0;
+  }
+  if (fstat(fd,&st) == 0 && S_ISFIFO(st.st_mode)) {
+    sent = send_vmsplice(fd,buf,bytes);
+    tried = 1;
+  } else if (memfd >= 0) {
+    sent = send_memfd(fd,memfd,bytes);
+    tried = 1;
+  }
+  if (sent == bytes) {
+    return 0;
+  }
+  //Only fall back to an ordinary copy if the zero-copy path is not supported
+  if (tried && errno != EINVAL && errno != ENOSYS) {
+    return -1;
+  }
+  return write_all(fd,(const char *) buf + sent,bytes - sent);
+}
+
+int write_capture(const char *dest,const void *buf,size_t bytes,int memfd) {
+  int fd, err;
+  if ((fd = open_output(dest)) < 0) {
+    return -1;
+  }
+  err = send_capture(fd,buf,bytes,memfd);
+  if (err != 0) {
+    perror("write");
+  }
+  close_output(fd);
+  return err;
+}
@@ -0,0 +1,41 @@
+#ifndef CAPTURE_OUTPUT_H_
+#define CAPTURE_OUTPUT_H_
+
+#include <stddef.h>
+
+#define DEFAULT_OUTPUT_FILE         "SavedData.bin"
+
+/*
+ * Opens an output destination for captured data.  DEST can be
+ *    "-"                 standard output, e.g. a pipe to another program
+ *    "tcp:<host>:<port>" a TCP connection to a listening client
+ *    anything else       a file (or named pipe) which is created/truncated
+ * Returns a file descriptor or -1 on error
+ */
+int open_output(const char *dest);
+void close_output(int fd);
+/*
+ * Writes all LEN bytes of BUF to FD, retrying on partial writes.  Returns 0 on success
+ */
+int write_all(int fd,const void *buf,size_t len);
+
+/*
+ * Allocates a capture buffer of BYTES bytes.  Where possible the buffer is backed by an
+ * anonymous memory file (memfd) so that it can be sent with sendfile() and never touches
+ * the SD card; *MEMFD is then set to its descriptor, otherwise to -1 and the buffer comes
+ * from malloc().  The pages are touched before returning
+ */
+void *alloc_capture_buffer(size_t bytes,int *memfd);
+void free_capture_buffer(void *buf,size_t bytes,int memfd);
+/*
+ * Sends the first BYTES bytes of a capture buffer to FD using the cheapest available
+ * path: vmsplice() if FD is a pipe, sendfile() from the memfd for sockets and files,
+ * and write() otherwise.  After vmsplice() the pipe references the buffer pages
+ * directly, so the buffer must not be modified again by the caller
+ */
+int send_capture(int fd,const void *buf,size_t bytes,int memfd);
+/*
+ * Opens DEST with open_output(), sends the capture buffer and closes it again
+ */
+int write_capture(const char *dest,const void *buf,size_t bytes,int memfd);
+#endif
@@ -0,0 +1,390 @@
+//Large-file offsets on the 32-bit Red Pitaya
+#define _FILE_OFFSET_BITS 64
+
+//These are libraries which contain useful functions
+#include <ctype.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "capture_output.h"
+#include "capture_file.h"
+#include "iq_decode.h"
+
+/*
+ * Converts raw device data (see iq_decode.h), or a capture file, into one column per
+ * stream, reading the input in blocks so that files larger than memory can be converted.
+ * The columns are written either to one file each, <prefix>_1.bin, <prefix>_2.bin, ...
+ * (-o), or as one column-major matrix of num_samples rows (-m) that MATLAB can open with
+ * memmapfile or read with fread.  The matrix needs the number of samples in advance, so
+ * it cannot be written from standard input
+ */
+#define DEFAULT_BLOCK_SAMPLES       (1 << 20)
+
+typedef struct {
+  int fd[IQ_DECODE_MAX_COLUMNS];  //Column files, or fd[0] for the matrix
+  uint32_t columns;
+  int matrix;
+  uint64_t num_samples;           //Rows of the matrix
+  size_t value_bytes;
+} column_sink_t;
+
+static int read_full(int fd,void *buf,size_t len,size_t *got) {
+  ssize_t n;
+  *got = 0;
+  while (*got < len) {
+    n = read(fd,(uint8_t *) buf + *got,len - *got);
+    if (n < 0) return -1;
+    if (n == 0) break;
+    *got += (size_t) n;
+  }
+  return 0;
+}
+
+static int pread_full(int fd,void *buf,size_t len,off_t offset) {
+  ssize_t n;
+  size_t got = 0;
+  while (got < len) {
+    n = pread(fd,(uint8_t *) buf + got,len - got,offset + (off_t) got);
+    if (n <= 0) return -1;
+    got += (size_t) n;
+  }
+  return 0;
+}
+
+static int pwrite_full(int fd,const void *buf,size_t len,off_t offset) {
+  ssize_t n;
+  size_t done = 0;
+  while (done < len) {
+    n = pwrite(fd,(const uint8_t *) buf + done,len - done,offset + (off_t) done);
+    if (n <= 0) return -1;
+    done += (size_t) n;
+  }
+  return 0;
+}
+
+/*
+ * Writes N values of column K, starting at row FIRST
+ */
+static int sink_write(column_sink_t *s,uint32_t k,uint64_t first,const void *values,size_t n) {
+  if (s->matrix) {
+    return pwrite_full(s->fd[0],values,n*s->value_bytes,(off_t)(((uint64_t) k*s->num_samples + first)*s->value_bytes));
+  }
+  return write_all(s->fd[k],values,n*s->value_bytes);
+}
+
+static int sink_open(column_sink_t *s,const char *prefix,const char *matrixFile) {
+  char name[1024];
+  uint32_t k;
+  if (s->matrix) {
+    s->fd[0] = open(matrixFile,O_WRONLY | O_CREAT | O_TRUNC,0644);
+    if (s->fd[0] < 0 || ftruncate(s->fd[0],(off_t)(s->num_samples*s->columns*s->value_bytes)) != 0) {
+      perror("open");
+      return -1;
+    }
+    return 0;
+  }
+  for (k = 0;k < s->columns;k++) {
+    snprintf(name,sizeof(name),"%s_%u.bin",prefix,k + 1);
+    s->fd[k] = open(name,O_WRONLY | O_CREAT | O_TRUNC,0644);
+    if (s->fd[k] < 0) {
+      perror("open");
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static void sink_close(column_sink_t *s) {
+  uint32_t k;
+  for (k = 0;k < (s->matrix ? 1 : s->columns);k++) {
+    if (s->fd[k] >= 0) close(s->fd[k]);
+  }
+}
+
+/*
+ * Parses a comma-separated list of 1 or N factors into X
+ */
+static int parse_scale(const char *list,double *x,uint32_t *n) {
+  const char *p = list;
+  char *end;
+  *n = 0;
+  while (*n < IQ_DECODE_MAX_COLUMNS) {
+    x[(*n)++] = strtod(p,&end);
+    if (end == p) return -1;
+    if (*end == '\0') return 0;
+    if (*end != ',') return -1;
+    p = end + 1;
+  }
+  return -1;
+}
+
+/*
+ * Converts a capture file chunk by chunk with the index in its footer.  The chunks are
+ * already column-major, so each column is converted as a single stream
+ */
+static int convert_capture_file(int in,const iq_decode_t *base,column_sink_t *sink,const char *prefix,
+                                const char *matrixFile,uint64_t *converted) {
+  capture_header_t hdr;
+  capture_footer_t foot;
+  capture_index_t *index;
+  iq_decode_t d = *base;
+  struct stat sb;
+  uint32_t *chunk = NULL, k;
+  uint8_t *out = NULL;
+  uint64_t c;
+  double scale;
+  size_t alloc = 0, i;
+  int ret = -1;
+
+  if (fstat(in,&sb) != 0 || pread_full(in,&hdr,sizeof(hdr),0) != 0 ||
+      pread_full(in,&foot,sizeof(foot),sb.st_size - (off_t) sizeof(foot)) != 0 || foot.magic != CAPTURE_FOOTER_MAGIC ||
+      hdr.num_streams == 0 || hdr.num_streams > IQ_DECODE_MAX_COLUMNS) {
+    fprintf(stderr,"Invalid capture file\n");
+    return -1;
+  }
+  index = (capture_index_t *) malloc((foot.num_chunks > 0 ? foot.num_chunks : 1)*sizeof(capture_index_t));
+  if (!index || pread_full(in,index,foot.num_chunks*sizeof(capture_index_t),(off_t) foot.index_offset) != 0) {
+    fprintf(stderr,"Invalid capture file index\n");
+    free(index);
+    return -1;
+  }
+  sink->columns = hdr.num_streams;
+  sink->num_samples = foot.num_samples;
+  if (sink_open(sink,prefix,matrixFile) != 0) {
+    free(index);
+    return -1;
+  }
+  d.layout = IQ_LAYOUT_INT32;
+  d.num_streams = 1;
+  for (c = 0;c < foot.num_chunks;c++) {
+    if (index[c].num_samples*hdr.num_streams > alloc) {
+      alloc = index[c].num_samples*hdr.num_streams;
+      free(chunk);
+      free(out);
+      chunk = (uint32_t *) malloc(alloc*sizeof(uint32_t));
+      out = (uint8_t *) malloc(alloc*iq_decode_value_bytes(&d));
+      if (!chunk || !out) {
+        printf("Error allocating memory");
+        goto done;
+      }
+    }
+    if (pread_full(in,chunk,index[c].num_samples*hdr.num_streams*sizeof(uint32_t),(off_t) index[c].offset) != 0) {
+      fprintf(stderr,"Capture file truncated in chunk %llu\n",(unsigned long long) c);
+      goto done;
+    }
+    for (k = 0;k < hdr.num_streams;k++) {
+      scale = base->scale ? base->scale[k] : 1.0;
+      d.scale = &scale;
+      if (hdr.sample_format == CAPTURE_FORMAT_FLOAT32) {
+        //Already converted on the device
+        for (i = 0;i < index[c].num_samples;i++) {
+          float v;
+          memcpy(&v,chunk + k*index[c].num_samples + i,sizeof(v));
+          if (d.out_format == IQ_OUT_DOUBLE) ((double *) out)[i] = scale*v;
+          else if (d.out_format == IQ_OUT_SINGLE) ((float *) out)[i] = (float)(scale*v);
+          else ((int32_t *) out)[i] = (int32_t) v;
+        }
+      } else {
+        iq_decode(&d,chunk + k*index[c].num_samples,index[c].num_samples,out,index[c].num_samples);
+      }
+      if (sink_write(sink,k,index[c].first_sample,out,index[c].num_samples) != 0) {
+        perror("write");
+        goto done;
+      }
+    }
+    *converted += index[c].num_samples;
+  }
+  ret = 0;
+
+done:
+  sink_close(sink);
+  free(index);
+  free(chunk);
+  free(out);
+  return ret;
+}
+
+int main(int argc, char **argv)
+{
+  iq_decode_t d;
+  column_sink_t sink;
+  double scale[IQ_DECODE_MAX_COLUMNS];
+  uint32_t numScale = 0, k;
+  char *inputFile = DEFAULT_OUTPUT_FILE;  //The file the savers write by default
+  char *prefix = NULL;        //Column files <prefix>_<k>.bin
+  char *matrixFile = NULL;    //Column-major matrix
+  uint32_t blockSamples = DEFAULT_BLOCK_SAMPLES;
+  uint8_t debugFlag = 0;
+  uint8_t *raw, *out;
+  uint32_t magic = 0;
+  uint64_t converted = 0;
+  size_t sb, got, n, leftover = 0;
+  struct stat st;
+  struct timespec start, stop;
+  int in, ret = 0;
+
+  memset(&d,0,sizeof(d));
+  d.layout = IQ_LAYOUT_INT32;
+  d.num_streams = 4;
+  d.out_format = IQ_OUT_DOUBLE;
+  /*
+   * Parse the input arguments
+   */
+  int c;
+  while ((c = getopt(argc,argv,"t:s:c:F:o:m:b:j:f")) != -1) {
+    switch (c) {
+      case 't':
+        if (strcmp(optarg,"bias") == 0) {
+          d.layout = IQ_LAYOUT_INT32;
+          d.num_streams = 4;
+        } else if (strcmp(optarg,"phase") == 0) {
+          d.layout = IQ_LAYOUT_INT32;
+          d.num_streams = 5;
+        } else if (strcmp(optarg,"adc") == 0) {
+          d.layout = IQ_LAYOUT_ADC;
+        } else {
+          fprintf(stderr,"The layout is bias, phase or adc\n");
+          return 1;
+        }
+        break;
+      case 's':
+        d.num_streams = atoi(optarg);
+        break;
+      case 'c':
+        if (parse_scale(optarg,scale,&numScale) != 0) {
+          fprintf(stderr,"Option -c needs a list of at most %d factors\n",IQ_DECODE_MAX_COLUMNS);
+          return 1;
+        }
+        break;
+      case 'F':
+        if (strcmp(optarg,"double") == 0) {
+          d.out_format = IQ_OUT_DOUBLE;
+        } else if (strcmp(optarg,"single") == 0) {
+          d.out_format = IQ_OUT_SINGLE;
+        } else if (strcmp(optarg,"int32") == 0) {
+          d.out_format = IQ_OUT_INT32;
+        } else {
+          fprintf(stderr,"The output format is double, single or int32\n");
+          return 1;
+        }
+        break;
+      case 'o':
+        prefix = optarg;
+        break;
+      case 'm':
+        matrixFile = optarg;
+        break;
+      case 'b':
+        blockSamples = atoi(optarg);
+        break;
+      case 'j':
+        d.threads = atoi(optarg);
+        break;
+      case 'f':
+        debugFlag = 1;
+        break;
+
+      case '?':
+        if (isprint (optopt))
+            fprintf (stderr, "Unknown option `-%c'.\n", optopt);
+        else
+            fprintf (stderr,
+                    "Unknown option character `\\x%x'.\n",
+                    optopt);
+        return 1;
+
+      default:
+        abort();
+        break;
+    }
+  }
+  if (optind < argc) {
+    inputFile = argv[optind];
+  }
+
+  if ((prefix == NULL) == (matrixFile == NULL)) {
+    fprintf(stderr,"Give either -o <prefix> for column files or -m <file> for a matrix\n");
+    return 1;
+  }
+  if ((sb = iq_decode_sample_bytes(&d)) == 0 || blockSamples == 0) {
+    fprintf(stderr,"Between 1 and %d streams, and a block of at least one sample\n",IQ_DECODE_MAX_COLUMNS);
+    return 1;
+  }
+  memset(&sink,0,sizeof(sink));
+  for (k = 0;k < IQ_DECODE_MAX_COLUMNS;k++) {
+    sink.fd[k] = -1;
+    scale[k] = numScale == 1 ? scale[0] : (k < numScale ? scale[k] : 1.0);
+  }
+  if (numScale > 0) {
+    d.scale = scale;
+  }
+  sink.matrix = matrixFile != NULL;
+  sink.value_bytes = iq_decode_value_bytes(&d);
+
+  in = strcmp(inputFile,"-") == 0 ? STDIN_FILENO : open(inputFile,O_RDONLY);
+  if (in < 0) {
+    perror("open");
+    return 1;
+  }
+  clock_gettime(CLOCK_MONOTONIC,&start);
+  if (in != STDIN_FILENO && pread_full(in,&magic,sizeof(magic),0) == 0 && magic == CAPTURE_FILE_MAGIC) {
+    ret = convert_capture_file(in,&d,&sink,prefix,matrixFile,&converted) == 0 ? 0 : 1;
+    sink.columns = sink.columns ? sink.columns : 1;
+  } else {
+    sink.columns = iq_decode_columns(&d);
+    if (sink.matrix) {
+      if (fstat(in,&st) != 0 || !S_ISREG(st.st_mode)) {
+        fprintf(stderr,"A matrix needs a regular input file\n");
+        return 1;
+      }
+      sink.num_samples = (uint64_t) st.st_size/sb;
+    }
+    raw = (uint8_t *) malloc((size_t) blockSamples*sb);
+    out = (uint8_t *) malloc((size_t) blockSamples*sink.columns*sink.value_bytes);
+    if (!raw || !out) {
+      printf("Error allocating memory");
+      return -1;
+    }
+    if (sink_open(&sink,prefix,matrixFile) != 0) {
+      return 1;
+    }
+    while (read_full(in,raw,(size_t) blockSamples*sb,&got) == 0 && got > 0) {
+      n = got/sb;
+      leftover = got % sb;
+      if (sink.matrix && converted + n > sink.num_samples) {
+        n = sink.num_samples - converted;
+      }
+      iq_decode(&d,raw,n,out,n);
+      for (k = 0;k < sink.columns;k++) {
+        if (sink_write(&sink,k,converted,out + k*n*sink.value_bytes,n) != 0) {
+          perror("write");
+          ret = 1;
+          break;
+        }
+      }
+      converted += n;
+      if (ret || got < (size_t) blockSamples*sb) break;
+    }
+    if (leftover > 0) {
+      fprintf(stderr,"Ignored %zu bytes at the end that are not a whole sample\n",leftover);
+    }
+    sink_close(&sink);
+    free(raw);
+    free(out);
+  }
+  clock_gettime(CLOCK_MONOTONIC,&stop);
+  if (in != STDIN_FILENO) close(in);
+
+  if (debugFlag) {
+    double t = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec)*1e-9;
+    fprintf(stderr,"%llu samples of %u columns in %.3f s (%.1f Msamples/s)\n",(unsigned long long) converted,
+            sink.columns,t,converted/t*1e-6);
+  }
+  return ret;	//C functions should have a return value - 0 is the usual "no error" return value
+}
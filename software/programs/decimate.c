@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#include "iq_bias_control.h"
+#include "decimate.h"
+
+#define DECIMATE_BLOCK_SAMPLES      4096
+
+/*
+ * Windowed-sinc (Hamming) low-pass with a cut-off at 0.8 of the output Nyquist frequency,
+ * rounded to Q15 with the centre tap adjusted so that the DC gain is exactly one
+ */
+static void design_fir(int32_t *taps,uint32_t num_taps,uint32_t factor) {
+  const double fc = 0.8*0.5/factor;
+  double h[DECIMATE_MAX_TAPS], sum = 0, x;
+  int32_t total = 0;
+  uint32_t k;
+  for (k = 0;k < num_taps;k++) {
+    x = (double) k - 0.5*(num_taps - 1);
+    h[k] = (x == 0 ? 2*fc : sin(2*M_PI*fc*x)/(M_PI*x))*(0.54 - 0.46*cos(2*M_PI*k/(num_taps > 1 ? num_taps - 1 : 1)));
+    sum += h[k];
+  }
+  for (k = 0;k < num_taps;k++) {
+    taps[k] = (int32_t) lround(h[k]/sum*(1 << DECIMATE_FIR_SHIFT));
+    total += taps[k];
+  }
+  taps[num_taps/2] += (1 << DECIMATE_FIR_SHIFT) - total;
+}
+
+int decimator_init(decimator_t *d,const char *spec,uint32_t factor,uint32_t num_streams) {
+  const char *arg = strchr(spec,':');
+  size_t len = arg ? (size_t)(arg - spec) : strlen(spec);
+  uint32_t n = arg ? strtoul(arg + 1,NULL,0) : 0;
+  double bits;
+
+  memset(d,0,sizeof(*d));
+  if (factor < 1 || num_streams < 1) return -1;
+  d->factor = factor;
+  d->num_streams = num_streams;
+  if (len == 6 && strncmp(spec,"boxcar",len) == 0) {
+    d->type = DECIMATE_BOXCAR;
+    d->acc = (int64_t *) calloc(num_streams,sizeof(int64_t));
+    return d->acc ? 0 : -1;
+  } else if (len == 3 && strncmp(spec,"cic",len) == 0) {
+    d->type = DECIMATE_CIC;
+    d->order = n > 0 ? n : DECIMATE_DEFAULT_CIC_ORDER;
+    //The integrators wrap, which is harmless as long as the output fits in 64 bits
+    bits = d->order*log2((double) factor);
+    if (bits >= 32) {
+      fprintf(stderr,"CIC order %u is too high for a decimation of %u\n",d->order,factor);
+      return -1;
+    }
+    d->acc = (int64_t *) calloc((size_t) 2*d->order*num_streams,sizeof(int64_t));
+    return d->acc ? 0 : -1;
+  } else if (len == 3 && strncmp(spec,"fir",len) == 0) {
+    d->type = DECIMATE_FIR;
+    d->num_taps = n > 0 ? n : 4*factor + 1;
+    if (d->num_taps > DECIMATE_MAX_TAPS) {
+      fprintf(stderr,"At most %u FIR taps are supported\n",DECIMATE_MAX_TAPS);
+      return -1;
+    }
+    d->taps = (int32_t *) malloc(d->num_taps*sizeof(int32_t));
+    d->history = (int32_t *) calloc((size_t) 2*d->num_taps*num_streams,sizeof(int32_t));
+    if (!d->taps || !d->history) {
+      decimator_free(d);
+      return -1;
+    }
+    design_fir(d->taps,d->num_taps,factor);
+    return 0;
+  }
+  fprintf(stderr,"Unknown filter `%s', use boxcar, cic[:order] or fir[:taps]\n",spec);
+  return -1;
+}
+
+void decimator_free(decimator_t *d) {
+  free(d->acc);
+  free(d->taps);
+  free(d->history);
+  d->acc = NULL;
+  d->taps = NULL;
+  d->history = NULL;
+}
+
+/*
+ * Dot product of the taps with the most recent num_taps inputs of one stream, oldest
+ * first
+ */
+static int64_t fir_dot(const int32_t *taps,const int32_t *x,uint32_t num_taps) {
+  uint32_t k = 0;
+  int64_t sum = 0;
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+  int64x2_t acc = vdupq_n_s64(0);
+  for (;k + 4 <= num_taps;k += 4) {
+    int32x4_t h = vld1q_s32(taps + k), v = vld1q_s32(x + k);
+    acc = vmlal_s32(acc,vget_low_s32(h),vget_low_s32(v));
+    acc = vmlal_s32(acc,vget_high_s32(h),vget_high_s32(v));
+  }
+  sum = vgetq_lane_s64(acc,0) + vgetq_lane_s64(acc,1);
+#endif
+  for (;k < num_taps;k++) {
+    sum += (int64_t) taps[k]*x[k];
+  }
+  return sum;
+}
+
+uint32_t decimate(decimator_t *d,const uint32_t *in,uint32_t numSamples,uint32_t *out) {
+  const uint32_t S = d->num_streams;
+  uint32_t i, k, j, n = 0;
+  uint64_t v;
+  int64_t *integ, *comb, prev;
+  int32_t *hist;
+  double norm;
+
+  for (i = 0;i < numSamples;i++) {
+    const int32_t *x = (const int32_t *) in + (size_t) i*S;
+    switch (d->type) {
+      case DECIMATE_BOXCAR:
+        for (k = 0;k < S;k++) d->acc[k] += x[k];
+        break;
+      case DECIMATE_CIC:
+        //Integrators run at the input rate with wrap-around arithmetic
+        for (k = 0;k < S;k++) {
+          integ = d->acc + (size_t) k*d->order;
+          v = (uint64_t)(int64_t) x[k];
+          for (j = 0;j < d->order;j++) {
+            v += (uint64_t) integ[j];
+            integ[j] = (int64_t) v;
+          }
+        }
+        break;
+      case DECIMATE_FIR:
+        //Each input is stored twice so that the last num_taps inputs are contiguous
+        for (k = 0;k < S;k++) {
+          hist = d->history + (size_t) k*2*d->num_taps;
+          hist[d->pos] = hist[d->pos + d->num_taps] = x[k];
+        }
+        d->pos = d->pos + 1 == d->num_taps ? 0 : d->pos + 1;
+        break;
+    }
+    if (++d->phase < d->factor) continue;
+    d->phase = 0;
+
+    int32_t *y = (int32_t *) out + (size_t) n*S;
+    switch (d->type) {
+      case DECIMATE_BOXCAR:
+        for (k = 0;k < S;k++) {
+          y[k] = (int32_t)(d->acc[k]/(int64_t) d->factor);
+          d->acc[k] = 0;
+        }
+        break;
+      case DECIMATE_CIC:
+        //Combs run at the output rate
+        norm = pow((double) d->factor,(double) d->order);
+        for (k = 0;k < S;k++) {
+          integ = d->acc + (size_t) k*d->order;
+          comb = d->acc + (size_t)(S + k)*d->order;
+          v = (uint64_t) integ[d->order - 1];
+          for (j = 0;j < d->order;j++) {
+            prev = comb[j];
+            comb[j] = (int64_t) v;
+            v -= (uint64_t) prev;
+          }
+          y[k] = (int32_t) floor((double)(int64_t) v/norm + 0.5);
+        }
+        break;
+      case DECIMATE_FIR:
+        for (k = 0;k < S;k++) {
+          hist = d->history + (size_t) k*2*d->num_taps;
+          y[k] = (int32_t)(fir_dot(d->taps,hist + d->pos,d->num_taps) >> DECIMATE_FIR_SHIFT);
+        }
+        break;
+    }
+    n++;
+  }
+  return n;
+}
+
+int read_fifo_decimated(void *cfg,uint32_t loc,uint32_t mask,uint32_t numSamples,decimator_t *d,uint32_t *data) {
+  const uint32_t saveFactor = __builtin_popcount(mask);
+  uint32_t block = DECIMATE_BLOCK_SAMPLES - DECIMATE_BLOCK_SAMPLES % d->factor;
+  uint64_t remaining = (uint64_t) numSamples*d->factor;
+  uint32_t *buf, n;
+
+  if (block == 0) block = d->factor;
+  buf = (uint32_t *) malloc((size_t) block*saveFactor*sizeof(uint32_t));
+  if (!buf) return -1;
+  while (remaining > 0) {
+    n = remaining < block ? (uint32_t) remaining : block;
+    read_fifo_mask(cfg,loc,mask,n,buf);
+    data += (size_t) decimate(d,buf,n,data)*saveFactor;
+    remaining -= n;
+  }
+  free(buf);
+  return 0;
+}
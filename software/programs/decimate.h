@@ -0,0 +1,60 @@
+#ifndef DECIMATE_H_
+#define DECIMATE_H_
+
+#include <stdint.h>
+
+/*
+ * On-device decimation of interleaved int32 samples, run between the FIFO drain and the
+ * output so that only one sample in every factor is stored or sent:
+ *
+ *    boxcar    mean of each block of factor samples
+ *    cic       order-stage CIC filter, the same as matlab/cicfilter.m, normalised by
+ *              factor^order.  factor^order must be below 2^32
+ *    fir       windowed-sinc low-pass FIR with num_taps taps and a cut-off at 0.8 of
+ *              the output Nyquist frequency, in Q15 fixed point
+ *
+ * Every filter produces one output for every factor inputs, so numSamples outputs need
+ * exactly factor*numSamples FIFO samples.  The state is kept between calls so that a
+ * stream can be filtered in blocks of any size
+ */
+#define DECIMATE_BOXCAR             0
+#define DECIMATE_CIC                1
+#define DECIMATE_FIR                2
+
+#define DECIMATE_DEFAULT_CIC_ORDER  3
+#define DECIMATE_FIR_SHIFT          15
+#define DECIMATE_MAX_TAPS           4095
+
+typedef struct {
+  uint32_t type;                  //DECIMATE_*
+  uint32_t factor;
+  uint32_t order;                 //CIC stages
+  uint32_t num_taps;              //FIR taps
+  uint32_t num_streams;           //Words per input sample
+  uint32_t phase;                 //Inputs since the last output
+  int64_t *acc;                   //Boxcar sums or CIC integrators, then CIC combs
+  int32_t *taps;                  //FIR taps in Q15
+  int32_t *history;               //FIR input history, 2*num_taps per stream
+  uint32_t pos;                   //Next history slot
+} decimator_t;
+
+/*
+ * Parses a filter specification of the form boxcar, cic[:order] or fir[:taps] and
+ * initialises D for num_streams streams.  Returns -1 if the specification is not valid
+ * or memory could not be allocated
+ */
+int decimator_init(decimator_t *d,const char *spec,uint32_t factor,uint32_t num_streams);
+void decimator_free(decimator_t *d);
+/*
+ * Filters numSamples interleaved samples from IN and writes the outputs to OUT, which may
+ * be the same buffer.  Returns the number of output samples
+ */
+uint32_t decimate(decimator_t *d,const uint32_t *in,uint32_t numSamples,uint32_t *out);
+
+/*
+ * Captures numSamples decimated samples of the FIFOs selected by MASK into data, reading
+ * the FIFOs in blocks so that the full-rate data is never held in memory
+ */
+int read_fifo_decimated(void *cfg,uint32_t loc,uint32_t mask,uint32_t numSamples,decimator_t *d,uint32_t *data);
+
+#endif
@@ -0,0 +1,282 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "iq_bias_control.h"
+#include "step_response.h"
+#include "feedback_tuning.h"
+
+_Static_assert(IQ_REG(pid) == PID_CONTROL_REG,"PID_CONTROL_REG");
+_Static_assert(IQ_REG(phase_gain) == PHASE_GAIN_REG,"PHASE_GAIN_REG");
+_Static_assert(IQ_REG(phase_divisor) == PHASE_DIVISOR_REG,"PHASE_DIVISOR_REG");
+
+void tune_defaults(tune_params_t *p) {
+  memset(p,0,sizeof(*p));
+  p->step = TUNE_DEFAULT_STEP;
+  p->points = TUNE_DEFAULT_POINTS;
+  p->numAvgs = TUNE_DEFAULT_AVGS;
+  p->settle.window = 0;
+  p->settle.tolerance = 0;
+  p->settle.maxDwell = DEFAULT_BIAS_DWELL;
+  p->jump = TUNE_DEFAULT_JUMP;
+  p->numSamples = TUNE_DEFAULT_SAMPLES;
+  p->repeats = TUNE_DEFAULT_REPEATS;
+  p->factor = TUNE_DEFAULT_FACTOR;
+}
+
+static uint16_t clamp_pwm(double V) {
+  if (V < 0) return 0;
+  if (V > MIMO_PWM_MAX) return MIMO_PWM_MAX;
+  return (uint16_t) lround(V);
+}
+
+/*
+ * Time constant of a first-order step response from its 10%-90% rise time, at least
+ * one sample.  Returns NAN if there is no step
+ */
+static double step_tau(const double *avg,uint32_t numSamples,uint32_t num_streams,uint32_t stream,uint32_t jump_sample,
+                       double sample_period,double *step) {
+  step_metrics_t m;
+  step_metrics(avg,numSamples,num_streams,stream,jump_sample,STEP_DEFAULT_BAND,sample_period,&m);
+  *step = m.step;
+  if (isnan(m.rise_time)) return NAN;
+  return m.rise_time/log(9.0) > sample_period ? m.rise_time/log(9.0) : sample_period;
+}
+
+int tune_measure_bias(void *cfg,const tune_params_t *p,tune_result_t *r) {
+  const uint32_t mask = (1u << MIMO_NUM) - 1;
+  const uint32_t jump_sample = step_jump_sample(mask,p->numSamples);
+  double Ginv[MIMO_NUM][MIMO_NUM], x, y[MIMO_NUM], Sx, Sxx, Sy[MIMO_NUM], Sxy[MIMO_NUM], step;
+  uint32_t *raw, *data, control, n;
+  uint16_t V[MIMO_NUM];
+  double *avg;
+  bias_stats_t st;
+  int32_t offset;
+  int i, j, ret = 0;
+
+  raw = (uint32_t *) malloc((size_t) NUM_BIAS_FIFOS*p->numAvgs*sizeof(uint32_t));
+  data = (uint32_t *) malloc((size_t) MIMO_NUM*p->numSamples*sizeof(uint32_t));
+  avg = (double *) malloc((size_t) MIMO_NUM*p->numSamples*sizeof(double));
+  if (!raw || !data || !avg) {
+    free(raw);
+    free(data);
+    free(avg);
+    return -1;
+  }
+  r->dt = fifo_sample_period(cfg,FIFO_BIAS_DATA_START_LOC);
+  for (i = 0;i < MIMO_NUM;i++) {
+    r->start[i] = IQ_READ(cfg,pwm[i]) & 0x3FF;
+  }
+  // The FPGA controller would fight the measurement
+  control = IQ_READ(cfg,pid[0]);
+  IQ_WRITE(cfg,pid[0],control & ~1u);
+
+  // Linear response of every signal to each output around the start
+  for (j = 0;j < MIMO_NUM;j++) {
+    Sx = Sxx = 0;
+    memset(Sy,0,sizeof(Sy));
+    memset(Sxy,0,sizeof(Sxy));
+    n = 0;
+    for (offset = -(int32_t) p->points;offset <= (int32_t) p->points;offset++) {
+      x = (double) offset*p->step;
+      if (r->start[j] + x < 0 || r->start[j] + x > MIMO_PWM_MAX) continue;
+      memcpy(V,r->start,sizeof(V));
+      V[j] = (uint16_t)(r->start[j] + x);
+      acquire_bias_point(cfg,V[0],V[1],V[2],p->numAvgs,&p->settle,raw,NULL);
+      bias_stats(raw,p->numAvgs,&st);
+      for (i = 0;i < MIMO_NUM;i++) {
+        y[i] = (double) st.sum[i]/st.n;
+        Sy[i] += y[i];
+        Sxy[i] += x*y[i];
+      }
+      Sx += x;
+      Sxx += x*x;
+      n++;
+    }
+    for (i = 0;i < MIMO_NUM;i++) {
+      r->G[i][j] = n > 1 ? (n*Sxy[i] - Sx*Sy[i])/(n*Sxx - Sx*Sx) : 0;
+      if (i == j) r->offset[i] = n > 0 ? (Sy[i] - r->G[i][j]*Sx)/n : 0;
+    }
+  }
+  write_to_bias_pwm(cfg,r->start[0],r->start[1],r->start[2]);
+  if (mimo_invert((const double (*)[MIMO_NUM]) r->G,Ginv) != 0) {
+    ret = -2;
+    goto done;
+  }
+  // The outputs which null the signals according to the fits
+  for (i = 0;i < MIMO_NUM;i++) {
+    x = r->start[i];
+    for (j = 0;j < MIMO_NUM;j++) {
+      x -= Ginv[i][j]*r->offset[j];
+    }
+    r->zero[i] = clamp_pwm(x);
+  }
+
+  // Open-loop step responses from the zero outputs
+  for (j = 0;j < MIMO_NUM;j++) {
+    if (record_bias_steps(cfg,mask,p->numSamples,r->zero[0],r->zero[1],r->zero[2],p->jump,j + 1,p->repeats,data,avg,NULL) == -1) {
+      ret = -1;
+      break;
+    }
+    r->tau[j] = step_tau(avg,p->numSamples,MIMO_NUM,j,jump_sample,r->dt,&step);
+    if (isnan(r->tau[j])) {
+      r->tau[j] = r->dt;
+      r->flags |= TUNE_NO_RESPONSE;
+    }
+  }
+  write_to_bias_pwm(cfg,r->start[0],r->start[1],r->start[2]);
+
+done:
+  IQ_WRITE(cfg,pid[0],control);
+  free(raw);
+  free(data);
+  free(avg);
+  return ret;
+}
+
+/*
+ * Splits a real gain into the integer K and the shift D with K/2^D closest to it, using
+ * the largest shift (up to max_shift) which keeps |K| within max_gain
+ */
+static int split_gain(double k,double max_gain,int max_shift,int *D) {
+  int shift = k != 0 ? (int) floor(log2(max_gain/fabs(k))) : 0;
+  if (shift < 0) shift = 0;
+  if (shift > max_shift) shift = max_shift;
+  *D = shift;
+  return (int) lround(ldexp(k,shift));
+}
+
+int tune_bias_gains(const tune_params_t *p,tune_result_t *r) {
+  double Ginv[MIMO_NUM][MIMO_NUM], largest, a;
+  int i, j, D;
+  long K;
+
+  if (mimo_invert((const double (*)[MIMO_NUM]) r->G,Ginv) != 0) return -1;
+  for (j = 0;j < MIMO_NUM;j++) {
+    r->bandwidth[j] = p->bandwidth[j] > 0 ? p->bandwidth[j] : p->factor/(2*M_PI*r->tau[j]);
+    a = 2*M_PI*r->bandwidth[j]*r->dt;
+    for (i = 0;i < MIMO_NUM;i++) {
+      r->Kreal[i][j] = Ginv[i][j]*a;
+    }
+  }
+  for (i = 0;i < MIMO_NUM;i++) {
+    // One shift per row, set by the largest gain of the row
+    largest = 0;
+    for (j = 0;j < MIMO_NUM;j++) {
+      if (fabs(r->Kreal[i][j]) > largest) largest = fabs(r->Kreal[i][j]);
+    }
+    split_gain(largest,TUNE_MAX_GAIN,255,&D);
+    r->D[i] = (uint8_t) D;
+    r->gain_reg[i] = (uint32_t) D << 24;
+    for (j = 0;j < MIMO_NUM;j++) {
+      K = lround(ldexp(r->Kreal[i][j],D));
+      if (K > 127 || K < -128) {
+        K = K > 0 ? 127 : -128;
+        r->flags |= TUNE_CLIPPED;
+      }
+      r->K[i][j] = (int8_t) K;
+      r->gain_reg[i] |= ((uint32_t) K & 0xFF) << (8*j);
+    }
+  }
+  return 0;
+}
+
+int tune_phase(void *cfg,const tune_params_t *p,tune_result_t *r) {
+  const uint32_t jump_sample = step_jump_sample(1,p->numSamples);
+  uint32_t *data, control;
+  double *avg, step, kp, ki;
+  uint16_t V;
+  int D, K, ret;
+
+  data = (uint32_t *) malloc((size_t) p->numSamples*sizeof(uint32_t));
+  avg = (double *) malloc((size_t) p->numSamples*sizeof(double));
+  if (!data || !avg) {
+    free(data);
+    free(avg);
+    return -1;
+  }
+  r->phase_dt = fifo_sample_period(cfg,FIFO_PHASE_DATA_START_LOC);
+  r->phase_actuator = (IQ_READ(cfg,top) >> 2) & 1;
+  V = r->phase_actuator ? IQ_READ(cfg,pwm[3]) & 0x3FF : IQ_READ(cfg,dac) & 0x3FFF;
+  control = IQ_READ(cfg,phase_control);
+  set_lock_status(cfg,0);
+  ret = record_phase_steps(cfg,1,p->numSamples,V,p->jump,r->phase_actuator,p->repeats,data,avg,NULL);
+  IQ_WRITE(cfg,phase_control,control);
+  if (ret == -1) {
+    free(data);
+    free(avg);
+    return -1;
+  }
+  r->phase_tau = step_tau(avg,p->numSamples,1,0,jump_sample,r->phase_dt,&step);
+  free(data);
+  free(avg);
+  if (isnan(r->phase_tau) || p->jump == 0) {
+    r->phase_flags |= TUNE_NO_RESPONSE;
+    return -2;
+  }
+
+  r->phase = 1;
+  r->phase_gain = step/p->jump;
+  r->phase_bandwidth = p->phase_bandwidth > 0 ? p->phase_bandwidth : p->factor/(2*M_PI*r->phase_tau);
+  kp = 2*M_PI*r->phase_bandwidth*r->phase_tau/fabs(r->phase_gain);
+  ki = 2*M_PI*r->phase_bandwidth*r->phase_dt/fabs(r->phase_gain);
+  K = split_gain(kp,TUNE_MAX_PHASE_GAIN,127,&D);
+  r->Kp = (uint8_t)(K > TUNE_MAX_PHASE_GAIN ? TUNE_MAX_PHASE_GAIN : K);
+  r->Dp = (int8_t) D;
+  if (K > TUNE_MAX_PHASE_GAIN) r->phase_flags |= TUNE_CLIPPED;
+  K = split_gain(ki,TUNE_MAX_PHASE_GAIN,127,&D);
+  r->Ki = (uint8_t)(K > TUNE_MAX_PHASE_GAIN ? TUNE_MAX_PHASE_GAIN : K);
+  r->Di = (int8_t) D;
+  if (K > TUNE_MAX_PHASE_GAIN) r->phase_flags |= TUNE_CLIPPED;
+  // With polarity 0 the error is control - measurement, which needs a positive plant
+  r->polarity = r->phase_gain < 0;
+  r->phase_gain_reg = (uint32_t) r->Kp | ((uint32_t) r->Ki << 8);
+  r->phase_divisor_reg = ((uint32_t) r->Dp & 0xFF) | (((uint32_t) r->Di & 0xFF) << 8);
+  return 0;
+}
+
+void tune_print(FILE *f,const tune_result_t *r) {
+  int i;
+  fprintf(f,"# bias sample period %.6e s, flags %u\n",r->dt,r->flags);
+  for (i = 0;i < MIMO_NUM;i++) {
+    fprintf(f,"# G[%d] = % .6g % .6g % .6g counts/count, offset % .6g, start %u, zero %u\n",i,
+            r->G[i][0],r->G[i][1],r->G[i][2],r->offset[i],r->start[i],r->zero[i]);
+  }
+  for (i = 0;i < MIMO_NUM;i++) {
+    fprintf(f,"# loop %d: tau %.6e s, bandwidth %.6g Hz, K = %+4d %+4d %+4d, D = %u\n",i,r->tau[i],r->bandwidth[i],
+            r->K[i][0],r->K[i][1],r->K[i][2],r->D[i]);
+  }
+  if (r->phase) {
+    fprintf(f,"# phase: %s, gain %.6g counts/count, tau %.6e s, bandwidth %.6g Hz, Kp %u/2^%d, Ki %u/2^%d, polarity %u, flags %u\n",
+            r->phase_actuator ? "PWM" : "DAC",r->phase_gain,r->phase_tau,r->phase_bandwidth,r->Kp,r->Dp,r->Ki,r->Di,
+            r->polarity,r->phase_flags);
+  }
+  fprintf(f,"# register value\n");
+  for (i = 0;i < MIMO_NUM;i++) {
+    fprintf(f,"0x%08x 0x%08x\n",PWM_LOC + 4*i,r->zero[i]);
+  }
+  for (i = 0;i < MIMO_NUM;i++) {
+    fprintf(f,"0x%08x 0x%08x\n",PID_GAIN_REG + 4*i,r->gain_reg[i]);
+  }
+  if (r->phase) {
+    fprintf(f,"0x%08x 0x%08x\n",PHASE_GAIN_REG,r->phase_gain_reg);
+    fprintf(f,"0x%08x 0x%08x\n",PHASE_DIVISOR_REG,r->phase_divisor_reg);
+  }
+}
+
+void tune_write(void *cfg,const tune_result_t *r) {
+  uint32_t reg;
+  write_to_bias_pwm(cfg,r->zero[0],r->zero[1],r->zero[2]);
+  IQ_WRITE(cfg,pid[2],r->gain_reg[0]);
+  IQ_WRITE(cfg,pid[3],r->gain_reg[1]);
+  IQ_WRITE(cfg,pid[4],r->gain_reg[2]);
+  if (r->phase) {
+    IQ_WRITE(cfg,phase_gain,r->phase_gain_reg);
+    IQ_WRITE(cfg,phase_divisor,r->phase_divisor_reg);
+    reg = IQ_READ(cfg,phase_control);
+    reg = (reg & ~((uint32_t) 1 << PHASE_POLARITY_BIT)) | (r->polarity << PHASE_POLARITY_BIT);
+    IQ_WRITE(cfg,phase_control,reg);
+  }
+}
@@ -0,0 +1,118 @@
+#ifndef FEEDBACK_TUNING_H_
+#define FEEDBACK_TUNING_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "iq_bias_control.h"
+#include "mimo_control.h"
+
+/*
+ * Automatic tuning of the FPGA feedback, as automatically_set_feedback.m does it but in
+ * one run on the device.
+ *
+ * 1. Linear response: with the FPGA controller disabled, each output j is moved by
+ *    -points*step to +points*step counts around the starting values and the mean of
+ *    every bias signal i is fitted with a line.  The slopes form G [counts/count], and
+ *    the outputs are moved to the values where the lines predict zero signals, as
+ *    get_linear_response.m does.
+ * 2. Step responses: each output is stepped by jump counts from those values, repeats
+ *    times (see step_response.h), and the time constant of signal j for output j is the
+ *    10%-90% rise time divided by ln 9, at least one sample.
+ * 3. Gains: the target bandwidth of loop j is factor/(2 pi tau_j) unless it is given.
+ *    The integral controller adds (K/2^D) (r - y) to the outputs every sample of period
+ *    dt, so K/2^D = G^-1 diag(2 pi f_j dt), and each row is scaled by the largest shift
+ *    D that keeps every |K| within TUNE_MAX_GAIN.
+ *
+ * The phase lock is tuned the same way from a step of its actuator (the phase PWM or the
+ * auxiliary DAC, as routed in TOP_REG): with the plant a gain g and time constant tau,
+ * the PI gains Kp = 2 pi f tau/|g| and Ki = 2 pi f dt/|g| per sample give a loop of
+ * bandwidth f with the zero on the plant pole.  The polarity follows the sign of g
+ */
+#define TUNE_DEFAULT_STEP           3         //[counts], about 5 mV
+#define TUNE_DEFAULT_POINTS         10        //Points either side of the start
+#define TUNE_DEFAULT_AVGS           1000
+#define TUNE_DEFAULT_JUMP           16        //[counts]
+#define TUNE_DEFAULT_SAMPLES        4096
+#define TUNE_DEFAULT_REPEATS        4
+#define TUNE_DEFAULT_FACTOR         0.5
+#define TUNE_MAX_GAIN               120       //Largest |K| of the bias controller
+#define TUNE_MAX_PHASE_GAIN         255
+
+#define PID_CONTROL_REG             0x00000200
+#define PID_GAIN_REG                0x00000208
+#define PHASE_GAIN_REG              0x00000304
+#define PHASE_DIVISOR_REG           0x00000308
+#define PHASE_POLARITY_BIT          30
+
+#define TUNE_CLIPPED                0x1       //A gain did not fit its register
+#define TUNE_NO_RESPONSE            0x2       //A step was lost in the noise
+
+typedef struct {
+  uint32_t step;                  //Between points of the linear scan [counts]
+  uint32_t points;                //Points either side of the start
+  uint32_t numAvgs;               //Samples averaged at each point
+  bias_settle_t settle;           //Settling at each point
+  uint16_t jump;                  //Step of the step responses [counts]
+  uint32_t numSamples;            //Samples of each step response
+  uint32_t repeats;               //Averaged step responses
+  double factor;                  //Target bandwidth over the open-loop bandwidth
+  double bandwidth[MIMO_NUM];     //Target bandwidths [Hz], 0 to use factor
+  double phase_bandwidth;         //[Hz], 0 to use factor
+} tune_params_t;
+
+typedef struct {
+  uint16_t start[MIMO_NUM];       //Outputs before tuning [counts]
+  double G[MIMO_NUM][MIMO_NUM];   //Signal i per count on output j
+  double offset[MIMO_NUM];        //Signal i at the start, from the fit for output i
+  uint16_t zero[MIMO_NUM];        //Outputs of zero signals [counts]
+  double tau[MIMO_NUM];           //[s]
+  double dt;                      //Bias sample period [s]
+  double bandwidth[MIMO_NUM];     //Target bandwidths [Hz]
+  double Kreal[MIMO_NUM][MIMO_NUM];
+  int8_t K[MIMO_NUM][MIMO_NUM];
+  uint8_t D[MIMO_NUM];
+  uint32_t gain_reg[MIMO_NUM];    //Values of the registers from PID_GAIN_REG
+  uint32_t flags;                 //TUNE_*
+
+  int phase;                      //Phase lock tuned
+  uint32_t phase_actuator;        //1 for the phase PWM, 0 for the auxiliary DAC
+  double phase_gain;              //Phase per actuator count
+  double phase_tau;               //[s]
+  double phase_dt;                //Phase sample period [s]
+  double phase_bandwidth;         //[Hz]
+  uint8_t Kp, Ki;
+  int8_t Dp, Di;
+  uint32_t polarity;
+  uint32_t phase_gain_reg;        //Values of PHASE_GAIN_REG and PHASE_DIVISOR_REG
+  uint32_t phase_divisor_reg;
+  uint32_t phase_flags;           //TUNE_*
+} tune_result_t;
+
+void tune_defaults(tune_params_t *p);
+/*
+ * Steps 1 and 2 for the bias controller, which is disabled while measuring and
+ * re-enabled afterwards if it was on.  The outputs are left at the starting values.
+ * Returns -1 if memory could not be allocated and -2 if G is singular
+ */
+int tune_measure_bias(void *cfg,const tune_params_t *p,tune_result_t *r);
+/*
+ * Step 3 for the bias controller.  Returns -1 if G is singular
+ */
+int tune_bias_gains(const tune_params_t *p,tune_result_t *r);
+/*
+ * Measures the phase actuator and computes the PI gains.  Returns -1 if memory could not
+ * be allocated and -2 if the step could not be seen
+ */
+int tune_phase(void *cfg,const tune_params_t *p,tune_result_t *r);
+/*
+ * Prints the measurements and gains as comments, followed by one line of address and
+ * value for every register to write
+ */
+void tune_print(FILE *f,const tune_result_t *r);
+/*
+ * Writes the zero outputs and the gain registers to the device.  The enable bits are
+ * left as they are
+ */
+void tune_write(void *cfg,const tune_result_t *r);
+#endif
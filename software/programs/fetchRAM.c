@@ -4,24 +4,24 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <unistd.h>
-#include <sys/mman.h>
-#include <fcntl.h>
 #include <math.h>
 #include <time.h>
 
 #include "iq_bias_control.h"
+#include "capture_output.h"
  
 int main(int argc, char **argv)
 {
     int fd;		                //File identifier
     int numSamples;	          //Number of samples to collect
     void *cfg;		            //A pointer to a memory location.  The * indicates that it is a pointer - it points to a location in memory
-    char *name = "/dev/mem";	//Name of the memory resource
 
     uint32_t i, incr = 0;
     uint32_t tmp;
     uint32_t *data;
-    FILE *ptr;
+    char *outputFile = NULL;  //Output destination, SavedData.bin by default
+    int memfd;                //Memory file backing the data buffer, if any
+    int saveErr = 0;          //Writing the output failed
 
     /*
     * Parse the input arguments
@@ -31,34 +31,29 @@ int main(int argc, char **argv)
     } else {
         numSamples = atoi(argv[1]);
     }
+    if (argc >= 3) {
+        outputFile = argv[2];
+    }
 
 
-    data = (uint32_t *) malloc(numSamples * sizeof(uint32_t));
+    data = (uint32_t *) alloc_capture_buffer((size_t) numSamples * sizeof(uint32_t),&memfd);
     if (!data) {
         printf("Error allocating memory");
         return -1;
     }
-    //This returns a file identifier corresponding to the memory, and allows for reading and writing.  O_RDWR is just a constant
-    if((fd = open(name, O_RDWR)) < 0) {
-        perror("open");
+    cfg = map_device(RAM_DATA_LOC,&fd);
+    if (!cfg) {
         return 1;
     }
-    /*
-    * mmap maps the memory location 0x40000000 to the pointer cfg, which "points" to that location in memory.
-    */
-    cfg = mmap(0,MAP_SIZE,PROT_READ|PROT_WRITE,MAP_SHARED,fd,RAM_DATA_LOC);
     for (i = 0;i<numSamples;i++) {
-      *(data + i) = *((uint32_t *)(cfg + (i << 2)));
+      *(data + i) = reg_read(cfg,(i << 2));
     }
     /*
      * Save then free data
      */
-    ptr = fopen("SavedData.bin","wb");
-    fwrite(data,4,(size_t)(numSamples),ptr);
-    fclose(ptr);
-    free(data);
+    saveErr = write_capture(outputFile,data,(size_t) numSamples * 4,memfd);
+    free_capture_buffer(data,(size_t) numSamples * 4,memfd);
 
-    //Unmap cfg from pointing to the previous location in memory
-    munmap(cfg, MAP_SIZE);
-    return 0;	//C functions should have a return value - 0 is the usual "no error" return value
+    unmap_device(cfg,fd);
+    return saveErr ? 1 : 0;	//C functions should have a return value - 0 is the usual "no error" return value
 }
@@ -0,0 +1,345 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "iq_bias_control.h"
+#include "capture_output.h"
+#include "fifo_stream.h"
+
+static void *reader_thread(void *arg) {
+  fifo_stream_t *s = (fifo_stream_t *) arg;
+  uint64_t head, tail, fill;
+  uint64_t remaining = s->numSamples;
+  uint32_t samples_per_block = s->block_words/s->saveFactor;
+  uint32_t n, idx;
+  uint32_t *dst;
+  cpu_set_t cpus;
+
+  if (s->reader_cpu >= 0) {
+    CPU_ZERO(&cpus);
+    CPU_SET(s->reader_cpu,&cpus);
+    if (pthread_setaffinity_np(pthread_self(),sizeof(cpus),&cpus) != 0) {
+      fprintf(stderr,"Could not pin reader thread to CPU %d\n",s->reader_cpu);
+    }
+  }
+  if (rt_enabled()) {
+    rt_set_priority(RT_DEFAULT_PRIORITY);
+  }
+
+  start_fifo(s->cfg);
+  while (atomic_load_explicit(&s->running,memory_order_relaxed)) {
+    n = samples_per_block;
+    if (s->numSamples > 0) {
+      if (remaining == 0) break;
+      if (remaining < n) n = (uint32_t) remaining;
+    }
+    head = atomic_load_explicit(&s->head,memory_order_relaxed);
+    tail = atomic_load_explicit(&s->tail,memory_order_acquire);
+    if (head - tail < s->num_blocks) {
+      idx = (uint32_t)(head % s->num_blocks);
+      dst = s->blocks + (size_t) idx*s->block_words;
+    } else {
+      //Ring is full: keep draining the FIFOs but discard the data
+      idx = 0;
+      dst = s->scratch;
+    }
+    read_fifo_mask(s->cfg,s->loc,s->mask,n,dst);
+    atomic_fetch_add_explicit(&s->words_read,(uint64_t) n*s->saveFactor,memory_order_relaxed);
+    if (dst == s->scratch) {
+      atomic_fetch_add_explicit(&s->words_dropped,(uint64_t) n*s->saveFactor,memory_order_relaxed);
+      atomic_fetch_add_explicit(&s->overruns,1,memory_order_relaxed);
+    } else {
+      s->block_len[idx] = n*s->saveFactor;
+      fill = head + 1 - tail;
+      if (fill > atomic_load_explicit(&s->max_fill,memory_order_relaxed)) {
+        atomic_store_explicit(&s->max_fill,fill,memory_order_relaxed);
+      }
+      atomic_store_explicit(&s->head,head + 1,memory_order_release);
+    }
+    if (s->numSamples > 0) {
+      remaining -= n;
+    }
+  }
+  stop_fifo(s->cfg);
+  atomic_store_explicit(&s->reader_done,1,memory_order_release);
+  return NULL;
+}
+
+static void *writer_thread(void *arg) {
+  fifo_stream_t *s = (fifo_stream_t *) arg;
+  uint64_t head, tail;
+  uint32_t idx;
+  int ret;
+
+  while (1) {
+    tail = atomic_load_explicit(&s->tail,memory_order_relaxed);
+    head = atomic_load_explicit(&s->head,memory_order_acquire);
+    if (tail < head) {
+      idx = (uint32_t)(tail % s->num_blocks);
+      ret = s->consumer(s->consumer_arg,s->blocks + (size_t) idx*s->block_words,s->block_len[idx]);
+      if (ret != 0) {
+        //Output has failed or asked to stop, so stop the reader as well
+        if (ret < 0) atomic_store(&s->consumer_failed,1);
+        atomic_store(&s->running,0);
+        break;
+      }
+      atomic_fetch_add_explicit(&s->words_written,s->block_len[idx],memory_order_relaxed);
+      atomic_store_explicit(&s->tail,tail + 1,memory_order_release);
+    } else if (atomic_load_explicit(&s->reader_done,memory_order_acquire)) {
+      //Check once more in case a block was published just before the reader finished
+      if (atomic_load_explicit(&s->head,memory_order_acquire) == tail) break;
+    } else {
+      usleep(1000);
+    }
+  }
+  return NULL;
+}
+
+int stream_init(fifo_stream_t *s,void *cfg,uint32_t loc,uint32_t mask,uint64_t numSamples,uint32_t block_words,uint32_t num_blocks) {
+  uint32_t saveFactor = __builtin_popcount(mask);
+  memset(s,0,sizeof(*s));
+  if (saveFactor == 0) {
+    return -1;
+  }
+  if (block_words == 0) {
+    block_words = STREAM_DEFAULT_BLOCK_WORDS;
+  }
+  if (num_blocks < 2) {
+    num_blocks = STREAM_DEFAULT_NUM_BLOCKS;
+  }
+  //Blocks always hold a whole number of samples
+  block_words -= block_words % saveFactor;
+  if (block_words == 0) {
+    block_words = saveFactor;
+  }
+
+  s->cfg = cfg;
+  s->loc = loc;
+  s->mask = mask;
+  s->saveFactor = saveFactor;
+  s->numSamples = numSamples;
+  s->block_words = block_words;
+  s->num_blocks = num_blocks;
+  s->reader_cpu = -1;
+
+  s->blocks = (uint32_t *) malloc((size_t) num_blocks*block_words*sizeof(uint32_t));
+  s->block_len = (uint32_t *) malloc(num_blocks*sizeof(uint32_t));
+  s->scratch = (uint32_t *) malloc(block_words*sizeof(uint32_t));
+  if (!s->blocks || !s->block_len || !s->scratch) {
+    stream_free(s);
+    return -1;
+  }
+  //Touch all pages now so that the reader never takes a page fault
+  memset(s->blocks,0,(size_t) num_blocks*block_words*sizeof(uint32_t));
+  memset(s->scratch,0,block_words*sizeof(uint32_t));
+  return 0;
+}
+
+int stream_start(fifo_stream_t *s,stream_consumer_t consumer,void *consumer_arg,int reader_cpu) {
+  s->consumer = consumer;
+  s->consumer_arg = consumer_arg;
+  s->reader_cpu = reader_cpu;
+  atomic_store(&s->running,1);
+  if (pthread_create(&s->writer,NULL,writer_thread,s) != 0) {
+    return -1;
+  }
+  if (pthread_create(&s->reader,NULL,reader_thread,s) != 0) {
+    atomic_store(&s->running,0);
+    atomic_store(&s->reader_done,1);
+    pthread_join(s->writer,NULL);
+    return -1;
+  }
+  return 0;
+}
+
+void stream_stop(fifo_stream_t *s) {
+  atomic_store(&s->running,0);
+}
+
+int stream_is_done(fifo_stream_t *s) {
+  if (!atomic_load(&s->reader_done)) {
+    return 0;
+  }
+  return !atomic_load(&s->running) || atomic_load(&s->tail) == atomic_load(&s->head);
+}
+
+int stream_failed(fifo_stream_t *s) {
+  return atomic_load(&s->consumer_failed);
+}
+
+void stream_join(fifo_stream_t *s) {
+  pthread_join(s->reader,NULL);
+  pthread_join(s->writer,NULL);
+}
+
+void stream_free(fifo_stream_t *s) {
+  free(s->blocks);
+  free(s->block_len);
+  free(s->scratch);
+  s->blocks = NULL;
+  s->block_len = NULL;
+  s->scratch = NULL;
+}
+
+void stream_print_stats(fifo_stream_t *s,FILE *f) {
+  fprintf(f,"Words read: %llu, written: %llu, dropped: %llu, overruns: %llu, max blocks queued: %llu/%u\n",
+          (unsigned long long) atomic_load(&s->words_read),
+          (unsigned long long) atomic_load(&s->words_written),
+          (unsigned long long) atomic_load(&s->words_dropped),
+          (unsigned long long) atomic_load(&s->overruns),
+          (unsigned long long) atomic_load(&s->max_fill),
+          s->num_blocks);
+}
+
+int stream_write_fd(void *arg,const uint32_t *block,uint32_t num_words) {
+  int fd = *((int *) arg);
+  return write_all(fd,block,(size_t) num_words*sizeof(uint32_t));
+}
+
+/*
+ * Consumer which passes each block to the tap, decimates it and passes the result on to
+ * the output consumer
+ */
+typedef struct {
+  stream_consumer_t tap;
+  void *tap_arg;
+  decimator_t *d;
+  uint32_t *out;                //Decimated block
+  stream_consumer_t next;
+  void *next_arg;
+} stream_pipeline_t;
+
+static int stream_pipeline(void *arg,const uint32_t *block,uint32_t num_words) {
+  stream_pipeline_t *c = (stream_pipeline_t *) arg;
+  int ret;
+  if (c->tap && (ret = c->tap(c->tap_arg,block,num_words)) != 0) {
+    return ret;
+  }
+  if (c->d) {
+    num_words = decimate(c->d,block,num_words/c->d->num_streams,c->out)*c->d->num_streams;
+    block = c->out;
+    if (num_words == 0) return 0;
+  }
+  return c->next(c->next_arg,block,num_words);
+}
+
+static volatile sig_atomic_t stop_requested = 0;
+static volatile sig_atomic_t stats_requested = 0;
+
+static void handle_stop(int sig) {
+  stop_requested = 1;
+}
+
+static void handle_stats(int sig) {
+  stats_requested = 1;
+}
+
+int stream_to_output(void *cfg,uint32_t loc,uint32_t mask,uint64_t numSamples,const char *dest,
+                     const capture_header_t *hdr,decimator_t *dec,stream_consumer_t tap,void *tap_arg,uint32_t block_words,uint32_t num_blocks,int reader_cpu,int debugFlag) {
+  fifo_stream_t s;
+  capture_file_t cf;
+  struct sigaction sa;
+  stream_consumer_t consumer;
+  void *consumer_arg;
+  stream_pipeline_t dc;
+  int fd = -1, ticks = 0, err;
+
+  if (dec) {
+    numSamples *= dec->factor;
+  }
+  if (stream_init(&s,cfg,loc,mask,numSamples,block_words,num_blocks) != 0) {
+    printf("Error allocating memory");
+    return -1;
+  }
+  dc.out = NULL;
+  if (dec) {
+    dc.out = (uint32_t *) malloc((size_t) s.block_words*sizeof(uint32_t));
+    if (!dc.out) {
+      printf("Error allocating memory");
+      stream_free(&s);
+      return -1;
+    }
+  }
+  if (hdr) {
+    if (capture_file_open(&cf,dest,hdr) != 0) {
+      free(dc.out);
+      stream_free(&s);
+      return -1;
+    }
+    consumer = stream_write_capture_file;
+    consumer_arg = &cf;
+  } else {
+    if ((fd = open_output(dest)) < 0) {
+      free(dc.out);
+      stream_free(&s);
+      return -1;
+    }
+    consumer = stream_write_fd;
+    consumer_arg = &fd;
+  }
+  if (dec || tap) {
+    dc.tap = tap;
+    dc.tap_arg = tap_arg;
+    dc.d = dec;
+    dc.next = consumer;
+    dc.next_arg = consumer_arg;
+    consumer = stream_pipeline;
+    consumer_arg = &dc;
+  }
+
+  memset(&sa,0,sizeof(sa));
+  sa.sa_handler = handle_stop;
+  sigaction(SIGINT,&sa,NULL);
+  sigaction(SIGTERM,&sa,NULL);
+  sa.sa_handler = handle_stats;
+  sigaction(SIGUSR1,&sa,NULL);
+  //A reader closing the pipe or socket should stop the stream, not kill the process
+  signal(SIGPIPE,SIG_IGN);
+
+  if (stream_start(&s,consumer,consumer_arg,reader_cpu) != 0) {
+    fprintf(stderr,"Could not start streaming threads\n");
+    if (hdr) {
+      capture_file_close(&cf);
+    } else {
+      close_output(fd);
+    }
+    free(dc.out);
+    stream_free(&s);
+    return -1;
+  }
+  while (!stream_is_done(&s)) {
+    usleep(100000);
+    if (stop_requested) {
+      stream_stop(&s);
+    }
+    if (stats_requested || (debugFlag && (++ticks % 10 == 0))) {
+      stats_requested = 0;
+      stream_print_stats(&s,stderr);
+    }
+  }
+  stream_join(&s);
+  if (debugFlag || atomic_load(&s.overruns) > 0) {
+    stream_print_stats(&s,stderr);
+  }
+  err = stream_failed(&s) ? -1 : 0;
+  if (err) {
+    fprintf(stderr,"Writing the output failed, so it is incomplete\n");
+  }
+  if (hdr) {
+    if (capture_file_close(&cf) != 0) {
+      fprintf(stderr,"Could not complete the capture file\n");
+      err = -1;
+    }
+  } else {
+    close_output(fd);
+  }
+  free(dc.out);
+  stream_free(&s);
+  return err;
+}
@@ -0,0 +1,91 @@
+#ifndef FIFO_STREAM_H_
+#define FIFO_STREAM_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "capture_file.h"
+#include "decimate.h"
+
+#define STREAM_DEFAULT_BLOCK_WORDS  65536
+#define STREAM_DEFAULT_NUM_BLOCKS   64
+
+/*
+ * Continuous FIFO streaming.  A reader thread (optionally pinned to one CPU) drains the
+ * FIFOs into a pre-allocated single-producer/single-consumer ring of large blocks, and a
+ * writer thread flushes whole blocks to the output.  If the writer falls behind and the
+ * ring is full, the reader keeps draining the hardware FIFOs into a scratch block so that
+ * they never back up; those words are counted as dropped and the block as an overrun.
+ */
+typedef struct fifo_stream fifo_stream_t;
+
+/*
+ * Called by the writer thread for each full block.  NUM_WORDS is always a multiple of
+ * the save factor.  Return 1 to stop the stream, or -1 if the output has failed, which
+ * stops the stream and is reported by stream_failed()
+ */
+typedef int (*stream_consumer_t)(void *arg,const uint32_t *block,uint32_t num_words);
+
+struct fifo_stream {
+  void *cfg;                    //Register space
+  uint32_t loc;                 //Address of the first FIFO
+  uint32_t mask;                //FIFOs to read, counted from loc
+  uint32_t saveFactor;          //Number of FIFOs read per sample
+  uint64_t numSamples;          //Number of samples to acquire, 0 for unbounded
+  int reader_cpu;               //CPU to pin the reader to, -1 for no pinning
+
+  uint32_t block_words;         //Words per block, a multiple of saveFactor
+  uint32_t num_blocks;          //Number of blocks in the ring
+  uint32_t *blocks;             //Ring storage, num_blocks*block_words words
+  uint32_t *block_len;          //Number of valid words in each block
+  uint32_t *scratch;            //Block used when the ring is full
+
+  stream_consumer_t consumer;
+  void *consumer_arg;
+
+  atomic_uint_fast64_t head;    //Number of blocks produced by the reader
+  atomic_uint_fast64_t tail;    //Number of blocks consumed by the writer
+  atomic_int running;           //Cleared to stop the stream
+  atomic_int reader_done;
+  atomic_int consumer_failed;    //The consumer returned an error
+
+  //Statistics, safe to read from any thread while streaming
+  atomic_uint_fast64_t words_read;
+  atomic_uint_fast64_t words_written;
+  atomic_uint_fast64_t words_dropped;
+  atomic_uint_fast64_t overruns;
+  atomic_uint_fast64_t max_fill;    //Largest number of blocks waiting to be written
+
+  pthread_t reader;
+  pthread_t writer;
+};
+
+int stream_init(fifo_stream_t *s,void *cfg,uint32_t loc,uint32_t mask,uint64_t numSamples,uint32_t block_words,uint32_t num_blocks);
+int stream_start(fifo_stream_t *s,stream_consumer_t consumer,void *consumer_arg,int reader_cpu);
+void stream_stop(fifo_stream_t *s);
+int stream_is_done(fifo_stream_t *s);
+int stream_failed(fifo_stream_t *s);
+void stream_join(fifo_stream_t *s);
+void stream_free(fifo_stream_t *s);
+void stream_print_stats(fifo_stream_t *s,FILE *f);
+
+/*
+ * Consumer which writes blocks to the file descriptor pointed to by ARG
+ */
+int stream_write_fd(void *arg,const uint32_t *block,uint32_t num_words);
+/*
+ * Runs a complete stream of the FIFOs selected by MASK, counted from the FIFO at LOC, to
+ * the output destination DEST (see open_output()) until numSamples have been acquired or SIGINT/SIGTERM is received.  If HDR is not NULL the
+ * output is written as a capture file with that header, otherwise as raw words.
+ * SIGUSR1 prints the statistics to stderr while running, as does the debug flag once
+ * per second.  If TAP is not NULL it is called with every block before it is written,
+ * e.g. to keep running statistics.  If DEC is not NULL the blocks are then decimated by
+ * the writer thread before being written, and numSamples counts the decimated samples.
+ * Returns -1 if the stream could not be started, the output failed (e.g. a full disk or
+ * a closed socket) or the output could not be completed, so the data may be truncated
+ */
+int stream_to_output(void *cfg,uint32_t loc,uint32_t mask,uint64_t numSamples,const char *dest,
+                     const capture_header_t *hdr,decimator_t *dec,stream_consumer_t tap,void *tap_arg,uint32_t block_words,uint32_t num_blocks,int reader_cpu,int debugFlag);
+#endif
@@ -0,0 +1,41 @@
+#ifndef IQ_BACKEND_H_
+#define IQ_BACKEND_H_
+
+#include <stdint.h>
+
+/*
+ * Access to the FPGA address space.  Programs map a block with map_device(), so that the
+ * same code runs on the Red Pitaya (through /dev/mem) or, when built with -DMOCK_BACKEND,
+ * against the emulated device in mock_backend.c.  Registers and FIFOs are accessed by
+ * name with IQ_READ() and IQ_WRITE() from iq_registers.h.  reg_read() and reg_write()
+ * are only for the RAM block and for offsets that are computed at run time
+ */
+
+/*
+ * Maps MAP_SIZE bytes of the address space starting at LOC (MEM_LOC or RAM_DATA_LOC).
+ * Returns NULL on failure, after printing the reason
+ */
+void *map_device(uint32_t loc,int *fd);
+void unmap_device(void *ptr,int fd);
+
+#ifdef MOCK_BACKEND
+uint32_t mock_reg_read(void *base,uint32_t offset);
+void mock_reg_write(void *base,uint32_t offset,uint32_t value);
+
+static inline uint32_t reg_read(void *base,uint32_t offset) {
+  return mock_reg_read(base,offset);
+}
+
+static inline void reg_write(void *base,uint32_t offset,uint32_t value) {
+  mock_reg_write(base,offset,value);
+}
+#else
+static inline uint32_t reg_read(void *base,uint32_t offset) {
+  return *((volatile uint32_t *)((uint8_t *) base + offset));
+}
+
+static inline void reg_write(void *base,uint32_t offset,uint32_t value) {
+  *((volatile uint32_t *)((uint8_t *) base + offset)) = value;
+}
+#endif
+#endif
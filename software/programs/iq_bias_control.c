@@ -1,42 +1,511 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <ctype.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
 #include "iq_bias_control.h"
 
-int start_fifo(void *cfg) {
-  //Disable FIFO
-  *((uint32_t *)(cfg + FIFO_CONTROL_LOC)) = 0;
-  //Reset FIFO
-  usleep(1);
-  *((uint32_t *)(cfg + FIFO_CONTROL_LOC)) = (1 << 1);
-  usleep(1);
-  *((uint32_t *)(cfg + FIFO_CONTROL_LOC)) = 0;
-  usleep(1);
-  //Enable FIFO
-  *((uint32_t *)(cfg + FIFO_CONTROL_LOC)) = 1;
+#ifndef MOCK_BACKEND
+void *map_device(uint32_t loc,int *fd) {
+  void *ptr;
+  //This returns a file identifier corresponding to the memory, and allows for reading and writing
+  if ((*fd = open("/dev/mem",O_RDWR)) < 0) {
+    perror("open");
+    return NULL;
+  }
+  ptr = mmap(0,MAP_SIZE,PROT_READ|PROT_WRITE,MAP_SHARED,*fd,loc);
+  if (ptr == MAP_FAILED) {
+    perror("mmap");
+    close(*fd);
+    return NULL;
+  }
+  return ptr;
+}
+
+void unmap_device(void *ptr,int fd) {
+  munmap(ptr,MAP_SIZE);
+  close(fd);
+}
+#endif
+
+static int fifo_lock_fd = -1;
+static int fifo_lock_held = 0;
+
+int fifo_lock(int wait) {
+  if (fifo_lock_held) {
+    return 0;
+  }
+  if (fifo_lock_fd < 0) {
+    fifo_lock_fd = open(FIFO_LOCK_FILE,O_RDWR | O_CREAT | O_CLOEXEC,0666);
+    if (fifo_lock_fd < 0) {
+      perror("open " FIFO_LOCK_FILE);
+      fifo_lock_fd = -2;
+    }
+  }
+  if (fifo_lock_fd == -2) {
+    //Already warned
+    return 0;
+  }
+  if (flock(fifo_lock_fd,LOCK_EX | LOCK_NB) != 0) {
+    if (errno != EWOULDBLOCK) {
+      perror("flock");
+      return 0;
+    }
+    if (!wait) return -1;
+    //Say why the program seems to hang, e.g. behind mimo_bias_control
+    fprintf(stderr,"Waiting for the FIFO lock held by another program\n");
+    while (flock(fifo_lock_fd,LOCK_EX) != 0) {
+      if (errno != EINTR) {
+        perror("flock");
+        return 0;
+      }
+    }
+  }
+  fifo_lock_held = 1;
   return 0;
 }
 
-int stop_fifo(void *cfg) {
-  *((uint32_t *)(cfg + FIFO_CONTROL_LOC)) = (1 << 1);
-  usleep(1);
-  *((uint32_t *)(cfg + FIFO_CONTROL_LOC)) = 0;
+void fifo_unlock(void) {
+  if (fifo_lock_held) {
+    flock(fifo_lock_fd,LOCK_UN);
+    fifo_lock_held = 0;
+  }
+}
+
+static int rt_active = 0;
+
+static void __attribute__((noinline)) prefault_stack(void) {
+  uint8_t stack[RT_STACK_PREFAULT];
+  volatile uint8_t *p = stack;
+  uint32_t i;
+  //Written through a volatile pointer so that the stores are not optimised away
+  for (i = 0;i < RT_STACK_PREFAULT;i += 1024) {
+    p[i] = 0;
+  }
+}
+
+int rt_set_priority(int priority) {
+  struct sched_param sp;
+  sp.sched_priority = priority;
+  //Applies to the calling thread only
+  if (sched_setscheduler(0,SCHED_FIFO,&sp) != 0) {
+    perror("sched_setscheduler");
+    return -1;
+  }
+  return 0;
+}
+
+int rt_enter(int cpu,int priority) {
+  cpu_set_t cpus;
+  int ret = 0;
+
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+    perror("mlockall");
+    ret = -1;
+  }
+  prefault_stack();
+  if (priority > 0 && rt_set_priority(priority) != 0) {
+    ret = -1;
+  }
+  if (cpu >= 0) {
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu,&cpus);
+    if (sched_setaffinity(0,sizeof(cpus),&cpus) != 0) {
+      perror("sched_setaffinity");
+      ret = -1;
+    }
+  }
+  //The timing does not need privileges, so it is used even if the rest failed
+  rt_active = 1;
+  return ret;
+}
+
+int rt_enabled(void) {
+  return rt_active;
+}
+
+uint64_t rt_now_ns(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC,&t);
+  return (uint64_t) t.tv_sec*1000000000ULL + (uint64_t) t.tv_nsec;
+}
+
+void rt_wait_until(uint64_t t_ns) {
+  struct timespec ts;
+  uint64_t wake = rt_active ? t_ns - RT_SPIN_NS : t_ns;
+  uint64_t now = rt_now_ns();
+
+  if (now >= t_ns) return;
+  if (wake > now) {
+    ts.tv_sec = wake/1000000000ULL;
+    ts.tv_nsec = wake % 1000000000ULL;
+    while (clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&ts,NULL) == EINTR) {}
+  }
+  while (rt_active && rt_now_ns() < t_ns) {}
+}
+
+void rt_sleep_us(uint64_t us) {
+  rt_wait_until(rt_now_ns() + 1000*us);
+}
+
+double fifo_sample_period(void *cfg,uint32_t loc) {
+  //The bias and phase FIFOs have their rates in bits 0-3 of separate registers
+  uint32_t reg = loc >= FIFO_PHASE_DATA_START_LOC ? IQ_READ(cfg,phase_control) : IQ_READ(cfg,filter);
+  return (double)(1 << (reg & 0xF))/CLK_FREQ;
+}
+
+uint64_t jump_wait(uint64_t t0,double period,uint32_t sample) {
+  if (rt_active) {
+    rt_wait_until(t0 + (uint64_t)(1e9*period*(double) sample));
+  }
+  return rt_now_ns();
+}
+
+void add_jump_event(capture_events_t *ev,uint32_t type,uint32_t repeat,uint32_t sample,double period,
+                    uint64_t t0,uint64_t before,uint64_t after) {
+  capture_event_t *e;
+  if (!ev) return;
+  if (rt_active) ev->flags |= CAPTURE_EVENTS_REALTIME;
+  if (ev->num_events >= CAPTURE_MAX_EVENTS) return;
+  e = &ev->event[ev->num_events++];
+  e->type = type;
+  e->repeat = repeat;
+  e->sample = sample;
+  e->time_ns = before - t0;
+  e->hw_sample = 1e-9*(double)(before - t0)/period;
+  e->latency_ns = (uint32_t)(after - before);
+  e->reserved = 0;
+}
+
+void jump_bias_pwm(void *cfg,const jump_levels_t *l,int up) {
+  uint16_t V[3] = {l->V[0],l->V[1],l->V[2]};
+  if (up && l->index >= 1 && l->index <= 3) {
+    V[l->index - 1] += l->Vjump;
+  }
+  write_to_bias_pwm(cfg,V[0],V[1],V[2]);
+}
+
+void jump_phase_output(void *cfg,const jump_levels_t *l,int up) {
+  uint16_t V = up ? l->V[0] + l->Vjump : l->V[0];
+  if (l->index == 1) {
+    write_to_phase_pwm(cfg,V);
+  } else {
+    write_to_aux_dac(cfg,V);
+  }
+}
+
+void jump_lock(void *cfg,const jump_levels_t *l,int up) {
+  set_lock_status(cfg,up);
+}
+
+uint32_t step_jump_sample(uint32_t mask,uint32_t numSamples) {
+  uint32_t saveFactor = __builtin_popcount(mask);
+  uint32_t jump_sample = ((saveFactor*numSamples >> 2) + saveFactor - 1)/saveFactor;
+  return jump_sample > numSamples ? numSamples : jump_sample;
+}
+
+int record_jump(void *cfg,uint32_t loc,uint32_t mask,uint32_t numSamples,uint32_t jump_sample,jump_action_t action,
+                const jump_levels_t *l,int up,uint32_t type,uint32_t repeat,uint32_t *data,capture_events_t *ev) {
+  const uint32_t S = __builtin_popcount(mask);
+  const double period = fifo_sample_period(cfg,loc);
+  uint64_t t0, before;
+  if (jump_sample > numSamples) jump_sample = numSamples;
+  start_fifo(cfg);
+  t0 = rt_now_ns();
+  read_fifo_mask(cfg,loc,mask,jump_sample,data);
+  if (jump_sample < numSamples) {
+    before = jump_wait(t0,period,jump_sample);
+    action(cfg,l,up);
+    add_jump_event(ev,type,repeat,jump_sample,period,t0,before,rt_now_ns());
+    read_fifo_mask(cfg,loc,mask,numSamples - jump_sample,data + (size_t) S*jump_sample);
+  }
+  stop_fifo(cfg);
+  return 0;
+}
+
+/*
+ * One specialised kernel per mask for the bias FIFOs, and for the phase FIFOs
+ */
+#define CAPTURE_CASE(first,m)       case (m): iq_capture(cfg,first,(m),numSamples,data); return 0;
+#define CAPTURE_CASES_4(first,m)    CAPTURE_CASE(first,m) CAPTURE_CASE(first,(m) + 1) CAPTURE_CASE(first,(m) + 2) CAPTURE_CASE(first,(m) + 3)
+#define CAPTURE_CASES_16(first,m)   CAPTURE_CASES_4(first,m) CAPTURE_CASES_4(first,(m) + 4) CAPTURE_CASES_4(first,(m) + 8) CAPTURE_CASES_4(first,(m) + 12)
+
+int read_fifo_mask(void *cfg,uint32_t loc,uint32_t mask,uint32_t numSamples,uint32_t *data) {
+  uint32_t i, incr;
+  if (loc == FIFO_BIAS_DATA_START_LOC && mask <= IQ_BIAS_MASK) {
+    switch (mask) {
+      CAPTURE_CASES_16(0,0)
+    }
+  } else if (loc == FIFO_PHASE_DATA_START_LOC && mask <= IQ_PHASE_MASK) {
+    switch (mask) {
+      CAPTURE_CASES_16(NUM_BIAS_FIFOS,0)
+      CAPTURE_CASES_16(NUM_BIAS_FIFOS,16)
+    }
+  }
+  //Any other layout
+  for (i = 0;i < numSamples;i++) {
+    for (incr = 0;incr < 32;incr++) {
+      if (mask & (1u << incr)) *data++ = reg_read(cfg,loc + (incr << 2));
+    }
+  }
+  return 0;
+}
+
+int read_fifo_data(void *cfg,uint32_t loc,uint32_t saveFactor,uint32_t numSamples,uint32_t *data) {
+  return read_fifo_mask(cfg,loc,saveFactor >= 32 ? 0xFFFFFFFF : (1u << saveFactor) - 1,numSamples,data);
+}
+
+uint32_t capture_mask(uint32_t mask,uint32_t saveFactor,uint32_t numFifos) {
+  if (mask == 0) {
+    if (saveFactor < 1 || saveFactor > numFifos) return 0;
+    mask = (1u << saveFactor) - 1;
+  }
+  return mask & ~((1u << numFifos) - 1) ? 0 : mask;
+}
+
+int record_bias_jump(void *cfg,uint32_t mask,uint32_t numSamples,uint16_t Vx,uint16_t Vy,uint16_t Vz,uint16_t Vjump,uint8_t jump_index,
+                     uint32_t *data,capture_events_t *ev) {
+  jump_levels_t l = {{Vx,Vy,Vz},Vjump,jump_index};
+  // Set voltages and let the system settle
+  jump_bias_pwm(cfg,&l,0);
+  rt_sleep_us(1000000);
+  // Record data, applying the jump a quarter of the way through
+  record_jump(cfg,FIFO_BIAS_DATA_START_LOC,mask,numSamples,step_jump_sample(mask,numSamples),jump_bias_pwm,&l,1,
+              CAPTURE_EVENT_BIAS_JUMP,0,data,ev);
+  jump_bias_pwm(cfg,&l,0);
+  return 0;
+}
+
+int record_phase_jump(void *cfg,uint32_t mask,uint32_t numSamples,uint16_t V,uint16_t Vjump,uint8_t jump_type,uint32_t *data,
+                      capture_events_t *ev) {
+  jump_levels_t l = {{V,0,0},Vjump,jump_type};
+  // Set voltages and let the system settle
+  jump_phase_output(cfg,&l,0);
+  rt_sleep_us(1000000);
+  // Record data, applying the jump a quarter of the way through
+  record_jump(cfg,FIFO_PHASE_DATA_START_LOC,mask,numSamples,step_jump_sample(mask,numSamples),jump_phase_output,&l,1,
+              CAPTURE_EVENT_PHASE_JUMP,0,data,ev);
+  jump_phase_output(cfg,&l,0);
+  return 0;
+}
+
+int record_phase_lock(void *cfg,uint32_t mask,uint32_t numSamples,uint32_t change_sample,uint32_t *data,capture_events_t *ev) {
+  if (change_sample == 0) {
+    change_sample = step_jump_sample(mask,numSamples);
+  }
+  // Record data, engaging the lock at change_sample
+  set_lock_status(cfg,0);
+  rt_sleep_us(1000);
+  record_jump(cfg,FIFO_PHASE_DATA_START_LOC,mask,numSamples,change_sample,jump_lock,NULL,1,CAPTURE_EVENT_LOCK,0,data,ev);
+  set_lock_status(cfg,0);
+  return 0;
+}
+
+uint32_t sweep_channels(const bias_sweep_t *sweep) {
+  return __builtin_popcount(sweep->channel_mask & ((1 << NUM_PWM) - 1));
+}
+
+/*
+ * Value of channel ch (the n-th swept channel) at update k of num_updates
+ */
+static uint16_t sweep_value(const bias_sweep_t *sweep,uint32_t ch,uint32_t n,uint32_t k,uint32_t num_updates) {
+  double f;
+  uint32_t row;
+  if (sweep->shape == SWEEP_TRAJECTORY) {
+    row = k < sweep->num_points ? k : sweep->num_points - 1;
+    return sweep->points[row*sweep_channels(sweep) + n];
+  }
+  f = num_updates > 1 ? (double) k/(num_updates - 1) : 0;
+  if (sweep->shape == SWEEP_TRIANGLE) {
+    f = f <= 0.5 ? 2*f : 2*(1 - f);
+  }
+  return (uint16_t) (sweep->start[ch] + f*((int) sweep->end[ch] - (int) sweep->start[ch]) + 0.5);
+}
+
+int record_bias_sweep(void *cfg,uint32_t numSamples,const bias_sweep_t *sweep,uint32_t *data) {
+  const uint32_t num_tags = sweep_channels(sweep);
+  const uint32_t stride = NUM_BIAS_FIFOS + num_tags;
+  const uint32_t update = sweep->update_samples ? sweep->update_samples : 1;
+  const uint32_t num_updates = (numSamples + update - 1)/update;
+  uint16_t value[NUM_PWM];
+  uint32_t i, k = 0, ch, n, next = 0;
+
+  //Start at the first values and let the outputs settle
+  for (ch = 0, n = 0;ch < NUM_PWM;ch++) {
+    if (!(sweep->channel_mask & (1 << ch))) continue;
+    value[n] = sweep_value(sweep,ch,n,0,num_updates);
+    write_to_pwm(cfg,ch,value[n++]);
+  }
+  rt_sleep_us(sweep->dwell);
+
+  start_fifo(cfg);
+  for (i = 0;i < numSamples;i++) {
+    if (i == next) {
+      for (ch = 0, n = 0;ch < NUM_PWM;ch++) {
+        if (!(sweep->channel_mask & (1 << ch))) continue;
+        value[n] = sweep_value(sweep,ch,n,k,num_updates);
+        write_to_pwm(cfg,ch,value[n++]);
+      }
+      k++;
+      next += update;
+    }
+    iq_read_sample(cfg,0,IQ_BIAS_MASK,data + i*stride);
+    for (n = 0;n < num_tags;n++) {
+      *(data + i*stride + NUM_BIAS_FIFOS + n) = value[n];
+    }
+  }
+  stop_fifo(cfg);
+  return 0;
+}
+
+int wait_for_bias_settle(void *cfg,uint32_t numAvgs,const bias_settle_t *settle,uint32_t *raw_data,uint32_t *settle_us) {
+  struct timespec start, now;
+  uint32_t window = settle->window < numAvgs ? settle->window : numAvgs;
+  uint32_t elapsed = 0, i, k;
+  int64_t sum[NUM_BIAS_FIFOS];
+  int32_t mean[NUM_BIAS_FIFOS], last[NUM_BIAS_FIFOS];
+  int have_last = 0, settled;
+
+  clock_gettime(CLOCK_MONOTONIC,&start);
+  while (1) {
+    read_fifo_data(cfg,FIFO_BIAS_DATA_START_LOC,NUM_BIAS_FIFOS,window,raw_data);
+    for (k = 0;k < NUM_BIAS_FIFOS;k++) sum[k] = 0;
+    for (i = 0;i < NUM_BIAS_FIFOS*window;i += NUM_BIAS_FIFOS) {
+      for (k = 0;k < NUM_BIAS_FIFOS;k++) sum[k] += (int32_t) *(raw_data + i + k);
+    }
+    settled = have_last;
+    for (k = 0;k < NUM_BIAS_FIFOS;k++) {
+      mean[k] = (int32_t) (sum[k]/(int64_t) window);
+      if (have_last && abs(mean[k] - last[k]) > settle->tolerance) settled = 0;
+      last[k] = mean[k];
+    }
+    have_last = 1;
+    clock_gettime(CLOCK_MONOTONIC,&now);
+    elapsed = (now.tv_sec - start.tv_sec)*1000000 + (now.tv_nsec - start.tv_nsec)/1000;
+    if (settled || elapsed >= settle->maxDwell) break;
+  }
+  *settle_us = elapsed;
+  return settled ? 0 : 1;
+}
+
+int acquire_bias_point(void *cfg,uint16_t Vx,uint16_t Vy,uint16_t Vz,uint32_t numAvgs,const bias_settle_t *settle,uint32_t *raw_data,uint32_t *settle_us) {
+  uint32_t dwell;
+  int timed_out = 0;
+  // Set PWM values
+  write_to_bias_pwm(cfg,Vx,Vy,Vz);
+  if (settle && settle->window > 0) {
+    // Start averaging as soon as the signals stop changing
+    start_fifo(cfg);
+    timed_out = wait_for_bias_settle(cfg,numAvgs,settle,raw_data,&dwell);
+  } else {
+    dwell = settle ? settle->maxDwell : DEFAULT_BIAS_DWELL;
+    usleep(dwell);
+    start_fifo(cfg);
+  }
+  if (settle_us) *settle_us = dwell;
+  // Record raw data
+  read_fifo_data(cfg,FIFO_BIAS_DATA_START_LOC,NUM_BIAS_FIFOS,numAvgs,raw_data);
+  stop_fifo(cfg);
+  return timed_out;
+}
+
+int bias_stats(const uint32_t *raw_data,uint32_t numSamples,bias_stats_t *st) {
+  uint32_t i, k;
+  st->n = numSamples;
+#if (defined(__ARM_NEON) || defined(__ARM_NEON__)) && NUM_BIAS_FIFOS == 4
+  /*
+   * One sample of all four FIFOs fills a vector, so each lane accumulates one stream
+   */
+  int32x4_t x, mn = vdupq_n_s32(INT32_MAX), mx = vdupq_n_s32(INT32_MIN);
+  int64x2_t sum_lo = vdupq_n_s64(0), sum_hi = vdupq_n_s64(0);
+  int64x2_t sq_lo = vdupq_n_s64(0), sq_hi = vdupq_n_s64(0);
+  for (i = 0;i < numSamples;i++) {
+    x = vld1q_s32((const int32_t *) raw_data + (i << 2));
+    sum_lo = vaddw_s32(sum_lo,vget_low_s32(x));
+    sum_hi = vaddw_s32(sum_hi,vget_high_s32(x));
+    sq_lo = vmlal_s32(sq_lo,vget_low_s32(x),vget_low_s32(x));
+    sq_hi = vmlal_s32(sq_hi,vget_high_s32(x),vget_high_s32(x));
+    mn = vminq_s32(mn,x);
+    mx = vmaxq_s32(mx,x);
+  }
+  vst1q_s64(st->sum,sum_lo);
+  vst1q_s64(st->sum + 2,sum_hi);
+  vst1q_s64(st->sumsq,sq_lo);
+  vst1q_s64(st->sumsq + 2,sq_hi);
+  vst1q_s32(st->min,mn);
+  vst1q_s32(st->max,mx);
+#else
+  int32_t x;
+  for (k = 0;k < NUM_BIAS_FIFOS;k++) {
+    st->sum[k] = st->sumsq[k] = 0;
+    st->min[k] = INT32_MAX;
+    st->max[k] = INT32_MIN;
+  }
+  for (i = 0;i < numSamples;i++) {
+    for (k = 0;k < NUM_BIAS_FIFOS;k++) {
+      x = (int32_t) *(raw_data + i*NUM_BIAS_FIFOS + k);
+      st->sum[k] += x;
+      st->sumsq[k] += (int64_t) x*x;
+      st->min[k] = x < st->min[k] ? x : st->min[k];
+      st->max[k] = x > st->max[k] ? x : st->max[k];
+    }
+  }
+#endif
+  (void) k;
   return 0;
 }
 
-int write_to_bias_pwm(void *cfg,uint16_t V1,uint16_t V2,uint16_t V3) {
-  *((uint32_t *)(cfg + PWM_LOC)) = (uint32_t) V1;
-  *((uint32_t *)(cfg + PWM_LOC + 4)) = (uint32_t) V2;
-  *((uint32_t *)(cfg + PWM_LOC + 8)) = (uint32_t) V3;
+int bias_stats_value(const bias_stats_t *st,uint32_t stat,int *out) {
+  uint32_t k;
+  double m, v;
+  float f;
+  for (k = 0;k < NUM_BIAS_FIFOS;k++) {
+    switch (stat) {
+      case BIAS_STAT_MEAN:
+        out[k] = st->n ? (int) (st->sum[k]/(int64_t) st->n) : 0;
+        break;
+      case BIAS_STAT_VAR:
+        if (st->n < 2) {
+          out[k] = 0;
+        } else {
+          m = (double) st->sum[k]/st->n;
+          v = ((double) st->sumsq[k] - m*(double) st->sum[k])/(st->n - 1);
+          f = (float) (v > 0 ? v : 0);
+          memcpy(&out[k],&f,sizeof(f));
+        }
+        break;
+      case BIAS_STAT_MIN:
+        out[k] = st->min[k];
+        break;
+      case BIAS_STAT_MAX:
+        out[k] = st->max[k];
+        break;
+      default:
+        return -1;
+    }
+  }
   return 0;
 }
 
-int write_to_phase_pwm(void *cfg,uint16_t V) {
-  *((uint32_t *)(cfg + PWM_LOC + 0xC)) = (uint32_t) V;
+int average_bias_data(const uint32_t *raw_data,uint32_t numAvgs,int *avg) {
+  bias_stats_t st;
+  bias_stats(raw_data,numAvgs,&st);
+  return bias_stats_value(&st,BIAS_STAT_MEAN,avg);
 }
 
-int write_to_aux_dac(void *cfg,uint16_t V) {
-  *((uint32_t *)(cfg + DAC_LOC)) = (uint32_t) V;
+int measure_bias_point(void *cfg,uint16_t Vx,uint16_t Vy,uint16_t Vz,uint32_t numAvgs,const bias_settle_t *settle,uint32_t *raw_data,int *avg,uint32_t *settle_us) {
+  int timed_out = acquire_bias_point(cfg,Vx,Vy,Vz,numAvgs,settle,raw_data,settle_us);
+  average_bias_data(raw_data,numAvgs,avg);
+  return timed_out;
 }
@@ -1,19 +1,214 @@
 #ifndef CNSTS_H_
 #define CNSTS_H_
 
+#include "iq_backend.h"
+
 #define MAP_SIZE                    3145728UL
 #define MEM_LOC                     0x40000000
 #define FIFO_CONTROL_LOC            0x00100000
 #define FIFO_BIAS_DATA_START_LOC    0x00100004
 #define FIFO_PHASE_DATA_START_LOC   0x00100014
+#define FIFO_STATUS_LOC             0x00300008
 #define RAM_DATA_LOC                0x41000000
 
+#define TOP_REG                     0x00000004
+#define FILTER_REG                  0x0000000C
 #define PWM_LOC                     0x00000100
 #define DAC_LOC                     0x00000020
+#define PHASE_LOCK_REG              0x00000300
+
+#define NUM_BIAS_FIFOS              4
+#define NUM_PWM                     4
+#define NUM_PHASE_FIFOS             5
+#define NUM_FIFOS                   (NUM_BIAS_FIFOS + NUM_PHASE_FIFOS)
+#define CLK_FREQ                    125e6
+
+#include "iq_registers.h"
+#include "capture_file.h"
+
+/*
+ * Real-time execution.  rt_enter() locks all current and future pages of the process in
+ * memory, pre-faults RT_STACK_PREFAULT bytes of stack, switches the calling thread to
+ * SCHED_FIFO at PRIORITY (unless that is 0) and pins it to CPU (unless that is negative).
+ * Streaming programs only lock the memory, and the reader thread of fifo_stream.h then
+ * switches itself to SCHED_FIFO at RT_DEFAULT_PRIORITY on its own CPU, so that the writer
+ * and the rest of the system keep the other CPU.  Each step that fails (usually for lack
+ * of privileges) is reported and the program carries on, and the call returns -1.
+ *
+ * In real-time mode rt_wait_until() sleeps until RT_SPIN_NS before the deadline and
+ * busy-waits on the monotonic clock for the rest, and the record_* routines hold each
+ * jump until its sample is due, measured from the time the FIFOs were enabled
+ */
+#define RT_DEFAULT_PRIORITY         80
+#define RT_DEFAULT_CPU              1
+#define RT_STACK_PREFAULT           (256*1024)
+#define RT_SPIN_NS                  200000ULL
+
+int rt_enter(int cpu,int priority);
+int rt_set_priority(int priority);
+int rt_enabled(void);
+uint64_t rt_now_ns(void);
+void rt_wait_until(uint64_t t_ns);
+void rt_sleep_us(uint64_t us);
+
+/*
+ * Trajectory of a continuous sweep of the PWM outputs.  Every update_samples samples,
+ * each swept channel is set to the next value of either a linear ramp from start to
+ * end, a triangle from start to end and back, or the rows of a programmed trajectory
+ * (holding the last row once it runs out)
+ */
+#define SWEEP_RAMP                  0
+#define SWEEP_TRIANGLE              1
+#define SWEEP_TRAJECTORY            2
+#define SWEEP_PWM_MAX               1023          //Largest value of a PWM output
+
+typedef struct {
+  uint32_t channel_mask;          //PWM channels that are swept, bit 3 is the phase PWM
+  uint32_t shape;                 //SWEEP_*
+  uint16_t start[NUM_PWM];
+  uint16_t end[NUM_PWM];
+  uint32_t update_samples;        //Samples between PWM updates
+  uint32_t dwell;                 //Wait at the first values before recording [us]
+  uint32_t num_points;            //Rows in points for SWEEP_TRAJECTORY
+  const uint16_t *points;         //One value per swept channel in each row
+} bias_sweep_t;
+
+/*
+ * Statistics of the bias signals at each point
+ */
+#define BIAS_STAT_MEAN              0x1
+#define BIAS_STAT_VAR               0x2
+#define BIAS_STAT_MIN               0x4
+#define BIAS_STAT_MAX               0x8
+#define NUM_BIAS_STATS              4
+
+#define DEFAULT_BIAS_DWELL          10000
+#define DEFAULT_SETTLE_WINDOW       16
+#define NUM_SETTLE_COLUMNS          2
+
+/*
+ * Settling detection after a bias step.  The bias FIFOs are read in windows of window
+ * samples, and the signals are settled once the mean of every signal changes by no more
+ * than tolerance between consecutive windows.  If they have not settled after maxDwell
+ * microseconds averaging starts anyway.  With window = 0 there is no detection and the
+ * dwell is always maxDwell
+ */
+typedef struct {
+  uint32_t window;
+  int32_t tolerance;
+  uint32_t maxDwell;
+} bias_settle_t;
+
+/*
+ * Per-stream accumulators for the bias FIFOs.  The 64-bit sums cannot overflow for any
+ * realistic number of samples
+ */
+typedef struct {
+  uint32_t n;
+  int64_t sum[NUM_BIAS_FIFOS];
+  int64_t sumsq[NUM_BIAS_FIFOS];
+  int32_t min[NUM_BIAS_FIFOS];
+  int32_t max[NUM_BIAS_FIFOS];
+} bias_stats_t;
+
+/*
+ * Channel mask of a capture from numFifos FIFOs: MASK if it is non-zero, otherwise the
+ * first saveFactor FIFOs.  Returns 0 if the mask selects FIFOs that do not exist
+ */
+uint32_t capture_mask(uint32_t mask,uint32_t saveFactor,uint32_t numFifos);
+
+/*
+ * Acquisition routines shared by the stand-alone programs and iq_bias_controld.
+ * All of them write saveFactor interleaved words per sample into data, which
+ * must hold at least saveFactor*numSamples words.  The record_* routines read the
+ * FIFOs selected by MASK, so saveFactor is the number of bits set in it
+ */
+int read_fifo_data(void *cfg,uint32_t loc,uint32_t saveFactor,uint32_t numSamples,uint32_t *data);
+/*
+ * Reads the FIFOs selected by MASK, counted from the FIFO at LOC, so each sample is
+ * popcount(MASK) words.  Uses a kernel specialised for the mask for the bias and phase
+ * FIFOs
+ */
+int read_fifo_mask(void *cfg,uint32_t loc,uint32_t mask,uint32_t numSamples,uint32_t *data);
+/*
+ * The jump and lock routines add the time of each write to EV, which may be NULL
+ */
+int record_bias_jump(void *cfg,uint32_t mask,uint32_t numSamples,uint16_t Vx,uint16_t Vy,uint16_t Vz,uint16_t Vjump,uint8_t jump_index,
+                     uint32_t *data,capture_events_t *ev);
+int record_phase_jump(void *cfg,uint32_t mask,uint32_t numSamples,uint16_t V,uint16_t Vjump,uint8_t jump_type,uint32_t *data,
+                      capture_events_t *ev);
+int record_phase_lock(void *cfg,uint32_t mask,uint32_t numSamples,uint32_t change_sample,uint32_t *data,capture_events_t *ev);
+/*
+ * Building blocks for timed jumps.  fifo_sample_period() is the time between samples of
+ * the FIFOs at LOC.  jump_wait() is called after reading SAMPLE samples from FIFOs that
+ * were enabled at T0: in real-time mode it waits until the sample is due, and it returns
+ * the time just before the write.  add_jump_event() records the write that took from
+ * BEFORE to AFTER
+ */
+double fifo_sample_period(void *cfg,uint32_t loc);
+uint64_t jump_wait(uint64_t t0,double period,uint32_t sample);
+void add_jump_event(capture_events_t *ev,uint32_t type,uint32_t repeat,uint32_t sample,double period,
+                    uint64_t t0,uint64_t before,uint64_t after);
+/*
+ * The capture shared by the jump, lock and step routines.  step_jump_sample() is the
+ * default jump sample, the first at or after a quarter of the data.  record_jump()
+ * enables the FIFOs at LOC, reads JUMP_SAMPLE samples, calls ACTION(cfg,L,UP) when the
+ * next sample is due, records it in EV as TYPE and REPEAT, reads the rest and stops the
+ * FIFOs.  The jump_* actions set the base level (UP = 0) or the jumped level of the bias
+ * PWM outputs, of the phase PWM (index 1) or auxiliary DAC, or engage the phase lock
+ */
+typedef struct {
+  uint16_t V[3];
+  uint16_t Vjump;
+  uint8_t index;                  //Bias jump index, or phase jump type
+} jump_levels_t;
+
+typedef void (*jump_action_t)(void *cfg,const jump_levels_t *l,int up);
 
-int start_fifo(void *cfg);
-int stop_fifo(void *cfg);
-int write_to_bias_pwm(void *cfg,uint16_t V1,uint16_t V2,uint16_t V3);
-int write_to_phase_pwm(void *cfg,uint16_t V);
-int write_to_aux_dac(void *cfg,uint16_t V);
+void jump_bias_pwm(void *cfg,const jump_levels_t *l,int up);
+void jump_phase_output(void *cfg,const jump_levels_t *l,int up);
+void jump_lock(void *cfg,const jump_levels_t *l,int up);
+uint32_t step_jump_sample(uint32_t mask,uint32_t numSamples);
+int record_jump(void *cfg,uint32_t loc,uint32_t mask,uint32_t numSamples,uint32_t jump_sample,jump_action_t action,
+                const jump_levels_t *l,int up,uint32_t type,uint32_t repeat,uint32_t *data,capture_events_t *ev);
+/*
+ * Sweeps the PWM outputs along sweep while the bias FIFOs stream.  Each sample is
+ * NUM_BIAS_FIFOS FIFO words followed by the value of each swept channel (in channel
+ * order) at the time the sample was read, so data needs
+ * (NUM_BIAS_FIFOS + sweep_channels())*numSamples words
+ */
+uint32_t sweep_channels(const bias_sweep_t *sweep);
+int record_bias_sweep(void *cfg,uint32_t numSamples,const bias_sweep_t *sweep,uint32_t *data);
+/*
+ * Waits for the bias signals to settle with the FIFOs already running.  Returns 0 once
+ * settled and 1 on timeout, and sets settle_us to the time taken
+ */
+int wait_for_bias_settle(void *cfg,uint32_t numAvgs,const bias_settle_t *settle,uint32_t *raw_data,uint32_t *settle_us);
+/*
+ * Sets the bias voltages, waits for them to settle, and records numAvgs samples of each
+ * bias FIFO into raw_data, which needs NUM_BIAS_FIFOS*numAvgs words.  With settle NULL
+ * the dwell is DEFAULT_BIAS_DWELL.  Returns 1 if settling timed out and 0 otherwise
+ */
+int acquire_bias_point(void *cfg,uint16_t Vx,uint16_t Vy,uint16_t Vz,uint32_t numAvgs,const bias_settle_t *settle,uint32_t *raw_data,uint32_t *settle_us);
+/*
+ * Accumulates sums, sums of squares, minima and maxima of numSamples samples of each bias
+ * FIFO in raw_data in a single pass.  Uses NEON when available
+ */
+int bias_stats(const uint32_t *raw_data,uint32_t numSamples,bias_stats_t *st);
+/*
+ * Writes one statistic (a single BIAS_STAT_* flag) of each stream to out.  The mean is
+ * truncated towards zero.  The variance is the unbiased sample variance in counts^2 as
+ * the bit pattern of a float32, so that neither quiet points (std below a count) nor
+ * noisy ones (std above 46000 counts) are lost to an integer.  Returns -1 for an
+ * unknown statistic
+ */
+int bias_stats_value(const bias_stats_t *st,uint32_t stat,int *out);
+/*
+ * Averages numAvgs samples of each bias FIFO in raw_data into avg
+ */
+int average_bias_data(const uint32_t *raw_data,uint32_t numAvgs,int *avg);
+/*
+ * acquire_bias_point() followed by average_bias_data()
+ */
+int measure_bias_point(void *cfg,uint16_t Vx,uint16_t Vy,uint16_t Vz,uint32_t numAvgs,const bias_settle_t *settle,uint32_t *raw_data,int *avg,uint32_t *settle_us);
 #endif
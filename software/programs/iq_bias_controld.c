@@ -0,0 +1,565 @@
+//These are libraries which contain useful functions
+#include <ctype.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "iq_bias_control.h"
+#include "capture_output.h"
+#include "bias_search.h"
+
+/*
+ * iq_bias_controld is a long-lived version of the saver and analyzer programs.  It maps
+ * the register space and the RAM block once, allocates its buffers once, and then serves
+ * requests from a local (UNIX domain) socket.  Each request is a single line containing
+ * the same command line that would be used for the stand-alone program, e.g.
+ *
+ *    saveData -n 1000 -s 4
+ *
+ * and the reply is either "OK <number of bytes>\n" followed by exactly that many bytes of
+ * data in the same layout as SavedData.bin, or "ERR <message>\n".  A client may send any
+ * number of requests over the same connection.
+ */
+#define DEFAULT_SOCKET_PATH   "/tmp/iq_bias_control.sock"
+#define DEFAULT_MAX_WORDS     4194304
+#define MAX_LINE_LENGTH       1024
+#define MAX_ARGS              32
+
+static volatile sig_atomic_t running = 1;
+
+static void handle_signal(int sig) {
+  running = 0;
+}
+
+typedef struct {
+  void *cfg;            //Register space
+  void *ram;            //Block memory for raw ADC data
+  uint32_t *data;       //Pre-allocated output buffer
+  int memfd;            //Memory file backing the output buffer, if any
+  uint32_t *raw_data;   //Pre-allocated scratch buffer for averaging
+  uint32_t max_words;   //Size of each buffer in words
+  uint8_t debugFlag;
+} daemon_state_t;
+
+/*
+ * Writes all bytes to the client, returning -1 if the client has gone away
+ */
+static int send_all(int fd,const void *buf,size_t len) {
+  const char *p = (const char *) buf;
+  ssize_t n;
+  while (len > 0) {
+    n = send(fd,p,len,MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    p += n;
+    len -= (size_t) n;
+  }
+  return 0;
+}
+
+static int send_error(int fd,const char *msg) {
+  char line[MAX_LINE_LENGTH];
+  snprintf(line,sizeof(line),"ERR %s\n",msg);
+  return send_all(fd,line,strlen(line));
+}
+
+/*
+ * Replies are sent straight from the memfd-backed output buffer with sendfile(), so the
+ * data is never copied through user space or written to the SD card
+ */
+static int send_data(int fd,const void *data,size_t len,int memfd) {
+  char line[64];
+  snprintf(line,sizeof(line),"OK %zu\n",len);
+  if (send_all(fd,line,strlen(line)) < 0) return -1;
+  return send_capture(fd,data,len,memfd);
+}
+
+/*
+ * Splits a request line into whitespace-separated arguments in place
+ */
+static int split_args(char *line,char **argv) {
+  int argc = 0;
+  char *tok = strtok(line," \t\r\n");
+  while (tok && argc < MAX_ARGS - 1) {
+    argv[argc++] = tok;
+    tok = strtok(NULL," \t\r\n");
+  }
+  argv[argc] = NULL;
+  return argc;
+}
+
+/*
+ * Strips any leading path from the program name so that "./saveData" and "saveData"
+ * are both accepted
+ */
+static const char *command_name(const char *arg) {
+  const char *p = strrchr(arg,'/');
+  return p ? p + 1 : arg;
+}
+
+/*
+ * Resolves the channel mask from -C, or from the save factor if it is not given
+ */
+static int check_mask(uint32_t *mask,uint32_t saveFactor,uint32_t numFifos,char *err) {
+  *mask = capture_mask(*mask,saveFactor,numFifos);
+  if (*mask == 0) {
+    sprintf(err,"save factor must be between 1 and %u, or the channel mask within 0x%x",numFifos,(1u << numFifos) - 1);
+    return -1;
+  }
+  return 0;
+}
+
+static int check_size(daemon_state_t *s,uint32_t saveFactor,uint32_t maxFactor,int numSamples,char *err) {
+  if (saveFactor < 1 || saveFactor > maxFactor) {
+    sprintf(err,"save factor must be between 1 and %u",maxFactor);
+    return -1;
+  }
+  if (numSamples <= 0 || (uint64_t) saveFactor*numSamples > s->max_words) {
+    sprintf(err,"number of samples must be between 1 and %u",s->max_words/saveFactor);
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Each handler parses its arguments with getopt using the same options as the
+ * corresponding stand-alone program, acquires data, and returns the number of bytes
+ * in s->data or -1 on error.  Output options are ignored as data always goes back
+ * over the socket
+ */
+static long do_save_data(daemon_state_t *s,int argc,char **argv,uint32_t loc,uint32_t saveFactor,uint32_t maxFactor,char *err) {
+  int numSamples = 0;
+  uint32_t mask = 0;
+  int c;
+  while ((c = getopt(argc,argv,"n:t:s:C:o:f")) != -1) {
+    switch (c) {
+      case 'n':
+        numSamples = atoi(optarg);
+        break;
+      case 's':
+        saveFactor = atoi(optarg);
+        break;
+      case 'C':
+        mask = strtoul(optarg,NULL,0);
+        break;
+      case 't':
+      case 'o':
+      case 'f':
+        break;
+      default:
+        sprintf(err,"unknown option");
+        return -1;
+    }
+  }
+  if (check_mask(&mask,saveFactor,maxFactor,err) < 0) return -1;
+  saveFactor = __builtin_popcount(mask);
+  if (check_size(s,saveFactor,maxFactor,numSamples,err) < 0) return -1;
+  start_fifo(s->cfg);
+  read_fifo_mask(s->cfg,loc,mask,numSamples,s->data);
+  stop_fifo(s->cfg);
+  return (long) saveFactor*numSamples*4;
+}
+
+static long do_bias_jump(daemon_state_t *s,int argc,char **argv,char *err) {
+  int num_samples = 0;
+  uint16_t Vx = 320, Vy = 320, Vz = 320, Vjump = 64;
+  uint8_t jump_index = 0;
+  uint32_t saveFactor = NUM_BIAS_FIFOS;
+  uint32_t mask = 0;
+  int c;
+  while ((c = getopt(argc,argv,"s:C:j:n:x:y:z:i:o:f")) != -1) {
+    switch (c) {
+      case 's': saveFactor = atoi(optarg); break;
+      case 'C': mask = strtoul(optarg,NULL,0); break;
+      case 'j': Vjump = atoi(optarg); break;
+      case 'i': jump_index = atoi(optarg); break;
+      case 'n': num_samples = atoi(optarg); break;
+      case 'x': Vx = atoi(optarg); break;
+      case 'y': Vy = atoi(optarg); break;
+      case 'z': Vz = atoi(optarg); break;
+      case 'o':
+      case 'f': break;
+      default:
+        sprintf(err,"unknown option");
+        return -1;
+    }
+  }
+  if (check_mask(&mask,saveFactor,NUM_BIAS_FIFOS,err) < 0) return -1;
+  saveFactor = __builtin_popcount(mask);
+  if (check_size(s,saveFactor,NUM_BIAS_FIFOS,num_samples,err) < 0) return -1;
+  record_bias_jump(s->cfg,mask,num_samples,Vx,Vy,Vz,Vjump,jump_index,s->data,NULL);
+  return (long) saveFactor*num_samples*4;
+}
+
+static long do_phase_jump(daemon_state_t *s,int argc,char **argv,char *err) {
+  int num_samples = 0;
+  uint16_t V = 320, Vjump = 64;
+  uint8_t jump_type = 0;
+  uint32_t saveFactor = NUM_PHASE_FIFOS;
+  uint32_t mask = 0;
+  int c;
+  while ((c = getopt(argc,argv,"s:C:j:n:v:t:o:f")) != -1) {
+    switch (c) {
+      case 's': saveFactor = atoi(optarg); break;
+      case 'C': mask = strtoul(optarg,NULL,0); break;
+      case 'j': Vjump = atoi(optarg); break;
+      case 'n': num_samples = atoi(optarg); break;
+      case 'v': V = atoi(optarg); break;
+      case 't': jump_type = atoi(optarg); break;
+      case 'o':
+      case 'f': break;
+      default:
+        sprintf(err,"unknown option");
+        return -1;
+    }
+  }
+  if (check_mask(&mask,saveFactor,NUM_PHASE_FIFOS,err) < 0) return -1;
+  saveFactor = __builtin_popcount(mask);
+  if (check_size(s,saveFactor,NUM_PHASE_FIFOS,num_samples,err) < 0) return -1;
+  record_phase_jump(s->cfg,mask,num_samples,V,Vjump,jump_type,s->data,NULL);
+  return (long) saveFactor*num_samples*4;
+}
+
+static long do_phase_lock(daemon_state_t *s,int argc,char **argv,char *err) {
+  int num_samples = 0;
+  uint32_t change_sample = 0;
+  uint32_t saveFactor = NUM_PHASE_FIFOS;
+  uint32_t mask = 0;
+  int c;
+  while ((c = getopt(argc,argv,"s:C:n:c:o:f")) != -1) {
+    switch (c) {
+      case 's': saveFactor = atoi(optarg); break;
+      case 'C': mask = strtoul(optarg,NULL,0); break;
+      case 'n': num_samples = atoi(optarg); break;
+      case 'c': change_sample = atoi(optarg); break;
+      case 'o':
+      case 'f': break;
+      default:
+        sprintf(err,"unknown option");
+        return -1;
+    }
+  }
+  if (check_mask(&mask,saveFactor,NUM_PHASE_FIFOS,err) < 0) return -1;
+  saveFactor = __builtin_popcount(mask);
+  if (check_size(s,saveFactor,NUM_PHASE_FIFOS,num_samples,err) < 0) return -1;
+  record_phase_lock(s->cfg,mask,num_samples,change_sample,s->data,NULL);
+  return (long) saveFactor*num_samples*4;
+}
+
+static long do_sweep_biases(daemon_state_t *s,int argc,char **argv,char *err) {
+  int num_samples = 0;
+  unsigned int ch, v0, v1;
+  uint32_t saveFactor;
+  bias_sweep_t sweep;
+  int c;
+  memset(&sweep,0,sizeof(sweep));
+  sweep.shape = SWEEP_RAMP;
+  sweep.update_samples = 1000;
+  sweep.dwell = DEFAULT_BIAS_DWELL;
+  while ((c = getopt(argc,argv,"n:c:v:u:w:To:f")) != -1) {
+    switch (c) {
+      case 'n': num_samples = atoi(optarg); break;
+      case 'c': sweep.channel_mask = strtoul(optarg,NULL,0); break;
+      case 'v':
+        if (sscanf(optarg,"%u:%u:%u",&ch,&v0,&v1) != 3 || ch >= NUM_PWM) {
+          sprintf(err,"invalid sweep, use channel:start:end");
+          return -1;
+        }
+        sweep.channel_mask |= 1 << ch;
+        sweep.start[ch] = v0;
+        sweep.end[ch] = v1;
+        break;
+      case 'u': sweep.update_samples = atoi(optarg); break;
+      case 'w': sweep.dwell = atoi(optarg); break;
+      case 'T': sweep.shape = SWEEP_TRIANGLE; break;
+      case 'o':
+      case 'f': break;
+      default:
+        sprintf(err,"unknown option");
+        return -1;
+    }
+  }
+  if (sweep_channels(&sweep) == 0) {
+    sprintf(err,"no channels to sweep");
+    return -1;
+  }
+  saveFactor = NUM_BIAS_FIFOS + sweep_channels(&sweep);
+  if (check_size(s,saveFactor,saveFactor,num_samples,err) < 0) return -1;
+  record_bias_sweep(s->cfg,num_samples,&sweep,s->data);
+  return (long) saveFactor*num_samples*4;
+}
+
+static long do_scan_biases(daemon_state_t *s,int argc,char **argv,char *err) {
+  int numVoltages = 0, numAvgs = 0;
+  uint16_t Vmax = 160;
+  bias_search_params_t search;
+  uint32_t numPoints, numColumns;
+  int c;
+  bias_search_defaults(&search);
+  while ((c = getopt(argc,argv,"n:a:m:o:r:p:k:g:w:W:s:SPe:b:f")) != -1) {
+    switch (c) {
+      case 'n': numVoltages = atoi(optarg); break;
+      case 'a': numAvgs = atoi(optarg); break;
+      case 'm': Vmax = atoi(optarg); break;
+      case 'r': search.numLevels = atoi(optarg); break;
+      case 'p': search.refinePoints = atoi(optarg); break;
+      case 'k': search.numMinima = atoi(optarg); break;
+      case 'g': search.costMask = strtoul(optarg,NULL,0); break;
+      case 'w':
+        search.settle.tolerance = atoi(optarg);
+        if (search.settle.window == 0) search.settle.window = DEFAULT_SETTLE_WINDOW;
+        break;
+      case 'W': search.settle.maxDwell = atoi(optarg); break;
+      case 's': search.settle.window = atoi(optarg); break;
+      case 'S': search.order = BIAS_ORDER_SERPENTINE; break;
+      case 'P': search.reduceCPU = BIAS_REDUCE_CPU; break;
+      case 'e':
+        if (parse_bias_stats(optarg,&search.stats) != 0) {
+          sprintf(err,"unknown statistics");
+          return -1;
+        }
+        break;
+      case 'b':
+        if (parse_bias_box(optarg,search.box) != 0) {
+          sprintf(err,"invalid box");
+          return -1;
+        }
+        break;
+      case 'o':
+      case 'f': break;
+      default:
+        sprintf(err,"unknown option");
+        return -1;
+    }
+  }
+  if (check_size(s,NUM_BIAS_FIFOS,NUM_BIAS_FIFOS,numAvgs,err) < 0) return -1;
+  search.numVoltages = numVoltages;
+  search.numAvgs = numAvgs;
+  search.Vmax = Vmax;
+  numColumns = scan_biases_columns(&search);
+  if (numVoltages <= 0 || (uint64_t) numColumns*numVoltages*numVoltages*numVoltages > s->max_words) {
+    sprintf(err,"number of voltages is too large for the output buffer");
+    return -1;
+  }
+  if (search.numLevels > 0) {
+    if (search.refinePoints < 4) {
+      sprintf(err,"refinement grids need at least 4 points per axis");
+      return -1;
+    }
+    if ((uint64_t) bias_search_columns(&search)*bias_search_max_points(&search) > s->max_words) {
+      sprintf(err,"search is too large for the output buffer");
+      return -1;
+    }
+    if (bias_search(s->cfg,&search,s->raw_data,(int *) s->data,&numPoints) != 0) {
+      sprintf(err,"error allocating memory for search");
+      return -1;
+    }
+    return (long) bias_search_columns(&search)*numPoints*4;
+  }
+  if (scan_biases(s->cfg,&search,s->raw_data,(int *) s->data) != 0) {
+    sprintf(err,"error allocating memory for scan");
+    return -1;
+  }
+  return (long) numColumns*numVoltages*numVoltages*numVoltages*4;
+}
+
+static long do_fetch_ram(daemon_state_t *s,int argc,char **argv,char *err) {
+  uint32_t i, numSamples;
+  int n = argc < 2 ? 100 : atoi(argv[1]);
+  if (n <= 0 || (uint32_t) n > s->max_words || (uint32_t) n > MAP_SIZE/4) {
+    sprintf(err,"invalid number of samples");
+    return -1;
+  }
+  numSamples = (uint32_t) n;
+  for (i = 0;i < numSamples;i++) {
+    *(s->data + i) = reg_read(s->ram,(i << 2));
+  }
+  return (long) numSamples*4;
+}
+
+/*
+ * Dispatches a single request and sends the reply.  Returns -1 if the connection
+ * should be closed
+ */
+static int handle_request(daemon_state_t *s,int client,char *line) {
+  char *argv[MAX_ARGS];
+  char err[256];
+  int argc;
+  long nbytes;
+  const char *cmd;
+  struct timespec start, stop;
+
+  argc = split_args(line,argv);
+  if (argc == 0) return 0;
+  cmd = command_name(argv[0]);
+  if (strcmp(cmd,"quit") == 0) return -1;
+  if (strcmp(cmd,"ping") == 0) return send_data(client,NULL,0,-1);
+
+  //Reset getopt so that it can be re-used for each request
+  optind = 0;
+  err[0] = '\0';
+  clock_gettime(CLOCK_MONOTONIC,&start);
+  if (strcmp(cmd,"saveData") == 0) {
+    nbytes = do_save_data(s,argc,argv,FIFO_BIAS_DATA_START_LOC,NUM_BIAS_FIFOS,NUM_BIAS_FIFOS,err);
+  } else if (strcmp(cmd,"savePhaseData") == 0) {
+    nbytes = do_save_data(s,argc,argv,FIFO_PHASE_DATA_START_LOC,NUM_PHASE_FIFOS,NUM_PHASE_FIFOS,err);
+  } else if (strcmp(cmd,"analyze_jump_response") == 0) {
+    nbytes = do_bias_jump(s,argc,argv,err);
+  } else if (strcmp(cmd,"analyze_phase_jump") == 0) {
+    nbytes = do_phase_jump(s,argc,argv,err);
+  } else if (strcmp(cmd,"analyze_phase_lock") == 0) {
+    nbytes = do_phase_lock(s,argc,argv,err);
+  } else if (strcmp(cmd,"analyze_biases") == 0) {
+    nbytes = do_scan_biases(s,argc,argv,err);
+  } else if (strcmp(cmd,"sweep_biases") == 0) {
+    nbytes = do_sweep_biases(s,argc,argv,err);
+  } else if (strcmp(cmd,"fetchRAM") == 0) {
+    nbytes = do_fetch_ram(s,argc,argv,err);
+  } else {
+    snprintf(err,sizeof(err),"unknown command %s",cmd);
+    nbytes = -1;
+  }
+  clock_gettime(CLOCK_MONOTONIC,&stop);
+  if (s->debugFlag) {
+    fprintf(stderr,"%s: %ld bytes in %.3f ms\n",cmd,nbytes,
+            (stop.tv_sec - start.tv_sec)*1e3 + (stop.tv_nsec - start.tv_nsec)*1e-6);
+  }
+
+  if (nbytes < 0) {
+    return send_error(client,err);
+  } else {
+    return send_data(client,s->data,(size_t) nbytes,s->memfd);
+  }
+}
+
+static void serve_client(daemon_state_t *s,int client) {
+  char line[MAX_LINE_LENGTH];
+  FILE *in = fdopen(client,"r");
+  if (!in) {
+    close(client);
+    return;
+  }
+  while (running && fgets(line,sizeof(line),in)) {
+    if (handle_request(s,client,line) < 0) break;
+  }
+  fclose(in);
+}
+
+int main(int argc, char **argv)
+{
+  int fd, ram_fd;		//File identifiers
+  int server, client;
+  char *socket_path = DEFAULT_SOCKET_PATH;
+  daemon_state_t s;
+  struct sockaddr_un addr;
+  struct sigaction sa;
+
+  s.max_words = DEFAULT_MAX_WORDS;
+  s.debugFlag = 0;
+
+  /*
+   * Parse the input arguments
+   */
+  int c;
+  while ((c = getopt(argc,argv,"u:m:f")) != -1) {
+    switch (c) {
+      case 'u':
+        socket_path = optarg;
+        break;
+      case 'm':
+        s.max_words = atoi(optarg);
+        break;
+      case 'f':
+        s.debugFlag = 1;
+        break;
+
+      case '?':
+        if (isprint (optopt))
+            fprintf (stderr, "Unknown option `-%c'.\n", optopt);
+        else
+            fprintf (stderr,
+                    "Unknown option character `\\x%x'.\n",
+                    optopt);
+        return 1;
+
+      default:
+        abort();
+        break;
+    }
+  }
+
+  /*
+   * Allocate and touch the buffers once so that no requests pay for page faults
+   */
+  s.data = (uint32_t *) alloc_capture_buffer((size_t) s.max_words * sizeof(uint32_t),&s.memfd);
+  s.raw_data = (uint32_t *) malloc((size_t) s.max_words * sizeof(uint32_t));
+  if (!s.data || !s.raw_data) {
+    printf("Error allocating memory");
+    return -1;
+  }
+  memset(s.raw_data,0,(size_t) s.max_words * sizeof(uint32_t));
+
+  //Map the register space and the RAM block once for the lifetime of the daemon
+  s.cfg = map_device(MEM_LOC,&fd);
+  s.ram = map_device(RAM_DATA_LOC,&ram_fd);
+  if (!s.cfg || !s.ram) {
+    return 1;
+  }
+
+  /*
+   * Create the local socket
+   */
+  if ((server = socket(AF_UNIX,SOCK_STREAM,0)) < 0) {
+    perror("socket");
+    return 1;
+  }
+  memset(&addr,0,sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path,socket_path,sizeof(addr.sun_path) - 1);
+  unlink(socket_path);
+  if (bind(server,(struct sockaddr *) &addr,sizeof(addr)) < 0 || listen(server,4) < 0) {
+    perror("bind");
+    return 1;
+  }
+
+  //Stop cleanly on SIGINT/SIGTERM.  No SA_RESTART so that accept() is interrupted
+  memset(&sa,0,sizeof(sa));
+  sa.sa_handler = handle_signal;
+  sigaction(SIGINT,&sa,NULL);
+  sigaction(SIGTERM,&sa,NULL);
+  signal(SIGPIPE,SIG_IGN);
+
+  if (s.debugFlag) {
+    printf("Listening on %s\n",socket_path);
+  }
+  /*
+   * Requests are served one connection at a time as there is only one set of FIFOs
+   */
+  while (running) {
+    client = accept(server,NULL,NULL);
+    if (client < 0) {
+      if (errno == EINTR) continue;
+      perror("accept");
+      break;
+    }
+    serve_client(&s,client);
+  }
+
+  close(server);
+  unlink(socket_path);
+  free_capture_buffer(s.data,(size_t) s.max_words * sizeof(uint32_t),s.memfd);
+  free(s.raw_data);
+  unmap_device(s.cfg,fd);
+  unmap_device(s.ram,ram_fd);
+  return 0;
+}
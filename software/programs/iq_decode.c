@@ -0,0 +1,192 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef IQ_DECODE_NO_THREADS
+#include <unistd.h>
+#include <pthread.h>
+#endif
+
+#include "iq_decode.h"
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define LE32(x)                     ((int32_t) __builtin_bswap32((uint32_t)(x)))
+#define LE16(x)                     ((int16_t) __builtin_bswap16((uint16_t)(x)))
+#else
+#define LE32(x)                     (x)
+#define LE16(x)                     (x)
+#endif
+
+typedef struct {
+  const iq_decode_t *d;
+  const uint8_t *raw;             //Start of the whole block
+  size_t first;                   //First sample of this range
+  size_t n;
+  void *out;                      //Start of the whole matrix
+  size_t ld;
+} decode_range_t;
+
+size_t iq_decode_sample_bytes(const iq_decode_t *d) {
+  if (d->layout == IQ_LAYOUT_INT32) {
+    return d->num_streams >= 1 && d->num_streams <= IQ_DECODE_MAX_COLUMNS ? 4*(size_t) d->num_streams : 0;
+  }
+  return d->layout == IQ_LAYOUT_ADC ? 4 : 0;
+}
+
+uint32_t iq_decode_columns(const iq_decode_t *d) {
+  return d->layout == IQ_LAYOUT_ADC ? 2 : (uint32_t)(iq_decode_sample_bytes(d)/4);
+}
+
+size_t iq_decode_value_bytes(const iq_decode_t *d) {
+  switch (d->out_format) {
+    case IQ_OUT_DOUBLE:
+      return sizeof(double);
+    case IQ_OUT_SINGLE:
+      return sizeof(float);
+    case IQ_OUT_INT32:
+      return sizeof(int32_t);
+  }
+  return 0;
+}
+
+/*
+ * Decodes the N samples of one tile, S values of type T each, starting at sample FIRST.
+ * The input is read in order and each column is written in order, so the hardware sees
+ * S + 1 sequential streams.  Always inlined so that S and T are constants in the
+ * specialised kernels below and the loop over columns is unrolled
+ */
+#define DEFINE_TILE_KERNEL(name,T,LE)                                                       \
+static inline __attribute__((always_inline)) void name(const uint8_t *raw,size_t first,    \
+    size_t n,uint32_t S,uint32_t fmt,const double *scale,void *out,size_t ld) {            \
+  const uint8_t *p = raw + first*S*sizeof(T);                                               \
+  double c[IQ_DECODE_MAX_COLUMNS];                                                          \
+  float cf[IQ_DECODE_MAX_COLUMNS];                                                          \
+  uint32_t k;                                                                               \
+  size_t i;                                                                                 \
+  T w;                                                                                      \
+  for (k = 0;k < S;k++) {                                                                   \
+    c[k] = scale ? scale[k] : 1.0;                                                          \
+    cf[k] = (float) c[k];                                                                   \
+  }                                                                                         \
+  if (fmt == IQ_OUT_DOUBLE) {                                                               \
+    double *o = (double *) out + first;                                                     \
+    for (i = 0;i < n;i++) {                                                                 \
+      for (k = 0;k < S;k++) {                                                               \
+        memcpy(&w,p + (i*S + k)*sizeof(T),sizeof(T));                                       \
+        o[k*ld + i] = c[k]*(double) LE(w);                                                  \
+      }                                                                                     \
+    }                                                                                       \
+  } else if (fmt == IQ_OUT_SINGLE) {                                                        \
+    float *o = (float *) out + first;                                                       \
+    for (i = 0;i < n;i++) {                                                                 \
+      for (k = 0;k < S;k++) {                                                               \
+        memcpy(&w,p + (i*S + k)*sizeof(T),sizeof(T));                                       \
+        o[k*ld + i] = cf[k]*(float) LE(w);                                                  \
+      }                                                                                     \
+    }                                                                                       \
+  } else {                                                                                  \
+    int32_t *o = (int32_t *) out + first;                                                   \
+    for (i = 0;i < n;i++) {                                                                 \
+      for (k = 0;k < S;k++) {                                                               \
+        memcpy(&w,p + (i*S + k)*sizeof(T),sizeof(T));                                       \
+        o[k*ld + i] = (int32_t) LE(w);                                                      \
+      }                                                                                     \
+    }                                                                                       \
+  }                                                                                         \
+}
+
+DEFINE_TILE_KERNEL(decode_tile_int32,int32_t,LE32)
+DEFINE_TILE_KERNEL(decode_tile_int16,int16_t,LE16)
+
+static void decode_range(const decode_range_t *r) {
+  const iq_decode_t *d = r->d;
+  uint32_t S = d->num_streams, fmt = d->out_format;
+  size_t t, n, end = r->first + r->n;
+
+  for (t = r->first;t < end;t += IQ_DECODE_TILE) {
+    n = end - t < IQ_DECODE_TILE ? end - t : IQ_DECODE_TILE;
+    if (d->layout == IQ_LAYOUT_ADC) {
+      decode_tile_int16(r->raw,t,n,2,fmt,d->scale,r->out,r->ld);
+      continue;
+    }
+    switch (S) {
+      case 1:
+        decode_tile_int32(r->raw,t,n,1,fmt,d->scale,r->out,r->ld);
+        break;
+      case 2:
+        decode_tile_int32(r->raw,t,n,2,fmt,d->scale,r->out,r->ld);
+        break;
+      case 3:
+        decode_tile_int32(r->raw,t,n,3,fmt,d->scale,r->out,r->ld);
+        break;
+      case 4:
+        decode_tile_int32(r->raw,t,n,4,fmt,d->scale,r->out,r->ld);
+        break;
+      case 5:
+        decode_tile_int32(r->raw,t,n,5,fmt,d->scale,r->out,r->ld);
+        break;
+      default:
+        decode_tile_int32(r->raw,t,n,S,fmt,d->scale,r->out,r->ld);
+        break;
+    }
+  }
+}
+
+#ifndef IQ_DECODE_NO_THREADS
+static void *decode_thread(void *arg) {
+  decode_range(arg);
+  return NULL;
+}
+#endif
+
+int iq_decode(const iq_decode_t *d,const void *raw,size_t num_samples,void *out,size_t ld) {
+  decode_range_t r[IQ_DECODE_MAX_THREADS];
+  uint32_t T = 1, k;
+  size_t per;
+#ifndef IQ_DECODE_NO_THREADS
+  pthread_t tid[IQ_DECODE_MAX_THREADS];
+  uint32_t started[IQ_DECODE_MAX_THREADS];
+  long cpus;
+#endif
+
+  if (iq_decode_sample_bytes(d) == 0 || iq_decode_value_bytes(d) == 0 || ld < num_samples) {
+    return -1;
+  }
+#ifndef IQ_DECODE_NO_THREADS
+  if (d->threads > 0) {
+    T = d->threads;
+  } else {
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    T = cpus > 0 ? (uint32_t) cpus : 1;
+  }
+  if (T > IQ_DECODE_MAX_THREADS) T = IQ_DECODE_MAX_THREADS;
+  if (T > num_samples/IQ_DECODE_MIN_THREAD) T = num_samples/IQ_DECODE_MIN_THREAD;
+  if (T < 1) T = 1;
+#endif
+  //Whole tiles for every thread but the last
+  per = (num_samples/T + IQ_DECODE_TILE - 1)/IQ_DECODE_TILE*IQ_DECODE_TILE;
+  for (k = 0;k < T;k++) {
+    r[k].d = d;
+    r[k].raw = (const uint8_t *) raw;
+    r[k].first = k*per < num_samples ? k*per : num_samples;
+    r[k].n = k == T - 1 ? num_samples - r[k].first : (r[k].first + per < num_samples ? per : num_samples - r[k].first);
+    r[k].out = out;
+    r[k].ld = ld;
+  }
+#ifndef IQ_DECODE_NO_THREADS
+  for (k = 1;k < T;k++) {
+    //A thread that cannot be started has its range decoded here instead
+    started[k] = pthread_create(&tid[k],NULL,decode_thread,&r[k]) == 0;
+  }
+  decode_range(&r[0]);
+  for (k = 1;k < T;k++) {
+    if (started[k]) {
+      pthread_join(tid[k],NULL);
+    } else {
+      decode_range(&r[k]);
+    }
+  }
+#else
+  decode_range(&r[0]);
+#endif
+  return 0;
+}
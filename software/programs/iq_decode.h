@@ -0,0 +1,59 @@
+#ifndef IQ_DECODE_H_
+#define IQ_DECODE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Decoding of the raw data the device sends into one column per stream, for the host as
+ * well as the device.  It replaces the reshape/typecast loops of IQBiasControl.convertData,
+ * convertPhaseData and convertADCData, and is shared by the convert_data program and the
+ * MEX function iq_decode_mex:
+ *
+ *    IQ_LAYOUT_INT32   num_streams little-endian int32 words per sample, one per FIFO,
+ *                      as written by saveData, savePhaseData, the analyzers and
+ *                      sequencer.  One column per word
+ *    IQ_LAYOUT_ADC     one word per sample holding two int16 ADC values, the first in
+ *                      the low half, as written by fetchRAM.  Two columns
+ *
+ * Column k is scaled by scale[k] and written as double, single or (without scaling)
+ * int32.  The conversion is limited by memory bandwidth, so the kernels read the input
+ * once in order and write every column in order, and are specialised for the usual
+ * stream counts so that the loop over streams is unrolled.  Blocks of more than
+ * IQ_DECODE_MIN_THREAD samples are split in whole tiles between threads, each writing
+ * its own rows.  Build with -DIQ_DECODE_NO_THREADS where pthreads are not available
+ */
+#define IQ_LAYOUT_INT32             0
+#define IQ_LAYOUT_ADC               1
+
+#define IQ_OUT_DOUBLE               0
+#define IQ_OUT_SINGLE               1
+#define IQ_OUT_INT32                2
+
+#define IQ_DECODE_TILE              2048          //Samples per unit of work
+#define IQ_DECODE_MIN_THREAD        65536         //Fewest samples given to a thread
+#define IQ_DECODE_MAX_THREADS       16
+#define IQ_DECODE_MAX_COLUMNS       32
+
+typedef struct {
+  uint32_t layout;                //IQ_LAYOUT_*
+  uint32_t num_streams;           //Words per sample for IQ_LAYOUT_INT32
+  uint32_t out_format;            //IQ_OUT_*
+  const double *scale;            //One factor per column, NULL for none
+  uint32_t threads;               //0 for one per CPU
+} iq_decode_t;
+
+/*
+ * Bytes per input sample, columns and bytes per output value.  Return 0 for an invalid
+ * layout or format
+ */
+size_t iq_decode_sample_bytes(const iq_decode_t *d);
+uint32_t iq_decode_columns(const iq_decode_t *d);
+size_t iq_decode_value_bytes(const iq_decode_t *d);
+/*
+ * Decodes NUM_SAMPLES samples from RAW into the column-major matrix OUT, whose columns
+ * are LD values apart (LD >= NUM_SAMPLES), so that a block can be decoded straight into
+ * its rows of a larger matrix.  Returns -1 for an invalid layout or format
+ */
+int iq_decode(const iq_decode_t *d,const void *raw,size_t num_samples,void *out,size_t ld);
+#endif
@@ -0,0 +1,169 @@
+#ifndef IQ_REGISTERS_H_
+#define IQ_REGISTERS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "iq_backend.h"
+
+/*
+ * Register map of topmod.vhd as a struct overlay of the mapped address space.  Every
+ * field is volatile, so each access is exactly one bus transaction.  The accessors below
+ * go through the overlay on the device and through the mock hook in iq_backend.h when
+ * built with -DMOCK_BACKEND, and are all inlined so that register writes and FIFO reads
+ * compile to single loads and stores at constant offsets
+ */
+typedef volatile struct {
+  uint32_t triggers;              //0x000000
+  uint32_t top;                   //0x000004 TOP_REG
+  uint32_t output;                //0x000008
+  uint32_t filter;                //0x00000C FILTER_REG
+  uint32_t dds_phase_inc;         //0x000010
+  uint32_t dds_phase_off;         //0x000014
+  uint32_t dds2_phase_off;        //0x000018
+  uint32_t dds_phase_corr;        //0x00001C
+  uint32_t dac;                   //0x000020 DAC_LOC
+  uint32_t _pad0[(0x100 - 0x24) >> 2];
+  uint32_t pwm[NUM_PWM];          //0x000100 PWM_LOC
+  uint32_t pwm_limit[NUM_PWM];    //0x000110
+  uint32_t _pad1[(0x200 - 0x120) >> 2];
+  uint32_t pid[5];                //0x000200
+  uint32_t _pad2[(0x300 - 0x214) >> 2];
+  uint32_t phase_control;         //0x000300 PHASE_LOCK_REG
+  uint32_t phase_gain;            //0x000304
+  uint32_t phase_divisor;         //0x000308
+  uint32_t _pad3[(0x100000 - 0x30C) >> 2];
+  uint32_t fifo_control;          //0x100000 FIFO_CONTROL_LOC
+  uint32_t fifo_data[NUM_FIFOS];  //0x100004 bias then phase FIFO read ports
+  uint32_t _pad4[(0x200000 - 0x100028) >> 2];
+  uint32_t num_samples;           //0x200000
+  uint32_t mem_trigger;           //0x200004
+  //The read-only registers from 0x300000, including FIFO_STATUS_LOC, are beyond MAP_SIZE
+} iq_regs_t;
+
+#define IQ_REG(field)               ((uint32_t) offsetof(iq_regs_t,field))
+
+_Static_assert(IQ_REG(top) == TOP_REG,"TOP_REG");
+_Static_assert(IQ_REG(filter) == FILTER_REG,"FILTER_REG");
+_Static_assert(IQ_REG(dac) == DAC_LOC,"DAC_LOC");
+_Static_assert(IQ_REG(pwm) == PWM_LOC,"PWM_LOC");
+_Static_assert(IQ_REG(phase_control) == PHASE_LOCK_REG,"PHASE_LOCK_REG");
+_Static_assert(IQ_REG(fifo_control) == FIFO_CONTROL_LOC,"FIFO_CONTROL_LOC");
+_Static_assert(IQ_REG(fifo_data) == FIFO_BIAS_DATA_START_LOC,"FIFO_BIAS_DATA_START_LOC");
+_Static_assert(IQ_REG(fifo_data) + 4*NUM_BIAS_FIFOS == FIFO_PHASE_DATA_START_LOC,"FIFO_PHASE_DATA_START_LOC");
+_Static_assert(sizeof(iq_regs_t) <= MAP_SIZE,"MAP_SIZE");
+
+#define IQ_BIAS_MASK                ((1u << NUM_BIAS_FIFOS) - 1)
+#define IQ_PHASE_MASK               ((1u << NUM_PHASE_FIFOS) - 1)
+
+#ifdef MOCK_BACKEND
+#define IQ_READ(cfg,field)          mock_reg_read((cfg),IQ_REG(field))
+#define IQ_WRITE(cfg,field,v)       mock_reg_write((cfg),IQ_REG(field),(v))
+#define IQ_READ_FIFO(cfg,k)         mock_reg_read((cfg),IQ_REG(fifo_data) + ((k) << 2))
+#define IQ_WRITE_PWM(cfg,ch,v)      mock_reg_write((cfg),IQ_REG(pwm) + ((ch) << 2),(v))
+#else
+#define IQ_READ(cfg,field)          (((iq_regs_t *)(cfg))->field)
+#define IQ_WRITE(cfg,field,v)       (((iq_regs_t *)(cfg))->field = (v))
+#define IQ_READ_FIFO(cfg,k)         (((iq_regs_t *)(cfg))->fifo_data[k])
+#define IQ_WRITE_PWM(cfg,ch,v)      (((iq_regs_t *)(cfg))->pwm[ch] = (v))
+#endif
+
+/*
+ * Exclusive use of the FIFOs.  FIFO_CONTROL resets and enables every FIFO at once, so two
+ * programs capturing at the same time (such as lock_watchdog and saveData) would spoil
+ * each other's data.  start_fifo() therefore takes an flock() on FIFO_LOCK_FILE, waiting
+ * for the program that holds it (with a message on stderr), and stop_fifo() releases it.  The lock is held once per
+ * process, so restarting the FIFOs before stopping them does not wait on itself, and it
+ * is released by the kernel if the program dies.  fifo_lock(0) only tries to take the
+ * lock and returns -1 if another program holds it.  If the lock file cannot be opened the
+ * capture goes ahead without it, after a warning
+ */
+#define FIFO_LOCK_FILE              "/tmp/iq_bias_control.fifo.lock"
+
+int fifo_lock(int wait);
+void fifo_unlock(void);
+
+static inline int start_fifo(void *cfg) {
+  fifo_lock(1);
+  //Disable FIFO
+  IQ_WRITE(cfg,fifo_control,0);
+  //Reset FIFO
+  usleep(1);
+  IQ_WRITE(cfg,fifo_control,(1 << 1));
+  usleep(1);
+  IQ_WRITE(cfg,fifo_control,0);
+  usleep(1);
+  //Enable FIFO
+  IQ_WRITE(cfg,fifo_control,1);
+  return 0;
+}
+
+static inline int stop_fifo(void *cfg) {
+  IQ_WRITE(cfg,fifo_control,(1 << 1));
+  usleep(1);
+  IQ_WRITE(cfg,fifo_control,0);
+  fifo_unlock();
+  return 0;
+}
+
+static inline int write_to_bias_pwm(void *cfg,uint16_t V1,uint16_t V2,uint16_t V3) {
+  IQ_WRITE_PWM(cfg,0,(uint32_t) V1);
+  IQ_WRITE_PWM(cfg,1,(uint32_t) V2);
+  IQ_WRITE_PWM(cfg,2,(uint32_t) V3);
+  return 0;
+}
+
+static inline int write_to_phase_pwm(void *cfg,uint16_t V) {
+  IQ_WRITE_PWM(cfg,3,(uint32_t) V);
+  return 0;
+}
+
+static inline int write_to_pwm(void *cfg,uint32_t channel,uint16_t V) {
+  IQ_WRITE_PWM(cfg,channel,(uint32_t) V);
+  return 0;
+}
+
+static inline int write_to_aux_dac(void *cfg,uint16_t V) {
+  IQ_WRITE(cfg,dac,(uint32_t) V);
+  return 0;
+}
+
+static inline int set_lock_status(void *cfg,uint32_t s) {
+  uint32_t old = IQ_READ(cfg,phase_control);
+  old = (old & ~((uint32_t) 1 << 31)) | (s << 31);
+  IQ_WRITE(cfg,phase_control,old);
+  return 0;
+}
+
+/*
+ * Capture kernels.  iq_read_sample() reads one word from each FIFO selected by MASK,
+ * counting from FIFO FIRST (0 for the bias FIFOs, NUM_BIAS_FIFOS for the phase FIFOs),
+ * and returns the next free word of DST.  Both are always inlined, so when FIRST and
+ * MASK are constants the loop over FIFOs is unrolled into one load per selected FIFO and
+ * the only loop left is the one over samples
+ */
+static inline __attribute__((always_inline)) uint32_t *iq_read_sample(void *cfg,uint32_t first,uint32_t mask,uint32_t *dst) {
+  uint32_t k;
+#pragma GCC unroll 16
+  for (k = 0;k < NUM_FIFOS;k++) {
+    if (mask & (1u << k)) *dst++ = IQ_READ_FIFO(cfg,first + k);
+  }
+  return dst;
+}
+
+static inline __attribute__((always_inline)) void iq_capture(void *cfg,uint32_t first,uint32_t mask,uint32_t numSamples,uint32_t *data) {
+  uint32_t i;
+  for (i = 0;i < numSamples;i++) {
+    data = iq_read_sample(cfg,first,mask,data);
+  }
+}
+
+static inline void iq_capture_bias(void *cfg,uint32_t numSamples,uint32_t *data) {
+  iq_capture(cfg,0,IQ_BIAS_MASK,numSamples,data);
+}
+
+static inline void iq_capture_phase(void *cfg,uint32_t numSamples,uint32_t *data) {
+  iq_capture(cfg,NUM_BIAS_FIFOS,IQ_PHASE_MASK,numSamples,data);
+}
+#endif
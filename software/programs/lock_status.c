@@ -0,0 +1,124 @@
+//These are libraries which contain useful functions
+#include <ctype.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "capture_output.h"
+#include "watchdog.h"
+
+/*
+ * Reads the status published by lock_watchdog without touching the device, so it is
+ * cheap enough to call before every shot of an experiment.  Prints a one-line summary,
+ * or with -v every value, and exits with the result of watchdog_check(): 0 locked, 1 not
+ * locked, 2 watchdog not running, 3 locked with an output at a limit.  With -w the query
+ * is repeated until the locks are good or the time runs out, and with -z the exit code
+ * is always 0 for callers that take any other code as a failure.  The output goes to
+ * standard output, or to -o
+ */
+static const char *check_names[] = {"LOCKED","NOT_LOCKED","NOT_RUNNING","LOCKED_SATURATED"};
+
+int main(int argc, char **argv)
+{
+  const watchdog_shm_t *shm;
+  watchdog_status_t st;
+  uint8_t quietFlag = 0;      //Exit code only
+  uint8_t verboseFlag = 0;    //Every value
+  uint8_t debugFlag = 0;
+  uint8_t zeroFlag = 0;       //Always exit with 0
+  uint32_t waitTime = 0;      //Time to wait for a lock [ms]
+  char *outputFile = "-";     //Output destination, standard output by default
+  char *text = NULL;
+  size_t text_len = 0;
+  FILE *tptr;
+  int outfd;
+  uint64_t start, now;
+  int ret;
+
+  /*
+   * Parse the input arguments
+   */
+  int c;
+  while ((c = getopt(argc,argv,"qvw:o:zf")) != -1) {
+    switch (c) {
+      case 'q':
+        quietFlag = 1;
+        break;
+      case 'v':
+        verboseFlag = 1;
+        break;
+      case 'w':
+        waitTime = atoi(optarg);
+        break;
+      case 'o':
+        outputFile = optarg;
+        break;
+      case 'z':
+        zeroFlag = 1;
+        break;
+      case 'f':
+        debugFlag = 1;
+        break;
+
+      case '?':
+        if (isprint (optopt))
+            fprintf (stderr, "Unknown option `-%c'.\n", optopt);
+        else
+            fprintf (stderr,
+                    "Unknown option character `\\x%x'.\n",
+                    optopt);
+        return 1;
+
+      default:
+        abort();
+        break;
+    }
+  }
+
+  start = watchdog_now_ns();
+  //Without the block the zeroed status is classified as not running
+  memset(&st,0,sizeof(st));
+  shm = watchdog_open();
+  while (1) {
+    if (shm && watchdog_read(shm,&st) != 0) {
+      memset(&st,0,sizeof(st));
+    }
+    now = watchdog_now_ns();
+    ret = watchdog_check(&st,now);
+    if (!shm || ret == WATCHDOG_LOCKED || ret == WATCHDOG_LOCKED_SATURATED || now - start >= (uint64_t) waitTime*1000000) {
+      break;
+    }
+    usleep(st.period_us > 0 && st.period_us < 100000 ? st.period_us : 10000);
+  }
+  if (debugFlag) {
+    fprintf(stderr,"Query took %.1f us\n",(watchdog_now_ns() - start)*1e-3);
+  }
+
+  tptr = open_memstream(&text,&text_len);
+  if (!tptr) {
+    printf("Error allocating memory");
+    return -1;
+  }
+  if (verboseFlag) {
+    fprintf(tptr,"result %s\n",check_names[ret]);
+    watchdog_print(tptr,&st);
+  } else if (!quietFlag && st.update_ns == 0) {
+    fprintf(tptr,"%s\n",check_names[ret]);
+  } else if (!quietFlag) {
+    fprintf(tptr,"%s status 0x%02x bias error %.1f %.1f %.1f phase error %.1f age %.3f s\n",check_names[ret],st.status,
+            st.bias_error[0],st.bias_error[1],st.bias_error[2],st.phase_error,
+            st.update_ns > 0 && now > st.update_ns ? (now - st.update_ns)*1e-9 : 0.0);
+  }
+  fclose(tptr);
+  if (text_len > 0 && (outfd = open_output(outputFile)) >= 0) {
+    write_all(outfd,text,text_len);
+    close_output(outfd);
+  }
+  free(text);
+
+  watchdog_close(shm);
+  return zeroFlag ? 0 : ret;
+}
@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "iq_bias_control.h"
+#include "lock_trials.h"
+
+void lock_trial_analyse(const int32_t *x,uint32_t numSamples,uint32_t num_streams,uint32_t column,uint32_t change_sample,
+                        const lock_detect_t *det,double sample_period,lock_trial_t *t) {
+  const uint32_t S = num_streams;
+  const uint32_t hold = det->hold > 0 ? det->hold : 1;
+  uint32_t i, run = 0, out = 0, acq = numSamples, n = 0;
+  double e, sign, sumsq = 0;
+
+  memset(t,0,sizeof(*t));
+  t->acquisition_time = t->residual = NAN;
+  if (change_sample >= numSamples) {
+    t->flags = LOCK_TRIAL_FAILED;
+    return;
+  }
+  t->initial_error = (double) x[(size_t) change_sample*S + column] - det->setpoint;
+  sign = t->initial_error >= 0 ? 1.0 : -1.0;
+  for (i = change_sample;i < numSamples;i++) {
+    e = (double) x[(size_t) i*S + column] - det->setpoint;
+    if (-sign*e > t->overshoot) t->overshoot = -sign*e;
+    if (acq == numSamples) {
+      //Not acquired yet: look for hold samples in a row within the band
+      run = fabs(e) <= det->tolerance ? run + 1 : 0;
+      if (run >= hold) acq = i + 1 - hold;
+    } else {
+      out = fabs(e) > det->tolerance ? out + 1 : 0;
+      if (out >= hold) t->flags |= LOCK_TRIAL_LOST;
+      if (i >= acq + hold) {
+        sumsq += e*e;
+        n++;
+      }
+    }
+  }
+  if (acq == numSamples) {
+    t->flags |= LOCK_TRIAL_FAILED;
+    return;
+  }
+  t->acquisition_sample = acq - change_sample;
+  t->acquisition_time = (double) t->acquisition_sample*sample_period;
+  if (n > 0) {
+    t->residual = sqrt(sumsq/n);
+  }
+}
+
+int record_lock_trials(void *cfg,uint32_t mask,uint32_t numSamples,uint32_t change_sample,uint32_t numTrials,
+                       const lock_detect_t *det,uint32_t *data,double *avg,lock_trial_t *result,capture_events_t *ev) {
+  const uint32_t S = __builtin_popcount(mask);
+  const double period = fifo_sample_period(cfg,FIFO_PHASE_DATA_START_LOC);
+  const size_t num_words = (size_t) numSamples*S;
+  uint64_t off = 0;
+  uint32_t column, r;
+  size_t i;
+
+  if (det->stream >= NUM_PHASE_FIFOS || !(mask & (1u << det->stream))) {
+    return -1;
+  }
+  column = __builtin_popcount(mask & ((1u << det->stream) - 1));
+  if (change_sample > numSamples) change_sample = numSamples;
+  if (avg) {
+    memset(avg,0,num_words*sizeof(double));
+  }
+
+  for (r = 0;r < numTrials;r++) {
+    // The off time counts from the end of the previous trial, so it does not include the
+    // time taken to analyse it
+    set_lock_status(cfg,0);
+    if (r == 0) off = rt_now_ns();
+    rt_wait_until(off + 1000*(uint64_t) det->off_us);
+    record_jump(cfg,FIFO_PHASE_DATA_START_LOC,mask,numSamples,change_sample,jump_lock,NULL,1,CAPTURE_EVENT_LOCK,r,data,ev);
+    set_lock_status(cfg,0);
+    off = rt_now_ns();
+
+    lock_trial_analyse((const int32_t *) data,numSamples,S,column,change_sample,det,period,result + r);
+    if (avg) {
+      for (i = 0;i < num_words;i++) {
+        avg[i] += (double)(int32_t) data[i];
+      }
+    }
+  }
+  if (avg && numTrials > 0) {
+    for (i = 0;i < num_words;i++) {
+      avg[i] /= numTrials;
+    }
+  }
+  return 0;
+}
+
+static int compare_double(const void *a,const void *b) {
+  double x = *(const double *) a, y = *(const double *) b;
+  return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+void lock_print_trials(FILE *f,const lock_trial_t *result,uint32_t numTrials,const lock_detect_t *det,double sample_period) {
+  double *acq, mean = 0, var = 0, median, overshoot = 0, max_overshoot = 0;
+  uint32_t r, n = 0, lost = 0;
+
+  fprintf(f,"# %u trials, setpoint %d, tolerance %u counts for %u samples, %u us off, sample period %.6e s\n",
+          numTrials,det->setpoint,det->tolerance,det->hold,det->off_us,sample_period);
+  fprintf(f,"# trial flags acquisition_time[s] initial_error overshoot residual_rms\n");
+  acq = (double *) malloc((numTrials > 0 ? numTrials : 1)*sizeof(double));
+  for (r = 0;r < numTrials;r++) {
+    fprintf(f,"%u %u %.6e %.6g %.6g %.6g\n",r,result[r].flags,result[r].acquisition_time,result[r].initial_error,
+            result[r].overshoot,result[r].residual);
+    if (result[r].flags & LOCK_TRIAL_LOST) lost++;
+    if (!(result[r].flags & LOCK_TRIAL_FAILED)) {
+      if (acq) acq[n] = result[r].acquisition_time;
+      mean += result[r].acquisition_time;
+      overshoot += result[r].overshoot;
+      if (result[r].overshoot > max_overshoot) max_overshoot = result[r].overshoot;
+      n++;
+    }
+  }
+  fprintf(f,"# acquired %u of %u, failed %u, lost again %u\n",n,numTrials,numTrials - n,lost);
+  if (n > 0 && acq) {
+    mean /= n;
+    for (r = 0;r < n;r++) {
+      var += (acq[r] - mean)*(acq[r] - mean);
+    }
+    var = n > 1 ? var/(n - 1) : 0;
+    qsort(acq,n,sizeof(double),compare_double);
+    median = n & 1 ? acq[n/2] : 0.5*(acq[n/2 - 1] + acq[n/2]);
+    fprintf(f,"# acquisition time [s] mean %.6e std %.6e median %.6e p90 %.6e max %.6e\n",
+            mean,sqrt(var),median,acq[(9*n + 9)/10 - 1],acq[n - 1]);
+    fprintf(f,"# overshoot [counts] mean %.6g max %.6g\n",overshoot/n,max_overshoot);
+  }
+  free(acq);
+}
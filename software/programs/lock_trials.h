@@ -0,0 +1,64 @@
+#ifndef LOCK_TRIALS_H_
+#define LOCK_TRIALS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "capture_file.h"
+
+/*
+ * Repeated lock acquisition trials.  Each trial disengages the phase lock, waits off_us,
+ * then records numSamples samples of the phase FIFOs in MASK with the lock engaged before
+ * sample change_sample, as record_phase_lock() does.  So the lock is off for off_us plus
+ * change_sample samples and on for numSamples - change_sample samples.
+ *
+ * Every trial is analysed on the device from the error e = x - setpoint of one stream.
+ * The lock is acquired at the first sample after the engage from which |e| stays within
+ * tolerance for hold samples.  After that it is lost if |e| leaves the band for hold
+ * samples in a row.  The overshoot is the largest error of the opposite sign to the error
+ * at the engage, and the residual is the RMS error from the end of the hold onwards
+ */
+#define LOCK_DEFAULT_TOLERANCE      100
+#define LOCK_DEFAULT_HOLD           100
+#define LOCK_DEFAULT_OFF_US         1000
+
+#define LOCK_TRIAL_FAILED           0x1       //Never acquired
+#define LOCK_TRIAL_LOST             0x2       //Acquired and then lost again
+
+typedef struct {
+  uint32_t stream;                //FIFO of the error signal, counted from the first phase FIFO
+  int32_t setpoint;               //Value of the stream when locked [counts]
+  uint32_t tolerance;             //Largest |error| that counts as locked [counts]
+  uint32_t hold;                  //Samples the error must stay within tolerance
+  uint32_t off_us;                //Wait with the lock off before each trial [us]
+} lock_detect_t;
+
+typedef struct {
+  uint32_t flags;                 //LOCK_TRIAL_*
+  uint32_t acquisition_sample;    //Samples from the engage to the acquisition
+  double acquisition_time;        //[s], NAN if the lock failed
+  double initial_error;           //Error at the engage [counts]
+  double overshoot;               //[counts]
+  double residual;                //RMS error once locked [counts], NAN if the lock failed
+} lock_trial_t;
+
+/*
+ * Runs numTrials trials and writes one result per trial to RESULT.  DATA holds one trial
+ * and has the last one on return.  If AVG is not NULL, it receives the mean of the
+ * trials, numSamples interleaved samples of popcount(MASK) doubles.  The time of each
+ * engage is added to EV, which may be NULL.  Returns -1 if the error stream is not in MASK
+ */
+int record_lock_trials(void *cfg,uint32_t mask,uint32_t numSamples,uint32_t change_sample,uint32_t numTrials,
+                       const lock_detect_t *det,uint32_t *data,double *avg,lock_trial_t *result,capture_events_t *ev);
+/*
+ * Analyses one trial of numSamples interleaved samples of num_streams int32 words, with
+ * the error signal in column COLUMN and the lock engaged before sample change_sample
+ */
+void lock_trial_analyse(const int32_t *x,uint32_t numSamples,uint32_t num_streams,uint32_t column,uint32_t change_sample,
+                        const lock_detect_t *det,double sample_period,lock_trial_t *t);
+/*
+ * Prints one row per trial followed by a summary: the success rate and the mean,
+ * standard deviation, median, 90th percentile and maximum of the acquisition times
+ */
+void lock_print_trials(FILE *f,const lock_trial_t *result,uint32_t numTrials,const lock_detect_t *det,double sample_period);
+#endif
@@ -0,0 +1,159 @@
+//These are libraries which contain useful functions
+#include <ctype.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+
+#include "iq_bias_control.h"
+#include "watchdog.h"
+
+/*
+ * Lock-health watchdog service (see watchdog.h).  Runs until it is stopped with
+ * SIGINT/SIGTERM, publishing the status of the locks in shared memory after every
+ * window; lock_status and IQBiasControl.getLockStatus() read it without touching the
+ * device.  With -f every change of the status flags is written to standard error
+ */
+static volatile sig_atomic_t stop_requested = 0;
+
+static void handle_stop(int sig) {
+  stop_requested = 1;
+}
+
+int main(int argc, char **argv)
+{
+  int fd;		        //File identifier
+  void *cfg;		    //A pointer to a memory location.  The * indicates that it is a pointer - it points to a location in memory
+
+  watchdog_params_t params;
+  watchdog_state_t state;
+  watchdog_shm_t *shm;
+  uint32_t *data;
+  uint32_t last;
+  uint64_t t;
+  int cpu = RT_DEFAULT_CPU;   //CPU to run on in real-time mode
+  uint8_t rtFlag = 0;         //Real-time mode: locked memory and SCHED_FIFO
+  uint8_t debugFlag = 0;
+  struct sigaction sa;
+
+  watchdog_defaults(&params);
+  /*
+   * Parse the input arguments
+   */
+  int c;
+  while ((c = getopt(argc,argv,"t:n:h:e:E:m:Ru:N:p:Lf")) != -1) {
+    switch (c) {
+      case 't':
+        params.period_us = atoi(optarg);
+        break;
+      case 'n':
+        params.numSamples = atoi(optarg);
+        break;
+      case 'h':
+        params.hold = atoi(optarg);
+        break;
+      case 'e':
+        params.bias_error = atof(optarg);
+        break;
+      case 'E':
+        params.phase_error = atof(optarg);
+        break;
+      case 'm':
+        params.margin = atof(optarg);
+        break;
+      case 'R':
+        params.relock = 1;
+        break;
+      case 'u':
+        params.off_us = atoi(optarg);
+        break;
+      case 'N':
+        params.max_relocks = atoi(optarg);
+        break;
+      case 'p':
+        cpu = atoi(optarg);
+        break;
+      case 'L':
+        rtFlag = 1;
+        break;
+      case 'f':
+        debugFlag = 1;
+        break;
+
+      case '?':
+        if (isprint (optopt))
+            fprintf (stderr, "Unknown option `-%c'.\n", optopt);
+        else
+            fprintf (stderr,
+                    "Unknown option character `\\x%x'.\n",
+                    optopt);
+        return 1;
+
+      default:
+        abort();
+        break;
+    }
+  }
+
+  if (params.numSamples == 0 || params.hold == 0 || params.period_us == 0) {
+    fprintf(stderr,"The period, window and hold count must not be zero\n");
+    return 1;
+  }
+
+  data = (uint32_t *) malloc((size_t) NUM_FIFOS*params.numSamples*sizeof(uint32_t));
+  if (!data) {
+    printf("Error allocating memory");
+    return -1;
+  }
+  cfg = map_device(MEM_LOC,&fd);
+  if (!cfg) {
+    free(data);
+    return 1;
+  }
+  shm = watchdog_create();
+  if (!shm) {
+    unmap_device(cfg,fd);
+    free(data);
+    return 1;
+  }
+  if (rtFlag) {
+    rt_enter(cpu,RT_DEFAULT_PRIORITY);
+  }
+
+  memset(&sa,0,sizeof(sa));
+  sa.sa_handler = handle_stop;
+  sigaction(SIGINT,&sa,NULL);
+  sigaction(SIGTERM,&sa,NULL);
+
+  memset(&state,0,sizeof(state));
+  state.st.running = 1;
+  last = 0;
+  t = rt_now_ns();
+  while (!stop_requested) {
+    watchdog_window(cfg,&params,&state,data);
+    watchdog_publish(shm,&state.st);
+    if (debugFlag && state.st.status != last) {
+      fprintf(stderr,"Window %llu: status 0x%02x, bias error %.1f %.1f %.1f, phase error %.1f\n",
+              (unsigned long long) state.st.windows,state.st.status,state.st.bias_error[0],state.st.bias_error[1],
+              state.st.bias_error[2],state.st.phase_error);
+      last = state.st.status;
+    }
+    //A late window moves the schedule instead of starting a burst of windows
+    t += (uint64_t) params.period_us*1000;
+    if (t < rt_now_ns()) t = rt_now_ns();
+    rt_wait_until(t);
+  }
+  state.st.running = 0;
+  watchdog_publish(shm,&state.st);
+  if (debugFlag) {
+    fprintf(stderr,"%llu windows, %llu skipped, %llu re-locks\n",(unsigned long long) state.st.windows,
+            (unsigned long long) state.st.skipped,(unsigned long long) state.st.relocks);
+  }
+
+  watchdog_close(shm);
+  unmap_device(cfg,fd);
+  free(data);
+  return 0;	//C functions should have a return value - 0 is the usual "no error" return value
+}
@@ -0,0 +1,220 @@
+//These are libraries which contain useful functions
+#include <ctype.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <math.h>
+
+#include "iq_bias_control.h"
+#include "capture_output.h"
+#include "mimo_control.h"
+
+/*
+ * Outer-loop MIMO bias controller (see mimo_control.h).  Runs on the device, so the slow
+ * drift of the biases is corrected every few samples instead of over a network round
+ * trip.  It runs for the given time, or until it is stopped with SIGINT/SIGTERM, and
+ * leaves the outputs at their last values.  A log line is written every log_every
+ * updates, once a second by default.  It holds the FIFOs for the whole run, so other
+ * captures (saveData, the analyzers, the daemon) wait until it stops
+ */
+static volatile sig_atomic_t stop_requested = 0;
+
+static void handle_stop(int sig) {
+  stop_requested = 1;
+}
+
+int main(int argc, char **argv)
+{
+  int fd;		        //File identifier
+  void *cfg;		    //A pointer to a memory location.  The * indicates that it is a pointer - it points to a location in memory
+
+  mimo_config_t conf;
+  mimo_state_t st;
+  double tmp[MIMO_NUM*MIMO_NUM];
+  uint16_t V0[MIMO_NUM];
+  uint8_t V0Flag = 0;         //Start from given outputs instead of the current ones
+  double duration = 0;        //Run time [s], 0 to run until stopped
+  uint64_t numUpdates = 0;
+  uint32_t logEvery = 0;      //Updates per log line, 0 for once a second
+  uint32_t lim, lo, hi;
+  int cpu = RT_DEFAULT_CPU;   //CPU to run on in real-time mode
+  uint8_t rtFlag = 0;         //Real-time mode: locked memory and SCHED_FIFO
+  uint8_t debugFlag = 0;
+  char *outputFile = "-";     //Log destination, standard output by default
+  int outfd, ret, i, j;
+  FILE *log;
+  struct sigaction sa;
+
+  mimo_defaults(&conf);
+  /*
+   * Parse the input arguments
+   */
+  int c;
+  while ((c = getopt(argc,argv,"G:r:b:n:m:l:u:x:X:V:T:v:o:p:Lf")) != -1) {
+    switch (c) {
+      case 'G':
+        if (mimo_parse_list(optarg,tmp,MIMO_NUM*MIMO_NUM) != 0) {
+          fprintf(stderr,"The response matrix needs %d values, row by row\n",MIMO_NUM*MIMO_NUM);
+          return 1;
+        }
+        memcpy(conf.G,tmp,sizeof(conf.G));
+        break;
+      case 'r':
+      case 'b':
+      case 'l':
+      case 'u':
+      case 'V':
+        if (mimo_parse_list(optarg,tmp,MIMO_NUM) != 0) {
+          fprintf(stderr,"Option -%c needs 1 or %d values\n",c,MIMO_NUM);
+          return 1;
+        }
+        for (i = 0;i < MIMO_NUM;i++) {
+          if (c == 'r') conf.setpoint[i] = tmp[i];
+          else if (c == 'b') conf.bandwidth[i] = tmp[i];
+          else if (c == 'l') conf.min[i] = (uint16_t) tmp[i];
+          else if (c == 'u') conf.max[i] = (uint16_t) tmp[i];
+          else V0[i] = (uint16_t) tmp[i];
+        }
+        V0Flag |= c == 'V';
+        break;
+      case 'n':
+        conf.update_samples = atoi(optarg);
+        break;
+      case 'm':
+        conf.max_step = atof(optarg);
+        break;
+      case 'x':
+        conf.fault = atof(optarg);
+        break;
+      case 'X':
+        conf.fault_timeout = atoi(optarg);
+        break;
+      case 'T':
+        duration = atof(optarg);
+        break;
+      case 'v':
+        logEvery = atoi(optarg);
+        break;
+      case 'o':
+        outputFile = optarg;
+        break;
+      case 'p':
+        cpu = atoi(optarg);
+        break;
+      case 'L':
+        rtFlag = 1;
+        break;
+      case 'f':
+        debugFlag = 1;
+        break;
+
+      case '?':
+        if (isprint (optopt))
+            fprintf (stderr, "Unknown option `-%c'.\n", optopt);
+        else
+            fprintf (stderr,
+                    "Unknown option character `\\x%x'.\n",
+                    optopt);
+        return 1;
+
+      default:
+        abort();
+        break;
+    }
+  }
+
+  if (conf.update_samples == 0) {
+    fprintf(stderr,"The update needs at least one sample\n");
+    return 1;
+  }
+  for (i = 0;i < MIMO_NUM;i++) {
+    if (conf.max[i] > MIMO_PWM_MAX) conf.max[i] = MIMO_PWM_MAX;
+    if (conf.min[i] > conf.max[i]) {
+      fprintf(stderr,"Invalid limits for output %d\n",i + 1);
+      return 1;
+    }
+  }
+
+  cfg = map_device(MEM_LOC,&fd);
+  if (!cfg) {
+    return 1;
+  }
+  // Stay inside the FPGA PWM limits as well, where they are set
+  for (i = 0;i < MIMO_NUM;i++) {
+    lim = IQ_READ(cfg,pwm_limit[i]);
+    lo = lim & 0x3FF;
+    hi = (lim >> 10) & 0x3FF;
+    if (hi > lo) {
+      if (conf.min[i] < lo) conf.min[i] = lo;
+      if (conf.max[i] > hi) conf.max[i] = hi;
+    }
+    if (!V0Flag) {
+      V0[i] = IQ_READ(cfg,pwm[i]) & 0x3FF;
+    }
+  }
+  ret = mimo_init(&st,&conf,fifo_sample_period(cfg,FIFO_BIAS_DATA_START_LOC),V0);
+  if (ret == -1) {
+    fprintf(stderr,"The response matrix is singular or was not given\n");
+    unmap_device(cfg,fd);
+    return 1;
+  } else if (ret == -2) {
+    fprintf(stderr,"The bandwidths must be positive and at most %g times the update rate of %.4g Hz\n",
+            MIMO_MAX_BANDWIDTH_RATIO,1/st.period);
+    unmap_device(cfg,fd);
+    return 1;
+  }
+  if (logEvery == 0) {
+    logEvery = (uint32_t) ceil(1/st.period);
+  }
+  if (duration > 0) {
+    numUpdates = (uint64_t) ceil(duration/st.period);
+  }
+
+  if ((outfd = open_output(outputFile)) < 0) {
+    unmap_device(cfg,fd);
+    return 1;
+  }
+  log = outfd == STDOUT_FILENO ? stdout : fdopen(outfd,"w");
+  if (!log) {
+    printf("Error allocating memory");
+    return -1;
+  }
+  setvbuf(log,NULL,_IOLBF,0);
+  mimo_print_gains(log,&st,&conf);
+  if (rtFlag) {
+    // The loop is a single thread, so all of it runs at real-time priority
+    rt_enter(cpu,RT_DEFAULT_PRIORITY);
+  }
+
+  memset(&sa,0,sizeof(sa));
+  sa.sa_handler = handle_stop;
+  sigaction(SIGINT,&sa,NULL);
+  sigaction(SIGTERM,&sa,NULL);
+  signal(SIGPIPE,SIG_IGN);
+
+  ret = run_mimo_control(cfg,&conf,&st,numUpdates,&stop_requested,log,logEvery);
+  if (ret < 0) {
+    printf("Error allocating memory");
+    return -1;
+  } else if (ret == 1) {
+    fprintf(stderr,"Stopped after %u updates held by the fault limit\n",st.held);
+  }
+  if (debugFlag || ret == 1) {
+    fprintf(stderr,"%llu updates: %llu held, %llu rate limited, %llu saturated\n",(unsigned long long) st.updates,
+            (unsigned long long) st.faults,(unsigned long long) st.rate_limited,(unsigned long long) st.saturated);
+    for (j = 0;j < MIMO_NUM;j++) {
+      fprintf(stderr,"Output %d: %.3f counts, error %.3f counts\n",j + 1,st.V[j],st.error[j]);
+    }
+  }
+  if (log == stdout) {
+    fflush(log);
+  } else {
+    fclose(log);
+  }
+
+  unmap_device(cfg,fd);
+  return ret;	//C functions should have a return value - 0 is the usual "no error" return value
+}
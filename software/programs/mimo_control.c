@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "iq_bias_control.h"
+#include "mimo_control.h"
+
+void mimo_defaults(mimo_config_t *c) {
+  memset(c,0,sizeof(*c));
+  for (int i = 0;i < MIMO_NUM;i++) {
+    c->bandwidth[i] = MIMO_DEFAULT_BANDWIDTH;
+    c->min[i] = 0;
+    c->max[i] = MIMO_PWM_MAX;
+  }
+  c->update_samples = MIMO_DEFAULT_UPDATE_SAMPLES;
+  c->max_step = MIMO_DEFAULT_MAX_STEP;
+}
+
+int mimo_parse_list(const char *list,double *x,uint32_t n) {
+  const char *p = list;
+  char *end = (char *) list;
+  uint32_t k = 0;
+
+  while (k < n) {
+    x[k++] = strtod(p,&end);
+    if (end == p) return -1;
+    if (*end == '\0') break;
+    if (*end != ',') return -1;
+    p = end + 1;
+  }
+  if (*end != '\0') return -1;
+  if (k == 1) {
+    for (;k < n;k++) x[k] = x[0];
+  }
+  return k == n ? 0 : -1;
+}
+
+int mimo_invert(const double A[MIMO_NUM][MIMO_NUM],double B[MIMO_NUM][MIMO_NUM]) {
+  double det, scale = 0;
+  int i, j;
+
+  for (i = 0;i < 3;i++) {
+    for (j = 0;j < 3;j++) {
+      B[j][i] = A[(i + 1) % 3][(j + 1) % 3]*A[(i + 2) % 3][(j + 2) % 3]
+              - A[(i + 1) % 3][(j + 2) % 3]*A[(i + 2) % 3][(j + 1) % 3];
+      if (fabs(A[i][j]) > scale) scale = fabs(A[i][j]);
+    }
+  }
+  det = A[0][0]*B[0][0] + A[0][1]*B[1][0] + A[0][2]*B[2][0];
+  if (!(fabs(det) > 1e-9*scale*scale*scale)) return -1;
+  for (i = 0;i < 3;i++) {
+    for (j = 0;j < 3;j++) {
+      B[i][j] /= det;
+    }
+  }
+  return 0;
+}
+
+int mimo_init(mimo_state_t *st,const mimo_config_t *c,double sample_period,const uint16_t *V0) {
+  double Gpwm[MIMO_NUM][MIMO_NUM], Ginv[MIMO_NUM][MIMO_NUM], a;
+  int i, j;
+
+  memset(st,0,sizeof(*st));
+  st->period = sample_period*(c->update_samples > 0 ? c->update_samples : 1);
+  for (i = 0;i < MIMO_NUM;i++) {
+    for (j = 0;j < MIMO_NUM;j++) {
+      Gpwm[i][j] = c->G[i][j]*MIMO_CONV_PWM;
+    }
+  }
+  if (mimo_invert((const double (*)[MIMO_NUM]) Gpwm,Ginv) != 0) return -1;
+  for (j = 0;j < MIMO_NUM;j++) {
+    if (!(c->bandwidth[j] > 0) || c->bandwidth[j]*st->period > MIMO_MAX_BANDWIDTH_RATIO) return -2;
+    //Exact pole of a first-order loop, so the discrete gain never exceeds 1
+    a = 1 - exp(-2*M_PI*c->bandwidth[j]*st->period);
+    for (i = 0;i < MIMO_NUM;i++) {
+      st->K[i][j] = Ginv[i][j]*a;
+    }
+  }
+  for (i = 0;i < MIMO_NUM;i++) {
+    st->V[i] = V0[i];
+  }
+  return 0;
+}
+
+uint32_t mimo_update(mimo_state_t *st,const mimo_config_t *c,const double *y,uint16_t *out) {
+  double dV[MIMO_NUM], largest = 0;
+  int i, j;
+
+  st->flags = 0;
+  st->updates++;
+  for (i = 0;i < MIMO_NUM;i++) {
+    st->error[i] = y[i] - c->setpoint[i];
+    if (c->fault > 0 && fabs(st->error[i]) > c->fault) st->flags |= MIMO_FAULT;
+  }
+  if (st->flags & MIMO_FAULT) {
+    st->held++;
+    st->faults++;
+    memset(dV,0,sizeof(dV));
+  } else {
+    st->held = 0;
+    for (i = 0;i < MIMO_NUM;i++) {
+      dV[i] = 0;
+      for (j = 0;j < MIMO_NUM;j++) {
+        dV[i] -= st->K[i][j]*st->error[j];
+      }
+      //An output held at a limit must not throttle the others below
+      if ((st->V[i] >= c->max[i] && dV[i] > 0) || (st->V[i] <= c->min[i] && dV[i] < 0)) {
+        dV[i] = 0;
+        st->flags |= MIMO_SATURATED;
+      }
+      if (fabs(dV[i]) > largest) largest = fabs(dV[i]);
+    }
+    //Scaling the whole step keeps its direction, and so the decoupling
+    if (c->max_step > 0 && largest > c->max_step) {
+      for (i = 0;i < MIMO_NUM;i++) {
+        dV[i] *= c->max_step/largest;
+      }
+      st->flags |= MIMO_RATE_LIMITED;
+      st->rate_limited++;
+    }
+  }
+  for (i = 0;i < MIMO_NUM;i++) {
+    st->V[i] += dV[i];
+    if (st->V[i] < c->min[i]) {
+      st->V[i] = c->min[i];
+      st->flags |= MIMO_SATURATED;
+    } else if (st->V[i] > c->max[i]) {
+      st->V[i] = c->max[i];
+      st->flags |= MIMO_SATURATED;
+    }
+    out[i] = (uint16_t) lround(st->V[i]);
+  }
+  if (st->flags & MIMO_SATURATED) st->saturated++;
+  return st->flags;
+}
+
+int run_mimo_control(void *cfg,const mimo_config_t *c,mimo_state_t *st,uint64_t numUpdates,
+                     volatile sig_atomic_t *stop,FILE *log,uint32_t log_every) {
+  const uint32_t mask = (1u << MIMO_NUM) - 1;
+  const uint32_t N = c->update_samples;
+  uint32_t *data, n;
+  uint16_t out[MIMO_NUM];
+  int64_t sum[MIMO_NUM];
+  double y[MIMO_NUM];
+  uint64_t t0;
+  int i, ret = 0;
+
+  data = (uint32_t *) malloc((size_t) N*MIMO_NUM*sizeof(uint32_t));
+  if (!data) {
+    return -1;
+  }
+  t0 = rt_now_ns();
+  start_fifo(cfg);
+  while ((numUpdates == 0 || st->updates < numUpdates) && !(stop && *stop)) {
+    read_fifo_mask(cfg,FIFO_BIAS_DATA_START_LOC,mask,N,data);
+    memset(sum,0,sizeof(sum));
+    for (n = 0;n < N;n++) {
+      for (i = 0;i < MIMO_NUM;i++) {
+        sum[i] += (int32_t) data[n*MIMO_NUM + i];
+      }
+    }
+    for (i = 0;i < MIMO_NUM;i++) {
+      y[i] = (double) sum[i]/N;
+    }
+    mimo_update(st,c,y,out);
+    write_to_bias_pwm(cfg,out[0],out[1],out[2]);
+
+    if (log && log_every > 0 && st->updates % log_every == 0) {
+      fprintf(log,"%.6f %llu %.2f %.2f %.2f %.2f %.2f %.2f %.3f %.3f %.3f %u\n",1e-9*(double)(rt_now_ns() - t0),
+              (unsigned long long) st->updates,y[0],y[1],y[2],st->error[0],st->error[1],st->error[2],
+              st->V[0],st->V[1],st->V[2],st->flags);
+    }
+    if (c->fault_timeout > 0 && st->held >= c->fault_timeout) {
+      ret = 1;
+      break;
+    }
+  }
+  stop_fifo(cfg);
+  free(data);
+  return ret;
+}
+
+void mimo_print_gains(FILE *f,const mimo_state_t *st,const mimo_config_t *c) {
+  int i;
+  fprintf(f,"# update period %.6e s, bandwidths %.4g %.4g %.4g Hz, max step %.4g counts\n",st->period,
+          c->bandwidth[0],c->bandwidth[1],c->bandwidth[2],c->max_step);
+  for (i = 0;i < MIMO_NUM;i++) {
+    fprintf(f,"# K[%d] = % .6e % .6e % .6e, limits %u-%u\n",i,st->K[i][0],st->K[i][1],st->K[i][2],c->min[i],c->max[i]);
+  }
+  fprintf(f,"# time[s] update y1 y2 y3 e1 e2 e3 V1 V2 V3 flags\n");
+}
@@ -0,0 +1,97 @@
+#ifndef MIMO_CONTROL_H_
+#define MIMO_CONTROL_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <signal.h>
+
+/*
+ * Slow MIMO integrator on top of the FPGA bias controller.  The first MIMO_NUM bias FIFOs are
+ * averaged over update_samples samples, and the averages y move the manual PWM values V
+ * (which the FPGA control signals are added to) by
+ *
+ *    V[k+1] = V[k] - K (y[k] - r),       K = (G C)^-1 diag(1 - exp(-2 pi f_i T))
+ *
+ * where G is the response matrix measured by get_linear_response.m [counts/V], C the
+ * PWM conversion [V/count], T the update period and r the setpoints.  With the measured
+ * G each combination of signals is decoupled into a first-order loop of bandwidth f_i,
+ * so the cross-coupling is removed in software rather than by re-tuning the FPGA gains.
+ *
+ * Guards, applied in this order on every update:
+ *    fault       if any |y - r| exceeds fault the outputs hold (e.g. the light is off)
+ *    max_step    the change of V is scaled down so that no output moves by more than
+ *                max_step counts
+ *    limits      V is clamped to [min,max] and to the FPGA PWM limit registers.  As V
+ *                is also the integrator state, a clamped output does not wind up
+ *
+ * The bias FIFOs stay enabled for the whole run, so the controller holds the FIFO lock
+ * of iq_registers.h until it stops.  Every other capture waits in start_fifo() until
+ * then, and the lock watchdog skips its windows
+ */
+#define MIMO_NUM                    3
+#define MIMO_CONV_PWM               (1.6/1023.0)  //[V/count]
+#define MIMO_PWM_MAX                1023
+#define MIMO_DEFAULT_UPDATE_SAMPLES 16
+#define MIMO_DEFAULT_BANDWIDTH      1.0           //[Hz]
+#define MIMO_DEFAULT_MAX_STEP       1.0           //[counts/update]
+#define MIMO_MAX_BANDWIDTH_RATIO    0.1           //Largest f T
+
+#define MIMO_FAULT                  0x1           //Held by the fault guard
+#define MIMO_RATE_LIMITED           0x2
+#define MIMO_SATURATED              0x4
+
+typedef struct {
+  double G[MIMO_NUM][MIMO_NUM];   //Signal i per volt on output j [counts/V]
+  double setpoint[MIMO_NUM];      //[counts]
+  double bandwidth[MIMO_NUM];     //Of each decoupled loop [Hz]
+  uint32_t update_samples;        //Samples averaged per update
+  double max_step;                //Largest change of an output per update [counts]
+  uint16_t min[MIMO_NUM];         //Output limits [counts]
+  uint16_t max[MIMO_NUM];
+  double fault;                   //Error that holds the outputs [counts], 0 for no limit
+  uint32_t fault_timeout;         //Give up after this many held updates in a row, 0 for never
+} mimo_config_t;
+
+typedef struct {
+  double period;                  //Update period T [s]
+  double K[MIMO_NUM][MIMO_NUM];   //[counts/count]
+  double V[MIMO_NUM];             //Outputs and integrator state [counts]
+  double error[MIMO_NUM];         //y - r of the last update [counts]
+  uint32_t flags;                 //MIMO_* of the last update
+  uint32_t held;                  //Updates held in a row
+  uint64_t updates;
+  uint64_t faults, rate_limited, saturated;
+} mimo_state_t;
+
+void mimo_defaults(mimo_config_t *c);
+/*
+ * Inverts a 3x3 matrix by its adjugate.  Returns -1 if it is singular compared with
+ * the size of its entries
+ */
+int mimo_invert(const double A[MIMO_NUM][MIMO_NUM],double B[MIMO_NUM][MIMO_NUM]);
+/*
+ * Parses N comma-separated numbers, or a single one for all N.  Returns -1 otherwise
+ */
+int mimo_parse_list(const char *list,double *x,uint32_t n);
+/*
+ * Computes the gains for samples SAMPLE_PERIOD apart and starts from the outputs V0.
+ * Returns -1 if G is singular and -2 if a bandwidth is not between 0 and
+ * MIMO_MAX_BANDWIDTH_RATIO times the update rate
+ */
+int mimo_init(mimo_state_t *st,const mimo_config_t *c,double sample_period,const uint16_t *V0);
+/*
+ * One update from the averaged signals Y.  Writes the new outputs to OUT and returns
+ * the MIMO_* flags
+ */
+uint32_t mimo_update(mimo_state_t *st,const mimo_config_t *c,const double *y,uint16_t *out);
+/*
+ * Runs the loop on the device: streams the bias FIFOs, updates every update_samples
+ * samples and writes the outputs with write_to_bias_pwm().  It stops after numUpdates
+ * updates (0 for no limit), when *STOP becomes non-zero, or after fault_timeout held
+ * updates, for which it returns 1.  If LOG is not NULL a line with the averages,
+ * errors, outputs and flags is printed every log_every updates
+ */
+int run_mimo_control(void *cfg,const mimo_config_t *c,mimo_state_t *st,uint64_t numUpdates,
+                     volatile sig_atomic_t *stop,FILE *log,uint32_t log_every);
+void mimo_print_gains(FILE *f,const mimo_state_t *st,const mimo_config_t *c);
+#endif
@@ -0,0 +1,277 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "iq_bias_control.h"
+#include "mock_backend.h"
+
+#define MOCK_TIMEOUT_NS             1000000000ULL
+
+typedef struct {
+  uint64_t produced;              //Samples produced since the FIFOs were enabled
+  uint64_t level;                 //Words waiting to be read
+  uint64_t index;                 //Stream index of the next word to be read
+  mock_fifo_stats_t st;
+} mock_fifo_t;
+
+static struct {
+  uint32_t *regs;
+  uint32_t *ram;
+  int enabled;
+  uint64_t t0;                    //Time the FIFOs were enabled [ns]
+  double rate;
+  uint64_t depth;
+  uint32_t read_ns;
+  int print_stats;
+  mock_fifo_t fifo[MOCK_NUM_FIFOS];
+} mock;
+
+static uint64_t now_ns(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC,&t);
+  return (uint64_t) t.tv_sec*1000000000ULL + (uint64_t) t.tv_nsec;
+}
+
+static void spin_ns(uint64_t ns) {
+  uint64_t t = now_ns();
+  while (now_ns() - t < ns) {}
+}
+
+static double fifo_rate(uint32_t k) {
+  uint32_t reg;
+  if (mock.rate >= 0) return mock.rate;
+  reg = mock.regs[(k < NUM_BIAS_FIFOS ? FILTER_REG : PHASE_LOCK_REG) >> 2];
+  return CLK_FREQ/(double)(1 << (reg & 0xF));
+}
+
+/*
+ * Brings the FIFO up to time T: produces the samples due since the last update and drops
+ * the ones that do not fit
+ */
+static void update_fifo(uint32_t k,uint64_t t) {
+  mock_fifo_t *f = &mock.fifo[k];
+  double rate = fifo_rate(k);
+  uint64_t due, n, space;
+
+  if (!mock.enabled) return;
+  if (rate == 0) {
+    //Unlimited: a word is always waiting
+    if (f->level == 0) {
+      f->produced++;
+      f->level = 1;
+    }
+    return;
+  }
+  due = (uint64_t)((double)(t - mock.t0)*1e-9*rate);
+  if (due <= f->produced) return;
+  n = due - f->produced;
+  f->produced = due;
+  space = mock.depth - f->level;
+  if (n > space) {
+    f->st.words_dropped += n - space;
+    n = space;
+  }
+  f->level += n;
+  if (f->level > f->st.max_level) f->st.max_level = f->level;
+}
+
+static uint32_t fifo_value(uint32_t k,uint64_t n) {
+  static const int centre[NUM_PWM] = MOCK_BIAS_CENTRE;
+  uint32_t route, pwm;
+  uint64_t h = (n + 1)*0x9E3779B97F4A7C15ULL ^ ((uint64_t)(k + 1) << 56);
+  int noise;
+
+  h ^= h >> 29;
+  noise = (int)(h % 17) - 8;
+  if (k < NUM_BIAS_FIFOS) {
+    route = (mock.regs[TOP_REG >> 2] >> 16) & 0xF;
+    pwm = mock.regs[(PWM_LOC >> 2) + k] & 0x3FF;
+    if ((route >> k) & 1) return pwm;
+    return (uint32_t)(8*((int) pwm - centre[k]) + noise);
+  } else if (mock.regs[PHASE_LOCK_REG >> 2] & (1u << 31)) {
+    return (uint32_t) noise;
+  } else {
+    return (uint32_t)((int)((n*37 + (k - NUM_BIAS_FIFOS)*1000) % 4096) - 2048 + noise);
+  }
+}
+
+static uint32_t read_fifo(uint32_t k) {
+  mock_fifo_t *f = &mock.fifo[k];
+  uint64_t t, start = now_ns();
+  uint32_t v = 0, b = 0;
+
+  if (mock.read_ns) spin_ns(mock.read_ns);
+  t = now_ns();
+  update_fifo(k,t);
+  while (f->level == 0) {
+    if (t - start >= MOCK_TIMEOUT_NS) {
+      f->st.timeouts++;
+      break;
+    }
+    t = now_ns();
+    update_fifo(k,t);
+  }
+  if (f->level > 0) {
+    v = fifo_value(k,f->index);
+    f->index++;
+    f->level--;
+    f->st.words_read++;
+  }
+  t = now_ns() - start;
+  while (b < MOCK_HIST_BINS - 1 && (t >> (b + 1))) b++;
+  f->st.hist[b]++;
+  return v;
+}
+
+static void write_fifo_control(uint32_t value) {
+  uint32_t k;
+  uint64_t t = now_ns();
+  if (value & (1 << 1)) {
+    for (k = 0;k < MOCK_NUM_FIFOS;k++) {
+      mock.fifo[k].produced = mock.fifo[k].level = mock.fifo[k].index = 0;
+    }
+    mock.enabled = 0;
+  } else if ((value & 1) && !mock.enabled) {
+    //Production restarts from the current fill level
+    for (k = 0;k < MOCK_NUM_FIFOS;k++) {
+      mock.fifo[k].produced = 0;
+    }
+    mock.t0 = t;
+    mock.enabled = 1;
+  } else if (!(value & 1) && mock.enabled) {
+    //Stop producing but keep what is in the FIFOs
+    for (k = 0;k < MOCK_NUM_FIFOS;k++) {
+      update_fifo(k,t);
+    }
+    mock.enabled = 0;
+  }
+}
+
+uint32_t mock_reg_read(void *base,uint32_t offset) {
+  uint32_t k, status = 0;
+  uint64_t t;
+  if (base == mock.ram) {
+    return mock.ram[(offset % MAP_SIZE) >> 2];
+  }
+  if (offset >= FIFO_BIAS_DATA_START_LOC && offset < FIFO_BIAS_DATA_START_LOC + 4*MOCK_NUM_FIFOS) {
+    return read_fifo((offset - FIFO_BIAS_DATA_START_LOC) >> 2);
+  }
+  if (offset == FIFO_STATUS_LOC) {
+    t = now_ns();
+    for (k = 0;k < MOCK_NUM_FIFOS;k++) {
+      update_fifo(k,t);
+      if (mock.fifo[k].level == 0) status |= 1 << k;
+    }
+    return status;
+  }
+  return mock.regs[(offset % MAP_SIZE) >> 2];
+}
+
+void mock_reg_write(void *base,uint32_t offset,uint32_t value) {
+  if (base == mock.ram) {
+    mock.ram[(offset % MAP_SIZE) >> 2] = value;
+    return;
+  }
+  if (offset == FIFO_CONTROL_LOC) {
+    write_fifo_control(value);
+  }
+  mock.regs[(offset % MAP_SIZE) >> 2] = value;
+}
+
+static int mock_init(void) {
+  uint32_t i;
+  const char *env;
+
+  if (mock.regs) return 0;
+  mock.regs = (uint32_t *) calloc(MAP_SIZE/4,sizeof(uint32_t));
+  mock.ram = (uint32_t *) malloc(MAP_SIZE);
+  if (!mock.regs || !mock.ram) {
+    printf("Error allocating memory for the mock device");
+    return -1;
+  }
+  for (i = 0;i < MAP_SIZE/4;i++) {
+    mock.ram[i] = i;
+  }
+  mock.regs[FILTER_REG >> 2] = MOCK_DEFAULT_LOG2_RATE;
+  mock.regs[PHASE_LOCK_REG >> 2] = MOCK_DEFAULT_LOG2_RATE;
+
+  mock.rate = MOCK_RATE_FROM_REGS;
+  mock.depth = MOCK_DEFAULT_DEPTH;
+  if ((env = getenv("IQ_MOCK_RATE"))) mock.rate = atof(env);
+  if ((env = getenv("IQ_MOCK_DEPTH"))) mock.depth = strtoul(env,NULL,0);
+  if ((env = getenv("IQ_MOCK_READ_NS"))) mock.read_ns = strtoul(env,NULL,0);
+  mock.print_stats = getenv("IQ_MOCK_STATS") != NULL;
+  if (mock.depth == 0) mock.depth = 1;
+  return 0;
+}
+
+void *map_device(uint32_t loc,int *fd) {
+  if (mock_init() != 0) return NULL;
+  *fd = -1;
+  return loc == RAM_DATA_LOC ? (void *) mock.ram : (void *) mock.regs;
+}
+
+void unmap_device(void *ptr,int fd) {
+  if (ptr == mock.regs && mock.print_stats) {
+    mock_print_stats(stderr,0);
+  }
+}
+
+void mock_set_rate(double rate) {
+  mock_init();
+  mock.rate = rate;
+}
+
+void mock_set_depth(uint32_t depth) {
+  mock_init();
+  mock.depth = depth > 0 ? depth : 1;
+}
+
+void mock_set_read_ns(uint32_t ns) {
+  mock_init();
+  mock.read_ns = ns;
+}
+
+void mock_get_stats(uint32_t fifo,mock_fifo_stats_t *st) {
+  *st = mock.fifo[fifo].st;
+}
+
+void mock_reset_stats(void) {
+  uint32_t k;
+  for (k = 0;k < MOCK_NUM_FIFOS;k++) {
+    memset(&mock.fifo[k].st,0,sizeof(mock_fifo_stats_t));
+  }
+}
+
+double mock_latency_percentile(const mock_fifo_stats_t *st,double p) {
+  uint64_t total = 0, count = 0;
+  uint32_t b;
+  for (b = 0;b < MOCK_HIST_BINS;b++) total += st->hist[b];
+  if (total == 0) return 0;
+  for (b = 0;b < MOCK_HIST_BINS;b++) {
+    count += st->hist[b];
+    if ((double) count >= p*1e-2*(double) total) break;
+  }
+  //Upper edge of the bin
+  return (double)(1ULL << (b + 1));
+}
+
+void mock_print_stats(FILE *f,int histograms) {
+  uint32_t k, b;
+  mock_fifo_stats_t *st;
+  fprintf(f,"fifo      words    dropped  timeouts  max_level   p50[ns]   p99[ns]\n");
+  for (k = 0;k < MOCK_NUM_FIFOS;k++) {
+    st = &mock.fifo[k].st;
+    if (st->words_read == 0 && st->words_dropped == 0 && st->timeouts == 0) continue;
+    fprintf(f,"%4u %10llu %10llu %9llu %10llu %9.0f %9.0f\n",k,(unsigned long long) st->words_read,
+            (unsigned long long) st->words_dropped,(unsigned long long) st->timeouts,
+            (unsigned long long) st->max_level,mock_latency_percentile(st,50),mock_latency_percentile(st,99));
+    if (!histograms) continue;
+    for (b = 0;b < MOCK_HIST_BINS;b++) {
+      if (st->hist[b] == 0) continue;
+      fprintf(f,"       %10llu-%-10llu ns %10llu\n",1ULL << b,(1ULL << (b + 1)) - 1,(unsigned long long) st->hist[b]);
+    }
+  }
+}
@@ -0,0 +1,68 @@
+#ifndef MOCK_BACKEND_H_
+#define MOCK_BACKEND_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "iq_bias_control.h"
+
+/*
+ * Emulation of the topmod.vhd register map for running and timing the programs without
+ * a Red Pitaya.  Programs built with -DMOCK_BACKEND link against this instead of mapping
+ * /dev/mem.  The register space is a plain shadow of MAP_SIZE bytes except for:
+ *
+ *    FIFO_CONTROL_LOC    bit 0 enables and bit 1 resets the FIFOs
+ *    0x100004-0x100024   blocking FIFO read ports, NUM_BIAS_FIFOS bias then
+ *                        NUM_PHASE_FIFOS phase, returning 0 after a 1 s timeout
+ *    FIFO_STATUS_LOC     one bit per FIFO, set while it is empty
+ *
+ * and the RAM block at RAM_DATA_LOC holds a counting pattern.  While enabled, each FIFO
+ * is filled at the sample rate of its CIC filter (CLK_FREQ/2^log2_rate from FILTER_REG
+ * or PHASE_LOCK_REG) and drops new samples once it holds the FIFO depth, as the hardware
+ * does.  The bias FIFOs return a noisy signal proportional to the offset of their PWM
+ * output from MOCK_BIAS_CENTRE, so that bias scans have a known minimum, or the PWM
+ * value itself when routed out in TOP_REG.  The phase FIFOs return a sawtooth that
+ * collapses while the lock is engaged.
+ *
+ * The behaviour can be changed through the environment:
+ *
+ *    IQ_MOCK_RATE        samples/s of every FIFO, 0 for unlimited
+ *    IQ_MOCK_DEPTH       FIFO depth in words, MOCK_DEFAULT_DEPTH by default
+ *    IQ_MOCK_READ_NS     emulated bus time of each FIFO read [ns]
+ *    IQ_MOCK_STATS       print the FIFO statistics when the device is unmapped
+ */
+#define MOCK_BIAS_CENTRE            {310,420,530,200}
+#define MOCK_DEFAULT_DEPTH          16384
+#define MOCK_DEFAULT_LOG2_RATE      13
+#define MOCK_RATE_FROM_REGS         (-1.0)
+#define MOCK_NUM_FIFOS              NUM_FIFOS
+#define MOCK_HIST_BINS              32
+
+/*
+ * Statistics of one FIFO.  hist[b] counts reads that took between 2^b and 2^(b+1) ns,
+ * including the time spent waiting for data
+ */
+typedef struct {
+  uint64_t words_read;
+  uint64_t words_dropped;         //Samples lost because the FIFO was full
+  uint64_t timeouts;              //Reads that returned 0 after the timeout
+  uint64_t max_level;             //Largest number of words waiting in the FIFO
+  uint64_t hist[MOCK_HIST_BINS];
+} mock_fifo_stats_t;
+
+/*
+ * Samples/s of every FIFO, 0 for unlimited or MOCK_RATE_FROM_REGS to follow the filter
+ * registers
+ */
+void mock_set_rate(double rate);
+void mock_set_depth(uint32_t depth);
+void mock_set_read_ns(uint32_t ns);
+
+void mock_get_stats(uint32_t fifo,mock_fifo_stats_t *st);
+void mock_reset_stats(void);
+/*
+ * Percentile P (0-100) of the read latency of a FIFO from its histogram [ns]
+ */
+double mock_latency_percentile(const mock_fifo_stats_t *st,double p);
+void mock_print_stats(FILE *f,int histograms);
+#endif
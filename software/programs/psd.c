@@ -0,0 +1,258 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#include "capture_output.h"
+#include "capture_file.h"
+#include "psd.h"
+
+static const char *window_names[] = {"rect","hann","hamming","blackmanharris"};
+
+int psd_parse_window(const char *name) {
+  int k;
+  for (k = 0;k < (int)(sizeof(window_names)/sizeof(window_names[0]));k++) {
+    if (strcmp(name,window_names[k]) == 0) return k;
+  }
+  return -1;
+}
+
+static double window_value(uint32_t type,uint32_t k,uint32_t n) {
+  //Periodic windows, which have exact overlap properties for Welch averaging
+  double x = 2*M_PI*(double) k/(double) n;
+  switch (type) {
+    case PSD_WINDOW_HANN:
+      return 0.5 - 0.5*cos(x);
+    case PSD_WINDOW_HAMMING:
+      return 0.54 - 0.46*cos(x);
+    case PSD_WINDOW_BLACKMAN_HARRIS:
+      return 0.35875 - 0.48829*cos(x) + 0.14128*cos(2*x) - 0.01168*cos(3*x);
+    default:
+      return 1;
+  }
+}
+
+int psd_init(psd_t *p,uint32_t nfft,uint32_t overlap,uint32_t window_type,uint32_t num_streams,double fs) {
+  uint32_t k, h, bits = 0, r;
+
+  memset(p,0,sizeof(*p));
+  if (nfft < PSD_MIN_NFFT || nfft > PSD_MAX_NFFT || (nfft & (nfft - 1)) || overlap >= nfft || num_streams == 0) {
+    return -1;
+  }
+  p->nfft = nfft;
+  p->hop = nfft - overlap;
+  p->num_streams = num_streams;
+  p->num_bins = nfft/2 + 1;
+  p->window_type = window_type;
+  p->fs = fs;
+
+  p->window = (float *) malloc(nfft*sizeof(float));
+  p->buf = (float *) malloc((size_t) nfft*num_streams*sizeof(float));
+  p->re = (float *) malloc(nfft*sizeof(float));
+  p->im = (float *) malloc(nfft*sizeof(float));
+  p->twr = (float *) malloc(nfft*sizeof(float));
+  p->twi = (float *) malloc(nfft*sizeof(float));
+  p->bitrev = (uint32_t *) malloc(nfft*sizeof(uint32_t));
+  p->acc = (double *) calloc((size_t) p->num_bins*num_streams,sizeof(double));
+  if (!p->window || !p->buf || !p->re || !p->im || !p->twr || !p->twi || !p->bitrev || !p->acc) {
+    psd_free(p);
+    return -1;
+  }
+
+  for (k = 0;k < nfft;k++) {
+    p->window[k] = (float) window_value(window_type,k,nfft);
+    p->s1 += p->window[k];
+    p->s2 += (double) p->window[k]*p->window[k];
+  }
+  while ((1u << bits) < nfft) bits++;
+  for (k = 0;k < nfft;k++) {
+    for (h = 0, r = 0;h < bits;h++) {
+      r |= ((k >> h) & 1) << (bits - 1 - h);
+    }
+    p->bitrev[k] = r;
+  }
+  //Each stage gets its own contiguous twiddles so that the butterflies can be vectorised
+  for (h = 1;h < nfft;h <<= 1) {
+    for (k = 0;k < h;k++) {
+      p->twr[h - 1 + k] = (float) cos(-M_PI*(double) k/(double) h);
+      p->twi[h - 1 + k] = (float) sin(-M_PI*(double) k/(double) h);
+    }
+  }
+  return 0;
+}
+
+void psd_free(psd_t *p) {
+  free(p->window);
+  free(p->buf);
+  free(p->re);
+  free(p->im);
+  free(p->twr);
+  free(p->twi);
+  free(p->bitrev);
+  free(p->acc);
+  memset(p,0,sizeof(*p));
+}
+
+void psd_fft(psd_t *p) {
+  const uint32_t n = p->nfft;
+  float *re = p->re, *im = p->im;
+  const float *wr, *wi;
+  float tr, ti;
+  uint32_t i, j, h, a, b;
+
+  for (i = 0;i < n;i++) {
+    j = p->bitrev[i];
+    if (j > i) {
+      tr = re[i]; re[i] = re[j]; re[j] = tr;
+      ti = im[i]; im[i] = im[j]; im[j] = ti;
+    }
+  }
+  for (h = 1;h < n;h <<= 1) {
+    wr = p->twr + h - 1;
+    wi = p->twi + h - 1;
+    for (i = 0;i < n;i += 2*h) {
+      j = 0;
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+      /*
+       * Four butterflies per iteration once the half-length is a whole vector
+       */
+      for (;h >= 4 && j < h;j += 4) {
+        float32x4_t vwr = vld1q_f32(wr + j), vwi = vld1q_f32(wi + j);
+        float32x4_t ar = vld1q_f32(re + i + j), ai = vld1q_f32(im + i + j);
+        float32x4_t br = vld1q_f32(re + i + j + h), bi = vld1q_f32(im + i + j + h);
+        float32x4_t vtr = vmlsq_f32(vmulq_f32(vwr,br),vwi,bi);
+        float32x4_t vti = vmlaq_f32(vmulq_f32(vwr,bi),vwi,br);
+        vst1q_f32(re + i + j + h,vsubq_f32(ar,vtr));
+        vst1q_f32(im + i + j + h,vsubq_f32(ai,vti));
+        vst1q_f32(re + i + j,vaddq_f32(ar,vtr));
+        vst1q_f32(im + i + j,vaddq_f32(ai,vti));
+      }
+#endif
+      for (;j < h;j++) {
+        a = i + j;
+        b = a + h;
+        tr = wr[j]*re[b] - wi[j]*im[b];
+        ti = wr[j]*im[b] + wi[j]*re[b];
+        re[b] = re[a] - tr;
+        im[b] = im[a] - ti;
+        re[a] += tr;
+        im[a] += ti;
+      }
+    }
+  }
+}
+
+/*
+ * Transforms the current segment of every stream and accumulates |X|^2.  With z = x + iy
+ * for two real streams x and y, X[k] = (Z[k] + conj(Z[n-k]))/2 and
+ * Y[k] = (Z[k] - conj(Z[n-k]))/2i
+ */
+static void process_segment(psd_t *p) {
+  const uint32_t n = p->nfft;
+  uint32_t s, k, m;
+  const float *x, *y;
+  double *ax, *ay, zr, zi, mr, mi;
+
+  for (s = 0;s < p->num_streams;s += 2) {
+    x = p->buf + (size_t) s*n;
+    y = s + 1 < p->num_streams ? x + n : NULL;
+    for (k = 0;k < n;k++) {
+      p->re[k] = p->window[k]*x[k];
+      p->im[k] = y ? p->window[k]*y[k] : 0;
+    }
+    psd_fft(p);
+    ax = p->acc + (size_t) s*p->num_bins;
+    ay = ax + p->num_bins;
+    for (k = 0;k < p->num_bins;k++) {
+      m = (n - k) & (n - 1);
+      zr = p->re[k];
+      zi = p->im[k];
+      mr = p->re[m];
+      mi = p->im[m];
+      ax[k] += 0.25*((zr + mr)*(zr + mr) + (zi - mi)*(zi - mi));
+      if (y) {
+        ay[k] += 0.25*((zi + mi)*(zi + mi) + (zr - mr)*(zr - mr));
+      }
+    }
+  }
+  p->segments++;
+}
+
+uint32_t psd_push(psd_t *p,const uint32_t *data,uint32_t numSamples) {
+  const uint32_t n = p->nfft, S = p->num_streams;
+  uint32_t i = 0, j, k, count, segments = 0;
+  const int32_t *src;
+  float *dst;
+
+  while (i < numSamples) {
+    count = numSamples - i < n - p->fill ? numSamples - i : n - p->fill;
+    for (k = 0;k < S;k++) {
+      src = (const int32_t *) data + (size_t) i*S + k;
+      dst = p->buf + (size_t) k*n + p->fill;
+      for (j = 0;j < count;j++) {
+        dst[j] = (float) src[(size_t) j*S];
+      }
+    }
+    p->fill += count;
+    i += count;
+    if (p->fill == n) {
+      process_segment(p);
+      segments++;
+      //Keep the overlap for the next segment
+      for (k = 0;k < S;k++) {
+        memmove(p->buf + (size_t) k*n,p->buf + (size_t) k*n + p->hop,(n - p->hop)*sizeof(float));
+      }
+      p->fill = n - p->hop;
+    }
+  }
+  return segments;
+}
+
+void psd_spectrum(psd_t *p,double *out,int reset) {
+  uint32_t s, k;
+  double scale;
+  for (s = 0;s < p->num_streams;s++) {
+    for (k = 0;k < p->num_bins;k++) {
+      //One-sided, so every bin except DC and Nyquist holds the power of two
+      scale = (k == 0 || k == p->nfft/2 ? 1.0 : 2.0)/(p->fs*p->s2*(double)(p->segments > 0 ? p->segments : 1));
+      out[(size_t) s*p->num_bins + k] = scale*p->acc[(size_t) s*p->num_bins + k];
+    }
+  }
+  if (reset) {
+    memset(p->acc,0,(size_t) p->num_bins*p->num_streams*sizeof(double));
+    p->segments = 0;
+  }
+}
+
+void psd_header_init(psd_header_t *hdr,const capture_header_t *capture,const psd_t *p) {
+  memset(hdr,0,sizeof(*hdr));
+  hdr->magic = PSD_FILE_MAGIC;
+  hdr->version = PSD_FILE_VERSION;
+  hdr->header_size = PSD_HEADER_SIZE;
+  hdr->num_streams = p->num_streams;
+  hdr->num_bins = p->num_bins;
+  hdr->nfft = p->nfft;
+  hdr->overlap = p->nfft - p->hop;
+  hdr->window = p->window_type;
+  hdr->source = capture->source;
+  hdr->channel_mask = capture->channel_mask;
+  hdr->log2_rate = capture->log2_rate;
+  hdr->decimation = capture->decimation;
+  hdr->sample_rate = p->fs;
+  hdr->bin_width = p->fs/(double) p->nfft;
+  hdr->enbw = p->fs*p->s2/(p->s1*p->s1);
+  hdr->start_time_ns = capture->start_time_ns;
+  memcpy(hdr->stream_names,capture->stream_names,sizeof(hdr->stream_names));
+}
+
+int psd_write(int fd,const psd_header_t *hdr,const double *spectra) {
+  uint8_t buf[PSD_HEADER_SIZE];
+  memset(buf,0,sizeof(buf));
+  memcpy(buf,hdr,sizeof(*hdr));
+  if (write_all(fd,buf,sizeof(buf)) != 0) return -1;
+  return write_all(fd,spectra,(size_t) hdr->num_bins*hdr->num_streams*sizeof(double));
+}
@@ -0,0 +1,112 @@
+#ifndef PSD_H_
+#define PSD_H_
+
+#include <stdint.h>
+
+#include "capture_file.h"
+
+/*
+ * Welch power spectral density estimation of interleaved int32 streams.  Samples are
+ * pushed in blocks of any size; every hop samples the last nfft samples of each stream
+ * are windowed and transformed, and |X|^2 is accumulated.  Streams are transformed in
+ * pairs as the real and imaginary parts of one complex FFT, so S streams cost
+ * ceil(S/2) FFTs per segment.
+ *
+ * The spectra are one-sided in counts^2/Hz, so that integrating over frequency gives
+ * the variance of the stream.  Each bin has a resolution bandwidth equal to the
+ * equivalent noise bandwidth of the window, enbw = fs*sum(w^2)/sum(w)^2
+ */
+#define PSD_WINDOW_RECT             0
+#define PSD_WINDOW_HANN             1
+#define PSD_WINDOW_HAMMING          2
+#define PSD_WINDOW_BLACKMAN_HARRIS  3
+
+#define PSD_MIN_NFFT                16
+#define PSD_MAX_NFFT                (1 << 20)
+#define PSD_DEFAULT_NFFT            4096
+
+typedef struct {
+  uint32_t nfft;                  //FFT length, a power of two
+  uint32_t hop;                   //Samples between segments, nfft - overlap
+  uint32_t num_streams;
+  uint32_t num_bins;              //nfft/2 + 1
+  uint32_t window_type;           //PSD_WINDOW_*
+  double fs;                      //Sample rate [Hz]
+  double s1, s2;                  //Sum of the window and of its square
+  float *window;
+  float *buf;                     //Last nfft samples of each stream
+  uint32_t fill;                  //Valid samples in buf
+  float *re, *im;                 //FFT work arrays
+  float *twr, *twi;               //Twiddles, stage with half-length h at offset h - 1
+  uint32_t *bitrev;
+  double *acc;                    //Sum of |X|^2, num_bins per stream
+  uint64_t segments;              //Segments in acc
+} psd_t;
+
+/*
+ * Parses a window name: rect, hann, hamming or blackmanharris.  Returns -1 if unknown
+ */
+int psd_parse_window(const char *name);
+/*
+ * Initialises P for NUM_STREAMS streams sampled at FS.  Consecutive segments share
+ * OVERLAP samples.  Returns -1 if NFFT is not a power of two within range, OVERLAP is
+ * not below NFFT or memory could not be allocated
+ */
+int psd_init(psd_t *p,uint32_t nfft,uint32_t overlap,uint32_t window_type,uint32_t num_streams,double fs);
+void psd_free(psd_t *p);
+/*
+ * Adds numSamples interleaved samples and returns the number of segments completed
+ */
+uint32_t psd_push(psd_t *p,const uint32_t *data,uint32_t numSamples);
+/*
+ * Writes the average of the accumulated segments to out, num_bins per stream, and
+ * optionally clears the accumulators for the next average.  Input samples are kept
+ */
+void psd_spectrum(psd_t *p,double *out,int reset);
+/*
+ * In-place radix-2 FFT of the split complex data in P's work arrays
+ */
+void psd_fft(psd_t *p);
+
+/*
+ * Spectrum file.  All values are little-endian: the header, padded with zeros to
+ * header_size bytes, then num_bins doubles for each stream in turn.  A continuous
+ * measurement writes one such record per average
+ */
+#define PSD_FILE_MAGIC              0x53505149    //"IQPS"
+#define PSD_FILE_VERSION            1
+#define PSD_HEADER_SIZE             512
+
+typedef struct {
+  uint32_t magic;                 //PSD_FILE_MAGIC
+  uint32_t version;               //PSD_FILE_VERSION
+  uint32_t header_size;           //Bytes before the spectra
+  uint32_t num_streams;
+  uint32_t num_bins;              //Bins per stream, from 0 to fs/2
+  uint32_t nfft;
+  uint32_t overlap;               //Samples shared by consecutive segments
+  uint32_t window;                //PSD_WINDOW_*
+  uint32_t source;                //CAPTURE_SOURCE_*
+  uint32_t channel_mask;
+  uint32_t log2_rate;             //Log2 of the CIC decimation rate
+  uint32_t decimation;            //Additional on-device decimation, 1 for none
+  double sample_rate;             //Rate of the analysed samples [Hz]
+  double bin_width;               //sample_rate/nfft [Hz]
+  double enbw;                    //Equivalent noise bandwidth of a bin, i.e. the RBW [Hz]
+  uint64_t num_averages;          //Segments in this spectrum
+  uint64_t start_time_ns;         //Start of this average, ns since the UNIX epoch
+  char stream_names[CAPTURE_MAX_STREAMS][CAPTURE_NAME_LENGTH];
+} psd_header_t;
+
+_Static_assert(sizeof(psd_header_t) <= PSD_HEADER_SIZE,"PSD_HEADER_SIZE");
+
+/*
+ * Fills in a header from a capture header (see capture_header_init()) and the settings
+ * of P
+ */
+void psd_header_init(psd_header_t *hdr,const capture_header_t *capture,const psd_t *p);
+/*
+ * Writes one spectrum record to FD.  Returns 0 on success
+ */
+int psd_write(int fd,const psd_header_t *hdr,const double *spectra);
+#endif
@@ -3,29 +3,48 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
-#include <sys/mman.h>
-#include <fcntl.h>
 #include <math.h>
 #include <time.h>
 
 #include "iq_bias_control.h"
+#include "fifo_stream.h"
+#include "capture_output.h"
+#include "capture_file.h"
+#include "decimate.h"
+#include "allan.h"
  
 int main(int argc, char **argv)
 {
   int fd;		//File identifier
-  int numSamples;	//Number of samples to collect
+  int numSamples = 0;	//Number of samples to collect
   int dataSize;   //Size of actual data array
   void *cfg;		//A pointer to a memory location.  The * indicates that it is a pointer - it points to a location in memory
-  char *name = "/dev/mem";	//Name of the memory resource
 
-  uint32_t i, incr = 0;
+  uint32_t i;
   uint8_t saveType = 2;
   int saveFactor = 5;
-  uint32_t tmp;
+  uint32_t mask = 0;          //FIFOs to read, the first saveFactor by default
+  uint32_t sample[32];  //One sample when saving straight to file
   uint32_t *data;
   uint8_t debugFlag = 0;
   FILE *ptr;
+  char *outputFile = NULL;    //Output destination, SavedData.bin by default
+  int memfd;                  //Memory file backing the data buffer, if any
+  int saveErr = 0;            //Writing the output failed
+  uint32_t blockWords = 0;    //Words per streaming block, 0 for the default
+  uint32_t numBlocks = 0;     //Number of streaming blocks, 0 for the default
+  int readerCPU = 1;          //CPU for the streaming reader thread, -1 to not pin it
+  int streamErr;              //Streaming output failed or is incomplete
+  uint8_t containerFlag = 0;  //Write a self-describing capture file instead of raw words
+  capture_header_t hdr;
+  uint8_t rtFlag = 0;         //Real-time mode: locked memory and SCHED_FIFO
+  uint32_t decimation = 1;    //On-device decimation factor, 1 for none
+  const char *filterSpec = "cic";   //Decimation filter, see decimate.h
+  decimator_t dec;
+  char *allanFile = NULL;     //Allan deviation snapshot file, if any
+  allan_t allan;
 
   clock_t start, stop;
 
@@ -33,7 +52,7 @@ int main(int argc, char **argv)
    * Parse the input arguments
    */
   int c;
-  while ((c = getopt(argc,argv,"n:t:s:f")) != -1) {
+  while ((c = getopt(argc,argv,"n:t:s:C:o:b:k:p:d:D:A:LFf")) != -1) {
     switch (c) {
       case 'n':
         numSamples = atoi(optarg);
@@ -44,6 +63,36 @@ int main(int argc, char **argv)
       case 's':
         saveFactor = atoi(optarg);
         break;
+      case 'C':
+        mask = strtoul(optarg,NULL,0);
+        break;
+      case 'o':
+        outputFile = optarg;
+        break;
+      case 'b':
+        blockWords = atoi(optarg);
+        break;
+      case 'k':
+        numBlocks = atoi(optarg);
+        break;
+      case 'p':
+        readerCPU = atoi(optarg);
+        break;
+      case 'd':
+        decimation = atoi(optarg);
+        break;
+      case 'D':
+        filterSpec = optarg;
+        break;
+      case 'A':
+        allanFile = optarg;
+        break;
+      case 'F':
+        containerFlag = 1;
+        break;
+      case 'L':
+        rtFlag = 1;
+        break;
       case 'f':
         debugFlag = 1;
         break;
@@ -63,12 +112,35 @@ int main(int argc, char **argv)
     }
   }
 
+  mask = capture_mask(mask,saveFactor,NUM_PHASE_FIFOS);
+  if (mask == 0) {
+    fprintf(stderr,"Invalid channel mask or save factor\n");
+    return 1;
+  }
+  saveFactor = __builtin_popcount(mask);
   dataSize = saveFactor*numSamples;
+  if (decimation > 1 && decimator_init(&dec,filterSpec,decimation,saveFactor) != 0) {
+    fprintf(stderr,"Invalid decimation filter\n");
+    return 1;
+  }
+  if (allanFile != NULL) {
+    // The Allan deviation is computed while streaming, and the samples themselves are
+    // only kept if an output is given
+    saveType = 3;
+    if (outputFile == NULL) {
+      outputFile = "/dev/null";
+    }
+  }
+  if (saveType == 2 && (outputFile != NULL || containerFlag || decimation > 1)) {
+    // Word-by-word saving only goes to raw SavedData.bin, so capture to memory and send
+    // it to the requested output in one go instead
+    saveType = 1;
+  }
 
   if (saveType == 2) {
     ptr = fopen("SavedData.bin","wb");
-  } else {
-    data = (uint32_t *) malloc(dataSize * sizeof(uint32_t));
+  } else if (saveType != 3) {
+    data = (uint32_t *) alloc_capture_buffer((size_t) dataSize * sizeof(uint32_t),&memfd);
     if (!data) {
       printf("Error allocating memory");
       return -1;
@@ -76,15 +148,55 @@ int main(int argc, char **argv)
   }
   
 
-  //This returns a file identifier corresponding to the memory, and allows for reading and writing.  O_RDWR is just a constant
-  if((fd = open(name, O_RDWR)) < 0) {
-    perror("open");
+  cfg = map_device(MEM_LOC,&fd);
+  if (!cfg) {
     return 1;
   }
-
-  /*mmap maps the memory location 0x40000000 to the pointer cfg, which "points" to that location in memory.*/
-//  cfg = mmap(0,MAP_SIZE,PROT_READ|PROT_WRITE,MAP_SHARED,fd,MEM_LOC);
-  cfg = mmap(0,MAP_SIZE,PROT_READ|PROT_WRITE,MAP_SHARED,fd,MEM_LOC);
+  if (rtFlag) {
+    // Only the streaming reader runs at real-time priority, on readerCPU, while a capture
+    // to memory runs there directly
+    if (saveType == 3) {
+      rt_enter(-1,0);
+    } else {
+      rt_enter(readerCPU,RT_DEFAULT_PRIORITY);
+    }
+  }
+  if (containerFlag || decimation > 1 || allanFile != NULL) {
+    capture_header_init(&hdr,cfg,CAPTURE_SOURCE_PHASE,mask);
+    if (allanFile != NULL) {
+      if (allan_init(&allan,saveFactor,hdr.sample_period) != 0) {
+        printf("Error allocating memory");
+        return -1;
+      }
+      allan.snapshot_path = allanFile;
+      memcpy(allan.stream_names,hdr.stream_names,sizeof(allan.stream_names));
+    }
+    hdr.decimation = decimation;
+    hdr.sample_period *= decimation;
+  }
+  if (decimation > 1 && !containerFlag) {
+    // Raw output carries no header, so report the rate of the decimated samples
+    fprintf(stderr,"Effective sample rate: %.6g Hz\n",1.0/hdr.sample_period);
+  }
+  if (saveType == 3) {
+    // Stream continuously to the output until numSamples have been acquired, or until
+    // stopped with SIGINT/SIGTERM if numSamples is 0
+    streamErr = stream_to_output(cfg,FIFO_PHASE_DATA_START_LOC,mask,(uint64_t) numSamples,outputFile,containerFlag ? &hdr : NULL,
+                     decimation > 1 ? &dec : NULL,allanFile ? allan_stream_tap : NULL,&allan,
+                     blockWords,numBlocks,readerCPU,debugFlag);
+    if (allanFile != NULL) {
+      allan_write_snapshot(&allan,allanFile);
+      if (debugFlag) {
+        allan_print(&allan,stderr);
+      }
+      allan_free(&allan);
+    }
+    if (decimation > 1) {
+      decimator_free(&dec);
+    }
+    unmap_device(cfg,fd);
+    return streamErr == 0 ? 0 : 1;
+  }
   start_fifo(cfg);
 //  printf("FIFO Enabled!\n");
   //Record data
@@ -92,20 +204,17 @@ int main(int argc, char **argv)
     start = clock();
   }
   
-  if (saveType != 2) {
+  if (saveType != 2 && decimation > 1) {
+    // Filter and decimate while draining, so only the decimated samples are kept
+    read_fifo_decimated(cfg,FIFO_PHASE_DATA_START_LOC,mask,numSamples,&dec,data);
+  } else if (saveType != 2) {
     // This is if we are not saving to file, but saving to memory instead
-    for (i = 0;i<dataSize;i += saveFactor) {
-      for (incr = 0;incr < saveFactor;incr++) {
-        *(data + i + incr) = *((uint32_t *)(cfg + FIFO_PHASE_DATA_START_LOC + incr*4));
-      }
-    }
+    read_fifo_mask(cfg,FIFO_PHASE_DATA_START_LOC,mask,numSamples,data);
   } else {
     // This is for if we are saving to file
     for (i = 0;i<dataSize;i += saveFactor) {
-      for (incr = 0;incr < saveFactor;incr++) {
-        tmp = *((uint32_t *)(cfg + FIFO_PHASE_DATA_START_LOC + incr*4));
-        fwrite(&tmp,4,1,ptr);
-      }
+      read_fifo_mask(cfg,FIFO_PHASE_DATA_START_LOC,mask,1,sample);
+      fwrite(sample,4,saveFactor,ptr);
     }
   }
   
@@ -124,20 +233,26 @@ int main(int argc, char **argv)
     for (i = 0;i<dataSize;i++) {
         printf("%08x\n",*(data + i));
     }
-    free(data);
+    free_capture_buffer(data,(size_t) dataSize * sizeof(uint32_t),memfd);
   } else if (saveType == 1) {
     // This saves the data currently in memory to a file, which is then opened in Python
-    // by the server program, read, and sent.  This is quite fast
-    ptr = fopen("SavedData.bin","wb");
-    fwrite(data,4,(size_t)(dataSize),ptr);
-    fclose(ptr);
-    free(data);
+    // by the server program, read, and sent.  This is quite fast.  With -o the data can
+    // instead be sent to standard output or a socket without being copied or touching
+    // the SD card
+    if (containerFlag) {
+      saveErr = save_capture_file(outputFile,&hdr,data,numSamples);
+    } else {
+      saveErr = write_capture(outputFile,data,(size_t) dataSize * sizeof(uint32_t),memfd);
+    }
+    free_capture_buffer(data,(size_t) dataSize * sizeof(uint32_t),memfd);
   } else if (saveType == 2) {
     // In this method the data is already saved to file
     fclose(ptr);
   }
+  if (decimation > 1) {
+    decimator_free(&dec);
+  }
 
-  //Unmap cfg from pointing to the previous location in memory
-  munmap(cfg, MAP_SIZE);
-  return 0;	//C functions should have a return value - 0 is the usual "no error" return value
+  unmap_device(cfg,fd);
+  return saveErr ? 1 : 0;	//C functions should have a return value - 0 is the usual "no error" return value
 }
@@ -0,0 +1,250 @@
+//These are libraries which contain useful functions
+#include <ctype.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+
+#include "iq_bias_control.h"
+#include "capture_output.h"
+#include "capture_file.h"
+#include "fifo_stream.h"
+#include "trigger.h"
+
+/*
+ * Triggered capture: streams the bias or phase FIFOs through a pre-trigger ring on the
+ * device and only writes the windows around trigger events (see trigger.h for the
+ * conditions and the file format).  The trigger re-arms after every window, so the
+ * program can watch for rare glitches for hours while sending a few kilobytes per event.
+ * It runs until numEvents windows have been written, or until it is stopped with
+ * SIGINT/SIGTERM if numEvents is 0
+ */
+typedef struct {
+  trigger_t trig;
+  trigger_header_t hdr;
+  fifo_stream_t *s;
+  int fd;
+  uint64_t start_ns;              //Time of the first sample
+  uint64_t numEvents;             //Windows to write, 0 for no limit
+  int debug;
+} scope_consumer_t;
+
+static uint64_t now_ns(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_REALTIME,&t);
+  return (uint64_t) t.tv_sec*1000000000ULL + (uint64_t) t.tv_nsec;
+}
+
+static int emit_event(void *arg,const trigger_t *t,const uint32_t *window,uint32_t numSamples,uint32_t pre) {
+  scope_consumer_t *c = (scope_consumer_t *) arg;
+  uint8_t buf[TRIGGER_HEADER_SIZE];
+
+  c->hdr.num_samples = numSamples;
+  c->hdr.pre_samples = pre;
+  c->hdr.condition = t->fired;
+  c->hdr.condition_type = t->cond[t->fired].type;
+  c->hdr.event = t->triggers - 1;
+  c->hdr.trigger_sample = t->trigger_sample;
+  c->hdr.trigger_time_ns = c->start_ns + (uint64_t)(1e9*c->hdr.sample_period*(double) t->trigger_sample);
+  c->hdr.words_dropped = atomic_load(&c->s->words_dropped);
+  memset(buf,0,sizeof(buf));
+  memcpy(buf,&c->hdr,sizeof(c->hdr));
+  if (write_all(c->fd,buf,sizeof(buf)) != 0 ||
+      write_all(c->fd,window,(size_t) numSamples*t->num_streams*sizeof(uint32_t)) != 0) {
+    return -1;
+  }
+  if (c->debug) {
+    fprintf(stderr,"Trigger %llu: condition %u at sample %llu\n",(unsigned long long) c->hdr.event,t->fired,
+            (unsigned long long) t->trigger_sample);
+  }
+  if (c->numEvents > 0 && t->triggers >= c->numEvents) {
+    return 1;
+  }
+  return 0;
+}
+
+static int consume_block(void *arg,const uint32_t *block,uint32_t num_words) {
+  scope_consumer_t *c = (scope_consumer_t *) arg;
+  return trigger_push(&c->trig,block,num_words/c->trig.num_streams,emit_event,c);
+}
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void handle_stop(int sig) {
+  stop_requested = 1;
+}
+
+int main(int argc, char **argv)
+{
+  int fd;		        //File identifier
+  void *cfg;		    //A pointer to a memory location.  The * indicates that it is a pointer - it points to a location in memory
+
+  uint32_t saveFactor = 0;    //Number of FIFOs to read, all of the group by default
+  uint32_t mask = 0;          //FIFOs to read, the first saveFactor by default
+  uint8_t phaseFlag = 0;      //Watch the phase FIFOs instead of the bias FIFOs
+  uint32_t numFifos;
+  trigger_condition_t cond[TRIGGER_MAX_CONDITIONS];
+  uint32_t numConditions = 0;
+  uint32_t pre = 1000;        //Samples kept before the trigger
+  uint32_t post = 3000;       //Samples recorded from the trigger on
+  uint32_t holdoff = 0;       //Samples after a window before re-arming
+  uint64_t numEvents = 0;     //Windows to record, 0 to run until stopped
+  int readerCPU = 1;          //CPU for the streaming reader thread, -1 to not pin it
+  uint8_t rtFlag = 0;         //Real-time mode: locked memory and SCHED_FIFO
+  uint8_t debugFlag = 0;
+  char *outputFile = NULL;    //Output destination, SavedData.bin by default
+  capture_header_t capture;
+  scope_consumer_t consumer;
+  fifo_stream_t s;
+  struct sigaction sa;
+
+  /*
+   * Parse the input arguments
+   */
+  int c;
+  while ((c = getopt(argc,argv,"s:C:Pt:b:a:H:n:p:o:Lf")) != -1) {
+    switch (c) {
+      case 's':
+        saveFactor = atoi(optarg);
+        break;
+      case 'C':
+        mask = strtoul(optarg,NULL,0);
+        break;
+      case 'P':
+        phaseFlag = 1;
+        break;
+      case 't':
+        if (numConditions == TRIGGER_MAX_CONDITIONS || trigger_parse(&cond[numConditions],optarg) != 0) {
+          fprintf(stderr,"Invalid trigger condition `%s'\n",optarg);
+          return 1;
+        }
+        numConditions++;
+        break;
+      case 'b':
+        pre = atoi(optarg);
+        break;
+      case 'a':
+        post = atoi(optarg);
+        break;
+      case 'H':
+        holdoff = atoi(optarg);
+        break;
+      case 'n':
+        numEvents = strtoull(optarg,NULL,0);
+        break;
+      case 'p':
+        readerCPU = atoi(optarg);
+        break;
+      case 'o':
+        outputFile = optarg;
+        break;
+      case 'L':
+        rtFlag = 1;
+        break;
+      case 'f':
+        debugFlag = 1;
+        break;
+
+      case '?':
+        if (isprint (optopt))
+            fprintf (stderr, "Unknown option `-%c'.\n", optopt);
+        else
+            fprintf (stderr,
+                    "Unknown option character `\\x%x'.\n",
+                    optopt);
+        return 1;
+
+      default:
+        abort();
+        break;
+    }
+  }
+
+  numFifos = phaseFlag ? NUM_PHASE_FIFOS : NUM_BIAS_FIFOS;
+  mask = capture_mask(mask,saveFactor > 0 ? saveFactor : numFifos,numFifos);
+  if (mask == 0) {
+    fprintf(stderr,"Invalid channel mask or save factor\n");
+    return 1;
+  }
+  saveFactor = __builtin_popcount(mask);
+  if (numConditions == 0) {
+    fprintf(stderr,"No trigger condition given\n");
+    return 1;
+  }
+
+  memset(&consumer,0,sizeof(consumer));
+  if (trigger_init(&consumer.trig,mask,pre,post,holdoff,cond,numConditions) != 0) {
+    fprintf(stderr,"Invalid trigger: the streams must be in the channel mask, the lags shorter than the window and the window not empty\n");
+    return 1;
+  }
+
+  cfg = map_device(MEM_LOC,&fd);
+  if (!cfg) {
+    return 1;
+  }
+  capture_header_init(&capture,cfg,phaseFlag ? CAPTURE_SOURCE_PHASE : CAPTURE_SOURCE_BIAS,mask);
+  consumer.hdr.magic = TRIGGER_FILE_MAGIC;
+  consumer.hdr.version = TRIGGER_FILE_VERSION;
+  consumer.hdr.header_size = TRIGGER_HEADER_SIZE;
+  consumer.hdr.num_streams = saveFactor;
+  consumer.hdr.source = capture.source;
+  consumer.hdr.channel_mask = mask;
+  consumer.hdr.log2_rate = capture.log2_rate;
+  consumer.hdr.sample_period = capture.sample_period;
+  memcpy(consumer.hdr.stream_names,capture.stream_names,sizeof(consumer.hdr.stream_names));
+  consumer.numEvents = numEvents;
+  consumer.debug = debugFlag;
+  consumer.s = &s;
+
+  if (stream_init(&s,cfg,phaseFlag ? FIFO_PHASE_DATA_START_LOC : FIFO_BIAS_DATA_START_LOC,mask,0,
+                  STREAM_DEFAULT_BLOCK_WORDS,STREAM_DEFAULT_NUM_BLOCKS) != 0) {
+    printf("Error allocating memory");
+    return -1;
+  }
+  if ((consumer.fd = open_output(outputFile)) < 0) {
+    return 1;
+  }
+  if (rtFlag) {
+    // Only the reader runs at real-time priority, on readerCPU
+    rt_enter(-1,0);
+  }
+
+  memset(&sa,0,sizeof(sa));
+  sa.sa_handler = handle_stop;
+  sigaction(SIGINT,&sa,NULL);
+  sigaction(SIGTERM,&sa,NULL);
+  signal(SIGPIPE,SIG_IGN);
+
+  consumer.start_ns = now_ns();
+  if (stream_start(&s,consume_block,&consumer,readerCPU) != 0) {
+    fprintf(stderr,"Could not start streaming threads\n");
+    return 1;
+  }
+  while (!stream_is_done(&s)) {
+    usleep(100000);
+    if (stop_requested) {
+      stream_stop(&s);
+    }
+  }
+  stream_join(&s);
+  if (debugFlag || atomic_load(&s.overruns) > 0) {
+    stream_print_stats(&s,stderr);
+  }
+  //A window that was still being recorded is written as far as it got
+  if (numEvents == 0 || consumer.trig.triggers < numEvents) {
+    trigger_flush(&consumer.trig,emit_event,&consumer);
+  }
+  if (debugFlag) {
+    fprintf(stderr,"%llu triggers in %llu samples\n",(unsigned long long) consumer.trig.triggers,
+            (unsigned long long) consumer.trig.samples);
+  }
+  close_output(consumer.fd);
+
+  stream_free(&s);
+  trigger_free(&consumer.trig);
+  unmap_device(cfg,fd);
+  return 0;	//C functions should have a return value - 0 is the usual "no error" return value
+}
@@ -0,0 +1,462 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "iq_bias_control.h"
+#include "sequence.h"
+
+typedef struct {
+  const char *name;
+  uint32_t op;
+  uint32_t nargs;
+} seq_keyword_t;
+
+static const seq_keyword_t keywords[] = {
+  {"pwm",SEQ_PWM,2},
+  {"bias",SEQ_BIAS,3},
+  {"dac",SEQ_DAC,1},
+  {"reg",SEQ_REG,2},
+  {"lock",SEQ_LOCK,1},
+  {"wait",SEQ_WAIT,1},
+  {"tick",SEQ_TICK,1},
+  {"until",SEQ_UNTIL,5},
+  {"settle",SEQ_SETTLE,3},
+  {"capture",SEQ_CAPTURE,3},
+  {"repeat",SEQ_REPEAT,1},
+  {"end",SEQ_END,0},
+};
+
+#define NUM_KEYWORDS                (sizeof(keywords)/sizeof(keywords[0]))
+
+static const char *op_name(uint32_t op) {
+  uint32_t k;
+  for (k = 0;k < NUM_KEYWORDS;k++) {
+    if (keywords[k].op == op) return keywords[k].name;
+  }
+  return "?";
+}
+
+/*
+ * Parses <start>[:<step>].  Returns -1 if TOK is not a number
+ */
+static int parse_value(const char *tok,int64_t *start,int64_t *step) {
+  char *end;
+  *start = strtoll(tok,&end,0);
+  *step = 0;
+  if (end == tok) return -1;
+  if (*end == ':') {
+    tok = end + 1;
+    *step = strtoll(tok,&end,0);
+    if (end == tok) return -1;
+  }
+  return *end == '\0' ? 0 : -1;
+}
+
+/*
+ * Checks that argument K of S stays within [LO,HI] over N iterations
+ */
+static int check_range(const seq_step_t *s,int k,uint32_t n,int64_t lo,int64_t hi,const char *what) {
+  int64_t last = s->arg[k] + s->step[k]*(int64_t)(n - 1);
+  if (s->arg[k] < lo || s->arg[k] > hi || last < lo || last > hi) {
+    fprintf(stderr,"Line %u: %s must be between %lld and %lld\n",s->line,what,(long long) lo,(long long) hi);
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Checks the arguments of S, which runs N times in a row in its innermost loop
+ */
+static int check_step(seq_step_t *s,uint32_t n) {
+  uint32_t k, numFifos;
+  switch (s->op) {
+    case SEQ_PWM:
+      if (check_range(s,0,1,0,NUM_PWM - 1,"The PWM channel")) return -1;
+      return check_range(s,1,n,0,SEQ_PWM_MAX,"PWM values");
+    case SEQ_BIAS:
+      for (k = 0;k < 3;k++) {
+        if (check_range(s,k,n,0,SEQ_PWM_MAX,"PWM values")) return -1;
+      }
+      return 0;
+    case SEQ_DAC:
+      return check_range(s,0,n,0,SEQ_DAC_MAX,"DAC values");
+    case SEQ_REG:
+      if (check_range(s,0,1,0,MAP_SIZE - 4,"The register offset")) return -1;
+      if (s->arg[0] & 3) {
+        fprintf(stderr,"Line %u: register offsets are multiples of 4\n",s->line);
+        return -1;
+      }
+      return check_range(s,1,n,0,UINT32_MAX,"Register values");
+    case SEQ_LOCK:
+      return check_range(s,0,1,0,1,"The lock status");
+    case SEQ_WAIT:
+    case SEQ_TICK:
+      return check_range(s,0,1,0,UINT32_MAX,"Waits");
+    case SEQ_UNTIL:
+      numFifos = s->arg[0] == CAPTURE_SOURCE_PHASE ? NUM_PHASE_FIFOS : NUM_BIAS_FIFOS;
+      if (check_range(s,1,1,1,numFifos,"The FIFO")) return -1;
+      if (check_range(s,3,1,INT32_MIN,INT32_MAX,"The level")) return -1;
+      return check_range(s,4,1,0,UINT32_MAX,"The timeout");
+    case SEQ_SETTLE:
+      if (check_range(s,0,1,1,UINT32_MAX,"The settling window")) return -1;
+      if (check_range(s,1,1,0,INT32_MAX,"The tolerance")) return -1;
+      return check_range(s,2,1,0,UINT32_MAX,"The settling time");
+    case SEQ_CAPTURE:
+      numFifos = s->arg[0] == CAPTURE_SOURCE_PHASE ? NUM_PHASE_FIFOS : NUM_BIAS_FIFOS;
+      if (s->arg[1] <= 0 || s->arg[1] > UINT32_MAX || capture_mask((uint32_t) s->arg[1],0,numFifos) == 0) {
+        fprintf(stderr,"Line %u: the mask selects FIFOs that do not exist\n",s->line);
+        return -1;
+      }
+      return check_range(s,2,1,1,UINT32_MAX,"The number of samples");
+    case SEQ_REPEAT:
+      return check_range(s,0,1,1,UINT32_MAX,"The number of repeats");
+  }
+  return 0;
+}
+
+/*
+ * Adds the captures of step S, run once per iteration of the DEPTH loops in OPEN, to the
+ * totals of PLAN.  Returns -1 if the result would not fit in memory
+ */
+static int count_capture(seq_plan_t *plan,const seq_step_t *s,const uint32_t *open,uint32_t depth) {
+  uint64_t mult = 1, words, bytes;
+  uint32_t k;
+  int overflow = 0;
+
+  for (k = 0;k < depth;k++) {
+    overflow |= __builtin_mul_overflow(mult,(uint64_t) plan->steps[open[k]].arg[0],&mult);
+  }
+  overflow |= __builtin_mul_overflow(mult,(uint64_t) __builtin_popcount((uint32_t) s->arg[1])*(uint64_t) s->arg[2],&words);
+  overflow |= __builtin_add_overflow(plan->num_captures,mult,&plan->num_captures);
+  overflow |= __builtin_add_overflow(plan->data_words,words,&plan->data_words);
+  if (!overflow) {
+    bytes = plan->data_words*sizeof(uint32_t) + plan->num_captures*sizeof(seq_capture_t);
+    overflow = plan->data_words > SEQ_MAX_RESULT_BYTES || plan->num_captures > SEQ_MAX_RESULT_BYTES
+               || bytes > SEQ_MAX_RESULT_BYTES;
+  }
+  if (overflow) {
+    fprintf(stderr,"Line %u: the captures of the plan need more than %u MiB\n",s->line,SEQ_MAX_RESULT_BYTES >> 20);
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Parses the arguments of one step from the tokens after its keyword
+ */
+static int parse_args(seq_step_t *s,char **tok,uint32_t ntok) {
+  uint32_t k = 0, a = 0;
+  for (k = 0;k < ntok;k++) {
+    if ((s->op == SEQ_UNTIL || s->op == SEQ_CAPTURE) && k == 0) {
+      if (strcmp(tok[k],"bias") == 0) {
+        s->arg[a++] = CAPTURE_SOURCE_BIAS;
+      } else if (strcmp(tok[k],"phase") == 0) {
+        s->arg[a++] = CAPTURE_SOURCE_PHASE;
+      } else {
+        fprintf(stderr,"Line %u: the FIFO group is bias or phase\n",s->line);
+        return -1;
+      }
+    } else if (s->op == SEQ_UNTIL && k == 2) {
+      if (strcmp(tok[k],"<") != 0 && strcmp(tok[k],">") != 0) {
+        fprintf(stderr,"Line %u: the condition is < or >\n",s->line);
+        return -1;
+      }
+      s->arg[a++] = tok[k][0] == '>' ? 1 : -1;
+    } else {
+      if (parse_value(tok[k],&s->arg[a],&s->step[a]) != 0) {
+        fprintf(stderr,"Line %u: '%s' is not a number\n",s->line,tok[k]);
+        return -1;
+      }
+      if (s->step[a] != 0 && s->op != SEQ_PWM && s->op != SEQ_BIAS && s->op != SEQ_DAC && s->op != SEQ_REG) {
+        fprintf(stderr,"Line %u: only written values can change between iterations\n",s->line);
+        return -1;
+      }
+      if (s->step[a] != 0 && ((s->op == SEQ_PWM || s->op == SEQ_REG) && k == 0)) {
+        fprintf(stderr,"Line %u: the %s cannot change between iterations\n",s->line,
+                s->op == SEQ_PWM ? "channel" : "register offset");
+        return -1;
+      }
+      a++;
+    }
+  }
+  return 0;
+}
+
+int seq_parse(const char *text,seq_plan_t *plan) {
+  char buf[SEQ_MAX_LINE], *tok[SEQ_MAX_ARGS + 2], *p, *hash;
+  const char *q = text, *eol;
+  uint32_t line = 0, ntok, k, size = 0, depth = 0;
+  uint32_t open[SEQ_MAX_DEPTH];
+  seq_step_t *s;
+  size_t len;
+
+  memset(plan,0,sizeof(*plan));
+  while (*q) {
+    line++;
+    eol = q + strcspn(q,"\n;");
+    len = (size_t)(eol - q);
+    if (len >= SEQ_MAX_LINE) {
+      fprintf(stderr,"Line %u: too long\n",line);
+      goto error;
+    }
+    memcpy(buf,q,len);
+    buf[len] = '\0';
+    q = *eol ? eol + 1 : eol;
+    if ((hash = strchr(buf,'#'))) *hash = '\0';
+    ntok = 0;
+    for (p = strtok(buf," \t\r");p;p = strtok(NULL," \t\r")) {
+      if (ntok == SEQ_MAX_ARGS + 2) {
+        fprintf(stderr,"Line %u: too many arguments\n",line);
+        goto error;
+      }
+      tok[ntok++] = p;
+    }
+    if (ntok == 0) continue;
+
+    if (plan->num_steps == size) {
+      size = size ? 2*size : 64;
+      s = (seq_step_t *) realloc(plan->steps,size*sizeof(seq_step_t));
+      if (!s) {
+        fprintf(stderr,"Error allocating memory\n");
+        goto error;
+      }
+      plan->steps = s;
+    }
+    s = &plan->steps[plan->num_steps];
+    memset(s,0,sizeof(*s));
+    s->line = line;
+    for (k = 0;k < NUM_KEYWORDS;k++) {
+      if (strcmp(tok[0],keywords[k].name) == 0) break;
+    }
+    if (k == NUM_KEYWORDS) {
+      fprintf(stderr,"Line %u: unknown step '%s'\n",line,tok[0]);
+      goto error;
+    }
+    s->op = keywords[k].op;
+    if (ntok - 1 != keywords[k].nargs) {
+      fprintf(stderr,"Line %u: %s takes %u arguments\n",line,keywords[k].name,keywords[k].nargs);
+      goto error;
+    }
+    if (parse_args(s,tok + 1,ntok - 1) != 0) goto error;
+    if (check_step(s,depth > 0 ? (uint32_t) plan->steps[open[depth - 1]].arg[0] : 1) != 0) goto error;
+
+    if (s->op == SEQ_REPEAT) {
+      if (depth == SEQ_MAX_DEPTH) {
+        fprintf(stderr,"Line %u: loops nest at most %d deep\n",line,SEQ_MAX_DEPTH);
+        goto error;
+      }
+      open[depth++] = plan->num_steps;
+    } else if (s->op == SEQ_END) {
+      if (depth == 0) {
+        fprintf(stderr,"Line %u: end without repeat\n",line);
+        goto error;
+      }
+      s->jump = open[--depth];
+      plan->steps[s->jump].jump = plan->num_steps;
+    } else if (s->op == SEQ_CAPTURE) {
+      if (count_capture(plan,s,open,depth) != 0) goto error;
+    }
+    plan->num_steps++;
+  }
+  if (depth > 0) {
+    fprintf(stderr,"Line %u: repeat without end\n",plan->steps[open[depth - 1]].line);
+    goto error;
+  }
+  return 0;
+
+error:
+  seq_free(plan);
+  return -1;
+}
+
+void seq_free(seq_plan_t *plan) {
+  free(plan->steps);
+  memset(plan,0,sizeof(*plan));
+}
+
+void seq_print(FILE *f,const seq_plan_t *plan) {
+  const seq_step_t *s;
+  uint32_t i, k, depth = 0, nargs;
+  uint64_t mult = 1;
+  fprintf(f,"# %u steps, %llu captures, %llu words\n",plan->num_steps,(unsigned long long) plan->num_captures,
+          (unsigned long long) plan->data_words);
+  for (i = 0;i < plan->num_steps;i++) {
+    s = &plan->steps[i];
+    if (s->op == SEQ_END) {
+      depth--;
+      mult /= (uint64_t) plan->steps[s->jump].arg[0];
+    }
+    fprintf(f,"%4u %*s%s",s->line,2*depth,"",op_name(s->op));
+    nargs = 0;
+    for (k = 0;k < NUM_KEYWORDS;k++) {
+      if (keywords[k].op == s->op) nargs = keywords[k].nargs;
+    }
+    for (k = 0;k < nargs;k++) {
+      if ((s->op == SEQ_UNTIL || s->op == SEQ_CAPTURE) && k == 0) {
+        fprintf(f," %s",s->arg[k] == CAPTURE_SOURCE_PHASE ? "phase" : "bias");
+      } else if (s->op == SEQ_UNTIL && k == 2) {
+        fprintf(f," %c",s->arg[k] > 0 ? '>' : '<');
+      } else if (s->op == SEQ_CAPTURE && k == 1) {
+        fprintf(f," 0x%llx",(unsigned long long) s->arg[k]);
+      } else if (s->step[k] != 0) {
+        fprintf(f," %lld:%lld",(long long) s->arg[k],(long long) s->step[k]);
+      } else {
+        fprintf(f," %lld",(long long) s->arg[k]);
+      }
+    }
+    fprintf(f,"  (x%llu)\n",(unsigned long long) mult);
+    if (s->op == SEQ_REPEAT) {
+      depth++;
+      mult *= (uint64_t) s->arg[0];
+    }
+  }
+}
+
+/*
+ * Waits until the mean of DEFAULT_SETTLE_WINDOW samples of one FIFO crosses the level.
+ * Returns 1 on timeout
+ */
+static int wait_until(void *cfg,const seq_step_t *s) {
+  uint32_t loc = s->arg[0] == CAPTURE_SOURCE_PHASE ? FIFO_PHASE_DATA_START_LOC : FIFO_BIAS_DATA_START_LOC;
+  uint32_t buf[DEFAULT_SETTLE_WINDOW], i;
+  uint64_t deadline = rt_now_ns() + 1000*(uint64_t) s->arg[4];
+  int64_t sum;
+  int ret = 1;
+
+  start_fifo(cfg);
+  do {
+    read_fifo_mask(cfg,loc,1u << (s->arg[1] - 1),DEFAULT_SETTLE_WINDOW,buf);
+    sum = 0;
+    for (i = 0;i < DEFAULT_SETTLE_WINDOW;i++) sum += (int32_t) buf[i];
+    if (s->arg[2]*(sum - s->arg[3]*DEFAULT_SETTLE_WINDOW) > 0) {
+      ret = 0;
+      break;
+    }
+  } while (rt_now_ns() < deadline);
+  stop_fifo(cfg);
+  return ret;
+}
+
+int seq_run(void *cfg,const seq_plan_t *plan,seq_header_t *hdr,seq_capture_t *index,uint32_t *data,
+            volatile sig_atomic_t *stop) {
+  struct {
+    uint32_t pc, count, iter;
+  } loop[SEQ_MAX_DEPTH];
+  const seq_step_t *s;
+  seq_capture_t *c;
+  bias_settle_t settle;
+  struct timespec now;
+  uint32_t *raw_data = NULL, max_window = 0, pc = 0, depth = 0, i, settle_us;
+  uint64_t t0, tick, offset = 0, iter;
+  int64_t v[SEQ_MAX_ARGS];
+
+  for (i = 0;i < plan->num_steps;i++) {
+    if (plan->steps[i].op == SEQ_SETTLE && plan->steps[i].arg[0] > max_window) max_window = plan->steps[i].arg[0];
+  }
+  if (max_window > 0) {
+    raw_data = (uint32_t *) malloc((size_t) NUM_BIAS_FIFOS*max_window*sizeof(uint32_t));
+    if (!raw_data) return -1;
+  }
+
+  memset(hdr,0,sizeof(*hdr));
+  hdr->magic = SEQ_FILE_MAGIC;
+  hdr->version = SEQ_FILE_VERSION;
+  hdr->header_size = sizeof(seq_header_t);
+  hdr->flags = rt_enabled() ? SEQ_REALTIME : 0;
+  hdr->bias_period = fifo_sample_period(cfg,FIFO_BIAS_DATA_START_LOC);
+  hdr->phase_period = fifo_sample_period(cfg,FIFO_PHASE_DATA_START_LOC);
+  clock_gettime(CLOCK_REALTIME,&now);
+  hdr->start_time_ns = (uint64_t) now.tv_sec*1000000000ULL + (uint64_t) now.tv_nsec;
+  t0 = tick = rt_now_ns();
+
+  while (pc < plan->num_steps) {
+    if (stop && *stop) {
+      hdr->flags |= SEQ_STOPPED;
+      break;
+    }
+    s = &plan->steps[pc];
+    iter = depth > 0 ? loop[depth - 1].iter : 0;
+    for (i = 0;i < SEQ_MAX_ARGS;i++) v[i] = s->arg[i] + s->step[i]*(int64_t) iter;
+    switch (s->op) {
+      case SEQ_PWM:
+        write_to_pwm(cfg,(uint32_t) v[0],(uint16_t) v[1]);
+        break;
+      case SEQ_BIAS:
+        write_to_bias_pwm(cfg,(uint16_t) v[0],(uint16_t) v[1],(uint16_t) v[2]);
+        break;
+      case SEQ_DAC:
+        write_to_aux_dac(cfg,(uint16_t) v[0]);
+        break;
+      case SEQ_REG:
+        reg_write(cfg,(uint32_t) v[0],(uint32_t) v[1]);
+        break;
+      case SEQ_LOCK:
+        set_lock_status(cfg,(uint32_t) v[0]);
+        break;
+      case SEQ_WAIT:
+        rt_wait_until(rt_now_ns() + 1000*(uint64_t) v[0]);
+        break;
+      case SEQ_TICK:
+        tick += 1000*(uint64_t) v[0];
+        if (tick < rt_now_ns()) {
+          //Start the schedule again from now rather than catching up
+          hdr->late_ticks++;
+          tick = rt_now_ns();
+        } else {
+          rt_wait_until(tick);
+        }
+        break;
+      case SEQ_UNTIL:
+        hdr->timeouts += wait_until(cfg,s);
+        break;
+      case SEQ_SETTLE:
+        settle.window = (uint32_t) v[0];
+        settle.tolerance = (int32_t) v[1];
+        settle.maxDwell = (uint32_t) v[2];
+        start_fifo(cfg);
+        hdr->timeouts += wait_for_bias_settle(cfg,settle.window,&settle,raw_data,&settle_us);
+        stop_fifo(cfg);
+        break;
+      case SEQ_CAPTURE:
+        c = &index[hdr->num_captures++];
+        memset(c,0,sizeof(*c));
+        c->line = s->line;
+        c->source = (uint32_t) v[0];
+        c->channel_mask = (uint32_t) v[1];
+        c->num_streams = __builtin_popcount(c->channel_mask);
+        c->num_samples = (uint32_t) v[2];
+        c->depth = depth;
+        for (i = 0;i < depth;i++) c->loop[i] = loop[i].iter;
+        c->offset = offset;
+        c->time_ns = rt_now_ns() - t0;
+        start_fifo(cfg);
+        read_fifo_mask(cfg,c->source == CAPTURE_SOURCE_PHASE ? FIFO_PHASE_DATA_START_LOC : FIFO_BIAS_DATA_START_LOC,
+                       c->channel_mask,c->num_samples,data + offset);
+        stop_fifo(cfg);
+        offset += (uint64_t) c->num_streams*c->num_samples;
+        break;
+      case SEQ_REPEAT:
+        loop[depth].pc = pc;
+        loop[depth].count = (uint32_t) v[0];
+        loop[depth].iter = 0;
+        depth++;
+        break;
+      case SEQ_END:
+        if (++loop[depth - 1].iter < loop[depth - 1].count) {
+          pc = loop[depth - 1].pc;
+        } else {
+          depth--;
+        }
+        break;
+    }
+    pc++;
+  }
+
+  hdr->data_words = offset;
+  hdr->data_offset = sizeof(seq_header_t) + hdr->num_captures*sizeof(seq_capture_t);
+  hdr->duration_ns = rt_now_ns() - t0;
+  free(raw_data);
+  return hdr->flags & SEQ_STOPPED ? 1 : 0;
+}
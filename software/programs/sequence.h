@@ -0,0 +1,129 @@
+#ifndef SEQUENCE_H_
+#define SEQUENCE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <signal.h>
+
+/*
+ * Experiment sequences run on the device in one process.  A plan is a list of steps, one
+ * per line or separated by ';', with '#' starting a comment:
+ *
+ *    pwm <ch> <value>            write PWM output ch (0-2 bias, 3 phase)
+ *    bias <v1> <v2> <v3>         write the three bias PWM outputs together
+ *    dac <value>                 write the auxiliary DAC
+ *    reg <offset> <value>        write any register in the mapped block
+ *    lock <0|1>                  disengage or engage the phase lock
+ *    wait <us>                   wait from the end of the previous step
+ *    tick <us>                   wait until us after the previous tick (or the start), so
+ *                                that a loop with a tick runs at a fixed period
+ *    until <bias|phase> <k> <'<'|'>'> <value> <timeout_us>
+ *                                wait until the mean of DEFAULT_SETTLE_WINDOW samples of
+ *                                FIFO k (from 1) of the group crosses value
+ *    settle <window> <tolerance> <max_us>
+ *                                wait for the bias signals to settle (see bias_settle_t)
+ *    capture <bias|phase> <mask> <samples>
+ *                                record samples from the FIFOs of the group in mask
+ *    repeat <n> ... end          run the steps in between n times; loops nest up to
+ *                                SEQ_MAX_DEPTH deep
+ *
+ * Any value written can be given as <start>:<step>, which is start + step*i with i the
+ * iteration of the innermost loop around the step, so that a scan is a loop of a few
+ * steps.  Values are checked against the range of their output for every iteration when
+ * the plan is parsed.  Numbers may be decimal or hexadecimal (0x).
+ *
+ * The result is one block: a seq_header_t, one seq_capture_t per capture in the order
+ * they were taken, and then the data of each capture as interleaved FIFO words.  Every
+ * capture records the source line, the iteration of every enclosing loop, and its start
+ * time, so the captures of a scan can be matched to their settings.  The whole result is
+ * held in memory, so plans whose result would exceed SEQ_MAX_RESULT_BYTES are rejected
+ */
+#define SEQ_MAX_DEPTH               4
+#define SEQ_MAX_ARGS                5
+#define SEQ_MAX_LINE                256
+#define SEQ_PWM_MAX                 1023
+#define SEQ_DAC_MAX                 16383
+#define SEQ_MAX_RESULT_BYTES        (256u << 20)  //Largest result held in memory
+
+#define SEQ_PWM                     1
+#define SEQ_BIAS                    2
+#define SEQ_DAC                     3
+#define SEQ_REG                     4
+#define SEQ_LOCK                    5
+#define SEQ_WAIT                    6
+#define SEQ_TICK                    7
+#define SEQ_UNTIL                   8
+#define SEQ_SETTLE                  9
+#define SEQ_CAPTURE                 10
+#define SEQ_REPEAT                  11
+#define SEQ_END                     12
+
+#define SEQ_FILE_MAGIC              0x51535149    //"IQSQ"
+#define SEQ_FILE_VERSION            1
+
+#define SEQ_REALTIME                0x1           //Run in real-time mode
+#define SEQ_STOPPED                 0x2           //Stopped before the end
+
+typedef struct {
+  uint32_t op;                    //SEQ_*
+  uint32_t line;                  //Line of the plan from 1, counting ';' as a new line
+  int64_t arg[SEQ_MAX_ARGS];
+  int64_t step[SEQ_MAX_ARGS];     //Change per iteration of the innermost loop
+  uint32_t jump;                  //Matching end of a repeat, or repeat of an end
+} seq_step_t;
+
+typedef struct {
+  seq_step_t *steps;
+  uint32_t num_steps;
+  uint64_t num_captures;          //Captures when run to the end
+  uint64_t data_words;            //Words of capture data when run to the end
+} seq_plan_t;
+
+typedef struct {
+  uint32_t magic;                 //SEQ_FILE_MAGIC
+  uint32_t version;               //SEQ_FILE_VERSION
+  uint32_t header_size;           //sizeof(seq_header_t), the index follows
+  uint32_t flags;                 //SEQ_*
+  uint64_t num_captures;
+  uint64_t data_offset;           //File offset of the data
+  uint64_t data_words;
+  uint64_t start_time_ns;         //Start of the run, ns since the UNIX epoch
+  uint64_t duration_ns;
+  double bias_period;             //Sample periods at the start [s]
+  double phase_period;
+  uint32_t late_ticks;            //Ticks that were already due
+  uint32_t timeouts;              //until and settle steps that timed out
+} seq_header_t;
+
+typedef struct {
+  uint32_t line;                  //Line of the capture step
+  uint32_t source;                //CAPTURE_SOURCE_*
+  uint32_t channel_mask;
+  uint32_t num_streams;
+  uint32_t num_samples;
+  uint32_t depth;                 //Enclosing loops
+  uint32_t loop[SEQ_MAX_DEPTH];   //Iteration of each, outermost first
+  uint64_t time_ns;               //Start of the capture since the start of the run
+  uint64_t offset;                //Words from the start of the data
+} seq_capture_t;
+
+_Static_assert(sizeof(seq_header_t) % 8 == 0,"seq_header_t");
+_Static_assert(sizeof(seq_capture_t) % 8 == 0,"seq_capture_t");
+
+/*
+ * Parses TEXT into PLAN.  Returns 0 on success and otherwise prints the error with its
+ * line to stderr and returns -1
+ */
+int seq_parse(const char *text,seq_plan_t *plan);
+void seq_free(seq_plan_t *plan);
+/*
+ * Runs PLAN, filling HDR, INDEX (num_captures entries) and DATA (data_words words).
+ * Stops between steps once *STOP is set.  Returns 0 at the end and 1 if stopped
+ */
+int seq_run(void *cfg,const seq_plan_t *plan,seq_header_t *hdr,seq_capture_t *index,uint32_t *data,
+            volatile sig_atomic_t *stop);
+/*
+ * Prints the plan, one step per line with its multiplicity
+ */
+void seq_print(FILE *f,const seq_plan_t *plan);
+#endif
@@ -0,0 +1,190 @@
+//These are libraries which contain useful functions
+#include <ctype.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+
+#include "iq_bias_control.h"
+#include "capture_output.h"
+#include "sequence.h"
+
+/*
+ * Runs an experiment sequence on the device (see sequence.h), so that a scan of settings
+ * and captures costs one command instead of one program per point.  The plan is read
+ * from the file given with -i ("-" for standard input) or given directly with -e, and
+ * the result is written in one block to SavedData.bin or -o.  SIGINT/SIGTERM stop the
+ * sequence between steps, and the captures taken so far are still written
+ */
+static volatile sig_atomic_t stop_requested = 0;
+
+static void handle_stop(int sig) {
+  stop_requested = 1;
+}
+
+/*
+ * Reads all of F into a string.  Returns NULL on error
+ */
+static char *read_text(FILE *f) {
+  size_t size = 4096, len = 0, n;
+  char *text = (char *) malloc(size), *tmp;
+  while (text && (n = fread(text + len,1,size - len - 1,f)) > 0) {
+    len += n;
+    if (len + 1 == size) {
+      tmp = (char *) realloc(text,2*size);
+      if (!tmp) {
+        free(text);
+        return NULL;
+      }
+      text = tmp;
+      size *= 2;
+    }
+  }
+  if (text) text[len] = '\0';
+  return text;
+}
+
+int main(int argc, char **argv)
+{
+  int fd;		        //File identifier
+  void *cfg;		    //A pointer to a memory location.  The * indicates that it is a pointer - it points to a location in memory
+
+  seq_plan_t plan;
+  seq_header_t hdr;
+  seq_capture_t *index;
+  uint32_t *data;
+  char *planFile = NULL;      //Plan file, "-" for standard input
+  char *planText = NULL;      //Plan given on the command line
+  char *text;
+  char *outputFile = NULL;    //Output destination, SavedData.bin by default
+  int cpu = RT_DEFAULT_CPU;   //CPU to run on in real-time mode
+  uint8_t dryFlag = 0;        //Only check and print the plan
+  uint8_t rtFlag = 0;         //Real-time mode: locked memory and SCHED_FIFO
+  uint8_t debugFlag = 0;
+  FILE *fptr;
+  int outfd, ret;
+  struct sigaction sa;
+
+  /*
+   * Parse the input arguments
+   */
+  int c;
+  while ((c = getopt(argc,argv,"i:e:o:np:Lf")) != -1) {
+    switch (c) {
+      case 'i':
+        planFile = optarg;
+        break;
+      case 'e':
+        planText = optarg;
+        break;
+      case 'o':
+        outputFile = optarg;
+        break;
+      case 'n':
+        dryFlag = 1;
+        break;
+      case 'p':
+        cpu = atoi(optarg);
+        break;
+      case 'L':
+        rtFlag = 1;
+        break;
+      case 'f':
+        debugFlag = 1;
+        break;
+
+      case '?':
+        if (isprint (optopt))
+            fprintf (stderr, "Unknown option `-%c'.\n", optopt);
+        else
+            fprintf (stderr,
+                    "Unknown option character `\\x%x'.\n",
+                    optopt);
+        return 1;
+
+      default:
+        abort();
+        break;
+    }
+  }
+
+  if ((planFile == NULL) == (planText == NULL)) {
+    fprintf(stderr,"Give the plan with either -i <file> or -e <steps>\n");
+    return 1;
+  }
+  if (planFile) {
+    fptr = strcmp(planFile,"-") == 0 ? stdin : fopen(planFile,"r");
+    if (!fptr) {
+      perror("fopen");
+      return 1;
+    }
+    text = read_text(fptr);
+    if (fptr != stdin) fclose(fptr);
+    if (!text) {
+      printf("Error allocating memory");
+      return -1;
+    }
+  } else {
+    text = strdup(planText);
+  }
+  ret = seq_parse(text,&plan);
+  free(text);
+  if (ret != 0) {
+    return 1;
+  }
+  if (dryFlag || debugFlag) {
+    seq_print(dryFlag ? stdout : stderr,&plan);
+  }
+  if (dryFlag) {
+    seq_free(&plan);
+    return 0;
+  }
+
+  //seq_parse limits both to SEQ_MAX_RESULT_BYTES, so the sizes fit in size_t
+  index = (seq_capture_t *) malloc((plan.num_captures > 0 ? (size_t) plan.num_captures : 1)*sizeof(seq_capture_t));
+  data = (uint32_t *) malloc((plan.data_words > 0 ? (size_t) plan.data_words : 1)*sizeof(uint32_t));
+  if (!index || !data) {
+    printf("Error allocating memory");
+    return -1;
+  }
+  cfg = map_device(MEM_LOC,&fd);
+  if (!cfg) {
+    return 1;
+  }
+  if (rtFlag) {
+    rt_enter(cpu,RT_DEFAULT_PRIORITY);
+  }
+
+  memset(&sa,0,sizeof(sa));
+  sa.sa_handler = handle_stop;
+  sigaction(SIGINT,&sa,NULL);
+  sigaction(SIGTERM,&sa,NULL);
+
+  ret = seq_run(cfg,&plan,&hdr,index,data,&stop_requested);
+  if (ret < 0) {
+    printf("Error allocating memory");
+    return -1;
+  } else if (ret == 1) {
+    fprintf(stderr,"Stopped after %llu of %llu captures\n",(unsigned long long) hdr.num_captures,
+            (unsigned long long) plan.num_captures);
+  }
+  if (debugFlag) {
+    fprintf(stderr,"Ran in %.6f s: %llu captures, %llu words, %u late ticks, %u timeouts\n",hdr.duration_ns*1e-9,
+            (unsigned long long) hdr.num_captures,(unsigned long long) hdr.data_words,hdr.late_ticks,hdr.timeouts);
+  }
+
+  if ((outfd = open_output(outputFile)) >= 0) {
+    write_all(outfd,&hdr,sizeof(hdr));
+    write_all(outfd,index,hdr.num_captures*sizeof(seq_capture_t));
+    write_all(outfd,data,hdr.data_words*sizeof(uint32_t));
+    close_output(outfd);
+  }
+
+  free(index);
+  free(data);
+  seq_free(&plan);
+  unmap_device(cfg,fd);
+  return ret;	//C functions should have a return value - 0 is the usual "no error" return value
+}
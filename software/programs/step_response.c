@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "iq_bias_control.h"
+#include "step_response.h"
+
+static int record_steps(void *cfg,uint32_t loc,uint32_t mask,uint32_t numSamples,uint32_t repeats,uint32_t type,
+                        jump_action_t set_level,const jump_levels_t *l,uint32_t *data,double *avg,capture_events_t *ev) {
+  const uint32_t S = __builtin_popcount(mask);
+  const uint32_t jump_sample = step_jump_sample(mask,numSamples);
+  double *baseline, *first;
+  const int32_t *x;
+  double dir;
+  uint32_t r, i, k;
+  int up;
+
+  if (repeats == 0) repeats = 1;
+  baseline = (double *) calloc(2*S,sizeof(double));
+  if (!baseline) return -1;
+  first = baseline + S;
+  memset(avg,0,(size_t) numSamples*S*sizeof(double));
+
+  // Set voltages and let the system settle
+  set_level(cfg,l,0);
+  rt_sleep_us(1000000);
+  for (r = 0;r < repeats;r++) {
+    // Even repeats jump up from the base level and odd repeats jump back down, so the
+    // end of each trace is the settling time of the next
+    up = !(r & 1);
+    dir = up ? 1.0 : -1.0;
+    record_jump(cfg,loc,mask,numSamples,jump_sample,set_level,l,up,type,r,data,ev);
+
+    x = (const int32_t *) data;
+    for (k = 0;k < S;k++) baseline[k] = 0;
+    for (i = 0;i < jump_sample;i++) {
+      for (k = 0;k < S;k++) baseline[k] += x[(size_t) i*S + k];
+    }
+    for (k = 0;k < S;k++) {
+      baseline[k] = jump_sample > 0 ? baseline[k]/jump_sample : 0;
+      if (r == 0) first[k] = baseline[k];
+    }
+    for (i = 0;i < numSamples;i++) {
+      for (k = 0;k < S;k++) {
+        avg[(size_t) i*S + k] += dir*((double) x[(size_t) i*S + k] - baseline[k]);
+      }
+    }
+  }
+  set_level(cfg,l,0);
+
+  for (i = 0;i < numSamples;i++) {
+    for (k = 0;k < S;k++) {
+      avg[(size_t) i*S + k] = first[k] + avg[(size_t) i*S + k]/repeats;
+    }
+  }
+  free(baseline);
+  return 0;
+}
+
+int record_bias_steps(void *cfg,uint32_t mask,uint32_t numSamples,uint16_t Vx,uint16_t Vy,uint16_t Vz,uint16_t Vjump,
+                      uint8_t jump_index,uint32_t repeats,uint32_t *data,double *avg,capture_events_t *ev) {
+  jump_levels_t l = {{Vx,Vy,Vz},Vjump,jump_index};
+  return record_steps(cfg,FIFO_BIAS_DATA_START_LOC,mask,numSamples,repeats,CAPTURE_EVENT_BIAS_JUMP,jump_bias_pwm,&l,
+                      data,avg,ev);
+}
+
+int record_phase_steps(void *cfg,uint32_t mask,uint32_t numSamples,uint16_t V,uint16_t Vjump,uint8_t jump_type,
+                       uint32_t repeats,uint32_t *data,double *avg,capture_events_t *ev) {
+  jump_levels_t l = {{V,0,0},Vjump,jump_type};
+  return record_steps(cfg,FIFO_PHASE_DATA_START_LOC,mask,numSamples,repeats,CAPTURE_EVENT_PHASE_JUMP,jump_phase_output,&l,
+                      data,avg,ev);
+}
+
+/*
+ * First time at or after START at which the normalised response Z reaches LEVEL, in
+ * samples from START and interpolated between samples
+ */
+static double crossing(const double *avg,uint32_t numSamples,uint32_t S,uint32_t stream,uint32_t start,
+                       double baseline,double step,double level) {
+  double z, zprev = 0;
+  uint32_t i;
+  for (i = start;i < numSamples;i++) {
+    z = (avg[(size_t) i*S + stream] - baseline)/step;
+    if (z >= level) {
+      if (i == start) return 0;
+      return (double)(i - 1 - start) + (level - zprev)/(z - zprev);
+    }
+    zprev = z;
+  }
+  return NAN;
+}
+
+void step_metrics(const double *avg,uint32_t numSamples,uint32_t num_streams,uint32_t stream,uint32_t jump_sample,
+                  double band,double sample_period,step_metrics_t *m) {
+  const uint32_t S = num_streams;
+  uint32_t i, tail, last_out = jump_sample;
+  double final = 0, z, peak = -INFINITY, var = 0;
+
+  memset(m,0,sizeof(*m));
+  m->baseline = 0;
+  for (i = 0;i < jump_sample;i++) {
+    m->baseline += avg[(size_t) i*S + stream];
+  }
+  m->baseline = jump_sample > 0 ? m->baseline/jump_sample : avg[stream];
+  for (i = 0;i < jump_sample;i++) {
+    z = avg[(size_t) i*S + stream] - m->baseline;
+    var += z*z;
+  }
+  var = jump_sample > 1 ? var/(jump_sample - 1) : 0;
+  tail = (numSamples - jump_sample)/10 > 0 ? (numSamples - jump_sample)/10 : 1;
+  if (jump_sample >= numSamples) {
+    m->step = 0;
+  } else {
+    for (i = numSamples - tail;i < numSamples;i++) {
+      final += avg[(size_t) i*S + stream];
+    }
+    m->step = final/tail - m->baseline;
+  }
+  //A step within the noise before the jump is no step
+  if (fabs(m->step) <= 3*sqrt(var) || fabs(m->step) < 1e-6) {
+    m->rise_time = m->overshoot = m->settling_time = NAN;
+    return;
+  }
+
+  m->rise_time = (crossing(avg,numSamples,S,stream,jump_sample,m->baseline,m->step,0.9) -
+                  crossing(avg,numSamples,S,stream,jump_sample,m->baseline,m->step,0.1))*sample_period;
+  for (i = jump_sample;i < numSamples;i++) {
+    z = (avg[(size_t) i*S + stream] - m->baseline)/m->step;
+    if (z > peak) peak = z;
+    if (fabs(z - 1) > 1e-2*band) last_out = i + 1;
+  }
+  m->overshoot = peak > 1 ? 1e2*(peak - 1) : 0;
+  m->settling_time = (double)(last_out - jump_sample)*sample_period;
+}
+
+void step_print_metrics(FILE *f,const capture_header_t *hdr,const double *avg,uint32_t numSamples,uint32_t jump_sample,
+                        uint32_t repeats,double band) {
+  step_metrics_t m;
+  uint32_t k;
+  fprintf(f,"# %u repeats, jump at sample %u, settling band %.3g%%\n",repeats,jump_sample,band);
+  fprintf(f,"# stream baseline step rise_time[s] overshoot[%%] settling_time[s]\n");
+  for (k = 0;k < hdr->num_streams;k++) {
+    step_metrics(avg,numSamples,hdr->num_streams,k,jump_sample,band,hdr->sample_period,&m);
+    fprintf(f,"%s %.6g %.6g %.6e %.4g %.6e\n",hdr->stream_names[k][0] ? hdr->stream_names[k] : "-",
+            m.baseline,m.step,m.rise_time,m.overshoot,m.settling_time);
+  }
+}
+
+void step_average_to_words(const double *avg,uint32_t num_words,uint32_t sample_format,uint32_t *data) {
+  uint32_t i;
+  float v;
+  int32_t n;
+  for (i = 0;i < num_words;i++) {
+    if (sample_format == CAPTURE_FORMAT_FLOAT32) {
+      v = (float) avg[i];
+      memcpy(data + i,&v,sizeof(v));
+    } else {
+      n = (int32_t) lround(avg[i]);
+      memcpy(data + i,&n,sizeof(n));
+    }
+  }
+}
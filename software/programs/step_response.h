@@ -0,0 +1,63 @@
+#ifndef STEP_RESPONSE_H_
+#define STEP_RESPONSE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "capture_file.h"
+
+/*
+ * Repeated step responses.  Each repeat records numSamples samples with the jump applied
+ * before the first sample at or after a quarter of the data, as record_bias_jump() and
+ * record_phase_jump() do.  Repeats alternate between jumping up by Vjump and back down,
+ * so the end of one trace is the starting level of the next and only the first repeat
+ * waits one second to settle.  Every trace is aligned on the jump, has the mean of its
+ * pre-jump samples subtracted and is multiplied by the direction of its jump, and the
+ * traces are averaged coherently:
+ *
+ *    avg[i] = b_0 + (1/R) sum_r d_r (x_r[i] - b_r)
+ *
+ * where b_r is the pre-jump mean and d_r = +1/-1 the direction of repeat r, so AVG looks
+ * like a single upward jump from the first baseline with the noise reduced by sqrt(R).
+ * The time of each repeat's jump is added to EV (if not NULL), so that the timing
+ * jitter across the repeats can be checked
+ */
+#define STEP_DEFAULT_BAND           2.0       //Settling band [% of the step]
+
+typedef struct {
+  double baseline;                //Mean before the jump [counts]
+  double step;                    //Final value minus baseline [counts]
+  double rise_time;               //10% to 90% of the step [s]
+  double overshoot;               //Peak beyond the final value [% of the step]
+  double settling_time;           //From the jump until the signal stays within the band [s]
+} step_metrics_t;
+
+/*
+ * Record REPEATS alternating jumps of the bias or phase signals and write the coherent
+ * average to AVG, numSamples interleaved samples of popcount(MASK) doubles.  DATA is the
+ * buffer for one trace and holds the last one on return
+ */
+int record_bias_steps(void *cfg,uint32_t mask,uint32_t numSamples,uint16_t Vx,uint16_t Vy,uint16_t Vz,uint16_t Vjump,
+                      uint8_t jump_index,uint32_t repeats,uint32_t *data,double *avg,capture_events_t *ev);
+int record_phase_steps(void *cfg,uint32_t mask,uint32_t numSamples,uint16_t V,uint16_t Vjump,uint8_t jump_type,
+                       uint32_t repeats,uint32_t *data,double *avg,capture_events_t *ev);
+
+/*
+ * Measures the response of STREAM in an averaged trace.  The final value is the mean of
+ * the last tenth of the trace, and crossing times are interpolated between samples.
+ * The times and overshoot are NAN if the step is within three standard deviations of the
+ * noise before the jump, and the times are NAN if the response never reaches the level
+ */
+void step_metrics(const double *avg,uint32_t numSamples,uint32_t num_streams,uint32_t stream,uint32_t jump_sample,
+                  double band,double sample_period,step_metrics_t *m);
+/*
+ * Prints a table of the metrics of every stream, named as in HDR
+ */
+void step_print_metrics(FILE *f,const capture_header_t *hdr,const double *avg,uint32_t numSamples,uint32_t jump_sample,
+                        uint32_t repeats,double band);
+/*
+ * Converts the average to words for saving: float32 for a CAPTURE_FORMAT_FLOAT32 file,
+ * otherwise int32 rounded to the nearest count so that raw files read as before
+ */
+void step_average_to_words(const double *avg,uint32_t num_words,uint32_t sample_format,uint32_t *data);
+#endif
@@ -0,0 +1,207 @@
+//These are libraries which contain useful functions
+#include <ctype.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "iq_bias_control.h"
+#include "capture_output.h"
+#include "capture_file.h"
+
+/*
+ * Reads a programmed trajectory of whitespace-separated PWM values, with one row per
+ * update and one column per swept channel.  Values outside 0 to SWEEP_PWM_MAX are
+ * reported with their line.  Returns the number of rows, or -1 on error
+ */
+static int read_trajectory(const char *filename,uint32_t num_columns,uint16_t **points) {
+  FILE *ptr;
+  uint32_t n = 0, size = 1024, line = 0;
+  char *buf = NULL, *tok, *end;
+  size_t buf_size = 0;
+  long v;
+  uint16_t *p, *tmp;
+
+  if ((ptr = fopen(filename,"r")) == NULL) {
+    perror("fopen");
+    return -1;
+  }
+  if ((p = (uint16_t *) malloc(size*sizeof(uint16_t))) == NULL) {
+    fclose(ptr);
+    return -1;
+  }
+  while (getline(&buf,&buf_size,ptr) != -1) {
+    line++;
+    for (tok = strtok(buf," \t\r\n");tok;tok = strtok(NULL," \t\r\n")) {
+      v = strtol(tok,&end,0);
+      if (*end != '\0' || v < 0 || v > SWEEP_PWM_MAX) {
+        fprintf(stderr,"Line %u: PWM values must be between 0 and %d\n",line,SWEEP_PWM_MAX);
+        goto error;
+      }
+      if (n == size) {
+        //Keep the old block if it cannot grow, so it is still freed
+        if ((tmp = (uint16_t *) realloc(p,2*size*sizeof(uint16_t))) == NULL) {
+          goto error;
+        }
+        p = tmp;
+        size *= 2;
+      }
+      p[n++] = (uint16_t) v;
+    }
+  }
+  free(buf);
+  fclose(ptr);
+  if (n < num_columns) {
+    free(p);
+    return -1;
+  }
+  *points = p;
+  return n/num_columns;
+
+error:
+  free(buf);
+  fclose(ptr);
+  free(p);
+  return -1;
+}
+
+int main(int argc, char **argv)
+{
+  int fd;		        //File identifier
+  int num_samples = 0;  //Number of samples to acquire
+  void *cfg;		    //A pointer to a memory location.  The * indicates that it is a pointer - it points to a location in memory
+
+  uint32_t *data;
+  uint8_t debugFlag = 0;
+  char *outputFile = NULL;    //Output destination, SavedData.bin by default
+  char *trajectoryFile = NULL;
+  int memfd;                  //Memory file backing the data buffer, if any
+  int saveErr = 0;            //Writing the output failed
+  uint8_t containerFlag = 0;  //Write a self-describing capture file instead of raw words
+  capture_header_t hdr;
+  uint8_t rtFlag = 0;         //Real-time mode: locked memory and SCHED_FIFO
+  bias_sweep_t sweep;
+  uint16_t *points = NULL;
+  unsigned int ch, v0, v1;
+  int num_rows;
+
+  memset(&sweep,0,sizeof(sweep));
+  sweep.shape = SWEEP_RAMP;
+  sweep.update_samples = 1000;
+  sweep.dwell = DEFAULT_BIAS_DWELL;
+
+  /*
+   * Parse the input arguments
+   */
+  int c;
+  while ((c = getopt(argc,argv,"n:c:v:u:j:w:To:LFf")) != -1) {
+    switch (c) {
+        case 'n':
+            num_samples = atoi(optarg);
+            break;
+        case 'c':
+            sweep.channel_mask = strtoul(optarg,NULL,0);
+            break;
+        case 'v':
+            if (sscanf(optarg,"%u:%u:%u",&ch,&v0,&v1) != 3 || ch >= NUM_PWM) {
+                fprintf(stderr,"Invalid sweep `%s', use channel:start:end.\n",optarg);
+                return 1;
+            }
+            sweep.channel_mask |= 1 << ch;
+            sweep.start[ch] = v0;
+            sweep.end[ch] = v1;
+            break;
+        case 'u':
+            sweep.update_samples = atoi(optarg);
+            break;
+        case 'j':
+            trajectoryFile = optarg;
+            break;
+        case 'w':
+            sweep.dwell = atoi(optarg);
+            break;
+        case 'T':
+            sweep.shape = SWEEP_TRIANGLE;
+            break;
+        case 'o':
+            outputFile = optarg;
+            break;
+        case 'F':
+            containerFlag = 1;
+            break;
+        case 'L':
+            rtFlag = 1;
+            break;
+        case 'f':
+            debugFlag = 1;
+            break;
+
+        case '?':
+            if (isprint (optopt))
+                fprintf (stderr, "Unknown option `-%c'.\n", optopt);
+            else
+                fprintf (stderr,
+                        "Unknown option character `\\x%x'.\n",
+                        optopt);
+            return 1;
+
+        default:
+            abort();
+        break;
+    }
+  }
+
+  if (num_samples <= 0 || sweep_channels(&sweep) == 0) {
+    fprintf(stderr,"Specify the number of samples with -n and the channels to sweep with -v or -c\n");
+    return 1;
+  }
+  if (trajectoryFile) {
+    num_rows = read_trajectory(trajectoryFile,sweep_channels(&sweep),&points);
+    if (num_rows <= 0) {
+      fprintf(stderr,"Error reading trajectory %s\n",trajectoryFile);
+      return 1;
+    }
+    sweep.shape = SWEEP_TRAJECTORY;
+    sweep.num_points = num_rows;
+    sweep.points = points;
+  }
+
+  uint32_t saveFactor = NUM_BIAS_FIFOS + sweep_channels(&sweep);
+  uint32_t data_size = saveFactor*num_samples;
+  data = (uint32_t *) alloc_capture_buffer((size_t) data_size * sizeof(uint32_t),&memfd);
+  if (!data) {
+    printf("Error allocating memory for data");
+    return -1;
+  }
+
+  cfg = map_device(MEM_LOC,&fd);
+  if (!cfg) {
+    return 1;
+  }
+  if (rtFlag) {
+    rt_enter(RT_DEFAULT_CPU,RT_DEFAULT_PRIORITY);
+  }
+
+  if (containerFlag) {
+    capture_header_init(&hdr,cfg,CAPTURE_SOURCE_BIAS,(1u << NUM_BIAS_FIFOS) - 1);
+    for (ch = 0;ch < NUM_PWM;ch++) {
+      if (!(sweep.channel_mask & (1 << ch))) continue;
+      snprintf(hdr.stream_names[hdr.num_streams++],CAPTURE_NAME_LENGTH,"pwm%u",ch + 1);
+    }
+  }
+  // Sweep the outputs while recording
+  record_bias_sweep(cfg,num_samples,&sweep,data);
+
+  if (containerFlag) {
+    saveErr = save_capture_file(outputFile,&hdr,data,num_samples);
+  } else {
+    saveErr = write_capture(outputFile,data,(size_t) data_size * 4,memfd);
+  }
+  free_capture_buffer(data,(size_t) data_size * 4,memfd);
+  free(points);
+
+  unmap_device(cfg,fd);
+  return saveErr ? 1 : 0;	//C functions should have a return value - 0 is the usual "no error" return value
+}
@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trigger.h"
+
+static const char *condition_names[] = {"rise","fall","cross","abs","rate"};
+
+int trigger_parse(trigger_condition_t *c,const char *spec) {
+  char name[8];
+  long long level, extra;
+  unsigned int fifo;
+  int n, k;
+
+  memset(c,0,sizeof(*c));
+  n = sscanf(spec,"%7[a-z]:%u:%lld:%lld",name,&fifo,&level,&extra);
+  if (n < 3) return -1;
+  for (k = 0;k < (int)(sizeof(condition_names)/sizeof(condition_names[0]));k++) {
+    if (strcmp(name,condition_names[k]) == 0) break;
+  }
+  if (k == (int)(sizeof(condition_names)/sizeof(condition_names[0]))) return -1;
+  c->type = k;
+  c->fifo = fifo;
+  c->level = level;
+  c->lag = 1;
+  if (n == 4) {
+    if (c->type == TRIGGER_ABS) {
+      c->ref = extra;
+    } else if (c->type == TRIGGER_RATE && extra > 0) {
+      c->lag = (uint32_t) extra;
+    } else {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int trigger_init(trigger_t *t,uint32_t mask,uint32_t pre,uint32_t post,uint32_t holdoff,
+                 const trigger_condition_t *cond,uint32_t num_conditions) {
+  uint32_t k;
+
+  memset(t,0,sizeof(*t));
+  if (post == 0 || num_conditions == 0 || num_conditions > TRIGGER_MAX_CONDITIONS) return -1;
+  t->num_streams = __builtin_popcount(mask);
+  t->pre = pre;
+  t->post = post;
+  t->holdoff = holdoff;
+  t->length = pre + post;
+  t->num_conditions = num_conditions;
+  for (k = 0;k < num_conditions;k++) {
+    t->cond[k] = cond[k];
+    if (cond[k].fifo >= 32 || !(mask & (1u << cond[k].fifo)) || cond[k].lag >= t->length) return -1;
+    t->cond[k].column = __builtin_popcount(mask & ((1u << cond[k].fifo) - 1));
+  }
+  t->ring = (int32_t *) malloc((size_t) t->length*t->num_streams*sizeof(int32_t));
+  t->window = (uint32_t *) malloc((size_t) t->length*t->num_streams*sizeof(uint32_t));
+  if (!t->ring || !t->window) {
+    trigger_free(t);
+    return -1;
+  }
+  t->state = TRIGGER_ARMED;
+  return 0;
+}
+
+void trigger_free(trigger_t *t) {
+  free(t->ring);
+  free(t->window);
+  t->ring = NULL;
+  t->window = NULL;
+}
+
+/*
+ * Value of COLUMN BACK samples before the newest one
+ */
+static inline int64_t ring_value(const trigger_t *t,uint32_t head,uint32_t back,uint32_t column) {
+  uint32_t slot = head >= back ? head - back : head + t->length - back;
+  return t->ring[(size_t) slot*t->num_streams + column];
+}
+
+static int condition_met(const trigger_t *t,const trigger_condition_t *c,uint32_t head) {
+  int64_t x = ring_value(t,head,0,c->column), prev, d;
+  switch (c->type) {
+    case TRIGGER_RISE:
+    case TRIGGER_FALL:
+    case TRIGGER_CROSS:
+      if (t->samples == 0) return 0;
+      prev = ring_value(t,head,1,c->column);
+      if (c->type != TRIGGER_FALL && prev < c->level && x >= c->level) return 1;
+      if (c->type != TRIGGER_RISE && prev > c->level && x <= c->level) return 1;
+      return 0;
+    case TRIGGER_ABS:
+      d = x - c->ref;
+      return (d < 0 ? -d : d) > c->level;
+    case TRIGGER_RATE:
+      if (t->samples < c->lag) return 0;
+      d = x - ring_value(t,head,c->lag,c->column);
+      return (d < 0 ? -d : d) > c->level;
+    default:
+      return 0;
+  }
+}
+
+/*
+ * Copies the window of the last trigger, with POST samples from the trigger sample
+ * onwards, out of the ring in time order and emits it
+ */
+static int emit_window(trigger_t *t,uint32_t post,uint32_t head,trigger_emit_t emit,void *arg) {
+  const uint32_t S = t->num_streams;
+  uint32_t pre = t->trigger_sample < t->pre ? (uint32_t) t->trigger_sample : t->pre;
+  uint32_t count = pre + post, first, n;
+
+  //HEAD is the slot of the next sample, so the window starts COUNT slots before it
+  first = head >= count ? head - count : head + t->length - count;
+  n = t->length - first < count ? t->length - first : count;
+  memcpy(t->window,t->ring + (size_t) first*S,(size_t) n*S*sizeof(uint32_t));
+  memcpy(t->window + (size_t) n*S,t->ring,(size_t)(count - n)*S*sizeof(uint32_t));
+  t->triggers++;
+  return emit(arg,t,t->window,count,pre);
+}
+
+int trigger_push(trigger_t *t,const uint32_t *data,uint32_t numSamples,trigger_emit_t emit,void *arg) {
+  const uint32_t S = t->num_streams;
+  uint32_t head = (uint32_t)(t->samples % t->length), i, k;
+  int ret;
+
+  for (i = 0;i < numSamples;i++) {
+    memcpy(t->ring + (size_t) head*S,data + (size_t) i*S,S*sizeof(uint32_t));
+    if (t->state == TRIGGER_HOLDOFF && t->samples >= t->rearm_sample) {
+      t->state = TRIGGER_ARMED;
+    }
+    if (t->state == TRIGGER_ARMED) {
+      for (k = 0;k < t->num_conditions;k++) {
+        if (condition_met(t,&t->cond[k],head)) {
+          t->state = TRIGGER_FIRED;
+          t->trigger_sample = t->samples;
+          t->fired = k;
+          break;
+        }
+      }
+    }
+    head = head + 1 == t->length ? 0 : head + 1;
+    t->samples++;
+    if (t->state == TRIGGER_FIRED && t->samples == t->trigger_sample + t->post) {
+      t->state = TRIGGER_HOLDOFF;
+      t->rearm_sample = t->samples + t->holdoff;
+      if ((ret = emit_window(t,t->post,head,emit,arg)) != 0) return ret;
+    }
+  }
+  return 0;
+}
+
+int trigger_flush(trigger_t *t,trigger_emit_t emit,void *arg) {
+  if (t->state != TRIGGER_FIRED) return 0;
+  t->state = TRIGGER_HOLDOFF;
+  t->rearm_sample = t->samples + t->holdoff;
+  return emit_window(t,(uint32_t)(t->samples - t->trigger_sample),(uint32_t)(t->samples % t->length),emit,arg);
+}
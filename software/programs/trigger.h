@@ -0,0 +1,125 @@
+#ifndef TRIGGER_H_
+#define TRIGGER_H_
+
+#include <stdint.h>
+
+#include "capture_file.h"
+
+/*
+ * Triggered capture of interleaved int32 streams, like a digital oscilloscope in normal
+ * mode.  Every sample pushed goes into a ring of pre + post samples.  While armed, each
+ * sample is tested against the trigger conditions, and the first one that is met at
+ * sample t fires the trigger.  Once sample t + post - 1 has arrived, the window from
+ * t - pre to t + post - 1 is frozen and emitted, and the trigger re-arms holdoff samples
+ * later.  A trigger within pre samples of the start has a shorter pre-trigger part.
+ *
+ * Conditions on the stream x, any one of which fires the trigger:
+ *
+ *    rise:<fifo>:<level>           x crosses level upwards, x[t-1] < level <= x[t]
+ *    fall:<fifo>:<level>           x crosses level downwards, x[t-1] > level >= x[t]
+ *    cross:<fifo>:<level>          x crosses level in either direction
+ *    abs:<fifo>:<limit>[:<ref>]    |x[t] - ref| > limit, ref is 0 by default
+ *    rate:<fifo>:<limit>[:<lag>]   |x[t] - x[t-lag]| > limit, lag is 1 by default
+ *
+ * where <fifo> counts from the first FIFO of the group, as for channel masks
+ */
+#define TRIGGER_MAX_CONDITIONS      8
+
+#define TRIGGER_RISE                0
+#define TRIGGER_FALL                1
+#define TRIGGER_CROSS               2
+#define TRIGGER_ABS                 3
+#define TRIGGER_RATE                4
+
+#define TRIGGER_ARMED               0
+#define TRIGGER_FIRED               1       //Waiting for the post-trigger samples
+#define TRIGGER_HOLDOFF             2
+
+typedef struct {
+  uint32_t type;                  //TRIGGER_*
+  uint32_t fifo;                  //FIFO of the stream
+  uint32_t column;                //Position of the stream in a sample, set by trigger_init()
+  uint32_t lag;                   //Samples between the values compared by TRIGGER_RATE
+  int64_t level;                  //Level or limit [counts]
+  int64_t ref;                    //Reference of TRIGGER_ABS [counts]
+} trigger_condition_t;
+
+typedef struct {
+  uint32_t num_streams;
+  uint32_t pre, post;             //Samples before and from the trigger sample
+  uint32_t holdoff;               //Samples from an emitted window to re-arming
+  uint32_t length;                //pre + post, the ring length
+  uint32_t num_conditions;
+  trigger_condition_t cond[TRIGGER_MAX_CONDITIONS];
+  int32_t *ring;                  //Last length samples
+  uint32_t *window;               //Emitted window, in time order
+  uint64_t samples;               //Samples pushed so far
+  uint32_t state;                 //TRIGGER_ARMED etc.
+  uint64_t trigger_sample;        //Sample that fired the last trigger
+  uint32_t fired;                 //Condition that fired it
+  uint64_t rearm_sample;          //End of the holdoff
+  uint64_t triggers;              //Windows emitted so far
+} trigger_t;
+
+/*
+ * Called for every frozen window of numSamples samples, of which the first pre are
+ * before the trigger sample.  A non-zero return value stops trigger_push()
+ */
+typedef int (*trigger_emit_t)(void *arg,const trigger_t *t,const uint32_t *window,uint32_t numSamples,uint32_t pre);
+
+/*
+ * Parses a condition as above.  Returns -1 if it is malformed
+ */
+int trigger_parse(trigger_condition_t *c,const char *spec);
+/*
+ * Sets up a trigger for streams from the FIFOs in MASK.  Returns -1 if a condition
+ * refers to a FIFO that is not in MASK, a lag is not shorter than pre + post, or memory
+ * could not be allocated
+ */
+int trigger_init(trigger_t *t,uint32_t mask,uint32_t pre,uint32_t post,uint32_t holdoff,
+                 const trigger_condition_t *cond,uint32_t num_conditions);
+void trigger_free(trigger_t *t);
+/*
+ * Adds numSamples interleaved samples, calling EMIT for each window completed.  Returns
+ * the first non-zero value returned by EMIT, otherwise 0
+ */
+int trigger_push(trigger_t *t,const uint32_t *data,uint32_t numSamples,trigger_emit_t emit,void *arg);
+/*
+ * Emits a window that is still waiting for its post-trigger samples, cut short at the
+ * last sample pushed.  Used when a capture is stopped
+ */
+int trigger_flush(trigger_t *t,trigger_emit_t emit,void *arg);
+
+/*
+ * Event file.  All values are little-endian.  Each triggered window is one record: the
+ * header, padded with zeros to header_size bytes, then num_samples interleaved samples
+ * of num_streams int32 words, as in raw captures
+ */
+#define TRIGGER_FILE_MAGIC          0x52545149    //"IQTR"
+#define TRIGGER_FILE_VERSION        1
+#define TRIGGER_HEADER_SIZE         512
+
+typedef struct {
+  uint32_t magic;                 //TRIGGER_FILE_MAGIC
+  uint32_t version;               //TRIGGER_FILE_VERSION
+  uint32_t header_size;           //Bytes before the samples
+  uint32_t num_streams;
+  uint32_t num_samples;           //Samples per stream in this window
+  uint32_t pre_samples;           //Samples before the trigger sample
+  uint32_t condition;             //Index of the condition that fired
+  uint32_t condition_type;        //TRIGGER_*
+  uint32_t source;                //CAPTURE_SOURCE_*
+  uint32_t channel_mask;
+  uint32_t log2_rate;             //Log2 of the CIC decimation rate
+  uint32_t reserved;
+  uint64_t event;                 //Number of this window, from 0
+  uint64_t trigger_sample;        //Sample that fired, counted from the start of the capture
+  uint64_t trigger_time_ns;       //Time of that sample, ns since the UNIX epoch
+  uint64_t words_dropped;         //Words dropped by the reader so far.  Samples and times after
+                                  //a drop are late by the samples that were dropped
+  double sample_period;           //[s]
+  char stream_names[CAPTURE_MAX_STREAMS][CAPTURE_NAME_LENGTH];
+} trigger_header_t;
+
+_Static_assert(sizeof(trigger_header_t) <= TRIGGER_HEADER_SIZE,"TRIGGER_HEADER_SIZE");
+#endif
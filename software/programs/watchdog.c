@@ -0,0 +1,296 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <math.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "iq_bias_control.h"
+#include "watchdog.h"
+
+#define BIAS                        0
+#define PHASE                       1
+
+void watchdog_defaults(watchdog_params_t *p) {
+  p->period_us = WATCHDOG_DEFAULT_PERIOD_US;
+  p->numSamples = WATCHDOG_DEFAULT_SAMPLES;
+  p->hold = WATCHDOG_DEFAULT_HOLD;
+  p->bias_error = WATCHDOG_DEFAULT_BIAS_ERROR;
+  p->phase_error = WATCHDOG_DEFAULT_PHASE_ERROR;
+  p->margin = WATCHDOG_DEFAULT_MARGIN;
+  p->relock = 0;
+  p->off_us = WATCHDOG_DEFAULT_OFF_US;
+  p->max_relocks = WATCHDOG_DEFAULT_MAX_RELOCKS;
+}
+
+watchdog_shm_t *watchdog_create(void) {
+  watchdog_shm_t *shm;
+  int fd = shm_open(WATCHDOG_SHM_NAME,O_CREAT | O_RDWR,0644);
+  if (fd < 0) {
+    perror("shm_open");
+    return NULL;
+  }
+  if (ftruncate(fd,sizeof(watchdog_shm_t)) != 0) {
+    perror("ftruncate");
+    close(fd);
+    return NULL;
+  }
+  shm = (watchdog_shm_t *) mmap(NULL,sizeof(watchdog_shm_t),PROT_READ | PROT_WRITE,MAP_SHARED,fd,0);
+  close(fd);
+  if (shm == MAP_FAILED) {
+    perror("mmap");
+    return NULL;
+  }
+  shm->magic = WATCHDOG_MAGIC;
+  shm->version = WATCHDOG_VERSION;
+  shm->size = sizeof(watchdog_shm_t);
+  return shm;
+}
+
+const watchdog_shm_t *watchdog_open(void) {
+  const watchdog_shm_t *shm;
+  int fd = shm_open(WATCHDOG_SHM_NAME,O_RDONLY,0);
+  if (fd < 0) {
+    return NULL;
+  }
+  shm = (const watchdog_shm_t *) mmap(NULL,sizeof(watchdog_shm_t),PROT_READ,MAP_SHARED,fd,0);
+  close(fd);
+  return shm == MAP_FAILED ? NULL : shm;
+}
+
+void watchdog_close(const watchdog_shm_t *shm) {
+  if (shm) {
+    munmap((void *) shm,sizeof(watchdog_shm_t));
+  }
+}
+
+void watchdog_publish(watchdog_shm_t *shm,const watchdog_status_t *st) {
+  unsigned seq = atomic_load_explicit(&shm->seq,memory_order_relaxed);
+  atomic_store_explicit(&shm->seq,seq + 1,memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  memcpy(&shm->status,st,sizeof(*st));
+  atomic_store_explicit(&shm->seq,seq + 2,memory_order_release);
+}
+
+int watchdog_read(const watchdog_shm_t *shm,watchdog_status_t *st) {
+  unsigned s1, s2;
+  int tries;
+  if (shm->magic != WATCHDOG_MAGIC || shm->version != WATCHDOG_VERSION || shm->size != sizeof(watchdog_shm_t)) {
+    return -1;
+  }
+  for (tries = 0;tries < 1000;tries++) {
+    s1 = atomic_load_explicit((atomic_uint *) &shm->seq,memory_order_acquire);
+    if (s1 & 1) continue;
+    memcpy(st,&shm->status,sizeof(*st));
+    atomic_thread_fence(memory_order_acquire);
+    s2 = atomic_load_explicit((atomic_uint *) &shm->seq,memory_order_relaxed);
+    if (s1 == s2) return 0;
+  }
+  return -1;
+}
+
+uint64_t watchdog_now_ns(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_REALTIME,&t);
+  return (uint64_t) t.tv_sec*1000000000ULL + (uint64_t) t.tv_nsec;
+}
+
+int watchdog_check(const watchdog_status_t *st,uint64_t now_ns) {
+  uint64_t max_age = 3000ULL*st->period_us + 1000000000ULL;
+  if (!st->running || st->update_ns == 0 || (now_ns > st->update_ns && now_ns - st->update_ns > max_age)) {
+    return WATCHDOG_NOT_RUNNING;
+  }
+  if (st->status & (WATCHDOG_BIAS_UNLOCKED | WATCHDOG_PHASE_UNLOCKED)) {
+    return WATCHDOG_NOT_LOCKED;
+  }
+  return st->status & WATCHDOG_SATURATED ? WATCHDOG_LOCKED_SATURATED : WATCHDOG_LOCKED;
+}
+
+/*
+ * Window and rolling statistics of stream K of numSamples samples of S words.  Returns
+ * the RMS difference from CONTROL
+ */
+static double stream_stats(const int32_t *x,uint32_t numSamples,uint32_t S,uint32_t k,double control,uint64_t windows,
+                           watchdog_stream_t *w) {
+  double sum = 0, sumsq = 0, sumdsq = 0, v, d, a;
+  uint32_t i;
+  w->min = INFINITY;
+  w->max = -INFINITY;
+  for (i = 0;i < numSamples;i++) {
+    v = x[(size_t) i*S + k];
+    d = v - control;
+    sum += v;
+    sumsq += v*v;
+    sumdsq += d*d;
+    if (v < w->min) w->min = v;
+    if (v > w->max) w->max = v;
+  }
+  w->mean = sum/numSamples;
+  w->rms = sqrt(sumsq/numSamples);
+  //Exponential averages of the mean and mean square, over the first windows an ordinary mean
+  a = 1.0/(windows < WATCHDOG_ROLLING ? windows + 1 : WATCHDOG_ROLLING);
+  v = w->std*w->std + w->avg*w->avg;
+  w->avg += a*(w->mean - w->avg);
+  v += a*(sumsq/numSamples - v);
+  w->std = v > w->avg*w->avg ? sqrt(v - w->avg*w->avg) : 0;
+  return sqrt(sumdsq/numSamples);
+}
+
+/*
+ * Distance of the window [lo,hi] of an output from the nearest limit
+ */
+static double limit_margin(double lo,double hi,int32_t min,int32_t max) {
+  if (max <= min) return NAN;
+  return lo - min < max - hi ? lo - min : max - hi;
+}
+
+static void relock(void *cfg,int loop,const watchdog_params_t *p) {
+  uint32_t reg;
+  if (loop == PHASE) {
+    set_lock_status(cfg,0);
+    rt_sleep_us(p->off_us);
+    set_lock_status(cfg,1);
+  } else {
+    //Disabling the controller clears its accumulators
+    reg = IQ_READ(cfg,pid[0]);
+    IQ_WRITE(cfg,pid[0],reg & ~1u);
+    rt_sleep_us(1);
+    IQ_WRITE(cfg,pid[0],reg | 1u);
+  }
+}
+
+int watchdog_window(void *cfg,const watchdog_params_t *p,watchdog_state_t *s,uint32_t *data) {
+  static const uint32_t unlocked[2] = {WATCHDOG_BIAS_UNLOCKED,WATCHDOG_PHASE_UNLOCKED};
+  watchdog_status_t *st = &s->st;
+  const uint32_t N = p->numSamples;
+  const int32_t *bias = (const int32_t *) data;
+  const int32_t *phase = (const int32_t *) data + (size_t) NUM_BIAS_FIFOS*N;
+  uint32_t pid0, pid1, pc, lim, top, flags = 0, k;
+  int32_t control[3];
+  int bad[2], loop, on[2];
+  double e;
+
+  st->period_us = p->period_us;
+  //Another program is capturing, and resetting the FIFOs would spoil its data.  Never
+  //wait for it, so that the window stays short; start_fifo() then has the lock already
+  if (fifo_lock(0) != 0) {
+    //The status is not refreshed, so update_ns keeps the time of the last real check
+    st->skipped++;
+    st->status |= WATCHDOG_FIFO_BUSY;
+    return 1;
+  }
+  start_fifo(cfg);
+  read_fifo_mask(cfg,FIFO_BIAS_DATA_START_LOC,IQ_BIAS_MASK,N,data);
+  read_fifo_mask(cfg,FIFO_PHASE_DATA_START_LOC,IQ_PHASE_MASK,N,data + (size_t) NUM_BIAS_FIFOS*N);
+  stop_fifo(cfg);
+
+  pid0 = IQ_READ(cfg,pid[0]);
+  pid1 = IQ_READ(cfg,pid[1]);
+  pc = IQ_READ(cfg,phase_control);
+  top = IQ_READ(cfg,top);
+  control[0] = (int16_t)(pid0 >> 16);
+  control[1] = (int16_t)(pid1 & 0xFFFF);
+  control[2] = (int16_t)(pid1 >> 16);
+  on[BIAS] = pid0 & 1;
+  on[PHASE] = pc >> 31;
+  st->route = (top >> 16) & 0xF;
+
+  bad[BIAS] = 0;
+  for (k = 0;k < NUM_BIAS_FIFOS;k++) {
+    e = stream_stats(bias,N,NUM_BIAS_FIFOS,k,k < 3 ? control[k] : 0,st->windows,&st->bias[k]);
+    if (k < 3) {
+      st->bias_error[k] = (st->route >> k) & 1 ? NAN : e;
+      if (on[BIAS] && !isnan(st->bias_error[k]) && e > p->bias_error) bad[BIAS] = 1;
+    }
+  }
+  for (k = 0;k < NUM_PHASE_FIFOS;k++) {
+    e = stream_stats(phase,N,NUM_PHASE_FIFOS,k,k == WATCHDOG_PHASE_STREAM ? (int16_t)((pc >> 12) & 0xFFFF) : 0,
+                     st->windows,&st->phase[k]);
+    if (k == WATCHDOG_PHASE_STREAM) st->phase_error = e;
+  }
+  bad[PHASE] = on[PHASE] && st->phase_error > p->phase_error;
+
+  //Rail proximity of the outputs that can be seen
+  for (k = 0;k < NUM_PWM;k++) {
+    lim = IQ_READ(cfg,pwm_limit[k]);
+    if (k < 3) {
+      st->pwm_min[k] = lim & 0x3FF;
+      st->pwm_max[k] = (lim >> 10) & 0x3FF;
+      st->margin[k] = (st->route >> k) & 1 ? limit_margin(st->bias[k].min,st->bias[k].max,st->pwm_min[k],st->pwm_max[k]) : NAN;
+    } else {
+      st->pwm_min[k] = lim & 0xFFFF;
+      st->pwm_max[k] = lim >> 16;
+      st->margin[k] = on[PHASE] && ((top >> 2) & 1) ? limit_margin(st->phase[WATCHDOG_ACTUATOR_STREAM].min,
+                      st->phase[WATCHDOG_ACTUATOR_STREAM].max,st->pwm_min[k],st->pwm_max[k]) : NAN;
+    }
+    if (!isnan(st->margin[k]) && st->margin[k] <= p->margin) flags |= WATCHDOG_SATURATED;
+  }
+  if ((flags & WATCHDOG_SATURATED) && !(st->status & WATCHDOG_SATURATED)) st->saturations++;
+
+  for (loop = BIAS;loop <= PHASE;loop++) {
+    if (s->checking[loop] > 0) s->checking[loop]--;
+    if (!bad[loop]) {
+      s->bad[loop] = 0;
+      s->attempts[loop] = 0;
+      continue;
+    }
+    s->bad[loop]++;
+    if (s->bad[loop] < p->hold && !(st->status & unlocked[loop])) continue;
+    if (!(st->status & unlocked[loop])) {
+      if (loop == BIAS) st->bias_losses++;
+      else st->phase_losses++;
+      st->last_loss_ns = watchdog_now_ns();
+    }
+    flags |= unlocked[loop];
+    if (!p->relock || s->checking[loop] > 0) continue;
+    if (p->max_relocks > 0 && s->attempts[loop] >= p->max_relocks) {
+      if (s->attempts[loop] == p->max_relocks) {
+        st->relock_failures++;
+        s->attempts[loop]++;
+      }
+      flags |= WATCHDOG_RELOCK_FAILED;
+      continue;
+    }
+    relock(cfg,loop,p);
+    s->attempts[loop]++;
+    s->checking[loop] = p->hold;
+    st->relocks++;
+    st->last_relock_ns = watchdog_now_ns();
+  }
+  if (s->checking[BIAS] > 0 || s->checking[PHASE] > 0) flags |= WATCHDOG_RELOCKING;
+  if (p->max_relocks > 0 && (s->attempts[BIAS] > p->max_relocks || s->attempts[PHASE] > p->max_relocks)) {
+    flags |= WATCHDOG_RELOCK_FAILED;
+  }
+  if (!on[BIAS]) flags |= WATCHDOG_BIAS_OFF;
+  if (!on[PHASE]) flags |= WATCHDOG_PHASE_OFF;
+  st->status = flags;
+  st->windows++;
+  st->update_ns = watchdog_now_ns();
+  return 0;
+}
+
+void watchdog_print(FILE *f,const watchdog_status_t *st) {
+  uint32_t k;
+  fprintf(f,"running %u\nstatus 0x%02x\nupdate_ns %llu\nwindows %llu\nskipped %llu\nperiod_us %u\nroute 0x%x\n",
+          st->running,st->status,(unsigned long long) st->update_ns,(unsigned long long) st->windows,
+          (unsigned long long) st->skipped,st->period_us,st->route);
+  fprintf(f,"bias_error %.6g %.6g %.6g\nphase_error %.6g\n",st->bias_error[0],st->bias_error[1],st->bias_error[2],
+          st->phase_error);
+  fprintf(f,"margin %.6g %.6g %.6g %.6g\n",st->margin[0],st->margin[1],st->margin[2],st->margin[3]);
+  fprintf(f,"bias_losses %llu\nphase_losses %llu\nsaturations %llu\nrelocks %llu\nrelock_failures %llu\n",
+          (unsigned long long) st->bias_losses,(unsigned long long) st->phase_losses,(unsigned long long) st->saturations,
+          (unsigned long long) st->relocks,(unsigned long long) st->relock_failures);
+  fprintf(f,"last_loss_ns %llu\nlast_relock_ns %llu\n",(unsigned long long) st->last_loss_ns,
+          (unsigned long long) st->last_relock_ns);
+  for (k = 0;k < NUM_BIAS_FIFOS;k++) {
+    fprintf(f,"bias%u %.6g %.6g %.6g %.6g %.6g %.6g\n",k + 1,st->bias[k].mean,st->bias[k].rms,st->bias[k].min,
+            st->bias[k].max,st->bias[k].avg,st->bias[k].std);
+  }
+  for (k = 0;k < NUM_PHASE_FIFOS;k++) {
+    fprintf(f,"phase%u %.6g %.6g %.6g %.6g %.6g %.6g\n",k + 1,st->phase[k].mean,st->phase[k].rms,st->phase[k].min,
+            st->phase[k].max,st->phase[k].avg,st->phase[k].std);
+  }
+}
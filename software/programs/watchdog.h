@@ -0,0 +1,158 @@
+#ifndef WATCHDOG_H_
+#define WATCHDOG_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "iq_bias_control.h"
+
+/*
+ * Lock-health watchdog.  A background service reads a short window of the bias and phase
+ * FIFOs every period_us (a small duty cycle) and publishes the results in a shared-memory
+ * block.  The FIFOs are shared with every capture program, so each window only tries to
+ * take the FIFO lock of iq_registers.h and is skipped, never waiting, while another
+ * program holds it.  Captures in turn wait in start_fifo() for a window in progress, which
+ * is why windows are kept short.  Skipped windows set WATCHDOG_FIFO_BUSY but leave
+ * update_ns alone, so a status that cannot be checked while another program holds the
+ * FIFOs ages into WATCHDOG_NOT_RUNNING instead of looking fresh.  The block holds:
+ *
+ *    - the mean, RMS, minimum and maximum of every stream over the last window, and
+ *      rolling means and standard deviations over about WATCHDOG_ROLLING windows
+ *    - the RMS error of each bias signal (demodulated inputs only) and of the phase
+ *      against their control values, while the loop is enabled
+ *    - how far each output is from its limits in the PWM limit registers.  The bias
+ *      outputs are only seen when routed to their FIFOs in TOP_REG, and the phase
+ *      actuator when it drives the phase PWM
+ *
+ * A loop is unlocked once its error exceeds the threshold for hold windows in a row, and
+ * an output is saturated once it is within margin counts of a limit.  With relock set,
+ * an unlocked loop is reset: the phase lock is disengaged for off_us and engaged again
+ * with set_lock_status(), and the bias integrators are cleared by toggling the enable bit
+ * of the controller.  Each attempt is followed by hold windows to check it; after
+ * max_relocks failures the loop is left alone until it locks again by itself.
+ *
+ * The block is a seqlock: the service increments seq before and after each update, so
+ * a reader copies the status in a few microseconds, never blocks the service, and
+ * retries if seq was odd or changed during the copy
+ */
+#define WATCHDOG_SHM_NAME           "/iq_lock_watchdog"
+#define WATCHDOG_MAGIC              0x47445149    //"IQDG"
+#define WATCHDOG_VERSION            1
+
+#define WATCHDOG_DEFAULT_PERIOD_US  100000
+#define WATCHDOG_DEFAULT_SAMPLES    32
+#define WATCHDOG_DEFAULT_HOLD       3
+#define WATCHDOG_DEFAULT_BIAS_ERROR 500           //[counts]
+#define WATCHDOG_DEFAULT_PHASE_ERROR 200          //[counts]
+#define WATCHDOG_DEFAULT_MARGIN     10            //[counts]
+#define WATCHDOG_DEFAULT_OFF_US     10000
+#define WATCHDOG_DEFAULT_MAX_RELOCKS 3
+#define WATCHDOG_ROLLING            64            //Windows in the rolling statistics
+#define WATCHDOG_PHASE_STREAM       0             //Phase FIFO of the phase error
+#define WATCHDOG_ACTUATOR_STREAM    2             //Phase FIFO of the actuator
+
+//Status flags
+#define WATCHDOG_BIAS_UNLOCKED      0x01
+#define WATCHDOG_PHASE_UNLOCKED     0x02
+#define WATCHDOG_SATURATED          0x04          //An output is at a limit
+#define WATCHDOG_RELOCKING          0x08
+#define WATCHDOG_BIAS_OFF           0x10          //Bias controller disabled
+#define WATCHDOG_PHASE_OFF          0x20          //Phase lock disengaged
+#define WATCHDOG_RELOCK_FAILED      0x40          //Gave up re-locking
+#define WATCHDOG_FIFO_BUSY          0x80          //Windows skipped since the last update
+
+typedef struct {
+  double mean, rms, min, max;     //Last window [counts]
+  double avg, std;                //Rolling [counts]
+} watchdog_stream_t;
+
+typedef struct {
+  uint32_t running;               //Cleared when the service stops
+  uint32_t status;                //WATCHDOG_*
+  uint64_t update_ns;             //Time of the last window analysed, ns since the UNIX epoch
+  uint64_t windows;               //Windows analysed
+  uint64_t skipped;               //Windows skipped because the FIFOs were busy
+  uint32_t route;                 //Bias FIFOs routed to the outputs
+  uint32_t period_us;             //Between windows
+  watchdog_stream_t bias[NUM_BIAS_FIFOS];
+  watchdog_stream_t phase[NUM_PHASE_FIFOS];
+  double bias_error[3];           //RMS error of each bias signal, NAN if not seen
+  double phase_error;             //RMS phase error [counts]
+  int32_t pwm_min[NUM_PWM];       //Limits from the PWM limit registers [counts]
+  int32_t pwm_max[NUM_PWM];
+  double margin[NUM_PWM];         //Distance of each output from its nearest limit, NAN if not seen
+  uint64_t bias_losses, phase_losses, saturations;
+  uint64_t relocks, relock_failures;
+  uint64_t last_loss_ns;
+  uint64_t last_relock_ns;
+} watchdog_status_t;
+
+typedef struct {
+  uint32_t magic;                 //WATCHDOG_MAGIC
+  uint32_t version;               //WATCHDOG_VERSION
+  uint32_t size;                  //sizeof(watchdog_shm_t)
+  atomic_uint seq;                //Odd while the service writes
+  watchdog_status_t status;
+} watchdog_shm_t;
+
+typedef struct {
+  uint32_t period_us;             //Between windows
+  uint32_t numSamples;            //Samples per window from each group
+  uint32_t hold;                  //Windows in a row to declare a change
+  double bias_error;              //Thresholds of the RMS errors [counts]
+  double phase_error;
+  double margin;                  //Distance from a limit that counts as saturated [counts]
+  uint8_t relock;                 //Re-lock automatically
+  uint32_t off_us;                //Phase lock off time when re-locking
+  uint32_t max_relocks;           //Attempts before giving up, 0 for no limit
+} watchdog_params_t;
+
+/*
+ * State of the service between windows
+ */
+typedef struct {
+  watchdog_status_t st;           //Published after every window
+  uint32_t bad[2];                //Windows in a row over the threshold, bias then phase
+  uint32_t checking[2];           //Windows left to check a re-lock
+  uint32_t attempts[2];           //Re-locks since the loop was last locked
+} watchdog_state_t;
+
+//Results of watchdog_check()
+#define WATCHDOG_LOCKED             0
+#define WATCHDOG_NOT_LOCKED         1
+#define WATCHDOG_NOT_RUNNING        2
+#define WATCHDOG_LOCKED_SATURATED   3
+
+void watchdog_defaults(watchdog_params_t *p);
+/*
+ * Creates (service) or opens read-only (clients) the shared block.  Returns NULL on error
+ */
+watchdog_shm_t *watchdog_create(void);
+const watchdog_shm_t *watchdog_open(void);
+void watchdog_close(const watchdog_shm_t *shm);
+/*
+ * Seqlock accessors.  watchdog_read() copies a consistent snapshot, returning -1 if the
+ * block is not a watchdog block or no consistent copy was made within a few retries
+ */
+void watchdog_publish(watchdog_shm_t *shm,const watchdog_status_t *st);
+int watchdog_read(const watchdog_shm_t *shm,watchdog_status_t *st);
+/*
+ * Classifies a snapshot taken at NOW_NS (ns since the UNIX epoch): WATCHDOG_NOT_RUNNING
+ * if the service has stopped or has not updated for more than three periods plus a
+ * second, otherwise whether both enabled loops are locked and whether an output is at a
+ * limit.  A disabled loop counts as locked
+ */
+int watchdog_check(const watchdog_status_t *st,uint64_t now_ns);
+uint64_t watchdog_now_ns(void);
+/*
+ * One window: reads the FIFOs, updates the statistics and flags and re-locks if enabled.
+ * DATA needs (NUM_BIAS_FIFOS + NUM_PHASE_FIFOS)*numSamples words.  Returns 1 if the
+ * window was skipped because the FIFOs were busy
+ */
+int watchdog_window(void *cfg,const watchdog_params_t *p,watchdog_state_t *s,uint32_t *data);
+/*
+ * Prints a snapshot, one "name value" pair per line
+ */
+void watchdog_print(FILE *f,const watchdog_status_t *st);
+#endif